@@ -1,7 +1,12 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <numeric>
+#include <tuple>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -9,14 +14,34 @@
 #include <glm/gtx/io.hpp>
 
 #include "utils/cameras.hpp"
+#include "utils/allocation_counter.hpp"
+#include "utils/animation.hpp"
+#include "utils/culling.hpp"
+#include "utils/depth_pyramid.hpp"
+#include "utils/draw_list.hpp"
+#include "utils/dynamic_resolution.hpp"
+#include "utils/frame_builder.hpp"
+#include "utils/frame_pipeline.hpp"
+#include "utils/gl_state_cache.hpp"
+#include "utils/gpu_culling.hpp"
 #include "utils/gltf.hpp"
 #include "utils/images.hpp"
+#include "utils/indirect_draws.hpp"
+#include "utils/morphing.hpp"
+#include "utils/occlusion.hpp"
+#include "utils/packed_geometry.hpp"
+#include "utils/render_queue.hpp"
+#include "utils/ring_buffer.hpp"
+#include "utils/scene_query.hpp"
+#include "utils/scene_store.hpp"
+#include "utils/skinning.hpp"
+#include "utils/supersampling.hpp"
+#include "utils/texture_arrays.hpp"
+#include "utils/window_events.hpp"
 
 #include <stb_image_write.h>
 #include <tiny_gltf.h>
 
-#include <windows.h>
-
 void keyCallback(
     GLFWwindow *window, int key, int scancode, int action, int mods)
 {
@@ -45,10 +70,6 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
     const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
     std::vector<VaoRange> &meshToVertexArrays)
 {
-  const GLuint VERTEX_ATTRIB_POSITION_IDX = 0;
-  const GLuint VERTEX_ATTRIB_NORMAL_IDX = 1;
-  const GLuint VERTEX_ATTRIB_TEXCOORD0_IDX = 2;
-
   std::vector<GLuint> vertexArrayObjects;
 
   meshToVertexArrays.resize(model.meshes.size());
@@ -159,6 +180,37 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
               (const GLvoid *)byteOffset);
         }
       }
+      {
+        // Joint indices are integers, read with glVertexAttribIPointer
+        const auto iterator = primitive.attributes.find("JOINTS_0");
+        if (iterator != end(primitive.attributes)) {
+          const auto &accessor = model.accessors[(*iterator).second];
+          const auto &bufferView = model.bufferViews[accessor.bufferView];
+          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+
+          glEnableVertexAttribArray(VERTEX_ATTRIB_JOINTS0_IDX);
+          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+          glVertexAttribIPointer(VERTEX_ATTRIB_JOINTS0_IDX, accessor.type,
+              accessor.componentType, GLsizei(bufferView.byteStride),
+              (const GLvoid *)byteOffset);
+        }
+      }
+      {
+        const auto iterator = primitive.attributes.find("WEIGHTS_0");
+        if (iterator != end(primitive.attributes)) {
+          const auto &accessor = model.accessors[(*iterator).second];
+          const auto &bufferView = model.bufferViews[accessor.bufferView];
+          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+
+          glEnableVertexAttribArray(VERTEX_ATTRIB_WEIGHTS0_IDX);
+          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+          // Weights can be normalized unsigned bytes or shorts
+          glVertexAttribPointer(VERTEX_ATTRIB_WEIGHTS0_IDX, accessor.type,
+              accessor.componentType,
+              accessor.componentType == GL_FLOAT ? GL_FALSE : GL_TRUE,
+              GLsizei(bufferView.byteStride), (const GLvoid *)byteOffset);
+        }
+      }
 
       if (primitive.indices >= 0) {
         const auto accessorIdx = primitive.indices;
@@ -241,41 +293,11 @@ std::vector<GLuint> ViewerApplication::createTextureObjects(
 };
 
 bool ViewerApplication::loadGltfFile(tinygltf::Model &model) {
-  std::string path = m_gltfFilePath.string();
-
-  tinygltf::TinyGLTF loader;
-
-  std::string err, warn;
-
   std::cout << "Current path is " << fs::current_path() << '\n';
 
-  bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, path);
-
-  if (!err.empty())
-    std::cerr << "Err: " << err << std::endl;
-  if (!warn.empty())
-    std::cerr << "Warn: " << warn << std::endl;
-
-  if (!ret)
-    std::cerr << "Load failure for " << path << std::endl;
-
-  return ret;
-}
-
-void setUniformVec3(
-    const GLProgram &prog, const std::string &name, const glm::vec3 &vec)
-{
-  glUniform3f(
-      glGetUniformLocation(prog.glId(), name.c_str()), vec[0], vec[1], vec[2]);
-}
-
-void setUniformFloat(
-    const GLProgram &prog, const std::string &name, float value)
-{
-  glUniform1f(glGetUniformLocation(prog.glId(), name.c_str()), value);
+  return ::loadGltfFile(m_gltfFilePath, model, &m_jobSystem);
 }
 
-
 typedef struct
 {
   glm::vec3 position;
@@ -304,42 +326,114 @@ typedef struct
   bool enabled = true;
 } SpotLightStruct;
 
-int ViewerApplication::run()
+ViewerApplication::ShadingProgram ViewerApplication::compileShadingProgram(
+    const std::vector<std::string> &defines) const
 {
-  // Loader shaders
-  const auto glslProgram =
+  auto programDefines = defines;
+  programDefines.push_back(
+      "MAX_DRAW_TRANSFORMS " + std::to_string(MAX_DRAW_TRANSFORMS));
+  if (m_bindlessTextures) {
+    programDefines.push_back("BINDLESS");
+  } else if (m_textureArrays) {
+    programDefines.push_back("TEXTURE_ARRAYS");
+  }
+  ShadingProgram shading{
       compileProgram({m_ShadersRootPath / m_AppName / m_vertexShader,
-          m_ShadersRootPath / m_AppName / m_fragmentShader});
-
-  const auto modelViewProjMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewProjMatrix");
-  const auto modelViewMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewMatrix");
-  const auto normalMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uNormalMatrix");
+                         m_ShadersRootPath / m_AppName / m_fragmentShader},
+          programDefines)};
+  const auto programId = shading.program.glId();
+  shading.modelViewProjMatrixLocation =
+      glGetUniformLocation(programId, "uModelViewProjMatrix");
+  shading.modelViewMatrixLocation =
+      glGetUniformLocation(programId, "uModelViewMatrix");
+  shading.normalMatrixLocation =
+      glGetUniformLocation(programId, "uNormalMatrix");
   // Light for diffuse_directional_light.fs.glsl
-  const auto lightDirectionLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightDirection");
-  const auto lightIntensityLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightIntensity");
+  shading.lightDirectionLocation =
+      glGetUniformLocation(programId, "uLightDirection");
+  shading.lightIntensityLocation =
+      glGetUniformLocation(programId, "uLightIntensity");
   // Textures
-  const auto baseColorTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uBaseColorTexture");
-  const auto baseColorFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uBaseColorFactor");
-
-  const auto metallicRoughnessTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uMetallicRoughnessTexture");
-  const auto metallicFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uMetallicFactor");
-  const auto roughnessFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uRoughnessFactor");
-  const auto emissiveFactorLocation =
-      glGetUniformLocation(glslProgram.glId(), "uEmissiveFactor");
-  const auto emissiveTextureLocation =
-      glGetUniformLocation(glslProgram.glId(), "uEmissiveTexture");
-  
+  shading.baseColorTextureLocation =
+      glGetUniformLocation(programId, "uBaseColorTexture");
+  shading.baseColorFactorLocation =
+      glGetUniformLocation(programId, "uBaseColorFactor");
+  shading.metallicRoughnessTextureLocation =
+      glGetUniformLocation(programId, "uMetallicRoughnessTexture");
+  shading.metallicFactorLocation =
+      glGetUniformLocation(programId, "uMetallicFactor");
+  shading.roughnessFactorLocation =
+      glGetUniformLocation(programId, "uRoughnessFactor");
+  shading.emissiveFactorLocation =
+      glGetUniformLocation(programId, "uEmissiveFactor");
+  shading.emissiveTextureLocation =
+      glGetUniformLocation(programId, "uEmissiveTexture");
+  shading.alphaCutoffLocation = glGetUniformLocation(programId, "uAlphaCutoff");
+  // Skinning
+  shading.jointMatricesLocation =
+      glGetUniformLocation(programId, "uJointMatrices");
+  shading.jointOffsetLocation = glGetUniformLocation(programId, "uJointOffset");
+  // Morph targets
+  shading.morphTargetDeltasLocation =
+      glGetUniformLocation(programId, "uMorphTargetDeltas");
+  shading.morphFirstTexelLocation =
+      glGetUniformLocation(programId, "uMorphFirstTexel");
+  shading.morphVertexCountLocation =
+      glGetUniformLocation(programId, "uMorphVertexCount");
+  shading.morphTargetCountLocation =
+      glGetUniformLocation(programId, "uMorphTargetCount");
+  shading.morphTargetsLocation =
+      glGetUniformLocation(programId, "uMorphTargets");
+  shading.morphWeightsLocation =
+      glGetUniformLocation(programId, "uMorphWeights");
+  // Instancing
+  shading.instanceMatrixLocation =
+      glGetAttribLocation(programId, "aInstanceMatrix");
+  // Multi-draw indirect
+  shading.drawRecordsBlockIndex = glGetProgramResourceIndex(
+      programId, GL_SHADER_STORAGE_BLOCK, "DrawRecords");
+  if (shading.drawRecordsBlockIndex != GL_INVALID_INDEX) {
+    glShaderStorageBlockBinding(
+        programId, shading.drawRecordsBlockIndex, DRAW_RECORDS_BINDING);
+  }
+  shading.materialsBlockIndex = glGetProgramResourceIndex(
+      programId, GL_SHADER_STORAGE_BLOCK, "Materials");
+  if (shading.materialsBlockIndex != GL_INVALID_INDEX) {
+    glShaderStorageBlockBinding(
+        programId, shading.materialsBlockIndex, MATERIALS_BINDING);
+  }
+  shading.materialIndexLocation =
+      glGetUniformLocation(programId, "uMaterialIndex");
+  // Samplers are bound to fixed units, set once per program: the material
+  // textures to 0 to 2, the joint matrices to 3 and the morph target deltas
+  // to 4. With bindless textures, the material textures have no location.
+  glProgramUniform1i(programId, shading.baseColorTextureLocation, 0);
+  glProgramUniform1i(programId, shading.metallicRoughnessTextureLocation, 1);
+  glProgramUniform1i(programId, shading.emissiveTextureLocation, 2);
+  glProgramUniform1i(programId, shading.jointMatricesLocation, 3);
+  glProgramUniform1i(programId, shading.morphTargetDeltasLocation, 4);
+  shading.drawTransformsBlockIndex =
+      glGetUniformBlockIndex(programId, "DrawTransforms");
+  if (shading.drawTransformsBlockIndex != GL_INVALID_INDEX) {
+    glUniformBlockBinding(programId, shading.drawTransformsBlockIndex,
+        DRAW_TRANSFORMS_BINDING);
+  }
+  shading.drawTransformIndexLocation =
+      glGetUniformLocation(programId, "uDrawTransformIndex");
+  shading.lightsBlockIndex = glGetUniformBlockIndex(programId, "Lights");
+  if (shading.lightsBlockIndex != GL_INVALID_INDEX) {
+    glUniformBlockBinding(programId, shading.lightsBlockIndex, LIGHTS_BINDING);
+  }
+  return shading;
+}
 
+int ViewerApplication::run()
+{
+  // Loader shaders
+  m_bindlessTextures = GLAD_GL_ARB_bindless_texture;
+  m_textureArrays = !m_bindlessTextures;
+  const auto mainProgram = compileShadingProgram();
+  const ShadingProgram *shading = &mainProgram; // Program in use
 
   tinygltf::Model model;
 
@@ -351,8 +445,20 @@ int ViewerApplication::run()
   auto lightIntensity = glm::vec3(1, 1, 1);
   bool lightIsFromCamera = false;
 
+  // Shaders reading the materials from the table, others use the uniforms
+  // of bindMaterial
+  const auto materialTable = mainProgram.materialIndexLocation >= 0;
+  const auto bindlessTextures = m_bindlessTextures && materialTable;
+  const auto textureArrays = m_textureArrays && materialTable;
+
   //Texture load
-  std::vector<GLuint> textureObjects = createTextureObjects(model);
+  TextureArrays packedTextures;
+  std::vector<GLuint> textureObjects;
+  if (textureArrays) {
+    packedTextures.load(model);
+  } else {
+    textureObjects = createTextureObjects(model);
+  }
   //Default white texture
   float white[] = {1,1,1,1};
   GLuint whiteTexture;
@@ -372,11 +478,562 @@ int ViewerApplication::run()
   glBindTexture(GL_TEXTURE_2D, 0);
 
 
-  auto &bufferObjects = createBufferObjects(model);
+  const auto bufferObjects = createBufferObjects(model);
 
   std::vector<VaoRange> meshToVertexArrays;
   const auto vertexArrayObjects =
       createVertexArrayObjects(model, bufferObjects, meshToVertexArrays);
+  // Draw parameters, materials and bounds of the primitives, the frames don't
+  // read the model
+  SceneStore sceneStore;
+  sceneStore.load(model, vertexArrayObjects);
+
+  // Local transforms and morph target weights of the nodes, written by
+  // animations
+  NodeTransforms nodeTransforms;
+  nodeTransforms.reset(model);
+  const auto restTransforms = nodeTransforms; // Before any animation
+  MorphTargets morphTargets;
+  morphTargets.load(model);
+
+  // Flatten the scene into primitive instances with their world space bounds
+  // and build a bounding volume hierarchy on them for frustum culling
+  std::vector<glm::mat4> nodeMatrices(model.nodes.size(), glm::mat4(1));
+  std::vector<PrimitiveInstance> primitiveInstances;
+  std::vector<AABB> primitiveInstanceLocalBounds;
+  std::vector<AABB> primitiveInstanceBounds;
+  // Local matrices of the EXT_mesh_gpu_instancing instances, drawn with
+  // instanced calls
+  std::vector<glm::mat4> instanceMatrices;
+  bool hasGpuInstances = false;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &modelMatrix) {
+    nodeMatrices[nodeIdx] = modelMatrix;
+    const auto meshIdx = model.nodes[nodeIdx].mesh;
+    if (meshIdx < 0) {
+      return;
+    }
+    const auto gpuInstanceMatrices =
+        readGpuInstanceMatrices(model, model.nodes[nodeIdx]);
+    const auto firstGpuInstance = GLuint(instanceMatrices.size());
+    instanceMatrices.insert(end(instanceMatrices),
+        begin(gpuInstanceMatrices), end(gpuInstanceMatrices));
+    hasGpuInstances = hasGpuInstances || !gpuInstanceMatrices.empty();
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      primitiveInstances.push_back({nodeIdx, meshIdx, int(pIdx),
+          firstGpuInstance, GLsizei(gpuInstanceMatrices.size())});
+      auto localBounds = morphTargets.morphedBounds(meshIdx, int(pIdx),
+          sceneStore.bounds(sceneStore.primitiveIndex(meshIdx, int(pIdx))));
+      if (!gpuInstanceMatrices.empty()) {
+        AABB instancesBounds;
+        for (const auto &instanceMatrix : gpuInstanceMatrices) {
+          instancesBounds.extend(localBounds.transform(instanceMatrix));
+        }
+        localBounds = instancesBounds;
+      }
+      primitiveInstanceLocalBounds.push_back(localBounds);
+      primitiveInstanceBounds.push_back(
+          primitiveInstanceLocalBounds.back().transform(modelMatrix));
+    }
+  });
+
+  // Material table, the last entry is the default material. Factors,
+  // render state and textures of the materials are read from it instead of
+  // the glTF materials: by the shaders through a storage buffer, indexed by
+  // draw, or by bindMaterial for the shaders without table. With texture
+  // arrays, the table gives the layers of the textures, and the arrays are
+  // bound only when they change. With bindless textures, all the textures
+  // are made resident once and the shaders sample them through the handles
+  // of the table, without texture binds. Texture 0, bound when a material
+  // has no metallic roughness or emissive texture, samples as opaque black.
+  const auto getTextureObject = [&](int textureIdx, GLuint defaultTexture) {
+    if (textureArrays) {
+      return packedTextures.layer(textureIdx).texture;
+    }
+    if (textureIdx < 0 || model.textures[textureIdx].source < 0) {
+      return defaultTexture;
+    }
+    return textureObjects[textureIdx]; // One object per glTF texture
+  };
+  std::map<GLuint, GLuint64> textureHandles;
+  if (bindlessTextures) {
+    const float black[] = {0, 0, 0, 1};
+    GLuint blackTexture;
+    glGenTextures(1, &blackTexture);
+    glBindTexture(GL_TEXTURE_2D, blackTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, black);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    auto textures = textureObjects;
+    textures.push_back(whiteTexture);
+    for (const auto texture : textures) {
+      if (texture && !textureHandles.count(texture)) {
+        textureHandles[texture] = glGetTextureHandleARB(texture);
+        glMakeTextureHandleResidentARB(textureHandles[texture]);
+      }
+    }
+    textureHandles[0] = glGetTextureHandleARB(blackTexture);
+    glMakeTextureHandleResidentARB(textureHandles[0]);
+  }
+  const auto getTextureHandle = [&](GLuint texture) {
+    const auto it = textureHandles.find(texture);
+    return it != end(textureHandles) ? (*it).second : GLuint64(0);
+  };
+  const auto getTextureLayer = [&](int textureIdx) {
+    return textureArrays ? packedTextures.layer(textureIdx).layer : -1;
+  };
+  std::vector<MaterialRecord> materialRecords;
+  std::vector<MaterialTextures> materialTextures;
+  tinygltf::Material defaultMaterial;
+  defaultMaterial.emissiveFactor = {0, 0, 0}; // Empty by default
+  for (size_t i = 0; i <= model.materials.size(); ++i) {
+    const auto &material =
+        i < model.materials.size() ? model.materials[i] : defaultMaterial;
+    const auto &pbr = material.pbrMetallicRoughness;
+    materialTextures.push_back(
+        {getTextureObject(pbr.baseColorTexture.index, whiteTexture),
+            getTextureObject(pbr.metallicRoughnessTexture.index, 0),
+            getTextureObject(material.emissiveTexture.index, 0)});
+    const auto &textures = materialTextures.back();
+    materialRecords.push_back(
+        {glm::vec4(pbr.baseColorFactor[0], pbr.baseColorFactor[1],
+             pbr.baseColorFactor[2], pbr.baseColorFactor[3]),
+            glm::vec4(material.emissiveFactor[0], material.emissiveFactor[1],
+                material.emissiveFactor[2], 0),
+            float(pbr.metallicFactor), float(pbr.roughnessFactor),
+            material.alphaMode == "MASK" ? float(material.alphaCutoff) : 0.f,
+            getTextureLayer(pbr.baseColorTexture.index),
+            getTextureLayer(pbr.metallicRoughnessTexture.index),
+            getTextureLayer(material.emissiveTexture.index),
+            (material.alphaMode == "BLEND" ? MATERIAL_BLENDED : 0) |
+                (material.doubleSided ? MATERIAL_DOUBLE_SIDED : 0),
+            getTextureHandle(textures.baseColorTexture),
+            getTextureHandle(textures.metallicRoughnessTexture),
+            getTextureHandle(textures.emissiveTexture)});
+  }
+  const auto materialIsBlended = [&](size_t materialIndex) {
+    return (materialRecords[materialIndex].flags & MATERIAL_BLENDED) != 0;
+  };
+  const auto materialIsDoubleSided = [&](size_t materialIndex) {
+    return (materialRecords[materialIndex].flags & MATERIAL_DOUBLE_SIDED) != 0;
+  };
+  const auto getMaterialIndex = [&](const PrimitiveInstance &instance) {
+    return size_t(sceneStore.materialIndex(
+        sceneStore.primitiveIndex(instance.meshIdx, instance.primitiveIdx)));
+  };
+  // Skinned, morphed and instanced primitives are drawn with variants of the
+  // shaders, indexed by a combination of SKINNING_VARIANT, MORPHING_VARIANT
+  // and INSTANCING_VARIANT, and compiled if the scene needs them. The
+  // INDIRECT_VARIANT draws the multi-draw indirect path. Custom shaders may
+  // not support them.
+  const uint8_t SKINNING_VARIANT = 1;
+  const uint8_t MORPHING_VARIANT = 2;
+  const uint8_t INSTANCING_VARIANT = 4;
+  const uint8_t INDIRECT_VARIANT = 8;
+  std::unique_ptr<ShadingProgram> shadingVariants[16];
+  const auto getShadingVariant = [&](uint8_t variant) {
+    auto &shadingVariant = shadingVariants[variant];
+    if (!shadingVariant) {
+      std::vector<std::string> defines;
+      if (variant & SKINNING_VARIANT) {
+        defines.push_back("SKINNING");
+      }
+      if (variant & MORPHING_VARIANT) {
+        defines.push_back("MORPHING");
+        defines.push_back("MAX_ACTIVE_MORPH_TARGETS " +
+                          std::to_string(MorphTargets::MAX_ACTIVE_TARGETS));
+      }
+      if (variant & INSTANCING_VARIANT) {
+        defines.push_back("INSTANCING");
+      }
+      if (variant & INDIRECT_VARIANT) {
+        defines.push_back("INDIRECT");
+      }
+      shadingVariant =
+          std::make_unique<ShadingProgram>(compileShadingProgram(defines));
+    }
+    return shadingVariant.get();
+  };
+  const auto supportsInstancing =
+      getShadingVariant(INSTANCING_VARIANT)->instanceMatrixLocation >= 0;
+  std::vector<uint8_t> primitiveInstanceVariants(primitiveInstances.size(), 0);
+  std::vector<int> primitiveInstanceSkins(primitiveInstances.size(), -1);
+  bool hasSkinnedPrimitives = false;
+  bool hasMorphedPrimitives = false;
+  for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+    const auto &instance = primitiveInstances[i];
+    const auto &attributes = model.meshes[instance.meshIdx]
+                                 .primitives[instance.primitiveIdx]
+                                 .attributes;
+    const auto skinIdx = model.nodes[instance.nodeIdx].skin;
+    auto &variant = primitiveInstanceVariants[i];
+    if (skinIdx >= 0 && attributes.count("JOINTS_0") &&
+        attributes.count("WEIGHTS_0") &&
+        getShadingVariant(SKINNING_VARIANT)->jointMatricesLocation >= 0) {
+      variant |= SKINNING_VARIANT;
+      primitiveInstanceSkins[i] = skinIdx;
+      hasSkinnedPrimitives = true;
+    }
+    if (morphTargets.primitiveTargets(instance.meshIdx, instance.primitiveIdx)
+                .targetCount > 0 &&
+        getShadingVariant(MORPHING_VARIANT)->morphTargetDeltasLocation >= 0) {
+      variant |= MORPHING_VARIANT;
+      hasMorphedPrimitives = true;
+    }
+    // Deformed primitives of instanced nodes are drawn once per instance
+    if (instance.gpuInstanceCount > 0 && variant == 0 && supportsInstancing) {
+      variant = INSTANCING_VARIANT;
+    }
+    getShadingVariant(variant);
+  }
+
+  // Vertex arena: the triangles of all the primitives in shared buffers, drawn
+  // from one vertex array with a base vertex and a first index, so that the
+  // vertex array is bound once per frame instead of once per primitive. The
+  // vertex arrays of the glTF buffers remain for points, lines and
+  // primitives the arena can't pack.
+  PackedGeometry packedGeometry;
+  packedGeometry.load(model);
+  GLuint arenaVertexArray;
+  glGenVertexArrays(1, &arenaVertexArray);
+  glBindVertexArray(arenaVertexArray);
+  {
+    const auto addAttribute = [&](GLuint index, GLint size, GLenum type,
+                                  const void *data, size_t byteLength) {
+      if (byteLength == 0) {
+        return;
+      }
+      GLuint bufferObject;
+      glGenBuffers(1, &bufferObject);
+      glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
+      glBufferStorage(GL_ARRAY_BUFFER, byteLength, data, 0);
+      glEnableVertexAttribArray(index);
+      if (type == GL_FLOAT) {
+        glVertexAttribPointer(index, size, type, GL_FALSE, 0, nullptr);
+      } else {
+        glVertexAttribIPointer(index, size, type, 0, nullptr);
+      }
+    };
+    addAttribute(VERTEX_ATTRIB_POSITION_IDX, 3, GL_FLOAT,
+        packedGeometry.positions().data(),
+        packedGeometry.positions().size() * sizeof(glm::vec3));
+    addAttribute(VERTEX_ATTRIB_NORMAL_IDX, 3, GL_FLOAT,
+        packedGeometry.normals().data(),
+        packedGeometry.normals().size() * sizeof(glm::vec3));
+    addAttribute(VERTEX_ATTRIB_TEXCOORD0_IDX, 2, GL_FLOAT,
+        packedGeometry.texCoords().data(),
+        packedGeometry.texCoords().size() * sizeof(glm::vec2));
+    addAttribute(VERTEX_ATTRIB_JOINTS0_IDX, 4, GL_UNSIGNED_SHORT,
+        packedGeometry.joints().data(),
+        packedGeometry.joints().size() * sizeof(glm::u16vec4));
+    addAttribute(VERTEX_ATTRIB_WEIGHTS0_IDX, 4, GL_FLOAT,
+        packedGeometry.weights().data(),
+        packedGeometry.weights().size() * sizeof(glm::vec4));
+    if (!packedGeometry.indices().empty()) {
+      GLuint indexBuffer;
+      glGenBuffers(1, &indexBuffer);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+      glBufferStorage(GL_ELEMENT_ARRAY_BUFFER,
+          packedGeometry.indices().size() * sizeof(uint32_t),
+          packedGeometry.indices().data(), 0);
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  bool vertexArena = true;
+  const auto isPackedInstance = [&](const PrimitiveInstance &instance) {
+    const auto &range = packedGeometry.primitiveRange(
+        instance.meshIdx, instance.primitiveIdx);
+    return vertexArena && range.packed;
+  };
+
+  // Instance matrices are per instance attributes of every vertex array,
+  // drawn from a base instance. The EXT_mesh_gpu_instancing instances are
+  // uploaded once, the runs of automatic instancing each frame after them.
+  const GLuint VERTEX_ATTRIB_INSTANCE_MATRIX_IDX = 5; // 4 columns
+  const auto gpuInstanceCount = instanceMatrices.size();
+  const auto instanceMatrixCapacity =
+      gpuInstanceCount + (supportsInstancing ? primitiveInstances.size() : 0);
+  GLuint instanceMatrixBuffer = 0;
+  if (supportsInstancing) {
+    glGenBuffers(1, &instanceMatrixBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceMatrixBuffer);
+    glBufferData(GL_ARRAY_BUFFER,
+        std::max(instanceMatrixCapacity, size_t(1)) * sizeof(glm::mat4),
+        nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, gpuInstanceCount * sizeof(glm::mat4),
+        instanceMatrices.data());
+    auto vertexArrays = vertexArrayObjects;
+    vertexArrays.push_back(arenaVertexArray);
+    for (const auto vao : vertexArrays) {
+      glBindVertexArray(vao);
+      for (GLuint c = 0; c < 4; ++c) {
+        glEnableVertexAttribArray(VERTEX_ATTRIB_INSTANCE_MATRIX_IDX + c);
+        glVertexAttribPointer(VERTEX_ATTRIB_INSTANCE_MATRIX_IDX + c, 4,
+            GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+            (const GLvoid *)(c * sizeof(glm::vec4)));
+        glVertexAttribDivisor(VERTEX_ATTRIB_INSTANCE_MATRIX_IDX + c, 1);
+      }
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // Multi-draw indirect: the primitives of the vertex arena without
+  // deformation are drawn with one glMultiDrawElementsIndirect call per set
+  // of textures. The shaders read the model matrix and material of each
+  // instance from draw records, indexed by the base instance of the commands
+  // through an identity instanced attribute.
+  const GLuint VERTEX_ATTRIB_DRAW_RECORD_IDX = 9;
+  const auto indirectShading = getShadingVariant(INDIRECT_VARIANT);
+  const auto supportsMultiDrawIndirect =
+      indirectShading->drawRecordsBlockIndex != GL_INVALID_INDEX &&
+      indirectShading->materialsBlockIndex != GL_INVALID_INDEX;
+  IndirectDraws indirectDraws;
+  if (supportsMultiDrawIndirect) {
+    for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+      const auto &instance = primitiveInstances[i];
+      const auto &range = packedGeometry.primitiveRange(
+          instance.meshIdx, instance.primitiveIdx);
+      const auto materialIndex = getMaterialIndex(instance);
+      if ((primitiveInstanceVariants[i] & ~INSTANCING_VARIANT) != 0 ||
+          !range.packed || materialIsBlended(materialIndex)) {
+        continue; // Blended primitives are sorted back to front
+      }
+      const auto &textures = materialTextures[materialIndex];
+      indirectDraws.addInstance(uint32_t(i), instance.meshIdx,
+          instance.primitiveIdx, range,
+          {materialIsDoubleSided(materialIndex), textures.baseColorTexture,
+              textures.metallicRoughnessTexture, textures.emissiveTexture},
+          uint32_t(std::max(GLsizei(1), instance.gpuInstanceCount)));
+    }
+    indirectDraws.buildCommands(sceneStore);
+    const auto drawRecordCapacity = indirectDraws.drawRecordCapacity();
+    // Index of the draw record of each instance, from its base instance.
+    // GPU culling writes the records of the mirrored instances after the
+    // others. Instanced draws of the other shaders also fetch it from the
+    // arena, it covers the instance matrix buffer to stay in bounds.
+    std::vector<uint32_t> drawRecordIndices(std::max(
+        {2 * drawRecordCapacity, instanceMatrixCapacity, size_t(1)}));
+    std::iota(begin(drawRecordIndices), end(drawRecordIndices), 0);
+    GLuint drawRecordIndexBuffer;
+    glGenBuffers(1, &drawRecordIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, drawRecordIndexBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER,
+        drawRecordIndices.size() * sizeof(uint32_t), drawRecordIndices.data(),
+        0);
+    glBindVertexArray(arenaVertexArray);
+    glEnableVertexAttribArray(VERTEX_ATTRIB_DRAW_RECORD_IDX);
+    glVertexAttribIPointer(
+        VERTEX_ATTRIB_DRAW_RECORD_IDX, 1, GL_UNSIGNED_INT, 0, nullptr);
+    glVertexAttribDivisor(VERTEX_ATTRIB_DRAW_RECORD_IDX, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // GPU culling of the instances of the multi-draw indirect path: one
+  // command per primitive, in group order, with room for the draw records of
+  // all its instances. The other instances are culled by the CPU with a BVH
+  // of their own. Occlusion culling tests them against a depth pyramid.
+  GpuCulling gpuCulling;
+  DepthPyramid depthPyramid;
+  std::vector<GpuCulling::Instance> gpuCullingInstances;
+  std::vector<uint32_t> cpuCulledInstances; // Items of cpuCullingBVH
+  std::vector<AABB> cpuCulledBounds;
+  const auto &commandBounds = indirectDraws.commandBounds();
+  if (!commandBounds.empty()) {
+    gpuCulling.load(m_ShadersRootPath / m_AppName, indirectDraws.commands(),
+        indirectDraws.groupFirstCommands(),
+        indirectDraws.drawRecordCapacity());
+    depthPyramid.load(m_ShadersRootPath / m_AppName);
+    for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+      if (indirectDraws.command(uint32_t(i)) < 0) {
+        cpuCulledInstances.push_back(uint32_t(i));
+      }
+    }
+  }
+  // Set when the nodes move: the GL thread uploads the joint matrices and the
+  // GPU culled instances of the next draw list
+  bool sceneChanged = true;
+  // Model matrices of the instances culled by the GPU
+  const auto updateGpuCullingInstances = [&]() {
+    if (commandBounds.empty()) {
+      return;
+    }
+    gpuCullingInstances.clear();
+    for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+      const auto command = indirectDraws.command(uint32_t(i));
+      if (command < 0) {
+        continue;
+      }
+      const auto &instance = primitiveInstances[i];
+      const auto &bounds = commandBounds[command];
+      const auto materialIndex = getMaterialIndex(instance);
+      GpuCulling::Instance gpuInstance{nodeMatrices[instance.nodeIdx],
+          glm::vec4(bounds.min, 0), glm::vec4(bounds.max, 0),
+          uint32_t(command), uint32_t(materialIndex),
+          materialIsDoubleSided(materialIndex), 0};
+      if (instance.gpuInstanceCount == 0) {
+        gpuCullingInstances.push_back(gpuInstance);
+      }
+      for (GLsizei j = 0; j < instance.gpuInstanceCount; ++j) {
+        gpuCullingInstances.push_back(gpuInstance);
+        gpuCullingInstances.back().modelMatrix =
+            nodeMatrices[instance.nodeIdx] *
+            instanceMatrices[instance.firstGpuInstance + j];
+      }
+    }
+  };
+  updateGpuCullingInstances();
+
+  // The material table is uploaded for the multi-draw indirect path, for
+  // bindless textures and for texture arrays. Never rebound.
+  GLuint materialBuffer = 0;
+  if (supportsMultiDrawIndirect || materialTable) {
+    glGenBuffers(1, &materialBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        materialRecords.size() * sizeof(MaterialRecord),
+        materialRecords.data(), GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(
+        GL_SHADER_STORAGE_BUFFER, MATERIALS_BINDING, materialBuffer);
+  }
+  // Upload an entry of the table changed by the GUI
+  size_t editedMaterial = 0;
+  const auto patchMaterial = [&](size_t materialIndex) {
+    if (materialBuffer) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+      glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+          materialIndex * sizeof(MaterialRecord), sizeof(MaterialRecord),
+          &materialRecords[materialIndex]);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+  };
+
+  // The joint matrices of all the skins are computed together when the
+  // nodes move, then uploaded in a texture buffer by the GL thread
+  SkinPalette skinPalette;
+  skinPalette.load(model);
+  GLuint jointMatrixBuffer = 0;
+  GLuint jointMatrixTexture = 0;
+  if (hasSkinnedPrimitives) {
+    glGenBuffers(1, &jointMatrixBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, jointMatrixBuffer);
+    glBufferData(GL_TEXTURE_BUFFER,
+        skinPalette.jointCount() * sizeof(glm::mat4), nullptr,
+        GL_DYNAMIC_DRAW);
+    glGenTextures(1, &jointMatrixTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, jointMatrixTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, jointMatrixBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+  const auto updateSkinning = [&]() {
+    if (!hasSkinnedPrimitives) {
+      return;
+    }
+    skinPalette.update(nodeMatrices);
+    for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+      if (primitiveInstanceSkins[i] >= 0) {
+        primitiveInstanceBounds[i] = skinPalette.skinnedBounds(
+            primitiveInstanceSkins[i], primitiveInstanceLocalBounds[i]);
+      }
+    }
+  };
+  updateSkinning();
+
+  // Morph target deltas never change, they are uploaded once
+  GLuint morphTargetBuffer = 0;
+  GLuint morphTargetTexture = 0;
+  if (hasMorphedPrimitives) {
+    glGenBuffers(1, &morphTargetBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, morphTargetBuffer);
+    glBufferData(GL_TEXTURE_BUFFER,
+        morphTargets.texels().size() * sizeof(glm::vec4),
+        morphTargets.texels().data(), GL_STATIC_DRAW);
+    glGenTextures(1, &morphTargetTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, morphTargetTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, morphTargetBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+
+  BoundingVolumeHierarchy sceneBVH;
+  sceneBVH.build(primitiveInstanceBounds);
+  BoundingVolumeHierarchy cpuCullingBVH; // With GPU culling
+  const auto gatherCpuCulledBounds = [&]() {
+    cpuCulledBounds.clear();
+    for (const auto instanceIdx : cpuCulledInstances) {
+      cpuCulledBounds.push_back(primitiveInstanceBounds[instanceIdx]);
+    }
+  };
+  gatherCpuCulledBounds();
+  cpuCullingBVH.build(cpuCulledBounds);
+
+  // Visible instances of the same primitive are drawn with one instanced
+  // call when there are at least 2 of them
+  bool automaticInstancing = supportsInstancing;
+  size_t drawCallCount = 0;
+  size_t instancedDrawCallCount = 0;
+  bool multiDrawIndirect = supportsMultiDrawIndirect;
+  bool cullOnGpu = true;
+  const auto gpuCullingIsEnabled = [&]() {
+    return cullOnGpu && multiDrawIndirect && !commandBounds.empty();
+  };
+  bool gpuOcclusionCulling = true;
+
+  // Batches are sorted by 64 bits keys: opaque ones by render state then
+  // front to back, blended ones back to front
+  bool sortRenderQueue = true;
+  StateChangeCounts stateChanges = {};
+
+  bool frustumCulling = true;
+  float minPixelSize = 0.f; // Small feature culling disabled by default
+
+  // The draw list submitted by the GL thread and the one prepared by the
+  // worker for the next frame
+  DrawList drawLists[2];
+  for (auto &drawList : drawLists) {
+    drawList.visibleInstances.reserve(primitiveInstances.size());
+    drawList.runInstanceMatrices.reserve(
+        instanceMatrixCapacity - gpuInstanceCount);
+    auto &indirectDrawCalls = drawList.indirectDrawCalls;
+    indirectDrawCalls.drawRecords.reserve(indirectDraws.drawRecordCapacity());
+    indirectDrawCalls.commands.reserve(
+        supportsMultiDrawIndirect ? primitiveInstances.size() : 0);
+    indirectDrawCalls.multiDraws.reserve(indirectDraws.groups().size());
+  }
+
+  // Software occlusion culling: each frame the biggest visible opaque
+  // primitives are rasterized on the CPU, then the other ones are tested
+  // against the resulting depth buffer
+  const size_t maxOccluderTriangles = 2048; // Per primitive
+  std::vector<FrameBuilder::OccluderGeometry> occluderGeometries(
+      vertexArrayObjects.size());
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &primitive = mesh.primitives[pIdx];
+      if (primitive.material >= 0 &&
+          model.materials[primitive.material].alphaMode != "OPAQUE") {
+        continue; // See-through
+      }
+      auto &geometry =
+          occluderGeometries[meshToVertexArrays[meshIdx].begin + pIdx];
+      geometry.indices = readPrimitiveTriangles(model, primitive);
+      if (geometry.indices.empty() ||
+          geometry.indices.size() / 3 > maxOccluderTriangles) {
+        geometry.indices.clear();
+        continue;
+      }
+      geometry.positions = readPrimitivePositions(model, primitive);
+    }
+  }
+  OcclusionCuller occlusionCuller(m_jobSystem, 256,
+      std::max(64, 256 * m_nWindowHeight / std::max(m_nWindowWidth, 1)));
+  bool occlusionCulling = true;
+  int occluderTriangleBudget = 20000; // Per frame
 
   glm::vec3 bboxMin, bboxMax;
   computeSceneBounds(model, bboxMin, bboxMax);
@@ -404,16 +1061,30 @@ int ViewerApplication::run()
     std::cout << "Diag: " << bboxDiag << std::endl;
   }
 
-  const auto projMatrix =
-      glm::perspective(70.f, float(m_nWindowWidth) / m_nWindowHeight,
-          0.001f * maxDistance, 1.5f * maxDistance);
+  const auto zFar = 1.5f * maxDistance;
+  const auto projMatrix = glm::perspective(70.f,
+      float(m_nWindowWidth) / m_nWindowHeight, 0.001f * maxDistance, zFar);
 
   // Setup OpenGL state for rendering
   glEnable(GL_DEPTH_TEST);
-  glslProgram.use();
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Enabled by material
+  shading->program.use();
+
+  // The frames of the window are rendered at a lower resolution while the
+  // camera moves, if they are over the target GPU time
+  DynamicResolution dynamicResolution;
+  dynamicResolution.load(
+      m_ShadersRootPath / m_AppName, m_nWindowWidth, m_nWindowHeight);
+
+  // Still views and the output image average jittered frames instead of
+  // multisampling
+  ProgressiveSupersampling supersampling;
+  supersampling.load(
+      m_ShadersRootPath / m_AppName, m_nWindowWidth, m_nWindowHeight);
+  supersampling.setTargetSampleCount(m_sampleCount);
 
   // Point lights
-  const unsigned int nbPointLights = 4;
+  const unsigned int nbPointLights = POINT_LIGHT_COUNT;
   PointLightStruct pointLights[nbPointLights];
 
 
@@ -434,250 +1105,608 @@ int ViewerApplication::run()
       1.0f,
       glm::vec3(0, 0, 0), 7.5f, 13.5f, 100.f, 1.0f, 0.045f, 0.0075f};
 
-  const auto bindMaterial = [&](const auto materialIndex) {
-    if (materialIndex >= 0) {
-       
-      const auto &material = model.materials[materialIndex];
-      // Material data
-      const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
-      const auto &emissiveFactor = material.emissiveFactor;
-      const auto &emissiveTexture = material.emissiveTexture;
-      
-
-      if (pbrMetallicRoughness.baseColorTexture.index >= 0) {
-        const tinygltf::Texture &texture =
-            model.textures[pbrMetallicRoughness.baseColorTexture.index];
-        glActiveTexture(GL_TEXTURE0);
-        const GLuint texId = textureObjects[texture.source];
-        glBindTexture(GL_TEXTURE_2D, texId);
-        // By setting the uniform to 0, we tell OpenGL the texture is bound on
-        // tex unit 0:
-        glUniform1i(baseColorTextureLocation, 0);
-      } else {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, whiteTexture);
-        // By setting the uniform to 0, we tell OpenGL the texture is bound on
-        // tex unit 0:
-        glUniform1i(baseColorTextureLocation, 0);
-      }
-
-      if (baseColorFactorLocation >= 0) {
-        glUniform4f(baseColorFactorLocation,
-            (float)pbrMetallicRoughness.baseColorFactor[0],
-            (float)pbrMetallicRoughness.baseColorFactor[1],
-            (float)pbrMetallicRoughness.baseColorFactor[2],
-            (float)pbrMetallicRoughness.baseColorFactor[3]);
-      }
-      if (metallicRoughnessTextureLocation >= 0) {
-        auto textureObject = 0;
-        if (pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
-          const auto &texture =
-              model.textures[pbrMetallicRoughness.metallicRoughnessTexture
-                                 .index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-        glActiveTexture(GL_TEXTURE1);//Unit change
-        glBindTexture(GL_TEXTURE_2D, textureObject);
-        glUniform1i(metallicRoughnessTextureLocation, 1);
-      }
-      if (metallicFactorLocation >= 0) 
-        glUniform1f(roughnessFactorLocation,
-            (float)pbrMetallicRoughness.metallicFactor);
-      
-      if (roughnessFactorLocation >= 0) 
-        glUniform1f(roughnessFactorLocation,
-            (float)pbrMetallicRoughness.roughnessFactor);
-
-      if (emissiveTextureLocation >= 0) {
-        auto textureObject = 0;
-        if (emissiveTexture.index >= 0) {
-          const auto &texture = model.textures[emissiveTexture.index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, textureObject);
-        glUniform1i(emissiveTextureLocation, 2);
+  // State changes of the draws go through the cache, which elides the
+  // redundant ones
+  GLStateCache glState;
+
+  // Bind the textures of a material to the units 0 to 2. Missing textures
+  // have no layer in texture arrays, their unit keeps the previous array.
+  const auto bindMaterialTextures = [&](GLuint baseColorTexture,
+                                        GLuint metallicRoughnessTexture,
+                                        GLuint emissiveTexture) {
+    const GLuint textures[] = {
+        baseColorTexture, metallicRoughnessTexture, emissiveTexture};
+    for (GLuint unit = 0; unit < 3; ++unit) {
+      if (!textureArrays || textures[unit]) {
+        glState.bindTexture(unit,
+            textureArrays ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D,
+            textures[unit]);
       }
-      if (emissiveFactorLocation >= 0)
-        glUniform3f(emissiveFactorLocation, emissiveFactor[0], emissiveFactor[1],
-            emissiveFactor[2]);
-     
-
-
-    } else {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, whiteTexture);
-      // By setting the uniform to 0, we tell OpenGL the texture is bound on tex
-      // unit 0:
-      glUniform1i(baseColorTextureLocation, 0);
     }
   };
 
+  // Select an entry of the material table, the default material is
+  // sceneStore.materialCount()
+  const auto bindMaterial = [&](size_t materialIndex) {
+    const auto &textures = materialTextures[materialIndex];
+    if (materialTable) {
+      // Factors and texture layers or handles are read from the table
+      glUniform1ui(shading->materialIndexLocation, GLuint(materialIndex));
+      if (textureArrays) {
+        bindMaterialTextures(textures.baseColorTexture,
+            textures.metallicRoughnessTexture, textures.emissiveTexture);
+      }
+      return;
+    }
+    const auto &record = materialRecords[materialIndex];
+    bindMaterialTextures(textures.baseColorTexture,
+        textures.metallicRoughnessTexture, textures.emissiveTexture);
+    if (shading->baseColorFactorLocation >= 0) {
+      glUniform4fv(shading->baseColorFactorLocation, 1,
+          glm::value_ptr(record.baseColorFactor));
+    }
+    if (shading->metallicFactorLocation >= 0) {
+      glUniform1f(shading->metallicFactorLocation, record.metallicFactor);
+    }
+    if (shading->roughnessFactorLocation >= 0) {
+      glUniform1f(shading->roughnessFactorLocation, record.roughnessFactor);
+    }
+    if (shading->emissiveFactorLocation >= 0) {
+      glUniform3fv(shading->emissiveFactorLocation, 1,
+          glm::value_ptr(record.emissiveFactor));
+    }
+    if (shading->alphaCutoffLocation >= 0) {
+      glUniform1f(shading->alphaCutoffLocation, record.alphaCutoff);
+    }
+  };
 
-  // Lambda function to draw the scene
-  const auto drawScene = [&](const Camera &camera) {
-    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  // Dynamic data of the frames: transforms of the draws, lights and the
+  // draw records and commands of the multi-draw indirect path, bump
+  // allocated in a persistently mapped buffer. A region holds the worst
+  // case: one transform per draw when no instances are culled.
+  const auto uniformAlignment = FrameRingBuffer::uniformBufferAlignment();
+  const auto storageAlignment = FrameRingBuffer::storageBufferAlignment();
+  const auto alignSize = [](size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  };
+  const auto maxTransformCount =
+      primitiveInstances.size() + gpuInstanceCount + 1;
+  const auto drawTransformsSize = MAX_DRAW_TRANSFORMS * sizeof(TransformsBlock);
+  FrameRingBuffer frameRingBuffer(
+      (maxTransformCount / MAX_DRAW_TRANSFORMS + 1) *
+          alignSize(drawTransformsSize, uniformAlignment) +
+      alignSize(sizeof(LightsBlock), uniformAlignment) +
+      alignSize(indirectDraws.drawRecordCapacity() *
+                    sizeof(IndirectDraws::DrawRecord),
+          storageAlignment) +
+      drawLists[0].indirectDrawCalls.commands.capacity() *
+          sizeof(DrawElementsIndirectCommand) +
+      storageAlignment);
+
+  // Lights of the frame, shared by the programs through a uniform buffer
+  LightsBlock lightsBlock = {};
+
+  // Express the lights in view space and upload them
+  const auto updateLights = [&](const glm::mat4 &viewMatrix) {
+    lightsBlock.lightDirection =
+        lightIsFromCamera
+            ? glm::vec3(0, 0, 1) // Don't change the lightDirection value
+            : glm::normalize(
+                  glm::vec3(viewMatrix * glm::vec4(lightDirection, 0.)));
+    lightsBlock.lightIntensity = lightIntensity;
+
+    for (size_t i = 0; i < nbPointLights; i++) {
+      const auto &pointLight = pointLights[i];
+      auto &light = lightsBlock.pointLights[i];
+      light.position =
+          glm::vec3(viewMatrix * glm::vec4(pointLight.position, 1));
+      light.attenuationDistance = pointLight.attenuationDistance;
+      light.intensity = pointLight.enabled
+                            ? pointLight.color * pointLight.intensityFactor
+                            : glm::vec3(0.f);
+      light.constantAttenuator = pointLight.constantAttenuator;
+      light.linearAttenuator = pointLight.linearAttenuator;
+      light.quadraticAttenuator = pointLight.quadraticAttenuator;
+    }
 
-    const auto viewMatrix = camera.getViewMatrix();
+    if (glfwGetKey(m_GLFWHandle.window(), GLFW_KEY_F)) {
+      double xpos, ypos;
+      glfwGetCursorPos(m_GLFWHandle.window(), &xpos, &ypos);
+      spotLight.direction =
+          glm::vec3(float((xpos - m_nWindowWidth / 2) / m_nWindowWidth),
+              float(-(ypos - m_nWindowHeight / 2) / m_nWindowHeight), -1);
+    }
 
-    // The light is constant for 1 draw
+    // The spotlight is attached to the camera, already in view space
+    auto &light = lightsBlock.spotLight;
+    light.position = spotLight.position;
+    light.cutOff = glm::cos(glm::radians(spotLight.cutOff));
+    light.intensity = spotLight.enabled
+                          ? spotLight.color * spotLight.intensityFactor
+                          : glm::vec3(0.f);
+    light.outerCutOff = glm::cos(glm::radians(spotLight.outerCutOff));
+    light.direction = spotLight.direction;
+    light.distAttenuation = spotLight.distAttenuation;
+    light.constantAttenuator = spotLight.constantAttenuator;
+    light.linearAttenuator = spotLight.linearAttenuator;
+    light.quadraticAttenuator = spotLight.quadraticAttenuator;
+
+    const auto lights =
+        frameRingBuffer.allocate(&lightsBlock, 1, uniformAlignment);
+    if (lights.data) {
+      frameRingBuffer.bindRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING, lights);
+    }
+  };
 
-    if (lightDirectionLocation >= 0) {
+  // Shaders without the Lights block only get the directional light, set on
+  // the program in use
+  const auto setLightUniforms = [&]() {
+    if (shading->lightDirectionLocation >= 0) {
+      glUniform3fv(shading->lightDirectionLocation, 1,
+          glm::value_ptr(lightsBlock.lightDirection));
+    }
+    if (shading->lightIntensityLocation >= 0) {
+      glUniform3fv(shading->lightIntensityLocation, 1,
+          glm::value_ptr(lightsBlock.lightIntensity));
+    }
+  };
 
-      if (lightIsFromCamera) // From the camera
-        glUniform3f(lightDirectionLocation, 0, 0,
-            1); // Don't change the lightDirection value
-      else {
-        const auto lightDirectionInViewSpace = glm::normalize(
-            glm::vec3(viewMatrix * glm::vec4(lightDirection, 0.)));
+  // CPU work of a frame, without OpenGL calls since it runs on the worker
+  // of the frame pipeline: cull the instances, sort the batches and build the
+  // multi-draw indirect commands
+  FrameBuilder frameBuilder(
+      {primitiveInstanceBounds, instanceMatrices, sceneBVH, cpuCullingBVH,
+          cpuCulledInstances, indirectDraws, occlusionCuller},
+      INSTANCING_VARIANT, GLuint(gpuInstanceCount));
+  for (size_t i = 0; i < primitiveInstances.size(); ++i) {
+    const auto &instance = primitiveInstances[i];
+    const auto materialIndex = getMaterialIndex(instance);
+    const auto vertexArrayIdx = meshToVertexArrays[instance.meshIdx].begin +
+                                instance.primitiveIdx;
+    const auto &occluder = occluderGeometries[vertexArrayIdx];
+    frameBuilder.addInstance({instance.nodeIdx, instance.meshIdx,
+        instance.primitiveIdx, primitiveInstanceVariants[i],
+        primitiveInstanceSkins[i] >= 0, uint32_t(materialIndex),
+        materialIsBlended(materialIndex), materialIsDoubleSided(materialIndex),
+        isPackedInstance(instance) ? 0 : 1 + uint32_t(vertexArrayIdx),
+        occluder.indices.empty() ? nullptr : &occluder,
+        instance.firstGpuInstance, instance.gpuInstanceCount});
+  }
+  // The worker copies the nodes moved for the frame to the draw list, the
+  // frame builder reads nothing else of the scene that changes
+  const auto prepareFrame = [&](const Camera &camera, DrawList &drawList) {
+    const auto prepareStart = glfwGetTime();
+    drawList.nodeMatrices = nodeMatrices;
+    drawList.morphWeights = nodeTransforms.morphWeights;
+    drawList.sceneChanged = sceneChanged;
+    if (sceneChanged) {
+      drawList.jointMatrices = skinPalette.jointMatrices();
+      // Rebuilt from scratch by the next update
+      std::swap(drawList.gpuCullingInstances, gpuCullingInstances);
+      sceneChanged = false;
+    }
+    FrameBuilder::Settings settings;
+    settings.projMatrix = projMatrix;
+    settings.zFar = zFar;
+    settings.viewportHeight = float(m_nWindowHeight);
+    settings.minPixelSize = minPixelSize;
+    settings.frustumCulling = frustumCulling;
+    settings.gpuCulling = gpuCullingIsEnabled();
+    settings.gpuOcclusionCulling = gpuOcclusionCulling;
+    settings.occlusionCulling = occlusionCulling;
+    settings.occluderTriangleBudget = size_t(occluderTriangleBudget);
+    settings.multiDrawIndirect = multiDrawIndirect && supportsMultiDrawIndirect;
+    settings.automaticInstancing = automaticInstancing && supportsInstancing;
+    settings.sortRenderQueue = sortRenderQueue;
+    frameBuilder.build(camera, settings, drawList);
+    drawList.prepareTime = glfwGetTime() - prepareStart;
+  };
 
-        glUniform3f(lightDirectionLocation, lightDirectionInViewSpace[0],
-            lightDirectionInViewSpace[1], lightDirectionInViewSpace[2]);
+  // Submit a prepared frame, on the GL thread: the worker updates the scene
+  // for the next frame meanwhile, the nodes are read from the draw list.
+  // The frame is drawn in the bound framebuffer, of renderWidth x
+  // renderHeight, offset by jitter pixels for supersampling.
+  const auto submitFrame = [&](const DrawList &drawList, GLsizei renderWidth,
+                               GLsizei renderHeight, const glm::vec2 &jitter) {
+    const auto &viewMatrix = drawList.viewMatrix;
+    const auto &cullingView = drawList.cullingView;
+    const auto &nodeMatrices = drawList.nodeMatrices;
+    const auto &visibleInstances = drawList.visibleInstances;
+    // The culling keeps the projection without jitter, a sample moves by
+    // less than a pixel
+    const auto frameProjMatrix =
+        glm::translate(glm::mat4(1), glm::vec3(2.f * jitter.x / renderWidth,
+                                         2.f * jitter.y / renderHeight, 0.f)) *
+        projMatrix;
+    const auto viewProjMatrix = frameProjMatrix * viewMatrix;
+    const auto frustumCulling = drawList.frustumCulling;
+    const auto gpuCullingEnabled = drawList.gpuCulling;
+    const auto gpuOcclusionEnabled = drawList.gpuOcclusionCulling;
+    if (drawList.sceneChanged) {
+      if (hasSkinnedPrimitives) {
+        glBindBuffer(GL_TEXTURE_BUFFER, jointMatrixBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0,
+            drawList.jointMatrices.size() * sizeof(glm::mat4),
+            drawList.jointMatrices.data());
+      }
+      if (!commandBounds.empty()) {
+        gpuCulling.setInstances(drawList.gpuCullingInstances);
       }
     }
 
-    if (lightIntensityLocation >= 0)
-      glUniform3f(lightIntensityLocation, lightIntensity[0], lightIntensity[1],
-          lightIntensity[2]);
-    
-    for (int i = 0; i < nbPointLights; i++) {
-      PointLightStruct pointLight = pointLights[i];
-      std::string id_str = std::to_string(i);
+    glViewport(0, 0, renderWidth, renderHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-      if (!pointLight.enabled) {
-        setUniformVec3(glslProgram, ("pointLights[" + id_str + "].intensity").c_str(),
-            glm::vec3(0.f));
-      } else {
+    frameRingBuffer.beginFrame();
+    // Before the state cache forgets the program and buffers it changes
+    if (gpuCullingEnabled) {
+      gpuCulling.cull(cullingView, frustumCulling,
+          gpuOcclusionEnabled ? GpuCulling::FIRST_PHASE
+                              : GpuCulling::NO_OCCLUSION,
+          &depthPyramid);
+    }
+    glState.beginFrame();
+
+    // The light is constant for 1 draw, the programs without the Lights
+    // block get it in uniforms
+    updateLights(viewMatrix);
+    if (mainProgram.lightsBlockIndex == GL_INVALID_INDEX) {
+      setLightUniforms();
+      for (const auto &shadingVariant : shadingVariants) {
+        if (shadingVariant) {
+          shading = shadingVariant.get();
+          glState.useProgram(shading->program.glId());
+          setLightUniforms();
+        }
+      }
+      shading = &mainProgram;
+      glState.useProgram(shading->program.glId());
+    }
 
-        setUniformVec3(glslProgram, ("pointLights[" + id_str + "].position").c_str(),
-            glm::vec3(viewMatrix * glm::vec4(pointLight.position, 1)));
-        setUniformVec3(glslProgram, ("pointLights[" + id_str + "].intensity").c_str(),
-            pointLight.color * pointLight.intensityFactor);
-        setUniformFloat(glslProgram,
-            ("pointLights[" + id_str + "].attenuationDistance").c_str(),
-            pointLight.attenuationDistance);
+    const auto &runInstanceMatrices = drawList.runInstanceMatrices;
+    if (!runInstanceMatrices.empty()) {
+      glState.bindBuffer(GL_ARRAY_BUFFER, instanceMatrixBuffer);
+      glBufferSubData(GL_ARRAY_BUFFER, gpuInstanceCount * sizeof(glm::mat4),
+          runInstanceMatrices.size() * sizeof(glm::mat4),
+          runInstanceMatrices.data());
+      glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 
-        setUniformFloat(glslProgram,
-            ("pointLights[" + id_str + "].constantAttenuator").c_str(),
-            pointLight.constantAttenuator);
-        setUniformFloat(glslProgram,
-            ("pointLights[" + id_str + "].linearAttenuator").c_str(),
-            pointLight.linearAttenuator);
-        setUniformFloat(glslProgram,
-            ("pointLights[" + id_str + "].quadraticAttenuator").c_str(),
-            pointLight.quadraticAttenuator);
+    auto drawTransforms = FrameRingBuffer::Allocation{nullptr, 0, 0};
+    auto drawTransformCount = MAX_DRAW_TRANSFORMS; // Allocate on first use
+    // False if the transforms could not be allocated, the draws using them
+    // are skipped rather than drawn with the transforms of other draws
+    const auto setTransformUniforms = [&](const glm::mat4 &modelMatrix) {
+      const auto mvMatrix = viewMatrix * modelMatrix;
+      const auto mvpMatrix = frameProjMatrix * mvMatrix;
+
+      const auto normalMatrix = glm::transpose(glm::inverse(mvMatrix));
+
+      if (shading->drawTransformsBlockIndex != GL_INVALID_INDEX) {
+        // Written in place, no copy by the driver, and the block is bound
+        // again once every MAX_DRAW_TRANSFORMS draws
+        if (drawTransformCount == MAX_DRAW_TRANSFORMS) {
+          drawTransforms =
+              frameRingBuffer.allocate(drawTransformsSize, uniformAlignment);
+          if (!drawTransforms.data) {
+            return false; // Allocated again by the next draw
+          }
+          frameRingBuffer.bindRange(
+              GL_UNIFORM_BUFFER, DRAW_TRANSFORMS_BINDING, drawTransforms);
+          drawTransformCount = 0;
+        }
+        static_cast<TransformsBlock *>(
+            drawTransforms.data)[drawTransformCount] = {
+            mvpMatrix, mvMatrix, normalMatrix};
+        glUniform1i(
+            shading->drawTransformIndexLocation, GLint(drawTransformCount));
+        ++drawTransformCount;
+        return true;
+      }
+      glUniformMatrix4fv(shading->modelViewProjMatrixLocation, 1, GL_FALSE,
+          glm::value_ptr(mvpMatrix));
+      glUniformMatrix4fv(shading->modelViewMatrixLocation, 1, GL_FALSE,
+          glm::value_ptr(mvMatrix));
+      glUniformMatrix4fv(shading->normalMatrixLocation, 1, GL_FALSE,
+          glm::value_ptr(normalMatrix));
+      return true;
+    };
+
+    // Draw a primitive of the store, with an instanced call if
+    // instanceCount > 0
+    const auto drawPrimitive = [&](size_t primitive, GLsizei instanceCount,
+                                   GLuint baseInstance) {
+      const auto mode = sceneStore.mode(primitive);
+      const auto count = sceneStore.count(primitive);
+      const auto indexType = sceneStore.indexType(primitive);
+      if (indexType) {
+        const auto indices = (const GLvoid *)sceneStore.indexOffset(primitive);
+        if (instanceCount > 0) {
+          glDrawElementsInstancedBaseInstance(mode, count, indexType, indices,
+              instanceCount, baseInstance);
+        } else {
+          glDrawElements(mode, count, indexType, indices);
+        }
+      } else {
+        if (instanceCount > 0) {
+          glDrawArraysInstancedBaseInstance(
+              mode, 0, count, instanceCount, baseInstance);
+        } else {
+          glDrawArrays(mode, 0, count);
+        }
+      }
+      ++drawCallCount;
+      if (instanceCount > 0) {
+        ++instancedDrawCallCount;
+      }
+    };
+
+    // Draw the triangles of a primitive from the vertex arena
+    const auto drawPackedPrimitive = [&](const PackedGeometry::PrimitiveRange
+                                             &range,
+                                         GLsizei instanceCount,
+                                         GLuint baseInstance) {
+      const auto indices =
+          (const GLvoid *)(size_t(range.firstIndex) * sizeof(uint32_t));
+      if (instanceCount > 0) {
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,
+            GLsizei(range.indexCount), GL_UNSIGNED_INT, indices, instanceCount,
+            range.baseVertex, baseInstance);
+      } else {
+        glDrawElementsBaseVertex(GL_TRIANGLES, GLsizei(range.indexCount),
+            GL_UNSIGNED_INT, indices, range.baseVertex);
+      }
+      ++drawCallCount;
+      if (instanceCount > 0) {
+        ++instancedDrawCallCount;
+      }
+    };
+
+    // Render state, the cache elides the unchanged state
+    drawCallCount = 0;
+    instancedDrawCallCount = 0;
+    stateChanges = {};
+    const auto setFaceCulling = [&](uint8_t culling) {
+      glState.setEnabled(GL_CULL_FACE, culling != DrawList::CULL_NO_FACES);
+      if (culling != DrawList::CULL_NO_FACES) {
+        glState.frontFace(
+            culling == DrawList::CULL_MIRRORED_BACK_FACES ? GL_CW : GL_CCW);
+      }
+    };
+    const auto setBlend = [&](bool enabled) {
+      glState.setEnabled(GL_BLEND, enabled);
+      // Blended surfaces don't hide what is behind them
+      glState.depthMask(enabled ? GL_FALSE : GL_TRUE);
+    };
+
+    // The draws of the multi-draw indirect path read the model matrices and
+    // materials from the draw records. False if they must be skipped.
+    const auto useIndirectShading = [&]() {
+      shading = indirectShading;
+      glState.useProgram(shading->program.glId());
+      // Model matrices in draw records
+      return setTransformUniforms(glm::mat4(1));
+    };
+    const auto bindIndirectDrawGroup = [&](const IndirectDraws::Group &group,
+                                           uint8_t culling) {
+      setFaceCulling(culling);
+      // Groups keep splitting by textures so that the handles read by a
+      // draw are dynamically uniform, as ARB_bindless_texture requires
+      if (!bindlessTextures) {
+        bindMaterialTextures(group.baseColorTexture,
+            group.metallicRoughnessTexture, group.emissiveTexture);
+      }
+      glState.bindVertexArray(arenaVertexArray);
+    };
+
+    // Multi-draw indirect, one call per group
+    const auto &drawRecords = drawList.indirectDrawCalls.drawRecords;
+    const auto &indirectCommands = drawList.indirectDrawCalls.commands;
+    const auto &multiDraws = drawList.indirectDrawCalls.multiDraws;
+    if (!multiDraws.empty()) {
+      const auto records = frameRingBuffer.allocate(
+          drawRecords.data(), drawRecords.size(), storageAlignment);
+      // Commands are read from the ring buffer bound as indirect buffer
+      const auto commands = frameRingBuffer.allocate(indirectCommands.data(),
+          indirectCommands.size(), alignof(DrawElementsIndirectCommand));
+      // Not drawn if the ring buffer is full
+      if (records.data && commands.data && useIndirectShading()) {
+        frameRingBuffer.bindRange(
+            GL_SHADER_STORAGE_BUFFER, DRAW_RECORDS_BINDING, records);
+        glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, frameRingBuffer.glId());
+        for (const auto &multiDraw : multiDraws) {
+          const auto &group = indirectDraws.groups()[multiDraw.group];
+          bindIndirectDrawGroup(group, group.doubleSided
+                                           ? DrawList::CULL_NO_FACES
+                                           : DrawList::CULL_BACK_FACES);
+          glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+              (const GLvoid *)(commands.offset +
+                               multiDraw.firstCommand *
+                                   sizeof(DrawElementsIndirectCommand)),
+              GLsizei(multiDraw.commandCount), 0);
+        }
+        glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
       }
     }
 
-
-    if (glfwGetKey(m_GLFWHandle.window(), GLFW_KEY_F)) {
-      double xpos, ypos;
-      glfwGetCursorPos(m_GLFWHandle.window(), &xpos, &ypos);
-      spotLight.direction =
-          glm::vec3(float((xpos - m_nWindowWidth / 2) / m_nWindowWidth),
-              float(-(ypos - m_nWindowHeight / 2) / m_nWindowHeight), -1);
+    // GPU culling: the commands and draw records built by the culling pass,
+    // mirrored instances are drawn with reversed winding
+    const auto drawGpuCulledInstances = [&]() {
+      if (!useIndirectShading()) {
+        return;
+      }
+      glState.bindBuffer(
+          GL_DRAW_INDIRECT_BUFFER, gpuCulling.drawCommandBuffer());
+      if (gpuCulling.usesDrawCount()) {
+        glState.bindBuffer(
+            GL_PARAMETER_BUFFER_ARB, gpuCulling.drawCountBuffer());
+      }
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_RECORDS_BINDING,
+          gpuCulling.drawRecordBuffer());
+      for (size_t i = 0; i < gpuCulling.groupCount(); ++i) {
+        const auto &group = indirectDraws.groups()[i];
+        if (group.doubleSided) {
+          bindIndirectDrawGroup(group, DrawList::CULL_NO_FACES);
+          gpuCulling.drawGroup(i, false);
+          continue;
+        }
+        bindIndirectDrawGroup(group, DrawList::CULL_BACK_FACES);
+        gpuCulling.drawGroup(i, false);
+        bindIndirectDrawGroup(group, DrawList::CULL_MIRRORED_BACK_FACES);
+        gpuCulling.drawGroup(i, true);
+      }
+      glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      glState.bindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+    };
+    if (gpuCullingEnabled) {
+      drawGpuCulledInstances();
+    }
+    // Instances hidden in the previous frame may be visible in this one:
+    // retest them against the depth of the instances drawn so far
+    if (gpuOcclusionEnabled) {
+      depthPyramid.build(renderWidth, renderHeight, viewProjMatrix);
+      gpuCulling.cull(cullingView, frustumCulling, GpuCulling::SECOND_PHASE,
+          &depthPyramid);
+      glState.invalidate();
+      drawGpuCulledInstances();
     }
-    
 
+    int currentNodeIdx = -1;
+    int currentVariant = -1; // The program is selected by the first batch
+    size_t currentMaterialIndex = ~size_t(0); // Reset with the program
+    for (const auto &item : drawList.renderQueue.items()) {
+      const auto &batch = drawList.drawBatches[item.index];
+      const auto instanceIdx = visibleInstances[batch.begin];
+      const auto &instance = primitiveInstances[instanceIdx];
+      const auto skinIdx = primitiveInstanceSkins[instanceIdx];
+      const auto variant = batch.variant;
+      const auto packed = isPackedInstance(instance);
+      const auto &packedRange = packedGeometry.primitiveRange(
+          instance.meshIdx, instance.primitiveIdx);
+
+      if (variant != currentVariant) {
+        currentVariant = variant;
+        shading = variant ? shadingVariants[variant].get() : &mainProgram;
+        glState.useProgram(shading->program.glId());
+        currentMaterialIndex = ~size_t(0); // Uniforms are per program
+        if (variant & SKINNING_VARIANT) {
+          glState.bindTexture(3, GL_TEXTURE_BUFFER, jointMatrixTexture);
+        }
+        if (variant & MORPHING_VARIANT) {
+          glState.bindTexture(4, GL_TEXTURE_BUFFER, morphTargetTexture);
+        }
+        currentNodeIdx = -1;
+      }
 
-    if (!spotLight.enabled) {
-      setUniformVec3(glslProgram, "spotlight.LightIntensity", glm::vec3(0.f));
-    } else {
-      
+      if (batch.count > 1) {
+        currentNodeIdx = -1;
+        // World matrices of the run are in the instance matrix buffer
+        if (!setTransformUniforms(glm::mat4(1))) {
+          continue;
+        }
+      } else if (instance.nodeIdx != currentNodeIdx) {
+        // Joint matrices are in world space, the transform of the node of a
+        // skinned mesh is ignored
+        if (skinIdx >= 0) {
+          glUniform1i(
+              shading->jointOffsetLocation, skinPalette.jointOffset(skinIdx));
+        }
+        if (!setTransformUniforms(skinIdx >= 0
+                                      ? glm::mat4(1)
+                                      : nodeMatrices[instance.nodeIdx])) {
+          continue;
+        }
+        currentNodeIdx = instance.nodeIdx;
+      }
 
-      setUniformVec3(glslProgram, "spotlight.LightPosition", spotLight.position);
-      setUniformVec3(glslProgram, "spotlight.LightIntensity", spotLight.color * spotLight.intensityFactor);
-      setUniformVec3(glslProgram, "spotlight.LightDirection", spotLight.direction);
-
-      setUniformFloat(glslProgram,
-          "spotlight.constantAttenuator",
-          spotLight.constantAttenuator);
-      setUniformFloat(glslProgram,
-          "spotlight.linearAttenuator",
-          spotLight.linearAttenuator);
-      setUniformFloat(glslProgram,
-          "spotlight.quadraticAttenuator",
-          spotLight.quadraticAttenuator);
-
-
-      setUniformFloat(glslProgram, "spotlight.CutOff",
-          glm::cos(glm::radians(spotLight.cutOff)));
-
-      setUniformFloat(glslProgram, "spotlight.OuterCutOff",
-          glm::cos(glm::radians(spotLight.outerCutOff)));
-
-      setUniformFloat(
-          glslProgram, "spotlight.DistAttenuation", spotLight.distAttenuation);
-    }
-
-    // The recursive function that should draw a node
-    // We use a std::function because a simple lambda cannot be recursive
-    const std::function<void(int, const glm::mat4 &)> drawNode =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const tinygltf::Node node = model.nodes[nodeIdx];
-          glm::mat4 modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
-          
-          if (node.mesh >= 0) {
-            const auto mvMatrix = viewMatrix * modelMatrix;
-            const auto mvpMatrix = projMatrix * mvMatrix;
-
-            const auto normalMatrix = glm::transpose(glm::inverse(mvMatrix));
-
-            const auto &mesh = model.meshes[node.mesh];
-            const auto &vaoRange = meshToVertexArrays[node.mesh];
-
-            glUniformMatrix4fv(modelViewProjMatrixLocation, 1, GL_FALSE,
-                glm::value_ptr(mvpMatrix));
-            glUniformMatrix4fv(
-                modelViewMatrixLocation, 1, GL_FALSE, glm::value_ptr(mvMatrix));
-            glUniformMatrix4fv(normalMatrixLocation, 1, GL_FALSE,
-                glm::value_ptr(normalMatrix));
-
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-
-              const auto vao = vertexArrayObjects[vaoRange.begin + pIdx];
-              const auto &primitive = mesh.primitives[pIdx];
-
-
-              bindMaterial(primitive.material);
-              glBindVertexArray(vao);
-              if (primitive.indices >= 0) {
-                const auto &accessor = model.accessors[primitive.indices];
-                const auto &bufferView = model.bufferViews[accessor.bufferView];
-                const auto byteOffset =
-                    accessor.byteOffset + bufferView.byteOffset;
-                glDrawElements(primitive.mode, GLsizei(accessor.count),
-                    accessor.componentType, (const GLvoid *)byteOffset);
-              } else {
-                // Take first accessor to get the count
-                const auto accessorIdx = (*begin(primitive.attributes)).second;
-                const auto &accessor = model.accessors[accessorIdx];
-                glDrawArrays(primitive.mode, 0, GLsizei(accessor.count));
-              }
-            }
-          }
-        };
+      if (variant & MORPHING_VARIANT) {
+        // Only the targets with a non-zero weight are blended
+        const auto &targets = morphTargets.primitiveTargets(
+            instance.meshIdx, instance.primitiveIdx);
+        int32_t activeTargets[MorphTargets::MAX_ACTIVE_TARGETS];
+        float activeWeights[MorphTargets::MAX_ACTIVE_TARGETS];
+        const auto activeCount = MorphTargets::selectActiveTargets(
+            drawList.morphWeights.data() +
+                nodeTransforms.firstMorphWeights[instance.nodeIdx],
+            std::min(targets.targetCount,
+                nodeTransforms.morphWeightCounts[instance.nodeIdx]),
+            activeTargets, activeWeights);
+        // gl_VertexID includes the base vertex of arena draws
+        glUniform1i(shading->morphFirstTexelLocation,
+            targets.firstTexel - (packed ? packedRange.baseVertex : 0));
+        glUniform1i(shading->morphVertexCountLocation, targets.vertexCount);
+        glUniform1i(shading->morphTargetCountLocation, activeCount);
+        glUniform1iv(shading->morphTargetsLocation, activeCount, activeTargets);
+        glUniform1fv(shading->morphWeightsLocation, activeCount, activeWeights);
+      }
 
-    // Draw the scene referenced by gltf file
-    if (model.defaultScene >= 0) {
-      auto &sceneNodes = model.scenes[model.defaultScene].nodes;
-      for (int i = 0; i < sceneNodes.size(); i++) { //TODO: use iterator instead
-        drawNode(sceneNodes[i], glm::mat4(1));
+      const auto primitive =
+          sceneStore.primitiveIndex(instance.meshIdx, instance.primitiveIdx);
+      const auto vao =
+          packed ? arenaVertexArray : sceneStore.vertexArray(primitive);
+
+      const auto materialIndex = getMaterialIndex(instance);
+      setFaceCulling(batch.culling);
+      setBlend(materialIsBlended(materialIndex));
+      if (materialIndex != currentMaterialIndex) {
+        currentMaterialIndex = materialIndex;
+        bindMaterial(materialIndex);
+        ++stateChanges.materials;
+      } else {
+        ++stateChanges.skippedMaterials;
+      }
+      glState.bindVertexArray(vao);
+      if (batch.instanceCount > 0 || instance.gpuInstanceCount == 0) {
+        packed ? drawPackedPrimitive(
+                     packedRange, batch.instanceCount, batch.baseInstance)
+               : drawPrimitive(
+                     primitive, batch.instanceCount, batch.baseInstance);
+      } else {
+        // GPU instances without instancing support, drawn one by one
+        for (GLsizei i = 0; i < instance.gpuInstanceCount; ++i) {
+          if (setTransformUniforms(
+                  nodeMatrices[instance.nodeIdx] *
+                  instanceMatrices[instance.firstGpuInstance + i])) {
+            packed ? drawPackedPrimitive(packedRange, 0, 0)
+                   : drawPrimitive(primitive, 0, 0);
+          }
+        }
+        currentNodeIdx = -1;
       }
     }
+
+    // Depth of the whole frame, for the first phase of the next one
+    if (gpuOcclusionEnabled) {
+      depthPyramid.build(renderWidth, renderHeight, viewProjMatrix);
+      glState.invalidate();
+    }
+
+    setFaceCulling(DrawList::CULL_NO_FACES);
+    glState.frontFace(GL_CCW);
+    setBlend(false);
+    shading = &mainProgram;
+    glState.useProgram(shading->program.glId());
+    frameRingBuffer.endFrame();
   };
 
 
   //RENDER
   if (!m_OutputPath.empty()){
     std::vector<unsigned char> pixels( 3L * m_nWindowWidth * m_nWindowHeight);
-    renderToImage(m_nWindowWidth, m_nWindowHeight, 3, pixels.data(),
-        [&]() { drawScene(cameraController.getCamera()); });
+    prepareFrame(cameraController.getCamera(), drawLists[0]);
+    renderToImage(m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), [&]() {
+      if (m_sampleCount <= 1) {
+        submitFrame(drawLists[0], m_nWindowWidth, m_nWindowHeight,
+            glm::vec2(0));
+        return;
+      }
+      while (!supersampling.isConverged()) {
+        supersampling.beginSample();
+        submitFrame(drawLists[0], m_nWindowWidth, m_nWindowHeight,
+            supersampling.jitter());
+        supersampling.endSample();
+      }
+    });
 
     flipImageYAxis(m_nWindowWidth, m_nWindowHeight, 3, pixels.data()); //OpenGL data is different from png
     const auto strPath = m_OutputPath.string();
@@ -687,14 +1716,132 @@ int ViewerApplication::run()
     return 0;
   }
 
-  // LOOP (input + update + render)
-  // Loop until the user closes the window
-  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
-       ++iterationCount) {
+  // CPU copy of the scene triangles for picking (right click) and the other
+  // queries of the GUI
+  SceneQuery sceneQuery;
+  const auto sceneQueryStart = glfwGetTime();
+  sceneQuery.build(model, m_bvhCachePath, &m_jobSystem);
+  const auto sceneQueryBuildTime = glfwGetTime() - sceneQueryStart;
+
+  bool rightButtonWasPressed = false;
+  bool hasPickHit = false;
+  SceneQueryHit pickHit;
+  double pickTime = 0.;
+  float boxQueryHalfSize = 0.01f * maxDistance;
+  std::vector<SceneQueryHit> boxQueryHits;
+  const auto queryBoxAroundPick = [&]() {
+    boxQueryHits.clear();
+    sceneQuery.queryBox(AABB(pickHit.position - boxQueryHalfSize,
+                            pickHit.position + boxQueryHalfSize),
+        boxQueryHits);
+  };
+
+  // Animations move the nodes: the culling BVH is refitted every frame, the
+  // scene query BVH is only updated before a query
+  AnimationSystem animationSystem;
+  animationSystem.load(model);
+
+  // Everything the frames read was copied from the model, its buffers and
+  // images are freed
+  model = tinygltf::Model();
+  int animationIdx = 0;
+  bool playAnimation = animationSystem.animationCount() > 0;
+  bool loopAnimation = true;
+  float animationSpeed = 1.f;
+  float animationTime = 0.f;
+  double animationUpdateTime = 0.;
+  bool sceneQueryIsOutdated = false;
+  const auto updateAnimation = [&]() {
+    const auto updateStart = glfwGetTime();
+    animationSystem.apply(animationIdx, animationTime, nodeTransforms);
+    nodeTransforms.computeWorldMatrices(nodeMatrices);
+    m_jobSystem.parallelFor(primitiveInstances.size(), 1024,
+        [&](size_t begin, size_t end) {
+          for (auto i = begin; i < end; ++i) {
+            primitiveInstanceBounds[i] =
+                primitiveInstanceLocalBounds[i].transform(
+                    nodeMatrices[primitiveInstances[i].nodeIdx]);
+          }
+        });
+    updateSkinning();
+    sceneBVH.refit(primitiveInstanceBounds);
+    gatherCpuCulledBounds();
+    cpuCullingBVH.refit(cpuCulledBounds);
+    updateGpuCullingInstances();
+    sceneChanged = true;
+    sceneQueryIsOutdated = true;
+    animationUpdateTime = glfwGetTime() - updateStart;
+  };
+  const auto updateSceneQuery = [&]() {
+    if (sceneQueryIsOutdated) {
+      sceneQuery.updateTransforms(nodeMatrices);
+      sceneQueryIsOutdated = false;
+    }
+  };
+
+  // The worker prepares the next frame while this thread submits the
+  // current one, the input is shown one frame later. Declared last, its
+  // destructor waits for the job before the scene is destroyed. The next*
+  // inputs are set before each start.
+  auto nextAnimate = false;
+  Camera nextCamera;
+  size_t nextList = 0;
+  FramePipeline framePipeline([&]() {
+    if (nextAnimate) {
+      updateAnimation();
+    }
+    prepareFrame(nextCamera, drawLists[nextList]);
+  });
+  size_t submittedList = 0;
+  double frameWaitTime = 0.;
+  double ellapsedTime = 0.; // Of the previous frame
+  // Heap allocations of the previous frame, none for a static scene
+  size_t frameAllocationCount = 0;
+  auto lastAllocationCount = allocationCount();
+  prepareFrame(cameraController.getCamera(), drawLists[submittedList]);
+
+  // Redraw on demand: once nothing changes, the loop sleeps until an event
+  // arrives instead of drawing the same frame again. A change is drawn for
+  // a few frames, the prepared frame lags one frame behind the input and
+  // ImGui needs a frame to settle its widgets.
+  WindowEvents windowEvents(m_GLFWHandle.window());
+  bool onDemandRedraw = true;
+  const int redrawFrameCount = 3;
+  const double idleTimeout = 0.25; // Seconds
+  int pendingRedrawCount = redrawFrameCount;
+  // Frames per second, 0 for no limit
+  float targetFrameRate = m_targetFrameRate;
+  bool cameraMoving = false; // In the previous frame
+  // Once the view stops changing and its last frames are drawn, the idle
+  // frames accumulate jittered samples until the target count, then the
+  // average is redrawn
+  bool progressiveSupersampling = m_sampleCount > 1;
+  int settlingFrameCount = redrawFrameCount;
+
+  // An iteration of the loop: the GUI, the input, the update and the frame,
+  // or a wait for events if nothing changes
+  const auto runIteration = [&]() {
+    const auto accumulating = progressiveSupersampling &&
+                              settlingFrameCount == 0 &&
+                              !supersampling.isConverged();
+    if (onDemandRedraw && pendingRedrawCount == 0 && !accumulating) {
+      glfwWaitEventsTimeout(idleTimeout);
+      if (!windowEvents.consume()) {
+        return;
+      }
+      pendingRedrawCount = redrawFrameCount;
+    }
     const auto seconds = glfwGetTime();
+    const auto allocationCountNow = allocationCount();
+    frameAllocationCount = allocationCountNow - lastAllocationCount;
+    lastAllocationCount = allocationCountNow;
 
-    const auto camera = cameraController.getCamera();
-    drawScene(camera);
+    // Until the next job starts, the worker is idle: the GUI, the picking and
+    // the animation may change the scene
+    frameWaitTime = framePipeline.wait();
+    m_jobSystem.runMainThreadJobs(); // OpenGL work queued by the jobs
+    const auto &drawList = drawLists[submittedList];
+    const auto &camera = drawList.camera;
 
     // GUI code:
     imguiNewFrame();
@@ -755,31 +1902,360 @@ int ViewerApplication::run()
       ImGui::InputFloat("Spot intensity ", &((spotLight.intensityFactor)));
 
       for (int i = 0; i < nbPointLights; i++) {
+        // Formatted in place, the GUI must not allocate each frame
+        char label[32];
+        std::snprintf(label, sizeof(label), "Enable pointlight %d", i);
+        ImGui::Checkbox(label, &(pointLights[i].enabled));
+
+        std::snprintf(label, sizeof(label), "Point color %d", i);
+        ImGui::ColorEdit3(label, (float *)&((pointLights[i].color)));
+        std::snprintf(label, sizeof(label), "Point intensity %d", i);
+        ImGui::InputFloat(label, &(pointLights[i].intensityFactor));
+      }
+
+      if (ImGui::CollapsingHeader("Culling", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Checkbox("Frustum culling", &frustumCulling);
+        if (!commandBounds.empty()) {
+          ImGui::Checkbox("GPU culling", &cullOnGpu);
+          ImGui::Text("GPU culled instances: %zu (%zu commands%s)",
+              gpuCulling.instanceCount(), gpuCulling.commandCount(),
+              gpuCulling.usesDrawCount() ? ", draw counts" : "");
+          ImGui::Checkbox("GPU occlusion culling", &gpuOcclusionCulling);
+          const auto &counts = gpuCulling.counts();
+          ImGui::Text("GPU drawn instances: %u + %u (%u occluded)",
+              counts.firstPhase, counts.secondPhase, counts.occluded);
+        }
+        ImGui::SliderFloat(
+            "Min size (px)", &minPixelSize, 0.f, 32.f, "%.1f");
+        // Without the instances culled by the GPU
+        const auto culledInstanceCount = gpuCullingIsEnabled()
+                                             ? cpuCulledInstances.size()
+                                             : primitiveInstances.size();
+        ImGui::Text("Drawn primitives: %zu / %zu (%zu culled)",
+            drawList.visibleInstances.size(), culledInstanceCount,
+            culledInstanceCount - drawList.visibleInstances.size());
+        ImGui::Text("BVH: %zu nodes", sceneBVH.nodeCount());
+
+        ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+        if (occlusionCulling) {
+          ImGui::SliderInt(
+              "Occluder triangles", &occluderTriangleBudget, 0, 100000);
+          ImGui::Text("Occluders: %zu (%zu / %zu triangles rasterized)",
+              drawList.occluderCount,
+              occlusionCuller.rasterizedTriangleCount(),
+              occlusionCuller.occluderTriangleCount());
+          ImGui::Text("Occluded primitives: %zu", drawList.occludedCount);
+          ImGui::Text("Occlusion: %.3f ms on %u threads (%ux%u)",
+              1000. * drawList.occlusionTime, occlusionCuller.threadCount(),
+              occlusionCuller.width(), occlusionCuller.height());
+        }
+      }
+
+      if (ImGui::CollapsingHeader("Rendering")) {
+        if (supportsInstancing) {
+          ImGui::Checkbox("Automatic instancing", &automaticInstancing);
+        } else {
+          ImGui::Text("Instancing not supported by the shaders");
+        }
+        ImGui::Text("Draw calls: %zu (%zu instanced)", drawCallCount,
+            instancedDrawCallCount);
+        ImGui::Checkbox("Sorted render queue", &sortRenderQueue);
+        ImGui::Checkbox("Vertex arena", &vertexArena);
+        ImGui::Text("Materials: %zu (%zu skipped)", stateChanges.materials,
+            stateChanges.skippedMaterials);
+        if (textureArrays) {
+          ImGui::Text("Texture arrays: %zu", packedTextures.arrayCount());
+        } else if (bindlessTextures) {
+          ImGui::Text("Bindless textures");
+        }
+        const auto totalCounts = glState.totalCounts();
+        if (ImGui::TreeNode("state", "GL state calls: %zu issued, %zu elided",
+                totalCounts.issued, totalCounts.elided)) {
+          for (int call = 0; call < GLStateCache::CALL_COUNT; ++call) {
+            const auto &counts = glState.counts(GLStateCache::Call(call));
+            ImGui::Text("%s: %zu issued, %zu elided",
+                GLStateCache::callName(GLStateCache::Call(call)),
+                counts.issued, counts.elided);
+          }
+          ImGui::TreePop();
+        }
+        ImGui::Text("Frame ring buffer: %zu / %zu KB",
+            frameRingBuffer.frameSize() / 1024,
+            frameRingBuffer.frameCapacity() / 1024);
+        if (supportsMultiDrawIndirect) {
+          ImGui::Checkbox("Multi-draw indirect", &multiDrawIndirect);
+          ImGui::Text("Multi-draws: %zu (%zu commands, %zu groups)",
+              drawList.indirectDrawCalls.multiDraws.size(),
+              drawList.indirectDrawCalls.commands.size(),
+              indirectDraws.groups().size());
+        } else {
+          ImGui::Text("Multi-draw indirect not supported by the shaders");
+        }
+        ImGui::Text("GPU instances: %zu", gpuInstanceCount);
+        ImGui::Text("Frame pipeline: %.3f ms prepare, %.3f ms wait",
+            1000. * drawList.prepareTime, 1000. * frameWaitTime);
+        ImGui::Checkbox("Redraw on demand", &onDemandRedraw);
+        ImGui::SliderFloat(
+            "Target FPS", &targetFrameRate, 0.f, 240.f, "%.0f (0: no limit)");
+        ImGui::Checkbox("Progressive supersampling", &progressiveSupersampling);
+        auto sampleCount = int(supersampling.targetSampleCount());
+        if (ImGui::SliderInt("Samples", &sampleCount, 1, 256)) {
+          supersampling.setTargetSampleCount(uint32_t(sampleCount));
+        }
+        ImGui::Text("Accumulated samples: %u", supersampling.sampleCount());
+        if (allocationCountingEnabled()) {
+          ImGui::Text("Heap allocations: %zu per frame", frameAllocationCount);
+        }
+      }
+
+      if (ImGui::CollapsingHeader("Dynamic resolution")) {
+        auto &policy = dynamicResolution.policy();
+        ImGui::Checkbox("Enabled##resolution", &policy.enabled);
+        ImGui::SliderFloat(
+            "Target GPU time", &policy.targetGpuTime, 1.f, 50.f, "%.1f ms");
+        ImGui::SliderFloat("Min scale", &policy.minScale, 0.25f, 1.f);
+        ImGui::SliderFloat(
+            "Increase threshold", &policy.increaseThreshold, 0.5f, 1.f);
         ImGui::Checkbox(
-            ("Enable pointlight " + std::to_string(i)).c_str(), &(pointLights[i].enabled));
+            "Full resolution when still", &policy.fullResolutionWhenStill);
+        ImGui::Text("Scale: %.3f (%dx%d), fitting %.3f",
+            dynamicResolution.scale(), dynamicResolution.width(),
+            dynamicResolution.height(), dynamicResolution.fittingScale());
+        ImGui::Text("GPU time: %.2f ms", dynamicResolution.gpuTime());
+        ImGui::PlotLines("Scale history", dynamicResolution.scaleHistory(),
+            int(DynamicResolution::HISTORY_SIZE),
+            int(dynamicResolution.historyOffset()), nullptr, 0.f, 1.f,
+            ImVec2(0, 60));
+      }
+
+      if (sceneStore.materialCount() > 0 &&
+          ImGui::CollapsingHeader("Materials")) {
+        // Formatted in place, the GUI must not allocate each frame
+        char label[128];
+        const auto formatLabel = [&](size_t i) {
+          std::snprintf(label, sizeof(label), "%zu %s", i,
+              sceneStore.materialName(i).c_str());
+          return label;
+        };
+        if (ImGui::BeginCombo("Material", formatLabel(editedMaterial))) {
+          for (size_t i = 0; i < sceneStore.materialCount(); ++i) {
+            if (ImGui::Selectable(formatLabel(i), i == editedMaterial)) {
+              editedMaterial = i;
+            }
+          }
+          ImGui::EndCombo();
+        }
+        // Only the edited entry of the table is uploaded
+        auto &record = materialRecords[editedMaterial];
+        bool changed = ImGui::ColorEdit4(
+            "Base color", glm::value_ptr(record.baseColorFactor));
+        changed |=
+            ImGui::SliderFloat("Metallic", &record.metallicFactor, 0.f, 1.f);
+        changed |= ImGui::SliderFloat(
+            "Roughness", &record.roughnessFactor, 0.f, 1.f);
+        changed |= ImGui::ColorEdit3(
+            "Emissive", glm::value_ptr(record.emissiveFactor));
+        if (changed) {
+          patchMaterial(editedMaterial);
+        }
+      }
+
+      if (animationSystem.animationCount() > 0 &&
+          ImGui::CollapsingHeader("Animation")) {
+        if (ImGui::BeginCombo("Animation",
+                animationSystem.name(animationIdx).c_str())) {
+          for (size_t i = 0; i < animationSystem.animationCount(); ++i) {
+            char label[128];
+            std::snprintf(label, sizeof(label), "%zu %s", i,
+                animationSystem.name(i).c_str());
+            if (ImGui::Selectable(label, int(i) == animationIdx)) {
+              // Other animations may have moved other nodes
+              animationIdx = int(i);
+              animationTime = 0.f;
+              nodeTransforms = restTransforms;
+              updateAnimation();
+            }
+          }
+          ImGui::EndCombo();
+        }
+        ImGui::Checkbox("Play", &playAnimation);
+        ImGui::SameLine();
+        ImGui::Checkbox("Loop", &loopAnimation);
+        ImGui::SliderFloat("Speed", &animationSpeed, -4.f, 4.f);
+        if (ImGui::SliderFloat("Time", &animationTime, 0.f,
+                animationSystem.duration(animationIdx))) {
+          updateAnimation();
+        }
+        ImGui::Text("%zu channels, updated in %.3f ms",
+            animationSystem.channelCount(animationIdx),
+            1000. * animationUpdateTime);
+      }
 
-        ImGui::ColorEdit3(("Point color " + std::to_string(i)).c_str(),
-            (float *)&((pointLights[i].color)));
-        ImGui::InputFloat(("Point intensity " + std::to_string(i)).c_str(),
-            &(pointLights[i].intensityFactor));
+      if (ImGui::CollapsingHeader("Scene queries")) {
+        updateSceneQuery();
+        ImGui::Text("BVH: %zu instances, %zu triangles, built in %.1f ms",
+            sceneQuery.instanceCount(), sceneQuery.triangleCount(),
+            1000. * sceneQueryBuildTime);
+        ImGui::Text("Right click to pick a triangle");
+        if (hasPickHit) {
+          ImGui::Text("Node %d (%s), mesh %d (%s)", pickHit.nodeIdx,
+              sceneStore.nodeName(pickHit.nodeIdx).c_str(), pickHit.meshIdx,
+              sceneStore.meshName(pickHit.meshIdx).c_str());
+          ImGui::Text("Primitive %d, triangle %u", pickHit.primitiveIdx,
+              pickHit.triangleIdx);
+          ImGui::Text("Position: %.3f %.3f %.3f, distance %.3f",
+              pickHit.position.x, pickHit.position.y, pickHit.position.z,
+              pickHit.distance);
+          ImGui::Text("Pick time: %.3f ms", 1000. * pickTime);
+          if (ImGui::SliderFloat("Box half size", &boxQueryHalfSize, 0.f,
+                  0.1f * maxDistance)) {
+            queryBoxAroundPick();
+          }
+          ImGui::Text("Triangles in box: %zu", boxQueryHits.size());
+        }
+        SceneQueryHit nearestHit;
+        if (sceneQuery.nearestPoint(camera.eye(), nearestHit)) {
+          ImGui::Text("Nearest surface from the camera: %.3f (node %d)",
+              nearestHit.distance, nearestHit.nodeIdx);
+        }
       }
 
       ImGui::End();
     }
 
+    const auto guiHasFocus =
+        ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard;
+    // A widget being dragged changes the scene without input events
+    const auto guiActive = ImGui::IsAnyItemActive();
+
+    // Pick the triangle under the cursor on right click
+    const auto rightButtonPressed =
+        glfwGetMouseButton(m_GLFWHandle.window(), GLFW_MOUSE_BUTTON_RIGHT) ==
+        GLFW_PRESS;
+    if (rightButtonPressed && !rightButtonWasPressed && !guiHasFocus) {
+      double xpos, ypos;
+      glfwGetCursorPos(m_GLFWHandle.window(), &xpos, &ypos);
+      const auto ndc = glm::vec2(2. * xpos / m_nWindowWidth - 1.,
+          1. - 2. * ypos / m_nWindowHeight);
+      const auto clipToWorld =
+          glm::inverse(projMatrix * camera.getViewMatrix());
+      const auto nearPoint = clipToWorld * glm::vec4(ndc, -1, 1);
+      const auto farPoint = clipToWorld * glm::vec4(ndc, 1, 1);
+      const auto rayOrigin = glm::vec3(nearPoint) / nearPoint.w;
+      const auto pickStart = glfwGetTime();
+      updateSceneQuery();
+      hasPickHit = sceneQuery.intersect(
+          Ray{rayOrigin, glm::vec3(farPoint) / farPoint.w - rayOrigin},
+          pickHit);
+      if (hasPickHit) {
+        queryBoxAroundPick();
+      }
+      pickTime = glfwGetTime() - pickStart;
+    }
+    rightButtonWasPressed = rightButtonPressed;
+
+    const auto animate =
+        playAnimation && animationSystem.animationCount() > 0;
+    if (animate) {
+      const auto duration = animationSystem.duration(animationIdx);
+      animationTime += animationSpeed * float(ellapsedTime);
+      if (loopAnimation && duration > 0.f) {
+        animationTime -= duration * std::floor(animationTime / duration);
+      } else {
+        animationTime = glm::clamp(animationTime, 0.f, duration);
+      }
+    }
+
+
+    // Frame N + 1 on the worker, from the camera moved by the input of frame
+    // N - 1, while frame N is submitted
+    nextAnimate = animate;
+    nextCamera = cameraController.getCamera();
+    nextList = 1 - submittedList;
+    framePipeline.start();
+
+    if (!progressiveSupersampling || settlingFrameCount > 0) {
+      supersampling.reset();
+      dynamicResolution.beginFrame(cameraMoving);
+      submitFrame(drawList, dynamicResolution.width(),
+          dynamicResolution.height(), glm::vec2(0));
+      dynamicResolution.endFrame();
+    } else if (!supersampling.isConverged()) {
+      supersampling.beginSample();
+      submitFrame(drawList, m_nWindowWidth, m_nWindowHeight,
+          supersampling.jitter());
+      supersampling.endSample();
+    } else {
+      supersampling.resolve();
+    }
+
     imguiRenderFrame();
 
     glfwPollEvents(); // Poll for and process events
 
-    auto ellapsedTime = glfwGetTime() - seconds;
-    auto guiHasFocus =
-        ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard;
-    if (!guiHasFocus) {
-      cameraController.update(float(ellapsedTime));
+    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+
+    // Frame pacing: process the events until the frame time of the target
+    // rate is spent, then the animation and the camera advance by the whole
+    // frame time
+    if (targetFrameRate > 0.f) {
+      const auto frameEnd = seconds + 1. / targetFrameRate;
+      for (auto now = glfwGetTime(); now < frameEnd; now = glfwGetTime()) {
+        glfwWaitEventsTimeout(frameEnd - now);
+      }
     }
+    ellapsedTime = glfwGetTime() - seconds;
+    const auto cameraMoved =
+        !guiHasFocus && cameraController.update(float(ellapsedTime));
+
+    cameraMoving = cameraMoved;
+    const auto viewChanged =
+        windowEvents.consumeInput() || guiActive || cameraMoved || animate;
+    if (windowEvents.consume() || viewChanged) {
+      pendingRedrawCount = redrawFrameCount;
+    } else if (pendingRedrawCount > 0) {
+      --pendingRedrawCount;
+    }
+    if (viewChanged) {
+      settlingFrameCount = redrawFrameCount;
+    } else if (settlingFrameCount > 0) {
+      --settlingFrameCount;
+    }
+    submittedList = 1 - submittedList;
+  };
 
-    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
-    Sleep(10);
+  // Allocation check: after a few iterations to warm up, the iterations of
+  // the loop on the static scene may not allocate. Each one draws a frame,
+  // the supersampling accumulates once the view has settled.
+  if (m_allocationCheckFrameCount > 0) {
+    if (!allocationCountingEnabled()) {
+      std::cerr << "Allocation counting is disabled, configure with "
+                   "GLMLV_COUNT_ALLOCATIONS"
+                << std::endl;
+      return -1;
+    }
+    onDemandRedraw = false;
+    const uint32_t warmUpFrameCount = 10;
+    const auto frameCount = warmUpFrameCount + m_allocationCheckFrameCount;
+    size_t checkStartCount = 0;
+    for (auto frameIdx = 0u; frameIdx < frameCount; ++frameIdx) {
+      if (frameIdx == warmUpFrameCount) {
+        checkStartCount = allocationCount();
+      }
+      runIteration();
+    }
+    framePipeline.wait();
+    const auto checkedAllocationCount = allocationCount() - checkStartCount;
+    std::cout << "Heap allocations: " << checkedAllocationCount << " in "
+              << m_allocationCheckFrameCount << " frames" << std::endl;
+    return checkedAllocationCount == 0 ? 0 : 1;
+  }
+
+  // LOOP (input + update + render)
+  // Loop until the user closes the window
+  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
+       ++iterationCount) {
+    runIteration();
   }
 
   // TODO clean up allocated GL data
@@ -790,7 +2266,10 @@ int ViewerApplication::run()
 ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     uint32_t height, const fs::path &gltfFile,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    const fs::path &bvhCachePath, uint32_t threadCount,
+    float targetFrameRate, uint32_t sampleCount,
+    uint32_t allocationCheckFrameCount) :
     m_nWindowWidth(width),
     m_nWindowHeight(height),
     m_AppPath{appPath},
@@ -798,7 +2277,12 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},  
     m_gltfFilePath{gltfFile},
-    m_OutputPath{output}
+    m_OutputPath{output},
+    m_bvhCachePath{bvhCachePath},
+    m_targetFrameRate{targetFrameRate},
+    m_sampleCount{sampleCount},
+    m_allocationCheckFrameCount{allocationCheckFrameCount},
+    m_jobSystem{threadCount}
 {
   if (!lookatArgs.empty()) {
     m_hasUserCamera = true;
@@ -3,6 +3,7 @@
 #include "utils/GLFWHandle.hpp"
 #include "utils/cameras.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/job_system.hpp"
 #include "utils/shaders.hpp"
 #include <tiny_gltf.h>
 
@@ -13,7 +14,9 @@ public:
   ViewerApplication(const fs::path &appPath, uint32_t width, uint32_t height,
       const fs::path &gltfFile, const std::vector<float> &lookatArgs,
       const std::string &vertexShader, const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output, const fs::path &bvhCachePath = {},
+      uint32_t threadCount = 0, float targetFrameRate = 0.f,
+      uint32_t sampleCount = 16, uint32_t allocationCheckFrameCount = 0);
 
 
 
@@ -30,6 +33,159 @@ private:
     GLsizei count; // Number of elements in range
   };
 
+  // A primitive of a mesh referenced by a node of the scene, unit of culling
+  // and drawing
+  struct PrimitiveInstance
+  {
+    int nodeIdx;
+    int meshIdx;
+    int primitiveIdx;
+    // Instances of the EXT_mesh_gpu_instancing extension of the node, in the
+    // instance matrix buffer
+    GLuint firstGpuInstance = 0;
+    GLsizei gpuInstanceCount = 0; // 0 if the node is not instanced
+  };
+
+  // Entry of the material table, with the std430 layout of Material in
+  // advanced_light.fs.glsl. Built once at load, edits of the GUI patch
+  // single entries.
+  struct MaterialRecord
+  {
+    glm::vec4 baseColorFactor;
+    glm::vec4 emissiveFactor; // w unused
+    float metallicFactor;
+    float roughnessFactor;
+    float alphaCutoff; // 0 unless alpha mode is MASK
+    // Layers in the texture arrays, -1 without texture or texture arrays
+    int32_t baseColorLayer;
+    int32_t metallicRoughnessLayer;
+    int32_t emissiveLayer;
+    uint32_t flags; // MATERIAL_BLENDED and MATERIAL_DOUBLE_SIDED
+    // Resident texture handles, 0 without bindless textures
+    GLuint64 baseColorTexture;
+    GLuint64 metallicRoughnessTexture;
+    GLuint64 emissiveTexture;
+    uint32_t padding[2]; // Array stride multiple of 16 bytes
+  };
+
+  static constexpr uint32_t MATERIAL_BLENDED = 1;
+  static constexpr uint32_t MATERIAL_DOUBLE_SIDED = 2;
+
+  // Texture objects of a material as bound by the shaders without bindless
+  // textures: texture arrays with texture arrays, 0 for a missing texture
+  // but the default base color texture
+  struct MaterialTextures
+  {
+    GLuint baseColorTexture;
+    GLuint metallicRoughnessTexture;
+    GLuint emissiveTexture;
+  };
+
+  // Transforms of a draw, with the std140 layout of Transforms in
+  // forward.vs.glsl. The DrawTransforms block holds MAX_DRAW_TRANSFORMS of
+  // them, 12 KB within the 16 KB guaranteed for a uniform block.
+  static constexpr size_t MAX_DRAW_TRANSFORMS = 64;
+  struct TransformsBlock
+  {
+    glm::mat4 modelViewProjMatrix;
+    glm::mat4 modelViewMatrix;
+    glm::mat4 normalMatrix;
+  };
+
+  // Lights in view space, with the std140 layout of the Lights block in
+  // advanced_light.fs.glsl, uploaded once per frame
+  static constexpr size_t POINT_LIGHT_COUNT = 4;
+  struct LightsBlock
+  {
+    glm::vec3 lightDirection;
+    float padding0;
+    glm::vec3 lightIntensity;
+    float padding1;
+    struct PointLight
+    {
+      glm::vec3 position;
+      float attenuationDistance;
+      glm::vec3 intensity; // 0 if the light is disabled
+      float constantAttenuator;
+      float linearAttenuator;
+      float quadraticAttenuator;
+      float padding[2];
+    } pointLights[POINT_LIGHT_COUNT];
+    struct SpotLight
+    {
+      glm::vec3 position;
+      float cutOff; // Cosines of the cone angles
+      glm::vec3 intensity; // 0 if the light is disabled
+      float outerCutOff;
+      glm::vec3 direction;
+      float distAttenuation;
+      float constantAttenuator;
+      float linearAttenuator;
+      float quadraticAttenuator;
+      float padding;
+    } spotLight;
+  };
+
+  // Material changes of a frame, the OpenGL calls are counted by the state
+  // cache
+  struct StateChangeCounts
+  {
+    size_t materials; // bindMaterial calls
+    size_t skippedMaterials; // Same material as the previous draw
+  };
+
+  // A variant of the shading program and the locations of its uniforms
+  struct ShadingProgram
+  {
+    GLProgram program;
+    GLint modelViewProjMatrixLocation;
+    GLint modelViewMatrixLocation;
+    GLint normalMatrixLocation;
+    GLint lightDirectionLocation;
+    GLint lightIntensityLocation;
+    GLint baseColorTextureLocation;
+    GLint baseColorFactorLocation;
+    GLint metallicRoughnessTextureLocation;
+    GLint metallicFactorLocation;
+    GLint roughnessFactorLocation;
+    GLint emissiveFactorLocation;
+    GLint emissiveTextureLocation;
+    GLint alphaCutoffLocation;
+    GLint jointMatricesLocation; // Skinning variant only
+    GLint jointOffsetLocation;
+    GLint morphTargetDeltasLocation; // Morphing variant only
+    GLint morphFirstTexelLocation;
+    GLint morphVertexCountLocation;
+    GLint morphTargetCountLocation;
+    GLint morphTargetsLocation;
+    GLint morphWeightsLocation;
+    GLint instanceMatrixLocation; // Attribute, instancing variant only
+    GLuint drawRecordsBlockIndex; // Storage blocks, indirect variant only
+    GLuint materialsBlockIndex;
+    // Bindless textures and texture arrays only
+    GLint materialIndexLocation;
+    // Uniform blocks, the uniforms of the transforms and of the directional
+    // light are used without them
+    GLuint drawTransformsBlockIndex;
+    GLint drawTransformIndexLocation;
+    GLuint lightsBlockIndex;
+  };
+
+  // Locations of the vertex attributes in forward.vs.glsl
+  static constexpr GLuint VERTEX_ATTRIB_POSITION_IDX = 0;
+  static constexpr GLuint VERTEX_ATTRIB_NORMAL_IDX = 1;
+  static constexpr GLuint VERTEX_ATTRIB_TEXCOORD0_IDX = 2;
+  static constexpr GLuint VERTEX_ATTRIB_JOINTS0_IDX = 3;
+  static constexpr GLuint VERTEX_ATTRIB_WEIGHTS0_IDX = 4;
+
+  // Binding points of the storage blocks of the indirect variant, the
+  // material table is also used with bindless textures and texture arrays
+  static constexpr GLuint DRAW_RECORDS_BINDING = 0;
+  static constexpr GLuint MATERIALS_BINDING = 1;
+  // Binding points of the uniform blocks
+  static constexpr GLuint LIGHTS_BINDING = 0;
+  static constexpr GLuint DRAW_TRANSFORMS_BINDING = 1;
+
 
 
   GLsizei m_nWindowWidth = 1280;
@@ -43,17 +199,32 @@ private:
   std::string m_vertexShader = "forward.vs.glsl";
   std::string m_fragmentShader = "advanced_light.fs.glsl";
 
+  // Shaders sample the textures through the handles of the material table
+  // when ARB_bindless_texture is supported, from texture arrays at the
+  // layers of the material table otherwise
+  bool m_bindlessTextures = false;
+  bool m_textureArrays = false;
+
   bool m_hasUserCamera = false;
   Camera m_userCamera;
 
   fs::path m_OutputPath;
+  fs::path m_bvhCachePath;
+  float m_targetFrameRate; // Frames per second, 0 for no limit
+  uint32_t m_sampleCount; // Of supersampling, 1 to disable it
+  // Frames drawn without window to check that they don't allocate, 0 to
+  // run the viewer
+  uint32_t m_allocationCheckFrameCount;
+
+  // Shared by the loader, the culling and the animation
+  JobSystem m_jobSystem;
 
   // Order is important here, see comment below
   const std::string m_ImGuiIniFilename;
-  // Last to be initialized, first to be destroyed:
+  // Last to be initialized, first to be destroyed. The window is shown
+  // only if m_OutputPath is empty and allocations are not checked.
   GLFWHandle m_GLFWHandle{int(m_nWindowWidth), int(m_nWindowHeight),
-      "glTF Viewer",
-      m_OutputPath.empty()}; // show the window only if m_OutputPath is empty
+      "glTF Viewer", m_OutputPath.empty() && m_allocationCheckFrameCount == 0};
   /*
     ! THE ORDER OF DECLARATION OF MEMBER VARIABLES IS IMPORTANT !
     - m_ImGuiIniFilename.c_str() will be used by ImGUI in ImGui::Shutdown, which
@@ -66,6 +237,9 @@ private:
     before most of OpenGL function calls.
   */
 
+  // Compile the shaders of the viewer with the given preprocessor definitions
+  ShadingProgram compileShadingProgram(
+      const std::vector<std::string> &defines = {}) const;
   bool loadGltfFile(tinygltf::Model &model);
   std::vector<GLuint> createBufferObjects(const tinygltf::Model &model);
 
@@ -1,12 +1,33 @@
 #include "ViewerApplication.hpp"
 #include "utils/GLFWHandle.hpp"
+#include "utils/allocation_counter.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/frame_builder.hpp"
+#include "utils/gltf.hpp"
+#include "utils/images.hpp"
+#include "utils/job_system.hpp"
+#include "utils/occlusion.hpp"
+#include "utils/scene_query.hpp"
 
 #include <args.hxx>
+#include <glm/gtc/matrix_transform.hpp>
+#include <stb_image_write.h>
+
+#include <chrono>
+#include <cmath>
+#include <future>
 
 std::vector<std::string> split(
     const std::string &str, const std::string &delim);
 
+std::vector<float> parseFloats(
+    const std::string &str, size_t count, const std::string &argName);
+
+void benchmarkJobSystem(uint32_t threadCount);
+
+int checkFrameAllocations(
+    const tinygltf::Model &model, JobSystem &jobSystem, uint32_t frameCount);
+
 int main(int argc, char **argv)
 {
   auto returnCode = 0;
@@ -43,29 +64,303 @@ int main(int argc, char **argv)
             "Output path to render the image. If specified no window is shown. "
             "Only png is supported.",
             {"o", "output"}};
+        args::ValueFlag<std::string> bvhCache{parser, "bvh-cache",
+            "File caching the triangle BVHs used for picking",
+            {"bvh-cache"}};
+        args::ValueFlag<uint32_t> threads{parser, "threads",
+            "Threads of the job system, one per hardware thread by default",
+            {"threads"}};
+        args::ValueFlag<float> fps{parser, "fps",
+            "Target frame rate, no limit by default", {"fps"}};
+        args::ValueFlag<uint32_t> samples{parser, "samples",
+            "Supersampling samples per pixel of the output image and of the "
+            "still views, 1 disables it",
+            {"samples"}, 16};
+        args::ValueFlag<uint32_t> checkAllocations{parser, "frames",
+            "Draw this number of frames without window and fail if they "
+            "allocate on the heap (builds with GLMLV_COUNT_ALLOCATIONS)",
+            {"check-allocations"}};
         parser.Parse();
 
         std::vector<float> lookatParams;
         if (lookat) {
-          const std::string &lookatArgs = args::get(lookat);
-          const auto tokens = split(lookatArgs, ",");
-          if (tokens.size() != 9) {
-            throw args::ValidationError("Unable to parse --lookat argument "
-                                        "(expected 9 numbers, got " +
-                                        std::to_string(tokens.size()) + ")");
-          }
-          for (const auto &arg : tokens) {
-            lookatParams.emplace_back(std::stof(arg));
-          }
+          lookatParams = parseFloats(args::get(lookat), 9, "lookat");
         }
 
         uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
         uint32_t height = imageHeight ? args::get(imageHeight) : 720;
 
-        ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file),
-            lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
-        returnCode = app.run();
+        try {
+          ViewerApplication app{fs::path{argv[0]}, width, height,
+              args::get(file), lookatParams, args::get(vertexShader),
+              args::get(fragmentShader), args::get(output),
+              args::get(bvhCache), args::get(threads), args::get(fps),
+              args::get(samples), args::get(checkAllocations)};
+          returnCode = app.run();
+        } catch (const std::runtime_error &e) {
+          std::cerr << e.what() << std::endl; // E.g. no OpenGL context
+          returnCode = -1;
+        }
+      }};
+  args::Command query{commands, "query",
+      "Query the triangles of a glTF scene, without OpenGL",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{
+            parser, "file", "Path to file", args::Options::Required};
+        args::ValueFlagList<std::string> rays{parser, "ray",
+            "Closest hit of the ray with format "
+            "origin_x,origin_y,origin_z,direction_x,direction_y,direction_z",
+            {"ray"}};
+        args::ValueFlagList<std::string> boxes{parser, "box",
+            "Triangles intersecting the box with format "
+            "min_x,min_y,min_z,max_x,max_y,max_z",
+            {"box"}};
+        args::ValueFlagList<std::string> points{parser, "nearest",
+            "Closest point to x,y,z", {"nearest"}};
+        args::ValueFlag<std::string> bvhCache{parser, "bvh-cache",
+            "File caching the triangle BVHs", {"bvh-cache"}};
+        args::ValueFlag<uint32_t> threads{parser, "threads",
+            "Threads of the job system, one per hardware thread by default",
+            {"threads"}};
+        parser.Parse();
+
+        JobSystem jobSystem(args::get(threads));
+        tinygltf::Model model;
+        if (!loadGltfFile(args::get(file), model, &jobSystem)) {
+          returnCode = -1;
+          return;
+        }
+
+        SceneQuery sceneQuery;
+        const auto buildStart = std::chrono::steady_clock::now();
+        sceneQuery.build(model, args::get(bvhCache), &jobSystem);
+        const auto buildTime = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - buildStart);
+        std::cout << "BVH: " << sceneQuery.instanceCount() << " instances, "
+                  << sceneQuery.triangleCount() << " triangles, "
+                  << sceneQuery.cachedPrimitiveCount()
+                  << " primitives from cache, " << buildTime.count() << " ms"
+                  << std::endl;
+
+        const auto printHit = [&](const SceneQueryHit &hit) {
+          std::cout << "  node " << hit.nodeIdx << " mesh " << hit.meshIdx
+                    << " primitive " << hit.primitiveIdx << " triangle "
+                    << hit.triangleIdx << " position " << hit.position.x
+                    << "," << hit.position.y << "," << hit.position.z
+                    << " distance " << hit.distance << std::endl;
+        };
+        for (const auto &arg : args::get(rays)) {
+          const auto values = parseFloats(arg, 6, "ray");
+          const auto ray =
+              Ray{glm::vec3(values[0], values[1], values[2]),
+                  glm::vec3(values[3], values[4], values[5])};
+          SceneQueryHit hit;
+          std::cout << "ray " << arg << ":"
+                    << (sceneQuery.intersect(ray, hit) ? "" : " no hit")
+                    << std::endl;
+          if (hit.nodeIdx >= 0) {
+            printHit(hit);
+          }
+        }
+        for (const auto &arg : args::get(boxes)) {
+          const auto values = parseFloats(arg, 6, "box");
+          std::vector<SceneQueryHit> hits;
+          sceneQuery.queryBox(AABB(glm::vec3(values[0], values[1], values[2]),
+                                  glm::vec3(values[3], values[4], values[5])),
+              hits);
+          std::cout << "box " << arg << ": " << hits.size() << " triangles"
+                    << std::endl;
+          for (const auto &hit : hits) {
+            printHit(hit);
+          }
+        }
+        for (const auto &arg : args::get(points)) {
+          const auto values = parseFloats(arg, 3, "nearest");
+          SceneQueryHit hit;
+          std::cout << "nearest " << arg << ":"
+                    << (sceneQuery.nearestPoint(
+                            glm::vec3(values[0], values[1], values[2]), hit)
+                               ? ""
+                               : " no triangle")
+                    << std::endl;
+          if (hit.nodeIdx >= 0) {
+            printHit(hit);
+          }
+        }
+      }};
+
+  args::Command occlusion{commands, "occlusion",
+      "Rasterize the occluders of a glTF scene on the CPU and test boxes "
+      "against them, without OpenGL",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{
+            parser, "file", "Path to file", args::Options::Required};
+        args::ValueFlag<std::string> lookat{parser, "lookat",
+            "Look at parameters for the Camera with format "
+            "eye_x,eye_y,eye_z,center_x,center_y,center_z,up_x,up_y,up_z",
+            {"lookat"}};
+        args::ValueFlag<int32_t> imageWidth{
+            parser, "width", "Width of the viewport", {"w", "width"}};
+        args::ValueFlag<int32_t> imageHeight{
+            parser, "height", "Height of the viewport", {"h", "height"}};
+        args::ValueFlagList<std::string> boxes{parser, "box",
+            "Box to test, with format min_x,min_y,min_z,max_x,max_y,max_z",
+            {"box"}};
+        args::ValueFlag<std::string> depthImage{parser, "depth",
+            "Write the depth buffer of the occluders to this png file",
+            {"depth"}};
+        args::ValueFlag<uint32_t> threads{parser, "threads",
+            "Threads of the job system, one per hardware thread by default",
+            {"threads"}};
+        parser.Parse();
+
+        JobSystem jobSystem(args::get(threads));
+        tinygltf::Model model;
+        if (!loadGltfFile(args::get(file), model, &jobSystem)) {
+          returnCode = -1;
+          return;
+        }
+
+        // Same camera and projection as the viewer
+        const auto width = imageWidth ? args::get(imageWidth) : 1280;
+        const auto height = imageHeight ? args::get(imageHeight) : 720;
+        glm::vec3 bboxMin, bboxMax;
+        computeSceneBounds(model, bboxMin, bboxMax);
+        const auto bboxDiag = bboxMax - bboxMin;
+        auto maxDistance = glm::length(bboxDiag);
+        if (maxDistance <= 0.f)
+          maxDistance = 100.f;
+        auto viewMatrix = glm::mat4(1);
+        if (lookat) {
+          const auto values = parseFloats(args::get(lookat), 9, "lookat");
+          viewMatrix = glm::lookAt(glm::vec3(values[0], values[1], values[2]),
+              glm::vec3(values[3], values[4], values[5]),
+              glm::vec3(values[6], values[7], values[8]));
+        } else {
+          const auto upVec = glm::vec3(0, 1, 0);
+          const auto bboxCenter = (bboxMax + bboxMin) * 0.5f;
+          const auto eye =
+              bboxDiag.z > 0 ? bboxCenter + bboxDiag
+                             : bboxCenter + 2.0f * glm::cross(bboxDiag, upVec);
+          viewMatrix = glm::lookAt(eye, bboxCenter, upVec);
+        }
+        const auto projMatrix = glm::perspective(70.f,
+            float(width) / height, 0.001f * maxDistance, 1.5f * maxDistance);
+
+        // Like the viewer, the opaque primitives of at most 2048 triangles
+        // occlude, all of them without triangle budget
+        struct Instance
+        {
+          int nodeIdx;
+          int meshIdx;
+          size_t primitiveIdx;
+          AABB bounds;
+        };
+        std::vector<Instance> instances;
+        std::vector<std::vector<glm::vec3>> positions;
+        std::vector<std::vector<uint32_t>> indices;
+        OcclusionCuller culler(
+            jobSystem, 256, std::max(64, 256 * height / std::max(width, 1)));
+        culler.beginFrame(projMatrix * viewMatrix);
+        visitScene(model, [&](int nodeIdx, const glm::mat4 &modelMatrix) {
+          const auto meshIdx = model.nodes[nodeIdx].mesh;
+          if (meshIdx < 0) {
+            return;
+          }
+          const auto &mesh = model.meshes[meshIdx];
+          for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+            const auto &primitive = mesh.primitives[pIdx];
+            instances.push_back({nodeIdx, meshIdx, pIdx,
+                computePrimitiveBounds(model, primitive)
+                    .transform(modelMatrix)});
+            if (primitive.material >= 0 &&
+                model.materials[primitive.material].alphaMode != "OPAQUE") {
+              continue; // See-through
+            }
+            auto triangles = readPrimitiveTriangles(model, primitive);
+            if (triangles.empty() || triangles.size() / 3 > 2048) {
+              continue;
+            }
+            // Kept alive until rasterize
+            positions.push_back(readPrimitivePositions(model, primitive));
+            indices.push_back(std::move(triangles));
+            culler.addOccluder(modelMatrix, positions.back().data(),
+                positions.back().size(), indices.back().data(),
+                indices.back().size());
+          }
+        });
+        culler.rasterize();
+        std::cout << "Occlusion: " << culler.width() << "x" << culler.height()
+                  << " depth buffer, " << positions.size() << " occluders, "
+                  << culler.rasterizedTriangleCount() << " / "
+                  << culler.occluderTriangleCount()
+                  << " triangles rasterized" << std::endl;
+
+        size_t occludedCount = 0;
+        for (const auto &instance : instances) {
+          const auto visible = culler.isVisible(instance.bounds);
+          occludedCount += visible ? 0 : 1;
+          std::cout << "  node " << instance.nodeIdx << " mesh "
+                    << instance.meshIdx << " primitive "
+                    << instance.primitiveIdx << ": "
+                    << (visible ? "visible" : "occluded") << std::endl;
+        }
+        std::cout << "primitives: " << instances.size() - occludedCount
+                  << " visible, " << occludedCount << " occluded"
+                  << std::endl;
+        for (const auto &arg : args::get(boxes)) {
+          const auto values = parseFloats(arg, 6, "box");
+          const auto box = AABB(glm::vec3(values[0], values[1], values[2]),
+              glm::vec3(values[3], values[4], values[5]));
+          std::cout << "box " << arg << ": "
+                    << (culler.isVisible(box) ? "visible" : "occluded")
+                    << std::endl;
+        }
+
+        if (depthImage) {
+          std::vector<unsigned char> pixels;
+          for (const auto depth : culler.depthBuffer()) {
+            pixels.push_back((unsigned char)(255.f * depth));
+          }
+          flipImageYAxis(culler.width(), culler.height(), 1, pixels.data());
+          stbi_write_png(args::get(depthImage).c_str(), culler.width(),
+              culler.height(), 1, pixels.data(), 0);
+        }
+      }};
+
+  args::Command frameAllocations{commands, "frame-allocations",
+      "Prepare the frames of a glTF scene on the CPU like the viewer and "
+      "fail if they allocate on the heap, without OpenGL (builds with "
+      "GLMLV_COUNT_ALLOCATIONS)",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{
+            parser, "file", "Path to file", args::Options::Required};
+        args::ValueFlag<uint32_t> frames{parser, "frames",
+            "Frames checked once the first orbit of the camera has warmed up",
+            {"frames"}, 100};
+        args::ValueFlag<uint32_t> threads{parser, "threads",
+            "Threads of the job system, one per hardware thread by default",
+            {"threads"}};
+        parser.Parse();
+
+        JobSystem jobSystem(args::get(threads));
+        tinygltf::Model model;
+        if (!loadGltfFile(args::get(file), model, &jobSystem)) {
+          returnCode = -1;
+          return;
+        }
+        returnCode =
+            checkFrameAllocations(model, jobSystem, args::get(frames));
+      }};
+
+  args::Command benchmark{commands, "benchmark-jobs",
+      "Compare the job system with std::async, without OpenGL",
+      [&](args::Subparser &parser) {
+        args::ValueFlag<uint32_t> threads{parser, "threads",
+            "Threads of the job system, one per hardware thread by default",
+            {"threads"}};
+        parser.Parse();
+        benchmarkJobSystem(args::get(threads));
       }};
 
   try {
@@ -107,4 +402,236 @@ std::vector<std::string> split(const std::string &str, const std::string &delim)
     prev = pos + delim.length();
   } while (pos < str.length() && prev < str.length());
   return tokens;
-}
\ No newline at end of file
+}
+
+std::vector<float> parseFloats(
+    const std::string &str, size_t count, const std::string &argName)
+{
+  const auto tokens = split(str, ",");
+  if (tokens.size() != count) {
+    throw args::ValidationError("Unable to parse --" + argName +
+                                " argument (expected " +
+                                std::to_string(count) + " numbers, got " +
+                                std::to_string(tokens.size()) + ")");
+  }
+  std::vector<float> values;
+  for (const auto &token : tokens) {
+    values.emplace_back(std::stof(token));
+  }
+  return values;
+}
+
+void benchmarkJobSystem(uint32_t threadCount)
+{
+  JobSystem jobSystem(threadCount);
+  std::cout << "Job system: " << jobSystem.threadCount() << " threads"
+            << std::endl;
+
+  // Best time of a few runs, in milliseconds
+  const auto measure = [](const std::function<void()> &run) {
+    auto bestTime = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      run();
+      bestTime = std::min(bestTime,
+          std::chrono::duration<double, std::milli>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+    return bestTime;
+  };
+
+  // parallel_for over ranges of grainSize indices, std::async launches a
+  // task per range
+  const size_t count = 1 << 20;
+  std::vector<float> values(count);
+  const auto computeRange = [&](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto value = float(i);
+      for (int j = 0; j < 32; ++j) {
+        value = std::sqrt(value * value + 1.f);
+      }
+      values[i] = value;
+    }
+  };
+  for (const size_t grainSize : {size_t(256), size_t(4096), size_t(65536)}) {
+    const auto serialTime = measure([&]() { computeRange(0, count); });
+    const auto asyncTime = measure([&]() {
+      std::vector<std::future<void>> futures;
+      for (size_t begin = 0; begin < count; begin += grainSize) {
+        futures.push_back(std::async(std::launch::async, computeRange, begin,
+            std::min(begin + grainSize, count)));
+      }
+      for (auto &future : futures) {
+        future.get();
+      }
+    });
+    const auto jobTime = measure(
+        [&]() { jobSystem.parallelFor(count, grainSize, computeRange); });
+    std::cout << "parallel_for of " << count << " items by " << grainSize
+              << ": serial " << serialTime << " ms, std::async " << asyncTime
+              << " ms, job system " << jobTime << " ms" << std::endl;
+  }
+
+  // A chain of small tasks, each one a continuation of the previous one
+  const size_t chainLength = 1000;
+  size_t chainValue = 0;
+  const auto asyncTime = measure([&]() {
+    std::shared_future<void> previous;
+    for (size_t i = 0; i < chainLength; ++i) {
+      previous = std::async(std::launch::async, [&, previous]() {
+        if (previous.valid()) {
+          previous.wait();
+        }
+        ++chainValue;
+      }).share();
+    }
+    previous.wait();
+  });
+  const auto jobTime = measure([&]() {
+    JobSystem::JobHandle previous = nullptr;
+    for (size_t i = 0; i < chainLength; ++i) {
+      const auto job = jobSystem.create([&]() { ++chainValue; });
+      if (previous) {
+        jobSystem.addDependency(job, previous);
+        jobSystem.release(previous);
+      }
+      jobSystem.submit(job);
+      previous = job;
+    }
+    jobSystem.wait(previous);
+  });
+  std::cout << "Chain of " << chainLength << " continuations: std::async "
+            << asyncTime << " ms, job system " << jobTime << " ms"
+            << std::endl;
+}
+
+int checkFrameAllocations(
+    const tinygltf::Model &model, JobSystem &jobSystem, uint32_t frameCount)
+{
+  if (!allocationCountingEnabled()) {
+    std::cerr << "Allocation counting is disabled, configure with "
+                 "GLMLV_COUNT_ALLOCATIONS"
+              << std::endl;
+    return -1;
+  }
+
+  // The primitive instances of the scene, every other opaque one drawn by
+  // the multi-draw indirect path and the others by batches, so that the
+  // frames use both. Like the viewer, the opaque primitives of at most 2048
+  // triangles occlude.
+  std::vector<glm::mat4> nodeMatrices(model.nodes.size(), glm::mat4(1));
+  std::vector<AABB> instanceBounds;
+  std::vector<FrameBuilder::Instance> instances;
+  std::vector<FrameBuilder::OccluderGeometry> occluders;
+  IndirectDraws indirectDraws;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &modelMatrix) {
+    nodeMatrices[nodeIdx] = modelMatrix;
+    const auto meshIdx = model.nodes[nodeIdx].mesh;
+    if (meshIdx < 0) {
+      return;
+    }
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &primitive = mesh.primitives[pIdx];
+      const auto material = primitive.material >= 0
+                                ? &model.materials[primitive.material]
+                                : nullptr;
+      const auto opaque = !material || material->alphaMode == "OPAQUE";
+      const auto blended = material && material->alphaMode == "BLEND";
+      const auto doubleSided = material && material->doubleSided;
+      const auto instanceIdx = uint32_t(instances.size());
+      instances.push_back({nodeIdx, meshIdx, int(pIdx), 0, false,
+          uint32_t(std::max(primitive.material, 0)), blended, doubleSided, 0,
+          nullptr, 0, 0});
+      instanceBounds.push_back(
+          computePrimitiveBounds(model, primitive).transform(modelMatrix));
+      occluders.emplace_back();
+      auto triangles =
+          opaque ? readPrimitiveTriangles(model, primitive)
+                 : std::vector<uint32_t>{};
+      if (!triangles.empty() && triangles.size() / 3 <= 2048) {
+        occluders.back().positions = readPrimitivePositions(model, primitive);
+        occluders.back().indices = std::move(triangles);
+      }
+      if (instanceIdx % 2 == 0 && !blended) {
+        indirectDraws.addInstance(instanceIdx, meshIdx, int(pIdx),
+            {true, 0, 0, 0}, {doubleSided, 0, 0, 0}, 1);
+      }
+    }
+  });
+  for (size_t i = 0; i < instances.size(); ++i) {
+    if (!occluders[i].indices.empty()) {
+      instances[i].occluder = &occluders[i];
+    }
+  }
+
+  // Frustum and occlusion culling on the CPU, without GPU instances
+  BoundingVolumeHierarchy sceneBVH;
+  sceneBVH.build(instanceBounds);
+  const BoundingVolumeHierarchy cpuCullingBVH;
+  const std::vector<uint32_t> cpuCulledInstances;
+  const std::vector<glm::mat4> gpuInstanceMatrices;
+  OcclusionCuller occlusionCuller(jobSystem, 256, 144);
+  const uint8_t instancingVariant = 4; // As in the viewer
+  FrameBuilder frameBuilder({instanceBounds, gpuInstanceMatrices, sceneBVH,
+                                cpuCullingBVH, cpuCulledInstances,
+                                indirectDraws, occlusionCuller},
+      instancingVariant, 0);
+  for (const auto &instance : instances) {
+    frameBuilder.addInstance(instance);
+  }
+
+  // Same projection as the viewer, all the CPU work of a frame enabled
+  glm::vec3 bboxMin, bboxMax;
+  computeSceneBounds(model, bboxMin, bboxMax);
+  const auto bboxCenter = (bboxMax + bboxMin) * 0.5f;
+  auto maxDistance = glm::length(bboxMax - bboxMin);
+  if (maxDistance <= 0.f)
+    maxDistance = 100.f;
+  FrameBuilder::Settings settings;
+  settings.zFar = 1.5f * maxDistance;
+  settings.projMatrix = glm::perspective(
+      70.f, 1280.f / 720.f, 0.001f * maxDistance, settings.zFar);
+  settings.viewportHeight = 720.f;
+  settings.minPixelSize = 1.f;
+  settings.frustumCulling = true;
+  settings.gpuCulling = false;
+  settings.gpuOcclusionCulling = false;
+  settings.occlusionCulling = true;
+  settings.occluderTriangleBudget = 20000;
+  settings.multiDrawIndirect = true;
+  settings.automaticInstancing = true;
+  settings.sortRenderQueue = true;
+
+  // The camera orbits around the scene. During the first orbit the vectors
+  // reach their maximum size, the next frames see the same views and may
+  // not allocate.
+  const uint32_t orbitFrameCount = 64;
+  DrawList drawList;
+  size_t checkStartCount = 0;
+  size_t batchCount = 0;
+  size_t commandCount = 0;
+  for (uint32_t frameIdx = 0; frameIdx < orbitFrameCount + frameCount;
+       ++frameIdx) {
+    if (frameIdx == orbitFrameCount) {
+      checkStartCount = allocationCount();
+    }
+    const auto angle = 2.f * glm::pi<float>() *
+                       float(frameIdx % orbitFrameCount) / orbitFrameCount;
+    const auto eye = bboxCenter + 0.75f * maxDistance *
+                                      glm::vec3(std::cos(angle), 0.25f,
+                                          std::sin(angle));
+    drawList.nodeMatrices = nodeMatrices;
+    frameBuilder.build(
+        Camera(eye, bboxCenter, glm::vec3(0, 1, 0)), settings, drawList);
+    batchCount += drawList.drawBatches.size();
+    commandCount += drawList.indirectDrawCalls.commands.size();
+  }
+  const auto checkedAllocationCount = allocationCount() - checkStartCount;
+  std::cout << "Frames: " << batchCount << " batches, " << commandCount
+            << " multi-draw indirect commands" << std::endl;
+  std::cout << "Heap allocations: " << checkedAllocationCount << " in "
+            << frameCount << " frames" << std::endl;
+  return checkedAllocationCount == 0 ? 0 : 1;
+}
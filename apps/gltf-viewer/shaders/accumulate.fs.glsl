@@ -0,0 +1,14 @@
+#version 330
+
+// Sample of progressive supersampling, added to the accumulation buffer by
+// additive blending. Clamped like in the window framebuffer.
+
+uniform sampler2D uSample;
+
+out vec4 fColor;
+
+void main()
+{
+    vec3 color = texelFetch(uSample, ivec2(gl_FragCoord.xy), 0).rgb;
+    fColor = vec4(clamp(color, 0, 1), 1);
+}
@@ -1,31 +1,132 @@
 #version 330
+// Materials are read from the table per draw with bindless textures and
+// texture arrays
+#if defined(BINDLESS) || defined(TEXTURE_ARRAYS)
+#define MATERIAL_TABLE
+#endif
+#if defined(INDIRECT) || defined(MATERIAL_TABLE)
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in vec3 vViewSpacePosition;
 in vec3 vViewSpaceNormal;
 in vec2 vTexCoords;
 
-uniform vec3 uLightDirection;
-uniform vec3 uLightIntensity;
+#if defined(INDIRECT) || defined(MATERIAL_TABLE)
+// Materials of the scene, indexed by the draw record or by the draw. The
+// layers of their textures are used with texture arrays only (-1 without
+// texture), the handles of their resident textures with bindless textures.
+struct Material
+{
+  vec4 baseColorFactor;
+  vec4 emissiveFactor; // w unused
+  float metallicFactor;
+  float roughnessFactor;
+  float alphaCutoff;
+  int baseColorLayer;
+  int metallicRoughnessLayer;
+  int emissiveLayer;
+  uint flags; // Render state, used by the application
+  uvec2 baseColorTexture;
+  uvec2 metallicRoughnessTexture;
+  uvec2 emissiveTexture;
+};
+
+layout(std430) readonly buffer Materials
+{
+  Material materials[];
+};
+
+#ifdef INDIRECT
+flat in uint vMaterialIndex;
+#else
+uniform uint uMaterialIndex;
+#define vMaterialIndex uMaterialIndex
+#endif
+
+#define uEmissiveFactor materials[vMaterialIndex].emissiveFactor.rgb
+#define uBaseColorFactor materials[vMaterialIndex].baseColorFactor
+#define uMetallicFactor materials[vMaterialIndex].metallicFactor
+#define uRoughnessFactor materials[vMaterialIndex].roughnessFactor
+#define uAlphaCutoff materials[vMaterialIndex].alphaCutoff
+#else
 uniform vec3 uEmissiveFactor;
 
 uniform vec4 uBaseColorFactor;
 
 uniform float uMetallicFactor;
 uniform float uRoughnessFactor;
+// Fragments with a lower alpha are discarded, 0 unless alpha mode is MASK
+uniform float uAlphaCutoff;
+#endif
 uniform float uNormalScale;
 
 
+#if defined(BINDLESS)
+#define uBaseColorTexture \
+  sampler2D(materials[vMaterialIndex].baseColorTexture)
+#define uMetallicRoughnessTexture \
+  sampler2D(materials[vMaterialIndex].metallicRoughnessTexture)
+#define uEmissiveTexture sampler2D(materials[vMaterialIndex].emissiveTexture)
+#elif defined(TEXTURE_ARRAYS)
+uniform sampler2DArray uBaseColorTexture;
+uniform sampler2DArray uMetallicRoughnessTexture;
+uniform sampler2DArray uEmissiveTexture;
+#else
 uniform sampler2D uBaseColorTexture;
 uniform sampler2D uNormalTexture;
 uniform sampler2D uMetallicRoughnessTexture;
 uniform sampler2D uEmissiveTexture;
+#endif
+
+// Texels of the textures of the material, missing textures sample as white
+// for the base color and as opaque black otherwise
+#ifdef TEXTURE_ARRAYS
+vec4 textureLayer(sampler2DArray textures, int layer, vec4 missingTexel)
+{
+  return layer >= 0 ? texture(textures, vec3(vTexCoords, layer))
+                    : missingTexel;
+}
 
+vec4 baseColorTexel()
+{
+  return textureLayer(uBaseColorTexture,
+      materials[vMaterialIndex].baseColorLayer, vec4(1));
+}
+
+vec4 metallicRoughnessTexel()
+{
+  return textureLayer(uMetallicRoughnessTexture,
+      materials[vMaterialIndex].metallicRoughnessLayer, vec4(0, 0, 0, 1));
+}
+
+vec4 emissiveTexel()
+{
+  return textureLayer(uEmissiveTexture, materials[vMaterialIndex].emissiveLayer,
+      vec4(0, 0, 0, 1));
+}
+#else
+vec4 baseColorTexel() { return texture(uBaseColorTexture, vTexCoords); }
 
+vec4 metallicRoughnessTexel()
+{
+  return texture(uMetallicRoughnessTexture, vTexCoords);
+}
+
+vec4 emissiveTexel() { return texture(uEmissiveTexture, vTexCoords); }
+#endif
+
+
+// Members ordered to pack the std140 layout of LightsBlock in
+// ViewerApplication.hpp
 struct PointLight
 {
   vec3 position;
-  vec3 intensity;
   float attenuationDistance;
+  vec3 intensity;
   float constantAttenuator;
   float linearAttenuator;
   float quadraticAttenuator;
@@ -34,24 +135,28 @@ struct PointLight
 struct SpotLight
 {
   vec3 LightPosition;
-  vec3 LightIntensity;
-  vec3 LightDirection;
   float CutOff;
+  vec3 LightIntensity;
   float OuterCutOff;
+  vec3 LightDirection;
   float DistAttenuation;
   float constantAttenuator;
   float linearAttenuator;
   float quadraticAttenuator;
 };
 
-//lights
+//lights, in view space, updated once per frame
 #define NB_POINT_LIGHTS 4
-uniform PointLight pointLights[NB_POINT_LIGHTS];
-
-uniform SpotLight spotlight;
+layout(std140) uniform Lights
+{
+  vec3 uLightDirection;
+  vec3 uLightIntensity;
+  PointLight pointLights[NB_POINT_LIGHTS];
+  SpotLight spotlight;
+};
 
 
-out vec3 fColor;
+out vec4 fColor;
 
 // Constants
 const float GAMMA = 2.2;
@@ -82,9 +187,8 @@ vec3 directionalLightRender()
 
 
   vec4 baseColor =
-      SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords)) * uBaseColorFactor;
-  vec4 metallicRougnessFromTexture =
-      texture(uMetallicRoughnessTexture, vTexCoords);
+      SRGBtoLINEAR(baseColorTexel()) * uBaseColorFactor;
+  vec4 metallicRougnessFromTexture = metallicRoughnessTexel();
 
   float NdotL = clamp(dot(N, L), 0, 1);
   float NdotV = clamp(dot(N, V), 0, 1);
@@ -147,9 +251,8 @@ vec3 pointLightRender(PointLight pointL)
 
   
   vec4 baseColor =
-      SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords)) * uBaseColorFactor;
-  vec4 metallicRougnessFromTexture =
-      texture(uMetallicRoughnessTexture, vTexCoords);
+      SRGBtoLINEAR(baseColorTexel()) * uBaseColorFactor;
+  vec4 metallicRougnessFromTexture = metallicRoughnessTexel();
 
 
   float NdotL = clamp(dot(N, L), 0, 1);
@@ -230,9 +333,8 @@ vec3 spotlightRender(SpotLight spotL)
   }
 
   vec4 baseColor =
-      SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords)) * uBaseColorFactor;
-  vec4 metallicRougnessFromTexture =
-      texture(uMetallicRoughnessTexture, vTexCoords);
+      SRGBtoLINEAR(baseColorTexel()) * uBaseColorFactor;
+  vec4 metallicRougnessFromTexture = metallicRoughnessTexel();
 
   float NdotL = clamp(dot(N, L), 0, 1);
   float NdotV = clamp(dot(N, V), 0, 1);
@@ -294,12 +396,17 @@ vec3 spotlightRender(SpotLight spotL)
 }
 
 vec3 emissiveTextureRender() {
-  vec4 emissiveTexture = SRGBtoLINEAR(texture(uEmissiveTexture, vTexCoords));
+  vec4 emissiveTexture = SRGBtoLINEAR(emissiveTexel());
   return uEmissiveFactor * emissiveTexture.rgb;
 }
 
 void main()
 {
+  float alpha = baseColorTexel().a * uBaseColorFactor.a;
+  if (alpha < uAlphaCutoff) {
+    discard;
+  }
+
   vec3 color = directionalLightRender();
   for (int i = 0; i < NB_POINT_LIGHTS; i++) {
     color += pointLightRender(pointLights[i]);
@@ -308,5 +415,5 @@ void main()
 
   color += emissiveTextureRender();
 
-  fColor = LINEARtoSRGB(color);
+  fColor = vec4(LINEARtoSRGB(color), alpha);
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 430
+
+// Append the commands with visible instances to the commands of their group,
+// counted in the parameter buffer of glMultiDrawElementsIndirectCountARB
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 3) readonly buffer DrawCommands
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 5) readonly buffer CommandGroups
+{
+    uvec2 commandGroups[]; // Group of each command and its first command
+};
+
+layout(std430, binding = 6) buffer DrawCounts
+{
+    uint drawCounts[]; // By group
+};
+
+layout(std430, binding = 7) writeonly buffer CompactedCommands
+{
+    DrawCommand compactedCommands[];
+};
+
+uniform uint uCommandCount;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uCommandCount || commands[i].instanceCount == 0u) {
+        return;
+    }
+    uvec2 group = commandGroups[i];
+    uint slot = atomicAdd(drawCounts[group.x], 1u);
+    compactedCommands[group.y + slot] = commands[i];
+}
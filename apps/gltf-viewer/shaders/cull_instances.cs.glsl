@@ -0,0 +1,169 @@
+#version 430
+
+// Frustum and small feature culling of the instances of the multi-draw
+// indirect path: each visible instance appends its draw record to the
+// command of its primitive, mirrored instances to the twin command drawn
+// with reversed winding.
+//
+// With occlusion culling, the first phase tests the instances against the
+// depth pyramid of the previous frame and flags the occluded ones, the
+// second phase retests the flagged instances against the pyramid of the
+// instances drawn by the first phase.
+
+layout(local_size_x = 64) in;
+
+struct Instance
+{
+    mat4 modelMatrix;
+    vec4 boundsMin; // Local bounds of the primitive
+    vec4 boundsMax;
+    uint command;
+    uint materialIndex;
+    uint doubleSided; // Drawn without face culling, never mirrored
+    uint occluded; // Written by the first phase, read by the second one
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+struct DrawRecord
+{
+    mat4 modelMatrix;
+    uint materialIndex;
+};
+
+layout(std430, binding = 2) buffer Instances
+{
+    Instance instances[];
+};
+
+layout(std430, binding = 3) buffer DrawCommands
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 4) writeonly buffer DrawRecords
+{
+    DrawRecord drawRecords[];
+};
+
+uniform uint uInstanceCount;
+uniform uint uCommandCount; // Twin of command i is command uCommandCount + i
+uniform bool uFrustumCulling;
+uniform vec4 uFrustumPlanes[6]; // World space, normals pointing inside
+uniform vec3 uEye;
+uniform float uPixelScale;
+uniform float uMinPixelSize; // 0 disables small feature culling
+
+const uint NO_OCCLUSION = 0u;
+const uint FIRST_PHASE = 1u;
+const uint SECOND_PHASE = 2u;
+uniform uint uPhase;
+uniform bool uOcclusionTest; // False until a depth pyramid is built
+uniform mat4 uOcclusionViewProj; // Of the depth of the pyramid
+uniform sampler2D uDepthPyramid;
+
+// Instances drawn by each phase, and occluded after the second one
+layout(binding = 0, offset = 0) uniform atomic_uint uFirstPhaseCount;
+layout(binding = 0, offset = 4) uniform atomic_uint uSecondPhaseCount;
+layout(binding = 0, offset = 8) uniform atomic_uint uOccludedCount;
+
+bool isVisible(vec3 boxMin, vec3 boxMax)
+{
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = uFrustumPlanes[i];
+        // Corner of the box the farthest along the plane normal
+        vec3 p = mix(boxMin, boxMax, greaterThanEqual(plane.xyz, vec3(0)));
+        if (dot(plane.xyz, p) + plane.w < 0) {
+            return false;
+        }
+    }
+    // Bounding sphere diameter projected on less than uMinPixelSize
+    vec3 d = 0.5 * (boxMin + boxMax) - uEye;
+    vec3 s = boxMax - boxMin;
+    return dot(s, s) * uPixelScale * uPixelScale >=
+           dot(d, d) * uMinPixelSize * uMinPixelSize;
+}
+
+bool isOccluded(vec3 boxMin, vec3 boxMax)
+{
+    vec3 ndcMin = vec3(1);
+    vec3 ndcMax = vec3(-1);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = mix(boxMin, boxMax, bvec3(i & 1, i & 2, i & 4));
+        vec4 clip = uOcclusionViewProj * vec4(corner, 1);
+        if (clip.w <= 0) {
+            return false; // Crosses the near plane
+        }
+        ndcMin = min(ndcMin, clip.xyz / clip.w);
+        ndcMax = max(ndcMax, clip.xyz / clip.w);
+    }
+    // Pixels of the screen rectangle, then texels of the level where it
+    // covers at most 2x2 of them
+    ivec2 size = textureSize(uDepthPyramid, 0);
+    ivec2 pixelMin =
+        min(ivec2(clamp(ndcMin.xy * 0.5 + 0.5, 0, 1) * size), size - 1);
+    ivec2 pixelMax =
+        min(ivec2(clamp(ndcMax.xy * 0.5 + 0.5, 0, 1) * size), size - 1);
+    ivec2 extent = pixelMax - pixelMin + 1;
+    int level = min(int(ceil(log2(float(max(extent.x, extent.y))))),
+        textureQueryLevels(uDepthPyramid) - 1);
+    ivec2 levelMax = textureSize(uDepthPyramid, level) - 1;
+    ivec2 texelMin = min(pixelMin >> level, levelMax);
+    ivec2 texelMax = min(pixelMax >> level, levelMax);
+    float depth = max(
+        max(texelFetch(uDepthPyramid, texelMin, level).r,
+            texelFetch(uDepthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+        max(texelFetch(uDepthPyramid, ivec2(texelMin.x, texelMax.y), level).r,
+            texelFetch(uDepthPyramid, texelMax, level).r));
+    return ndcMin.z * 0.5 + 0.5 > depth;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uInstanceCount) {
+        return;
+    }
+    Instance instance = instances[i];
+    if (uPhase == SECOND_PHASE && instance.occluded == 0u) {
+        return; // Drawn by the first phase, or outside of the frustum
+    }
+    mat3 m = mat3(instance.modelMatrix);
+    // World space bounds (Arvo's method)
+    vec3 center = vec3(instance.modelMatrix *
+        vec4(0.5 * (instance.boundsMin.xyz + instance.boundsMax.xyz), 1));
+    vec3 e = 0.5 * (instance.boundsMax.xyz - instance.boundsMin.xyz);
+    vec3 extent = abs(m[0]) * e.x + abs(m[1]) * e.y + abs(m[2]) * e.z;
+    vec3 boxMin = center - extent;
+    vec3 boxMax = center + extent;
+    bool visible = !uFrustumCulling || isVisible(boxMin, boxMax);
+    bool occluded = visible && uOcclusionTest && isOccluded(boxMin, boxMax);
+    if (uPhase == FIRST_PHASE) {
+        instances[i].occluded = occluded ? 1u : 0u;
+    }
+    if (!visible || occluded) {
+        if (occluded && uPhase == SECOND_PHASE) {
+            atomicCounterIncrement(uOccludedCount);
+        }
+        return;
+    }
+    if (uPhase == SECOND_PHASE) {
+        atomicCounterIncrement(uSecondPhaseCount);
+    } else {
+        atomicCounterIncrement(uFirstPhaseCount);
+    }
+    uint command = instance.command;
+    if (instance.doubleSided == 0u && determinant(m) < 0) {
+        command += uCommandCount;
+    }
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    drawRecords[commands[command].baseInstance + slot] =
+        DrawRecord(instance.modelMatrix, instance.materialIndex);
+}
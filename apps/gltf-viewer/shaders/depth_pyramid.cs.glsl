@@ -0,0 +1,37 @@
+#version 430
+
+// One level of the hierarchical depth buffer used by occlusion culling: each
+// texel is the farthest depth of the 2x2 texels it covers in the source
+// level, the last texel of an odd sized row or column also covers the third
+// one. Level 0 is a copy of the depth buffer.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uSource; // Depth texture or the pyramid
+uniform int uSourceLevel;
+layout(r32f, binding = 0) writeonly uniform image2D uDestination;
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(p, size))) {
+        return;
+    }
+    ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+    if (sourceSize == size) {
+        imageStore(uDestination, p, texelFetch(uSource, p, uSourceLevel));
+        return;
+    }
+    ivec2 first = 2 * p;
+    ivec2 last = min(first + 1 + ivec2(equal(p, size - 1)) * (sourceSize & 1),
+        sourceSize - 1);
+    float depth = 0;
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            depth =
+                max(depth, texelFetch(uSource, ivec2(x, y), uSourceLevel).r);
+        }
+    }
+    imageStore(uDestination, p, vec4(depth));
+}
@@ -1,21 +1,137 @@
 #version 330
+#ifdef INDIRECT
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
+#ifdef SKINNING
+layout(location = 3) in uvec4 aJoints;
+layout(location = 4) in vec4 aWeights;
+#endif
+#ifdef INSTANCING
+// Transform of the instance, applied before uModelViewMatrix
+layout(location = 5) in mat4 aInstanceMatrix;
+#endif
+#ifdef INDIRECT
+// Index of the draw record of the instance: an identity array read from the
+// base instance of the draw, as gl_DrawID requires GL 4.6
+layout(location = 9) in uint aDrawRecord;
+#endif
 
 out vec3 vViewSpacePosition;
 out vec3 vViewSpaceNormal;
 out vec2 vTexCoords;
+#ifdef INDIRECT
+flat out uint vMaterialIndex;
+#endif
 
-uniform mat4 uModelViewProjMatrix;
-uniform mat4 uModelViewMatrix;
-uniform mat4 uNormalMatrix;
+// Transforms of the draws of a frame, bound by ranges of MAX_DRAW_TRANSFORMS
+// from the frame ring buffer and indexed by the draw
+struct Transforms
+{
+    mat4 modelViewProjMatrix;
+    mat4 modelViewMatrix;
+    mat4 normalMatrix;
+};
+
+layout(std140) uniform DrawTransforms
+{
+    Transforms uDrawTransforms[MAX_DRAW_TRANSFORMS];
+};
+
+uniform int uDrawTransformIndex;
+
+#define uModelViewProjMatrix \
+    uDrawTransforms[uDrawTransformIndex].modelViewProjMatrix
+#define uModelViewMatrix uDrawTransforms[uDrawTransformIndex].modelViewMatrix
+#define uNormalMatrix uDrawTransforms[uDrawTransformIndex].normalMatrix
+
+#ifdef SKINNING
+// Joint matrices of all the skins (world space), 4 texels per matrix
+uniform samplerBuffer uJointMatrices;
+uniform int uJointOffset; // First joint of the skin of the mesh
+
+mat4 getJointMatrix(uint joint)
+{
+    int texel = 4 * (uJointOffset + int(joint));
+    return mat4(texelFetch(uJointMatrices, texel),
+        texelFetch(uJointMatrices, texel + 1),
+        texelFetch(uJointMatrices, texel + 2),
+        texelFetch(uJointMatrices, texel + 3));
+}
+#endif
+
+#ifdef INDIRECT
+// Model matrix and material of each instance of each draw of a multi-draw
+struct DrawRecord
+{
+    mat4 modelMatrix;
+    uint materialIndex;
+};
+
+layout(std430) readonly buffer DrawRecords
+{
+    DrawRecord drawRecords[];
+};
+#endif
+
+#ifdef MORPHING
+// Position then normal deltas of the targets of all the primitives
+uniform samplerBuffer uMorphTargetDeltas;
+uniform int uMorphFirstTexel; // Of the targets of the primitive
+uniform int uMorphVertexCount;
+// Targets with a non-zero weight
+uniform int uMorphTargetCount;
+uniform int uMorphTargets[MAX_ACTIVE_MORPH_TARGETS];
+uniform float uMorphWeights[MAX_ACTIVE_MORPH_TARGETS];
+#endif
 
 void main()
 {
-    vViewSpacePosition = vec3(uModelViewMatrix * vec4(aPosition, 1));
-	vViewSpaceNormal = normalize(vec3(uNormalMatrix * vec4(aNormal, 0)));
+    vec3 morphedPosition = aPosition;
+    vec3 morphedNormal = aNormal;
+#ifdef MORPHING
+    for (int i = 0; i < uMorphTargetCount; ++i) {
+        int texel = uMorphFirstTexel +
+            2 * uMorphTargets[i] * uMorphVertexCount + gl_VertexID;
+        morphedPosition +=
+            uMorphWeights[i] * texelFetch(uMorphTargetDeltas, texel).xyz;
+        morphedNormal += uMorphWeights[i] *
+            texelFetch(uMorphTargetDeltas, texel + uMorphVertexCount).xyz;
+    }
+#endif
+
+#ifdef SKINNING
+    mat4 skinMatrix = aWeights.x * getJointMatrix(aJoints.x) +
+        aWeights.y * getJointMatrix(aJoints.y) +
+        aWeights.z * getJointMatrix(aJoints.z) +
+        aWeights.w * getJointMatrix(aJoints.w);
+    vec4 position = skinMatrix * vec4(morphedPosition, 1);
+    vec4 normal = skinMatrix * vec4(morphedNormal, 0);
+#else
+    vec4 position = vec4(morphedPosition, 1);
+    vec4 normal = vec4(morphedNormal, 0);
+#endif
+
+#if defined(INSTANCING) || defined(INDIRECT)
+#ifdef INDIRECT
+    mat4 instanceMatrix = drawRecords[aDrawRecord].modelMatrix;
+    vMaterialIndex = drawRecords[aDrawRecord].materialIndex;
+#else
+    mat4 instanceMatrix = aInstanceMatrix;
+#endif
+    // Normals are transformed by the cofactor matrix of the instance, equal
+    // to its inverse transpose up to the determinant
+    mat3 m = mat3(instanceMatrix);
+    mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]),
+        cross(m[0], m[1]));
+    position = instanceMatrix * position;
+    normal = vec4(sign(dot(m[0], cofactor[0])) * (cofactor * normal.xyz), 0);
+#endif
+    vViewSpacePosition = vec3(uModelViewMatrix * position);
+	vViewSpaceNormal = normalize(vec3(uNormalMatrix * normal));
 	vTexCoords = aTexCoords;
-    gl_Position =  uModelViewProjMatrix * vec4(aPosition, 1);
-}
\ No newline at end of file
+    gl_Position =  uModelViewProjMatrix * position;
+}
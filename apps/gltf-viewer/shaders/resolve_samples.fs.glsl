@@ -0,0 +1,14 @@
+#version 330
+
+// Average of the samples of progressive supersampling
+
+uniform sampler2D uAccumulation;
+uniform float uSampleCount;
+
+out vec4 fColor;
+
+void main()
+{
+    fColor = texelFetch(uAccumulation, ivec2(gl_FragCoord.xy), 0) /
+             uSampleCount;
+}
@@ -0,0 +1,19 @@
+#version 330
+
+// Bilinear upscaling of a frame rendered in the lower left corner of the
+// texture, at uRenderSize pixels
+
+uniform sampler2D uColor;
+uniform vec2 uRenderSize;
+
+in vec2 vTexCoords;
+
+out vec4 fColor;
+
+void main()
+{
+    // Clamped to the texel centers of the frame, the rest of the texture is
+    // not part of it
+    vec2 p = clamp(vTexCoords * uRenderSize, vec2(0.5), uRenderSize - 0.5);
+    fColor = texture(uColor, p / vec2(textureSize(uColor, 0)));
+}
@@ -0,0 +1,12 @@
+#version 330
+
+// Triangle covering the window, without vertex buffer
+
+out vec2 vTexCoords;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vTexCoords = position;
+    gl_Position = vec4(2 * position - 1, 0, 1);
+}
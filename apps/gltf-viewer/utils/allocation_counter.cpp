@@ -0,0 +1,76 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef GLMLV_COUNT_ALLOCATIONS
+
+namespace
+{
+std::atomic<size_t> g_allocationCount{0};
+} // namespace
+
+void *operator new(size_t size)
+{
+  ++g_allocationCount;
+  if (size == 0) {
+    size = 1;
+  }
+  while (true) {
+    if (const auto pointer = std::malloc(size)) {
+      return pointer;
+    }
+    const auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+
+void operator delete[](void *pointer, size_t) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+  std::free(pointer);
+}
+
+bool allocationCountingEnabled() { return true; }
+
+size_t allocationCount() { return g_allocationCount; }
+
+#else
+
+bool allocationCountingEnabled() { return false; }
+
+size_t allocationCount() { return 0; }
+
+#endif
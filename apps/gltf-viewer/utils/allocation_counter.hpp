@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Heap allocations of the process, counted by a global operator new to check
+// that the frame loop doesn't allocate. Only builds configured with the
+// GLMLV_COUNT_ALLOCATIONS CMake option replace operator new, the others
+// count nothing. Over-aligned allocations and the C allocation functions are
+// not counted.
+
+// False without GLMLV_COUNT_ALLOCATIONS
+bool allocationCountingEnabled();
+
+// Calls of operator new since the start, by all threads
+size_t allocationCount();
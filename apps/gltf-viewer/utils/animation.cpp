@@ -0,0 +1,487 @@
+#include "animation.hpp"
+#include "gltf.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+void NodeTransforms::reset(const tinygltf::Model &model)
+{
+  const auto nodeCount = model.nodes.size();
+  translations.assign(nodeCount, glm::vec3(0));
+  rotations.assign(nodeCount, glm::quat(1, 0, 0, 0));
+  scales.assign(nodeCount, glm::vec3(1));
+  matrices.assign(nodeCount, glm::mat4(1));
+  hasMatrix.assign(nodeCount, 0);
+  morphWeights.clear();
+  firstMorphWeights.assign(nodeCount, 0);
+  morphWeightCounts.assign(nodeCount, 0);
+  for (size_t nodeIdx = 0; nodeIdx < nodeCount; ++nodeIdx) {
+    const auto &node = model.nodes[nodeIdx];
+    if (node.mesh >= 0) {
+      // Default weights are the ones of the node, or else of the mesh
+      const auto &mesh = model.meshes[node.mesh];
+      size_t targetCount = 0;
+      for (const auto &primitive : mesh.primitives) {
+        targetCount = std::max(targetCount, primitive.targets.size());
+      }
+      const auto &weights = node.weights.empty() ? mesh.weights : node.weights;
+      firstMorphWeights[nodeIdx] = uint32_t(morphWeights.size());
+      morphWeightCounts[nodeIdx] = uint32_t(targetCount);
+      for (size_t i = 0; i < targetCount; ++i) {
+        morphWeights.push_back(i < weights.size() ? float(weights[i]) : 0.f);
+      }
+    }
+    if (!node.matrix.empty()) {
+      hasMatrix[nodeIdx] = 1;
+      matrices[nodeIdx] = getLocalToWorldMatrix(node, glm::mat4(1));
+      continue;
+    }
+    if (!node.translation.empty()) {
+      translations[nodeIdx] = glm::vec3(
+          node.translation[0], node.translation[1], node.translation[2]);
+    }
+    if (!node.rotation.empty()) {
+      rotations[nodeIdx] = glm::quat(float(node.rotation[3]),
+          float(node.rotation[0]), float(node.rotation[1]),
+          float(node.rotation[2])); // prototype is w, x, y, z
+    }
+    if (!node.scale.empty()) {
+      scales[nodeIdx] =
+          glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+    }
+  }
+
+  sceneNodes.clear();
+  parentNodes.clear();
+  if (model.defaultScene < 0) {
+    return;
+  }
+  // Depth first, in the same order as visitScene()
+  std::vector<std::pair<int, int>> stack; // (node, parent)
+  const auto &roots = model.scenes[model.defaultScene].nodes;
+  for (auto it = roots.rbegin(); it != roots.rend(); ++it) {
+    stack.emplace_back(*it, -1);
+  }
+  while (!stack.empty()) {
+    const auto entry = stack.back();
+    stack.pop_back();
+    sceneNodes.push_back(entry.first);
+    parentNodes.push_back(entry.second);
+    const auto &children = model.nodes[entry.first].children;
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      stack.emplace_back(*it, entry.first);
+    }
+  }
+}
+
+void NodeTransforms::computeWorldMatrices(
+    std::vector<glm::mat4> &worldMatrices) const
+{
+  worldMatrices.resize(translations.size(), glm::mat4(1));
+  for (size_t i = 0; i < sceneNodes.size(); ++i) {
+    const auto nodeIdx = sceneNodes[i];
+    auto localMatrix = matrices[nodeIdx];
+    if (!hasMatrix[nodeIdx]) {
+      // T * R * S
+      localMatrix = glm::mat4_cast(rotations[nodeIdx]);
+      localMatrix[0] *= scales[nodeIdx].x;
+      localMatrix[1] *= scales[nodeIdx].y;
+      localMatrix[2] *= scales[nodeIdx].z;
+      localMatrix[3] = glm::vec4(translations[nodeIdx], 1);
+    }
+    worldMatrices[nodeIdx] = parentNodes[i] < 0
+                                 ? localMatrix
+                                 : worldMatrices[parentNodes[i]] * localMatrix;
+  }
+}
+
+void AnimationSystem::load(const tinygltf::Model &model)
+{
+  m_animations.clear();
+  m_channels.clear();
+  m_times.clear();
+  m_values.clear();
+  m_weights.clear();
+
+  for (const auto &gltfAnimation : model.animations) {
+    Animation animation{
+        gltfAnimation.name, 0.f, uint32_t(m_channels.size()), 0};
+    for (const auto &gltfChannel : gltfAnimation.channels) {
+      const auto nodeIdx = gltfChannel.target_node;
+      if (nodeIdx < 0 || gltfChannel.sampler < 0) {
+        continue;
+      }
+      if (size_t(nodeIdx) >= model.nodes.size() ||
+          size_t(gltfChannel.sampler) >= gltfAnimation.samplers.size()) {
+        std::cerr << "Invalid node " << nodeIdx << " or sampler "
+                  << gltfChannel.sampler << " in animation channel, skipping"
+                  << std::endl;
+        continue;
+      }
+      Path path;
+      if (gltfChannel.target_path == "translation") {
+        path = Path::Translation;
+      } else if (gltfChannel.target_path == "rotation") {
+        path = Path::Rotation;
+      } else if (gltfChannel.target_path == "scale") {
+        path = Path::Scale;
+      } else if (gltfChannel.target_path == "weights") {
+        path = Path::Weights;
+      } else {
+        std::cerr << "Animation path " << gltfChannel.target_path
+                  << " not supported, skipping" << std::endl;
+        continue;
+      }
+      if (path != Path::Weights && !model.nodes[nodeIdx].matrix.empty()) {
+        std::cerr << "Animated node " << nodeIdx
+                  << " has a matrix, skipping channel" << std::endl;
+        continue;
+      }
+
+      const auto &sampler = gltfAnimation.samplers[gltfChannel.sampler];
+      auto interpolation = Interpolation::Linear;
+      if (sampler.interpolation == "STEP") {
+        interpolation = Interpolation::Step;
+      } else if (sampler.interpolation == "CUBICSPLINE") {
+        interpolation = Interpolation::CubicSpline;
+      }
+
+      const auto times = readAccessorFloats(model, sampler.input);
+      const auto values = readAccessorFloats(model, sampler.output);
+      const auto valuesPerKey =
+          interpolation == Interpolation::CubicSpline ? 3u : 1u;
+      // Weights channels have one value per morph target for each key
+      const auto componentCount =
+          path == Path::Rotation
+              ? 4u
+              : path == Path::Weights && !times.empty()
+                    ? uint32_t(values.size() / (times.size() * valuesPerKey))
+                    : 3u;
+      if (times.empty() || componentCount == 0 ||
+          values.size() != times.size() * componentCount * valuesPerKey) {
+        std::cerr << "Invalid animation sampler " << gltfChannel.sampler
+                  << ", skipping" << std::endl;
+        continue;
+      }
+
+      const auto isWeights = path == Path::Weights;
+      m_channels.push_back({nodeIdx, path, interpolation,
+          uint32_t(m_times.size()), uint32_t(times.size()),
+          uint32_t(isWeights ? m_weights.size() : m_values.size()), 0,
+          isWeights ? componentCount : 0});
+      m_times.insert(end(m_times), begin(times), end(times));
+      if (isWeights) {
+        m_weights.insert(end(m_weights), begin(values), end(values));
+      } else {
+        for (size_t i = 0; i < values.size(); i += componentCount) {
+          m_values.emplace_back(values[i], values[i + 1], values[i + 2],
+              componentCount == 4 ? values[i + 3] : 0.f);
+        }
+      }
+      animation.duration = std::max(animation.duration, times.back());
+      ++animation.channelCount;
+    }
+    m_animations.push_back(animation);
+  }
+}
+
+void AnimationSystem::apply(
+    size_t animationIdx, float time, NodeTransforms &transforms)
+{
+  const auto write = [&](int nodeIdx, Path path, const glm::vec4 &value) {
+    switch (path) {
+    case Path::Translation:
+      transforms.translations[nodeIdx] = glm::vec3(value);
+      break;
+    case Path::Rotation:
+      transforms.rotations[nodeIdx] =
+          glm::normalize(glm::quat(value.w, value.x, value.y, value.z));
+      break;
+    case Path::Scale:
+      transforms.scales[nodeIdx] = glm::vec3(value);
+      break;
+    case Path::Weights:
+      break;
+    }
+  };
+
+  m_translations.clear();
+  m_rotations.clear();
+  m_scales.clear();
+
+  const auto &animation = m_animations[animationIdx];
+  for (auto channelIdx = animation.firstChannel;
+       channelIdx < animation.firstChannel + animation.channelCount;
+       ++channelIdx) {
+    auto &channel = m_channels[channelIdx];
+    const auto *times = &m_times[channel.firstKey];
+
+    // Move the cursor forward, or search again when going back in time
+    auto &key = channel.cursor;
+    if (time < times[key]) {
+      key = uint32_t(std::max<ptrdiff_t>(
+          std::upper_bound(times, times + channel.keyCount, time) - times - 1,
+          0));
+    }
+    while (key + 1 < channel.keyCount && times[key + 1] <= time) {
+      ++key;
+    }
+
+    if (channel.path == Path::Weights) {
+      applyWeights(channel, time, transforms);
+      continue;
+    }
+
+    const auto *values = &m_values[channel.firstValue];
+    const auto valueOffset =
+        channel.interpolation == Interpolation::CubicSpline ? 1u : 0u;
+    const auto valueStride =
+        channel.interpolation == Interpolation::CubicSpline ? 3u : 1u;
+
+    if (key + 1 >= channel.keyCount || time <= times[key]) {
+      // Before the first or after the last key
+      write(channel.nodeIdx, channel.path,
+          values[key * valueStride + valueOffset]);
+      continue;
+    }
+
+    const auto deltaTime = times[key + 1] - times[key];
+    const auto t = (time - times[key]) / deltaTime;
+    switch (channel.interpolation) {
+    case Interpolation::Step:
+      write(channel.nodeIdx, channel.path, values[key]);
+      break;
+    case Interpolation::Linear: {
+      auto &batch = channel.path == Path::Translation
+                        ? m_translations
+                        : channel.path == Path::Rotation ? m_rotations
+                                                         : m_scales;
+      batch.push(channel.nodeIdx, values[key], values[key + 1], t);
+      break;
+    }
+    case Interpolation::CubicSpline: {
+      // Hermite spline, keys store (in tangent, value, out tangent)
+      const auto &p0 = values[3 * key + 1];
+      const auto m0 = deltaTime * values[3 * key + 2];
+      const auto &p1 = values[3 * (key + 1) + 1];
+      const auto m1 = deltaTime * values[3 * (key + 1)];
+      const auto t2 = t * t;
+      const auto t3 = t2 * t;
+      write(channel.nodeIdx, channel.path,
+          (2.f * t3 - 3.f * t2 + 1.f) * p0 + (t3 - 2.f * t2 + t) * m0 +
+              (-2.f * t3 + 3.f * t2) * p1 + (t3 - t2) * m1);
+      break;
+    }
+    }
+  }
+
+  lerp(m_translations);
+  slerp(m_rotations);
+  lerp(m_scales);
+
+  for (size_t i = 0; i < m_translations.size; ++i) {
+    transforms.translations[m_translations.nodeIdx[i]] =
+        glm::vec3(m_translations.a[0][i], m_translations.a[1][i],
+            m_translations.a[2][i]);
+  }
+  for (size_t i = 0; i < m_rotations.size; ++i) {
+    transforms.rotations[m_rotations.nodeIdx[i]] =
+        glm::quat(m_rotations.a[3][i], m_rotations.a[0][i],
+            m_rotations.a[1][i], m_rotations.a[2][i]);
+  }
+  for (size_t i = 0; i < m_scales.size; ++i) {
+    transforms.scales[m_scales.nodeIdx[i]] = glm::vec3(
+        m_scales.a[0][i], m_scales.a[1][i], m_scales.a[2][i]);
+  }
+}
+
+void AnimationSystem::applyWeights(
+    const Channel &channel, float time, NodeTransforms &transforms) const
+{
+  const auto *times = &m_times[channel.firstKey];
+  const auto key = channel.cursor;
+  const auto cubic = channel.interpolation == Interpolation::CubicSpline;
+  // Keys store weightCount values, or in tangents, values and out tangents
+  const auto keyStride = (cubic ? 3 : 1) * channel.weightCount;
+  const auto *keyValues = &m_weights[channel.firstValue + key * keyStride];
+  auto *weights = transforms.morphWeights.data() +
+                 transforms.firstMorphWeights[channel.nodeIdx];
+  const auto weightCount = std::min(
+      channel.weightCount, transforms.morphWeightCounts[channel.nodeIdx]);
+
+  if (key + 1 >= channel.keyCount || time <= times[key] ||
+      channel.interpolation == Interpolation::Step) {
+    std::copy_n(keyValues + (cubic ? channel.weightCount : 0), weightCount,
+        weights);
+    return;
+  }
+
+  const auto *nextValues = keyValues + keyStride;
+  const auto deltaTime = times[key + 1] - times[key];
+  const auto t = (time - times[key]) / deltaTime;
+  if (!cubic) {
+    for (uint32_t i = 0; i < weightCount; ++i) {
+      weights[i] = keyValues[i] + t * (nextValues[i] - keyValues[i]);
+    }
+    return;
+  }
+  const auto t2 = t * t;
+  const auto t3 = t2 * t;
+  const auto w = channel.weightCount;
+  for (uint32_t i = 0; i < weightCount; ++i) {
+    weights[i] = (2.f * t3 - 3.f * t2 + 1.f) * keyValues[w + i] +
+                 (t3 - 2.f * t2 + t) * deltaTime * keyValues[2 * w + i] +
+                 (-2.f * t3 + 3.f * t2) * nextValues[w + i] +
+                 (t3 - t2) * deltaTime * nextValues[i];
+  }
+}
+
+void AnimationSystem::Batch::push(
+    int node, const glm::vec4 &valueA, const glm::vec4 &valueB, float weight)
+{
+  if (size == t.size()) {
+    const auto capacity = std::max<size_t>(8, 2 * size);
+    for (uint32_t c = 0; c < 4; ++c) {
+      a[c].resize(capacity);
+      b[c].resize(capacity);
+    }
+    t.resize(capacity);
+    nodeIdx.resize(capacity);
+  }
+  for (uint32_t c = 0; c < 4; ++c) {
+    a[c][size] = valueA[c];
+    b[c][size] = valueB[c];
+  }
+  t[size] = weight;
+  nodeIdx[size] = node;
+  ++size;
+}
+
+void AnimationSystem::Batch::pad()
+{
+  // Capacity is always a multiple of 8, pad with identity quaternions
+  for (auto i = size; i < t.size(); ++i) {
+    for (uint32_t c = 0; c < 4; ++c) {
+      a[c][i] = b[c][i] = c == 3 ? 1.f : 0.f;
+    }
+    t[i] = 0.f;
+  }
+}
+
+void AnimationSystem::lerp(Batch &batch)
+{
+  batch.pad();
+  if (cpuSupportsAvx2()) {
+    lerpAvx2(batch);
+    return;
+  }
+  for (size_t i = 0; i < batch.size; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      batch.a[c][i] += batch.t[i] * (batch.b[c][i] - batch.a[c][i]);
+    }
+  }
+}
+
+GLMLV_AVX2_FUNCTION void AnimationSystem::lerpAvx2(Batch &batch)
+{
+#if GLMLV_AVX2
+  for (size_t i = 0; i < batch.size; i += 8) {
+    const auto t = _mm256_loadu_ps(&batch.t[i]);
+    for (uint32_t c = 0; c < 3; ++c) {
+      const auto a = _mm256_loadu_ps(&batch.a[c][i]);
+      const auto b = _mm256_loadu_ps(&batch.b[c][i]);
+      _mm256_storeu_ps(
+          &batch.a[c][i], _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a));
+    }
+  }
+#endif
+}
+
+// Spherical interpolation approximated by a normalized lerp with a corrected
+// interpolation parameter (Zeux, "Approximating slerp"), which only needs
+// arithmetic and vectorizes well. Angular error is below 2e-3 radians.
+void AnimationSystem::slerp(Batch &batch)
+{
+  batch.pad();
+  if (cpuSupportsAvx2()) {
+    slerpAvx2(batch);
+    return;
+  }
+  for (size_t i = 0; i < batch.size; ++i) {
+    auto d = 0.f;
+    for (uint32_t c = 0; c < 4; ++c) {
+      d += batch.a[c][i] * batch.b[c][i];
+    }
+    const auto sign = d < 0.f ? -1.f : 1.f;
+    d *= sign;
+    const auto A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    const auto B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    const auto t = batch.t[i];
+    const auto tm = t - 0.5f;
+    const auto correctedT = t + t * tm * (t - 1.f) * (A * tm * tm + B);
+    float r[4];
+    auto lengthSq = 0.f;
+    for (uint32_t c = 0; c < 4; ++c) {
+      r[c] = batch.a[c][i] +
+             correctedT * (sign * batch.b[c][i] - batch.a[c][i]);
+      lengthSq += r[c] * r[c];
+    }
+    const auto invLength = 1.f / std::sqrt(lengthSq);
+    for (uint32_t c = 0; c < 4; ++c) {
+      batch.a[c][i] = r[c] * invLength;
+    }
+  }
+}
+
+GLMLV_AVX2_FUNCTION void AnimationSystem::slerpAvx2(Batch &batch)
+{
+#if GLMLV_AVX2
+  const auto signBit = _mm256_set1_ps(-0.f);
+  const auto half = _mm256_set1_ps(0.5f);
+  const auto one = _mm256_set1_ps(1.f);
+  for (size_t i = 0; i < batch.size; i += 8) {
+    __m256 a[4], b[4];
+    for (uint32_t c = 0; c < 4; ++c) {
+      a[c] = _mm256_loadu_ps(&batch.a[c][i]);
+      b[c] = _mm256_loadu_ps(&batch.b[c][i]);
+    }
+    auto d = _mm256_mul_ps(a[0], b[0]);
+    for (uint32_t c = 1; c < 4; ++c) {
+      d = _mm256_fmadd_ps(a[c], b[c], d);
+    }
+    // Take the shortest path: negate b where the dot product is negative
+    const auto sign = _mm256_and_ps(d, signBit);
+    d = _mm256_xor_ps(d, sign);
+    for (uint32_t c = 0; c < 4; ++c) {
+      b[c] = _mm256_xor_ps(b[c], sign);
+    }
+
+    // A = 1.0904 + d * (-3.2452 + d * (3.55645 - d * 1.43519))
+    // B = 0.848013 + d * (-1.06021 + d * 0.215638)
+    auto A = _mm256_fnmadd_ps(d, _mm256_set1_ps(1.43519f),
+        _mm256_set1_ps(3.55645f));
+    A = _mm256_fmadd_ps(d, A, _mm256_set1_ps(-3.2452f));
+    A = _mm256_fmadd_ps(d, A, _mm256_set1_ps(1.0904f));
+    auto B = _mm256_fmadd_ps(
+        d, _mm256_set1_ps(0.215638f), _mm256_set1_ps(-1.06021f));
+    B = _mm256_fmadd_ps(d, B, _mm256_set1_ps(0.848013f));
+    // t' = t + t * (t - 0.5) * (t - 1) * (A * (t - 0.5)^2 + B)
+    const auto t = _mm256_loadu_ps(&batch.t[i]);
+    const auto tm = _mm256_sub_ps(t, half);
+    const auto k = _mm256_fmadd_ps(_mm256_mul_ps(A, tm), tm, B);
+    const auto correctedT = _mm256_fmadd_ps(
+        _mm256_mul_ps(_mm256_mul_ps(t, tm), _mm256_sub_ps(t, one)), k, t);
+
+    __m256 r[4];
+    auto lengthSq = _mm256_setzero_ps();
+    for (uint32_t c = 0; c < 4; ++c) {
+      r[c] = _mm256_fmadd_ps(correctedT, _mm256_sub_ps(b[c], a[c]), a[c]);
+      lengthSq = _mm256_fmadd_ps(r[c], r[c], lengthSq);
+    }
+    const auto invLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSq));
+    for (uint32_t c = 0; c < 4; ++c) {
+      _mm256_storeu_ps(&batch.a[c][i], _mm256_mul_ps(r[c], invLength));
+    }
+  }
+#endif
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "simd.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Local transforms of the nodes of a model in SoA layout, written in place by
+// animations. Nodes defined by a matrix can't be animated (glTF 2.0 spec),
+// they keep their matrix.
+struct NodeTransforms
+{
+  std::vector<glm::vec3> translations;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<glm::mat4> matrices; // Only used if hasMatrix[nodeIdx]
+  std::vector<uint8_t> hasMatrix;
+
+  // Morph target weights of the nodes instancing a mesh with targets:
+  // morphWeightCounts[nodeIdx] weights from firstMorphWeights[nodeIdx]
+  std::vector<float> morphWeights;
+  std::vector<uint32_t> firstMorphWeights;
+  std::vector<uint32_t> morphWeightCounts;
+
+  // Nodes of the default scene, parents before their children, and their
+  // parent (-1 for roots)
+  std::vector<int> sceneNodes;
+  std::vector<int> parentNodes;
+
+  // Reset all nodes to the transforms of the model
+  void reset(const tinygltf::Model &model);
+
+  // Local to world matrix of the nodes of the default scene, indexed by node
+  void computeWorldMatrices(std::vector<glm::mat4> &worldMatrices) const;
+};
+
+// Playback of the animations of a glTF model.
+// Channels are converted at load into contiguous keyframe arrays. Each
+// channel keeps a cursor on its last keyframe, so playing forward never
+// searches for keyframes. LINEAR channels are interpolated in batches (with
+// AVX2 when the CPU supports it).
+class AnimationSystem
+{
+public:
+  void load(const tinygltf::Model &model);
+
+  size_t animationCount() const { return m_animations.size(); }
+
+  const std::string &name(size_t animationIdx) const
+  {
+    return m_animations[animationIdx].name;
+  }
+
+  // Time of the last keyframe, in seconds
+  float duration(size_t animationIdx) const
+  {
+    return m_animations[animationIdx].duration;
+  }
+
+  size_t channelCount(size_t animationIdx) const
+  {
+    return m_animations[animationIdx].channelCount;
+  }
+
+  // Write in transforms the state of the animated nodes at the given time
+  void apply(size_t animationIdx, float time, NodeTransforms &transforms);
+
+private:
+  enum class Path : uint8_t
+  {
+    Translation,
+    Rotation,
+    Scale,
+    Weights
+  };
+
+  enum class Interpolation : uint8_t
+  {
+    Linear,
+    Step,
+    CubicSpline
+  };
+
+  struct Channel
+  {
+    int nodeIdx;
+    Path path;
+    Interpolation interpolation;
+    uint32_t firstKey; // In m_times
+    uint32_t keyCount;
+    uint32_t firstValue; // In m_values, 3 values per key for CUBICSPLINE
+    uint32_t cursor; // Last key with time <= sampled time
+    uint32_t weightCount; // Weights path: values per key, in m_weights
+  };
+
+  struct Animation
+  {
+    std::string name;
+    float duration;
+    uint32_t firstChannel; // In m_channels
+    uint32_t channelCount;
+  };
+
+  // Channels waiting for interpolation, in SoA layout padded to a multiple of
+  // 8 elements: result = mix(a, b, t)
+  struct Batch
+  {
+    std::vector<float> a[4];
+    std::vector<float> b[4];
+    std::vector<float> t;
+    std::vector<int> nodeIdx;
+    size_t size = 0;
+
+    void clear() { size = 0; }
+    void push(int node, const glm::vec4 &a, const glm::vec4 &b, float t);
+    void pad();
+  };
+
+  void applyWeights(const Channel &channel, float time,
+      NodeTransforms &transforms) const;
+
+  // Write the results in a, the Avx2 versions only run if cpuSupportsAvx2()
+  static void lerp(Batch &batch);
+  static void slerp(Batch &batch);
+  GLMLV_AVX2_FUNCTION static void lerpAvx2(Batch &batch);
+  GLMLV_AVX2_FUNCTION static void slerpAvx2(Batch &batch);
+
+  std::vector<Animation> m_animations;
+  std::vector<Channel> m_channels;
+  std::vector<float> m_times;
+  std::vector<glm::vec4> m_values; // xyz for translation and scale
+  std::vector<float> m_weights;
+
+  Batch m_translations;
+  Batch m_rotations;
+  Batch m_scales;
+};
@@ -0,0 +1,373 @@
+#include "culling.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+AABB AABB::transform(const glm::mat4 &matrix) const
+{
+  if (isEmpty()) {
+    return *this;
+  }
+  // Transform the center, and take the extent of the box along each world
+  // axis from the absolute value of the linear part of the matrix
+  const auto c = glm::vec3(matrix * glm::vec4(center(), 1.f));
+  const auto e = extent();
+  const auto worldExtent = glm::abs(glm::vec3(matrix[0])) * e.x +
+                           glm::abs(glm::vec3(matrix[1])) * e.y +
+                           glm::abs(glm::vec3(matrix[2])) * e.z;
+  return AABB{c - worldExtent, c + worldExtent};
+}
+
+Frustum::Frustum(const glm::mat4 &viewProjMatrix)
+{
+  // Gribb & Hartmann plane extraction, glm matrices are column major so
+  // row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+  const auto row = [&](int i) {
+    return glm::vec4(viewProjMatrix[0][i], viewProjMatrix[1][i],
+        viewProjMatrix[2][i], viewProjMatrix[3][i]);
+  };
+  planes[0] = row(3) + row(0); // Left
+  planes[1] = row(3) - row(0); // Right
+  planes[2] = row(3) + row(1); // Bottom
+  planes[3] = row(3) - row(1); // Top
+  planes[4] = row(3) + row(2); // Near
+  planes[5] = row(3) - row(2); // Far
+  for (auto &plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+}
+
+bool Frustum::intersects(const AABB &box) const
+{
+  for (const auto &plane : planes) {
+    // Corner of the box the farthest along the plane normal
+    const auto p = glm::vec3(plane.x >= 0.f ? box.max.x : box.min.x,
+        plane.y >= 0.f ? box.max.y : box.min.y,
+        plane.z >= 0.f ? box.max.z : box.min.z);
+    if (glm::dot(glm::vec3(plane), p) + plane.w < 0.f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+CullingView::CullingView(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, float viewportHeight, float minPixelSize) :
+    frustum(projMatrix * viewMatrix),
+    eye(glm::inverse(viewMatrix)[3]),
+    pixelScale(0.5f * viewportHeight * projMatrix[1][1]),
+    minPixelSize(minPixelSize)
+{
+}
+
+void BoundingVolumeHierarchy::Node::setChildBounds(
+    uint32_t slot, const AABB &box)
+{
+  minX[slot] = box.min.x;
+  minY[slot] = box.min.y;
+  minZ[slot] = box.min.z;
+  maxX[slot] = box.max.x;
+  maxY[slot] = box.max.y;
+  maxZ[slot] = box.max.z;
+}
+
+AABB BoundingVolumeHierarchy::Node::childBounds(uint32_t slot) const
+{
+  return AABB{glm::vec3(minX[slot], minY[slot], minZ[slot]),
+      glm::vec3(maxX[slot], maxY[slot], maxZ[slot])};
+}
+
+AABB BoundingVolumeHierarchy::Node::bounds() const
+{
+  AABB box;
+  for (uint32_t slot = 0; slot < childCount; ++slot) {
+    box.extend(childBounds(slot));
+  }
+  return box;
+}
+
+void BoundingVolumeHierarchy::build(const std::vector<AABB> &itemBounds)
+{
+  m_nodes.clear();
+  m_items.resize(itemBounds.size());
+  std::iota(begin(m_items), end(m_items), 0);
+  if (itemBounds.empty()) {
+    return;
+  }
+
+  std::vector<glm::vec3> centroids(itemBounds.size());
+  for (size_t i = 0; i < itemBounds.size(); ++i) {
+    centroids[i] = itemBounds[i].center();
+  }
+
+  m_nodes.reserve(2 * itemBounds.size() / (WIDTH - 1) + 1);
+  buildNode(itemBounds, centroids, 0, uint32_t(itemBounds.size()));
+}
+
+uint32_t BoundingVolumeHierarchy::buildNode(
+    const std::vector<AABB> &itemBounds,
+    const std::vector<glm::vec3> &centroids, uint32_t begin, uint32_t end)
+{
+  // Split [begin, end) into at most WIDTH ranges, always splitting the largest
+  // range at the median of its centroids along their axis of largest extent
+  struct Range
+  {
+    uint32_t begin, end;
+  };
+  Range ranges[WIDTH] = {{begin, end}};
+  uint32_t rangeCount = 1;
+  while (rangeCount < WIDTH) {
+    const auto largest = std::max_element(
+        ranges, ranges + rangeCount, [](const Range &lhs, const Range &rhs) {
+          return lhs.end - lhs.begin < rhs.end - rhs.begin;
+        });
+    if (largest->end - largest->begin <= 1) {
+      break;
+    }
+
+    AABB centroidBounds;
+    for (auto i = largest->begin; i < largest->end; ++i) {
+      centroidBounds.extend(centroids[m_items[i]]);
+    }
+    const auto diag = centroidBounds.max - centroidBounds.min;
+    const auto axis = diag.x > diag.y ? (diag.x > diag.z ? 0 : 2)
+                                      : (diag.y > diag.z ? 1 : 2);
+
+    const auto middle = largest->begin + (largest->end - largest->begin) / 2;
+    std::nth_element(m_items.data() + largest->begin, m_items.data() + middle,
+        m_items.data() + largest->end, [&](uint32_t lhs, uint32_t rhs) {
+          return centroids[lhs][axis] < centroids[rhs][axis];
+        });
+
+    ranges[rangeCount++] = Range{middle, largest->end};
+    largest->end = middle;
+  }
+
+  const auto nodeIdx = uint32_t(m_nodes.size());
+  m_nodes.emplace_back();
+  {
+    auto &node = m_nodes[nodeIdx];
+    node.childCount = rangeCount;
+    for (uint32_t slot = 0; slot < WIDTH; ++slot) {
+      // Empty slots have inverted bounds so that they are outside of any plane
+      node.setChildBounds(slot, AABB{});
+      node.childNode[slot] = LEAF;
+      node.itemBegin[slot] = 0;
+      node.itemCount[slot] = 0;
+    }
+  }
+
+  for (uint32_t slot = 0; slot < rangeCount; ++slot) {
+    const auto &range = ranges[slot];
+    AABB box;
+    for (auto i = range.begin; i < range.end; ++i) {
+      box.extend(itemBounds[m_items[i]]);
+    }
+    // Recursion can reallocate m_nodes, don't keep a reference on the node
+    const auto childNode = range.end - range.begin > 1
+                               ? buildNode(itemBounds, centroids,
+                                     range.begin, range.end)
+                               : LEAF;
+    auto &node = m_nodes[nodeIdx];
+    node.setChildBounds(slot, box);
+    node.childNode[slot] = childNode;
+    node.itemBegin[slot] = range.begin;
+    node.itemCount[slot] = range.end - range.begin;
+  }
+
+  return nodeIdx;
+}
+
+void BoundingVolumeHierarchy::refit(const std::vector<AABB> &itemBounds)
+{
+  assert(itemBounds.size() == m_items.size());
+  if (!m_nodes.empty()) {
+    refitNode(0, itemBounds);
+  }
+}
+
+AABB BoundingVolumeHierarchy::refitNode(
+    uint32_t nodeIdx, const std::vector<AABB> &itemBounds)
+{
+  for (uint32_t slot = 0; slot < m_nodes[nodeIdx].childCount; ++slot) {
+    auto &node = m_nodes[nodeIdx];
+    if (node.childNode[slot] != LEAF) {
+      node.setChildBounds(slot, refitNode(node.childNode[slot], itemBounds));
+    } else {
+      AABB box;
+      for (auto i = node.itemBegin[slot];
+           i < node.itemBegin[slot] + node.itemCount[slot]; ++i) {
+        box.extend(itemBounds[m_items[i]]);
+      }
+      node.setChildBounds(slot, box);
+    }
+  }
+  return m_nodes[nodeIdx].bounds();
+}
+
+AABB BoundingVolumeHierarchy::bounds() const
+{
+  return m_nodes.empty() ? AABB{} : m_nodes[0].bounds();
+}
+
+void BoundingVolumeHierarchy::testChildren(const Node &node,
+    const CullingView &view, bool parentInside, uint32_t &visibleMask,
+    uint32_t &insideMask)
+{
+  const auto &planes = view.frustum.planes;
+  const bool smallFeatureCulling = view.minPixelSize > 0.f;
+  const auto minPixelSize2 = view.minPixelSize * view.minPixelSize;
+  const auto pixelScale2 = view.pixelScale * view.pixelScale;
+  for (uint32_t slot = 0; slot < node.childCount; ++slot) {
+    const auto box = node.childBounds(slot);
+    if (!parentInside) {
+      for (const auto &plane : planes) {
+        const auto normal = glm::vec3(plane);
+        const auto farthest =
+            glm::vec3(plane.x >= 0.f ? box.max.x : box.min.x,
+                plane.y >= 0.f ? box.max.y : box.min.y,
+                plane.z >= 0.f ? box.max.z : box.min.z);
+        const auto nearest =
+            glm::vec3(plane.x >= 0.f ? box.min.x : box.max.x,
+                plane.y >= 0.f ? box.min.y : box.max.y,
+                plane.z >= 0.f ? box.min.z : box.max.z);
+        if (glm::dot(normal, farthest) + plane.w < 0.f) {
+          visibleMask &= ~(1u << slot);
+          break;
+        }
+        if (glm::dot(normal, nearest) + plane.w < 0.f) {
+          insideMask &= ~(1u << slot);
+        }
+      }
+    }
+    if (smallFeatureCulling) {
+      const auto d = box.center() - view.eye;
+      const auto s = box.max - box.min;
+      if (glm::dot(s, s) * pixelScale2 < glm::dot(d, d) * minPixelSize2) {
+        visibleMask &= ~(1u << slot);
+      }
+    }
+  }
+  insideMask &= visibleMask;
+}
+
+GLMLV_AVX2_FUNCTION void BoundingVolumeHierarchy::testChildrenAvx2(
+    const Node &node, const CullingView &view, bool parentInside,
+    uint32_t &visibleMask, uint32_t &insideMask)
+{
+#if GLMLV_AVX2
+  const auto &planes = view.frustum.planes;
+  const bool smallFeatureCulling = view.minPixelSize > 0.f;
+  const auto minPixelSize2 = view.minPixelSize * view.minPixelSize;
+  const auto pixelScale2 = view.pixelScale * view.pixelScale;
+  const auto minX = _mm256_loadu_ps(node.minX);
+  const auto minY = _mm256_loadu_ps(node.minY);
+  const auto minZ = _mm256_loadu_ps(node.minZ);
+  const auto maxX = _mm256_loadu_ps(node.maxX);
+  const auto maxY = _mm256_loadu_ps(node.maxY);
+  const auto maxZ = _mm256_loadu_ps(node.maxZ);
+  const auto zero = _mm256_setzero_ps();
+
+  if (!parentInside) {
+    auto outside = zero;
+    auto intersecting = zero;
+    for (const auto &plane : planes) {
+      const auto nx = _mm256_set1_ps(plane.x);
+      const auto ny = _mm256_set1_ps(plane.y);
+      const auto nz = _mm256_set1_ps(plane.z);
+      const auto w = _mm256_set1_ps(plane.w);
+      // Nearest and farthest corners along the plane normal
+      const auto farthest = _mm256_fmadd_ps(nx, plane.x >= 0.f ? maxX : minX,
+          _mm256_fmadd_ps(ny, plane.y >= 0.f ? maxY : minY,
+              _mm256_fmadd_ps(nz, plane.z >= 0.f ? maxZ : minZ, w)));
+      const auto nearest = _mm256_fmadd_ps(nx, plane.x >= 0.f ? minX : maxX,
+          _mm256_fmadd_ps(ny, plane.y >= 0.f ? minY : maxY,
+              _mm256_fmadd_ps(nz, plane.z >= 0.f ? minZ : maxZ, w)));
+      outside =
+          _mm256_or_ps(outside, _mm256_cmp_ps(farthest, zero, _CMP_LT_OQ));
+      intersecting = _mm256_or_ps(
+          intersecting, _mm256_cmp_ps(nearest, zero, _CMP_LT_OQ));
+    }
+    visibleMask &= ~uint32_t(_mm256_movemask_ps(outside));
+    insideMask = visibleMask & ~uint32_t(_mm256_movemask_ps(intersecting));
+  }
+
+  if (smallFeatureCulling) {
+    // Vector from the eye to the box center
+    const auto half = _mm256_set1_ps(0.5f);
+    const auto dx = _mm256_fmsub_ps(half, _mm256_add_ps(minX, maxX),
+        _mm256_set1_ps(view.eye.x));
+    const auto dy = _mm256_fmsub_ps(half, _mm256_add_ps(minY, maxY),
+        _mm256_set1_ps(view.eye.y));
+    const auto dz = _mm256_fmsub_ps(half, _mm256_add_ps(minZ, maxZ),
+        _mm256_set1_ps(view.eye.z));
+    const auto sx = _mm256_sub_ps(maxX, minX);
+    const auto sy = _mm256_sub_ps(maxY, minY);
+    const auto sz = _mm256_sub_ps(maxZ, minZ);
+    const auto distance2 = _mm256_fmadd_ps(
+        dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+    const auto diameter2 = _mm256_fmadd_ps(
+        sx, sx, _mm256_fmadd_ps(sy, sy, _mm256_mul_ps(sz, sz)));
+    // diameter * pixelScale / distance < minPixelSize, squared
+    const auto tooSmall =
+        _mm256_cmp_ps(_mm256_mul_ps(diameter2, _mm256_set1_ps(pixelScale2)),
+            _mm256_mul_ps(distance2, _mm256_set1_ps(minPixelSize2)),
+            _CMP_LT_OQ);
+    visibleMask &= ~uint32_t(_mm256_movemask_ps(tooSmall));
+  }
+#else
+  testChildren(node, view, parentInside, visibleMask, insideMask);
+#endif
+}
+
+void BoundingVolumeHierarchy::cull(
+    const CullingView &view, std::vector<uint32_t> &visibleItems) const
+{
+  if (m_nodes.empty()) {
+    return;
+  }
+
+  const bool smallFeatureCulling = view.minPixelSize > 0.f;
+  const bool avx2 = cpuSupportsAvx2();
+
+  // Stack entries are node indices, with the high bit set when the node is
+  // known to be entirely inside the frustum (no plane test needed)
+  const uint32_t INSIDE_BIT = 1u << 31;
+  uint32_t stack[256];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while (stackSize) {
+    const auto entry = stack[--stackSize];
+    const auto &node = m_nodes[entry & ~INSIDE_BIT];
+    const bool parentInside = (entry & INSIDE_BIT) != 0;
+
+    // Bit i of visibleMask / insideMask is set if child i is visible /
+    // entirely inside the frustum
+    uint32_t visibleMask = (1u << node.childCount) - 1;
+    uint32_t insideMask = visibleMask;
+
+    if (avx2) {
+      testChildrenAvx2(node, view, parentInside, visibleMask, insideMask);
+    } else {
+      testChildren(node, view, parentInside, visibleMask, insideMask);
+    }
+
+    for (uint32_t slot = 0; slot < node.childCount; ++slot) {
+      if (!(visibleMask & (1u << slot))) {
+        continue;
+      }
+      const bool inside = (insideMask & (1u << slot)) != 0;
+      if (node.childNode[slot] == LEAF || (inside && !smallFeatureCulling)) {
+        // Leaf or subtree entirely visible: items are contiguous in m_items
+        const auto first = m_items.data() + node.itemBegin[slot];
+        visibleItems.insert(
+            end(visibleItems), first, first + node.itemCount[slot]);
+      } else {
+        assert(stackSize < sizeof(stack) / sizeof(stack[0]));
+        stack[stackSize++] = node.childNode[slot] | (inside ? INSIDE_BIT : 0u);
+      }
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "simd.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Axis aligned bounding box
+struct AABB
+{
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+  AABB() = default;
+
+  AABB(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax) :
+      min(bboxMin), max(bboxMax)
+  {
+  }
+
+  bool isEmpty() const
+  {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  glm::vec3 center() const { return 0.5f * (min + max); }
+
+  glm::vec3 extent() const { return 0.5f * (max - min); }
+
+  void extend(const glm::vec3 &point)
+  {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void extend(const AABB &box)
+  {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+
+  // Bounding box of this box transformed by matrix (Arvo's method)
+  AABB transform(const glm::mat4 &matrix) const;
+};
+
+// View frustum as 6 world space planes (xyz = normal pointing inside, w =
+// distance), extracted from a view projection matrix
+struct Frustum
+{
+  glm::vec4 planes[6];
+
+  Frustum() = default;
+
+  explicit Frustum(const glm::mat4 &viewProjMatrix);
+
+  // Conservative test: may return true for boxes close to a frustum corner
+  bool intersects(const AABB &box) const;
+};
+
+// Everything needed to cull against a camera
+struct CullingView
+{
+  Frustum frustum;
+  glm::vec3 eye = glm::vec3(0);
+  // Projected size in pixels of an object of size 1 at distance 1, ie.
+  // 0.5 * viewportHeight * projMatrix[1][1]
+  float pixelScale = 0.f;
+  // Items whose bounding sphere diameter projects on less pixels than this are
+  // culled. 0 disables small feature culling.
+  float minPixelSize = 0.f;
+
+  CullingView() = default;
+
+  CullingView(const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+      float viewportHeight, float minPixelSize = 0.f);
+};
+
+// Bounding volume hierarchy over a set of items (scene primitives) given by
+// their world space bounding boxes.
+// Nodes are 8-wide and store the bounds of their children in SoA layout, so
+// that the frustum test of all children of a node is done at once (with AVX2
+// when the CPU supports it).
+class BoundingVolumeHierarchy
+{
+public:
+  static const uint32_t WIDTH = 8;
+
+  void build(const std::vector<AABB> &itemBounds);
+
+  // Update node bounds after items have moved, keeping the same topology.
+  // Cheaper than build() but the tree quality degrades if items move a lot.
+  void refit(const std::vector<AABB> &itemBounds);
+
+  // Append to visibleItems the indices of items whose bounds intersect the
+  // view frustum and are not too small on screen
+  void cull(const CullingView &view, std::vector<uint32_t> &visibleItems) const;
+
+  // Bounds of all items
+  AABB bounds() const;
+
+  size_t nodeCount() const { return m_nodes.size(); }
+
+  size_t itemCount() const { return m_items.size(); }
+
+private:
+  struct alignas(32) Node
+  {
+    float minX[WIDTH];
+    float minY[WIDTH];
+    float minZ[WIDTH];
+    float maxX[WIDTH];
+    float maxY[WIDTH];
+    float maxZ[WIDTH];
+    // Index in m_nodes for inner children, LEAF for leaves
+    uint32_t childNode[WIDTH];
+    // Items of a child subtree are contiguous in m_items
+    uint32_t itemBegin[WIDTH];
+    uint32_t itemCount[WIDTH];
+    uint32_t childCount; // Slots [childCount, WIDTH) are empty
+
+    void setChildBounds(uint32_t slot, const AABB &box);
+    AABB childBounds(uint32_t slot) const;
+    AABB bounds() const;
+  };
+
+  uint32_t buildNode(const std::vector<AABB> &itemBounds,
+      const std::vector<glm::vec3> &centroids, uint32_t begin, uint32_t end);
+  AABB refitNode(uint32_t nodeIdx, const std::vector<AABB> &itemBounds);
+
+  // Clear the bits of visibleMask for the children of node outside the view
+  // or too small, and the ones of insideMask for the children not entirely
+  // inside, unless the parent is
+  static void testChildren(const Node &node, const CullingView &view,
+      bool parentInside, uint32_t &visibleMask, uint32_t &insideMask);
+  GLMLV_AVX2_FUNCTION static void testChildrenAvx2(const Node &node,
+      const CullingView &view, bool parentInside, uint32_t &visibleMask,
+      uint32_t &insideMask);
+
+  static const uint32_t LEAF = std::numeric_limits<uint32_t>::max();
+
+  std::vector<Node> m_nodes; // m_nodes[0] is the root
+  std::vector<uint32_t> m_items;
+};
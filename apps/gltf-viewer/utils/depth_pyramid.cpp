@@ -0,0 +1,132 @@
+#include "depth_pyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+DepthPyramid::~DepthPyramid()
+{
+  glDeleteFramebuffers(1, &m_framebuffer); // Ignores 0
+  const GLuint textures[] = {m_depthTexture, m_pyramidTexture};
+  glDeleteTextures(2, textures);
+}
+
+void DepthPyramid::load(const fs::path &shadersPath)
+{
+  m_program = compileProgram({shadersPath / "depth_pyramid.cs.glsl"});
+  m_sourceLevelLocation = m_program.getUniformLocation("uSourceLevel");
+  glProgramUniform1i(
+      m_program.glId(), m_program.getUniformLocation("uSource"), 0);
+}
+
+GLenum DepthPyramid::depthFormat()
+{
+  GLint framebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+  // The default framebuffer names its buffers, not its attachments
+  const GLenum attachment = framebuffer ? GL_DEPTH_ATTACHMENT : GL_DEPTH;
+  const auto get = [&](GLenum name) {
+    GLint value = 0;
+    glGetFramebufferAttachmentParameteriv(
+        GL_DRAW_FRAMEBUFFER, attachment, name, &value);
+    return value;
+  };
+  if (get(GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE) == GL_NONE) {
+    return 0;
+  }
+  const auto depthSize = get(GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE);
+  const auto stencilSize = get(GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE);
+  if (get(GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE) == GL_FLOAT) {
+    return stencilSize ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+  }
+  if (stencilSize) {
+    return GL_DEPTH24_STENCIL8;
+  }
+  return depthSize > 24 ? GL_DEPTH_COMPONENT32
+                        : depthSize > 16 ? GL_DEPTH_COMPONENT24
+                                         : GL_DEPTH_COMPONENT16;
+}
+
+void DepthPyramid::allocate(GLsizei width, GLsizei height, GLenum depthFormat)
+{
+  glDeleteFramebuffers(1, &m_framebuffer);
+  const GLuint textures[] = {m_depthTexture, m_pyramidTexture};
+  glDeleteTextures(2, textures);
+  m_depthFormat = depthFormat;
+  m_width = width;
+  m_height = height;
+  m_levelCount = GLsizei(std::log2(std::max(width, height))) + 1;
+
+  glGenTextures(1, &m_depthTexture);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glGenTextures(1, &m_pyramidTexture);
+  glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+  glTexStorage2D(GL_TEXTURE_2D, m_levelCount, GL_R32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Bound to the draw target by build, which restores the binding
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  const auto hasStencil = depthFormat == GL_DEPTH24_STENCIL8 ||
+                          depthFormat == GL_DEPTH32F_STENCIL8;
+  glFramebufferTexture(GL_DRAW_FRAMEBUFFER,
+      hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+      m_depthTexture, 0);
+  glDrawBuffer(GL_NONE);
+  if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) !=
+      GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Depth pyramid: incomplete framebuffer" << std::endl;
+  }
+}
+
+void DepthPyramid::build(
+    GLsizei width, GLsizei height, const glm::mat4 &viewProjMatrix)
+{
+  GLint readFramebuffer = 0;
+  GLint drawFramebuffer = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+  const auto format = depthFormat();
+  m_valid = format != 0 && width > 0 && height > 0;
+  if (!m_valid) {
+    return;
+  }
+  if (format != m_depthFormat || width != m_width || height != m_height) {
+    allocate(width, height, format);
+  }
+
+  // A blit resolves a multisampled depth buffer, which can't be sampled
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+  m_program.use();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  for (GLsizei level = 0; level < m_levelCount; ++level) {
+    if (level > 0) {
+      // Reads the previous level through the sampler
+      glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+      glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+    }
+    glUniform1i(m_sourceLevelLocation, std::max(level - 1, 0));
+    glBindImageTexture(
+        0, m_pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    const auto levelWidth = GLuint(std::max(width >> level, 1));
+    const auto levelHeight = GLuint(std::max(height >> level, 1));
+    glDispatchCompute((levelWidth + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+        (levelHeight + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  // Sampled by the culling shader
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  m_viewProjMatrix = viewProjMatrix;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Hierarchical depth buffer (Hi-Z) of occlusion culling: a mipmapped R32F
+// texture whose level 0 is a copy of the depth buffer and each next level
+// the farthest depth of the texels it covers. A box is hidden if its nearest
+// depth is behind the farthest depth of the texels of its screen rectangle,
+// read from the level where the rectangle covers at most 2x2 texels.
+class DepthPyramid
+{
+public:
+  DepthPyramid() = default;
+
+  ~DepthPyramid();
+
+  DepthPyramid(const DepthPyramid &) = delete;
+
+  DepthPyramid &operator=(const DepthPyramid &) = delete;
+
+  // Compile the compute shader
+  void load(const fs::path &shadersPath);
+
+  // Build the pyramid from the depth buffer of the bound draw framebuffer,
+  // rendered with viewProjMatrix. The depth is first resolved by a blit into
+  // a texture of the same format, the framebuffer bindings are restored but
+  // the program and the texture bindings of unit 0 are changed.
+  void build(GLsizei width, GLsizei height, const glm::mat4 &viewProjMatrix);
+
+  // False until built, or if the framebuffer has no depth buffer
+  bool isValid() const { return m_valid; }
+
+  GLuint texture() const { return m_pyramidTexture; }
+
+  // View projection of the depth of the last build
+  const glm::mat4 &viewProjMatrix() const { return m_viewProjMatrix; }
+
+private:
+  // Internal format of the depth buffer of the bound draw framebuffer, 0
+  // without depth buffer
+  static GLenum depthFormat();
+
+  // (Re)create the textures for a new size or depth format
+  void allocate(GLsizei width, GLsizei height, GLenum depthFormat);
+
+  static constexpr GLuint WORKGROUP_SIZE = 8;
+
+  GLProgram m_program;
+  GLint m_sourceLevelLocation = -1;
+  GLuint m_depthTexture = 0; // Resolved depth buffer
+  GLuint m_framebuffer = 0; // Blit destination, with m_depthTexture
+  GLuint m_pyramidTexture = 0;
+  GLenum m_depthFormat = 0;
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  GLsizei m_levelCount = 0;
+  glm::mat4 m_viewProjMatrix = glm::mat4(1);
+  bool m_valid = false;
+};
@@ -0,0 +1,60 @@
+#include "draw_batcher.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+void DrawBatcher::build(uint32_t *first, uint32_t *last, bool instancing,
+    const uint8_t *culling, const std::vector<glm::mat4> &nodeMatrices,
+    GLuint firstRunInstance, std::vector<Batch> &batches,
+    std::vector<glm::mat4> &runInstanceMatrices) const
+{
+  // Group instances of the same primitive, and batches by shading variant
+  // to switch program at most once per variant
+  if (instancing) {
+    std::sort(first, last, [&](uint32_t a, uint32_t b) {
+      const auto &instanceA = m_instances[a];
+      const auto &instanceB = m_instances[b];
+      return std::make_tuple(instanceA.variant, instanceA.meshIdx,
+                 instanceA.primitiveIdx, a) <
+             std::make_tuple(instanceB.variant, instanceB.meshIdx,
+                 instanceB.primitiveIdx, b);
+    });
+  }
+  batches.clear();
+  runInstanceMatrices.clear();
+  const auto instanceCount = size_t(last - first);
+  for (size_t runBegin = 0; runBegin < instanceCount;) {
+    const auto instanceIdx = first[runBegin];
+    const auto &instance = m_instances[instanceIdx];
+    const auto runCulling = culling[instanceIdx];
+    auto runEnd = runBegin + 1;
+    if (instancing && instance.variant == 0 && !instance.blended) {
+      while (runEnd < instanceCount) {
+        const auto &other = m_instances[first[runEnd]];
+        if (other.variant != 0 || other.meshIdx != instance.meshIdx ||
+            other.primitiveIdx != instance.primitiveIdx ||
+            culling[first[runEnd]] != runCulling) {
+          break;
+        }
+        ++runEnd;
+      }
+    }
+    const auto count = uint32_t(runEnd - runBegin);
+    if (count > 1) {
+      batches.push_back({uint32_t(runBegin), count, m_instancingVariant,
+          GLuint(firstRunInstance + runInstanceMatrices.size()),
+          GLsizei(count), runCulling});
+      for (auto i = runBegin; i < runEnd; ++i) {
+        runInstanceMatrices.push_back(
+            nodeMatrices[m_instances[first[i]].nodeIdx]);
+      }
+    } else if (instance.variant & m_instancingVariant) {
+      batches.push_back({uint32_t(runBegin), 1, instance.variant,
+          instance.firstGpuInstance, instance.gpuInstanceCount, runCulling});
+    } else {
+      batches.push_back(
+          {uint32_t(runBegin), 1, instance.variant, 0, 0, runCulling});
+    }
+    runBegin = runEnd;
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Draw batches of the visible primitive instances that are not drawn by the
+// multi-draw indirect path. Visible instances of the same primitive, without
+// deformation and with the same face culling, are grouped in runs drawn with
+// one instanced call (automatic instancing). The other instances are drawn
+// one by one, or once for all their GPU instances.
+//
+// Usage:
+//   at load, for each primitive instance, in order:
+//     batcher.addInstance(instance);
+//   each frame:
+//     batcher.build(first, last, instancing, culling, nodeMatrices,
+//         firstRunInstance, batches, runInstanceMatrices);
+class DrawBatcher
+{
+public:
+  // What the batching needs of a primitive instance
+  struct Instance
+  {
+    int nodeIdx;
+    int meshIdx;
+    int primitiveIdx;
+    uint8_t variant; // Shading variant, 0 for static primitives
+    bool blended; // Never grouped in runs, sorted back to front
+    // GPU instances of the node, in the instance matrix buffer
+    GLuint firstGpuInstance;
+    GLsizei gpuInstanceCount; // 0 if the node is not instanced
+  };
+
+  // Visible primitive instances drawn with the same shading variant: one
+  // primitive instance, drawn once or for each of its GPU instances, or a
+  // run of instances of the same primitive drawn with one instanced call
+  struct Batch
+  {
+    uint32_t begin; // Index of the first instance in the visible instances
+    uint32_t count; // Number of primitive instances, more than 1 for a run
+    uint8_t variant;
+    GLuint baseInstance; // In the instance matrix buffer
+    GLsizei instanceCount; // 0 if not drawn with an instanced call
+    uint8_t culling; // Face culling of the instances
+  };
+
+  // instancingVariant is the shading variant of instanced draws, given to
+  // the runs
+  explicit DrawBatcher(uint8_t instancingVariant) :
+      m_instancingVariant(instancingVariant)
+  {
+  }
+
+  void addInstance(const Instance &instance)
+  {
+    m_instances.push_back(instance);
+  }
+
+  // Build the batches of the visible instances [first, last), the indices of
+  // the instances in the order of addInstance(). With instancing, they are
+  // first sorted by variant and primitive. culling is the face culling of
+  // each instance for this frame. The node matrices of the runs are
+  // appended to runInstanceMatrices, their first one is at firstRunInstance
+  // in the instance matrix buffer. Doesn't allocate once the vectors have
+  // reached their maximum size.
+  void build(uint32_t *first, uint32_t *last, bool instancing,
+      const uint8_t *culling, const std::vector<glm::mat4> &nodeMatrices,
+      GLuint firstRunInstance, std::vector<Batch> &batches,
+      std::vector<glm::mat4> &runInstanceMatrices) const;
+
+  size_t instanceCount() const { return m_instances.size(); }
+
+private:
+  uint8_t m_instancingVariant;
+  std::vector<Instance> m_instances;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "cameras.hpp"
+#include "culling.hpp"
+#include "draw_batcher.hpp"
+#include "frame_arena.hpp"
+#include "gpu_culling.hpp"
+#include "indirect_draws.hpp"
+#include "render_queue.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A frame between the threads of the frame pipeline: the worker copies the
+// scene updated for the frame into it and builds the draws with
+// FrameBuilder, while the GL thread submits the previous frame. The GL
+// thread then only reads it. The node transforms are copied since the
+// worker updates them for the next frame.
+struct DrawList
+{
+  // Face culling of a primitive instance, computed each frame: transforms
+  // with a negative determinant reverse the winding of the triangles, and
+  // GPU instances with mixed signs can't be culled in one call
+  static constexpr uint8_t CULL_BACK_FACES = 0;
+  static constexpr uint8_t CULL_MIRRORED_BACK_FACES = 1;
+  static constexpr uint8_t CULL_NO_FACES = 2;
+
+  Camera camera;
+  glm::mat4 viewMatrix;
+  CullingView cullingView;
+  bool frustumCulling; // Settings of the frame, the GUI may change them
+  bool gpuCulling;
+  bool gpuOcclusionCulling;
+  std::vector<glm::mat4> nodeMatrices;
+  std::vector<float> morphWeights;
+  // Skinning and the GPU culled instances to upload, if animated
+  bool sceneChanged;
+  std::vector<glm::mat4> jointMatrices;
+  std::vector<GpuCulling::Instance> gpuCullingInstances;
+  // Culled instances sorted into batches, and the multi-draw indirect
+  // commands of the instances not culled by the GPU
+  std::vector<uint32_t> visibleInstances;
+  std::vector<DrawBatcher::Batch> drawBatches;
+  RenderQueue renderQueue;
+  std::vector<glm::mat4> runInstanceMatrices; // Automatic instancing
+  IndirectDraws::DrawCalls indirectDrawCalls;
+  // Software occlusion culling, 0 if disabled
+  size_t occluderCount;
+  size_t occludedCount;
+  double occlusionTime; // Seconds
+  double prepareTime; // Seconds spent by the worker
+  FrameArena arena; // Scratch memory of the worker, reset each frame
+};
@@ -0,0 +1,135 @@
+#include "dynamic_resolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Scales are multiples of the step, the depth pyramid and the viewport only
+// change when the scale changes by a step
+static constexpr float SCALE_STEP = 1.f / 32.f;
+
+DynamicResolution::~DynamicResolution()
+{
+  glDeleteFramebuffers(1, &m_framebuffer); // Ignores 0
+  glDeleteTextures(1, &m_colorTexture);
+  glDeleteRenderbuffers(1, &m_depthRenderbuffer);
+  if (m_queries[0]) {
+    glDeleteQueries(GLsizei(QUERY_COUNT), m_queries);
+  }
+}
+
+void DynamicResolution::load(
+    const fs::path &shadersPath, GLsizei width, GLsizei height)
+{
+  m_program = FullScreenPass::compileProgram(shadersPath, "upscale.fs.glsl");
+  m_renderSizeLocation = m_program.getUniformLocation("uRenderSize");
+  glProgramUniform1i(
+      m_program.glId(), m_program.getUniformLocation("uColor"), 0);
+  m_pass.load();
+  glGenQueries(GLsizei(QUERY_COUNT), m_queries);
+  std::fill(std::begin(m_scaleHistory), std::end(m_scaleHistory), 1.f);
+
+  // Allocated at the window size, scaled frames use its lower left corner
+  m_windowWidth = width;
+  m_windowHeight = height;
+  m_width = width;
+  m_height = height;
+  glGenTextures(1, &m_colorTexture);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glGenRenderbuffers(1, &m_depthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture(
+      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_colorTexture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER, m_depthRenderbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Dynamic resolution: incomplete framebuffer" << std::endl;
+    m_policy.enabled = false;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::beginFrame(bool moving)
+{
+  // Oldest first, the results of a query are available in order
+  while (m_pendingQueryCount > 0) {
+    const auto query = m_queries[m_firstPendingQuery];
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    update(float(1e-6 * double(nanoseconds)),
+        m_queryScales[m_firstPendingQuery]);
+    m_firstPendingQuery = (m_firstPendingQuery + 1) % QUERY_COUNT;
+    --m_pendingQueryCount;
+  }
+
+  const auto scaled = m_policy.enabled &&
+                      (moving || !m_policy.fullResolutionWhenStill) &&
+                      m_fittingScale < 1.f;
+  m_scale = scaled ? m_fittingScale : 1.f;
+  m_width = std::max(GLsizei(std::lround(m_scale * m_windowWidth)), 1);
+  m_height = std::max(GLsizei(std::lround(m_scale * m_windowHeight)), 1);
+  m_scaleHistory[m_historyOffset] = m_scale;
+  m_historyOffset = (m_historyOffset + 1) % HISTORY_SIZE;
+  glBindFramebuffer(GL_FRAMEBUFFER, scaled ? m_framebuffer : 0);
+
+  // Not timed if all the queries are in flight
+  m_timing = m_pendingQueryCount < QUERY_COUNT;
+  if (m_timing) {
+    const auto queryIdx =
+        (m_firstPendingQuery + m_pendingQueryCount) % QUERY_COUNT;
+    m_queryScales[queryIdx] = m_scale;
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[queryIdx]);
+  }
+}
+
+void DynamicResolution::endFrame()
+{
+  if (m_timing) {
+    glEndQuery(GL_TIME_ELAPSED);
+    ++m_pendingQueryCount;
+    m_timing = false;
+  }
+  if (m_scale == 1.f) {
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, m_windowWidth, m_windowHeight);
+  glProgramUniform2f(m_program.glId(), m_renderSizeLocation, GLfloat(m_width),
+      GLfloat(m_height));
+  m_pass.draw(m_program, m_colorTexture);
+}
+
+void DynamicResolution::update(float gpuTime, float frameScale)
+{
+  m_gpuTime = gpuTime;
+  if (gpuTime <= 0.f) {
+    return;
+  }
+  // The cost of the scene is about proportional to its pixels
+  const auto scale =
+      frameScale * std::sqrt(m_policy.targetGpuTime / gpuTime);
+  if (scale < m_fittingScale) {
+    m_fittingScale = scale; // Over the target, at once
+  } else if (gpuTime < m_policy.increaseThreshold * m_policy.targetGpuTime) {
+    m_fittingScale = std::min(scale, m_fittingScale + SCALE_STEP);
+  }
+  m_fittingScale = std::floor(m_fittingScale / SCALE_STEP) * SCALE_STEP;
+  m_fittingScale =
+      std::clamp(m_fittingScale, std::min(m_policy.minScale, 1.f), 1.f);
+}
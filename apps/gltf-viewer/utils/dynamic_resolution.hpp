@@ -0,0 +1,100 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "full_screen_pass.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Dynamic resolution scaling: while the camera moves, the scene is rendered
+// into an offscreen target at a fraction of the window resolution, chosen
+// to keep the GPU time of the scene under a target, then upscaled to the
+// window with bilinear filtering. The GPU time is measured with timer
+// queries read a few frames later, without waiting for the GPU. Once the
+// camera stops, the scene is rendered at full resolution in the default
+// framebuffer.
+class DynamicResolution
+{
+public:
+  struct Policy
+  {
+    bool enabled = true;
+    float targetGpuTime = 16.6f; // Milliseconds for the scene
+    float minScale = 0.5f; // Of the window width and height
+    // The scale only increases while the GPU time is below this fraction of
+    // the target, so that it doesn't oscillate around the target
+    float increaseThreshold = 0.85f;
+    bool fullResolutionWhenStill = true;
+  };
+
+  static constexpr size_t HISTORY_SIZE = 128;
+
+  DynamicResolution() = default;
+
+  ~DynamicResolution();
+
+  DynamicResolution(const DynamicResolution &) = delete;
+
+  DynamicResolution &operator=(const DynamicResolution &) = delete;
+
+  // Compile the upscaling program and create the target for the window size
+  void load(const fs::path &shadersPath, GLsizei width, GLsizei height);
+
+  Policy &policy() { return m_policy; }
+
+  // Read the finished timer queries, choose the scale of the frame, bind
+  // its framebuffer and start timing. moving is false once the camera stops.
+  void beginFrame(bool moving);
+
+  // Stop timing, upscale a scaled frame into the default framebuffer
+  void endFrame();
+
+  // Resolution of the frame, the window size until the first beginFrame
+  GLsizei width() const { return m_width; }
+  GLsizei height() const { return m_height; }
+  float scale() const { return m_scale; }
+
+  // Scale that fits the target, applied while moving
+  float fittingScale() const { return m_fittingScale; }
+
+  // Milliseconds of the last measured frame, 0 before the first result
+  float gpuTime() const { return m_gpuTime; }
+
+  // Scales of the last frames, oldest first from historyOffset
+  const float *scaleHistory() const { return m_scaleHistory; }
+  size_t historyOffset() const { return m_historyOffset; }
+
+private:
+  static constexpr size_t QUERY_COUNT = 4; // Frames in flight
+
+  // Update the fitting scale from the GPU time of a frame at frameScale
+  void update(float gpuTime, float frameScale);
+
+  Policy m_policy;
+  FullScreenPass m_pass;
+  GLProgram m_program;
+  GLint m_renderSizeLocation = -1;
+  GLuint m_framebuffer = 0;
+  GLuint m_colorTexture = 0;
+  GLuint m_depthRenderbuffer = 0;
+  GLsizei m_windowWidth = 0;
+  GLsizei m_windowHeight = 0;
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  float m_scale = 1.f;
+  float m_fittingScale = 1.f;
+  float m_gpuTime = 0.f;
+
+  // Ring of timer queries: m_pendingQueryCount from m_firstPendingQuery are
+  // waiting for their result, with the scale of their frame
+  GLuint m_queries[QUERY_COUNT] = {};
+  float m_queryScales[QUERY_COUNT] = {};
+  size_t m_firstPendingQuery = 0;
+  size_t m_pendingQueryCount = 0;
+  bool m_timing = false; // A query is active in the current frame
+
+  float m_scaleHistory[HISTORY_SIZE] = {};
+  size_t m_historyOffset = 0;
+};
@@ -0,0 +1,37 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t capacity) :
+    m_block(capacity ? new unsigned char[capacity] : nullptr),
+    m_capacity(capacity)
+{
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+  const auto base = reinterpret_cast<size_t>(m_block.get());
+  const auto offset =
+      (base + m_offset + alignment - 1) / alignment * alignment - base;
+  m_size += size + alignment - 1;
+  if (m_block && offset + size <= m_capacity) {
+    m_offset = offset + size;
+    return m_block.get() + offset;
+  }
+  // Full: from the heap until the next reset, new[] is aligned for the
+  // fundamental types
+  m_heapBlocks.emplace_back(new unsigned char[std::max(size, size_t(1))]);
+  return m_heapBlocks.back().get();
+}
+
+void FrameArena::reset()
+{
+  m_peakSize = std::max(m_peakSize, m_size);
+  if (!m_heapBlocks.empty()) {
+    m_heapBlocks.clear();
+    m_capacity = m_peakSize;
+    m_block.reset(new unsigned char[m_capacity]);
+  }
+  m_offset = 0;
+  m_size = 0;
+}
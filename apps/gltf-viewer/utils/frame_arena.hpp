@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Linear allocator of the transient data of a frame: allocations bump an
+// offset in a single block and are all freed at once by reset. When the
+// block is full, allocations fall back to the heap and the next reset grows
+// the block to the peak size, so the heap is only used until the arena
+// reaches the steady size of the frames. Only for trivially destructible
+// types, nothing is destroyed.
+class FrameArena
+{
+public:
+  explicit FrameArena(size_t capacity = 0);
+
+  FrameArena(const FrameArena &) = delete;
+
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  // size bytes at an address multiple of alignment (a power of 2)
+  void *allocate(size_t size, size_t alignment);
+
+  // Uninitialized array of count values
+  template <typename T> T *allocate(size_t count)
+  {
+    return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Free all the allocations
+  void reset();
+
+  size_t capacity() const { return m_capacity; }
+
+  // Bytes allocated since reset, including the heap fallbacks
+  size_t size() const { return m_size; }
+
+private:
+  std::unique_ptr<unsigned char[]> m_block;
+  size_t m_capacity;
+  size_t m_offset = 0; // In m_block
+  size_t m_size = 0;
+  size_t m_peakSize = 0;
+  std::vector<std::unique_ptr<unsigned char[]>> m_heapBlocks;
+};
+
+// std::stable_partition without its heap buffer: the elements for which
+// predicate is false are moved through the arena. Returns the first of them.
+template <typename T, typename Predicate>
+T *stablePartition(FrameArena &arena, T *first, T *last, Predicate predicate)
+{
+  const auto rejected = arena.allocate<T>(size_t(last - first));
+  size_t rejectedCount = 0;
+  auto accepted = first;
+  for (auto it = first; it != last; ++it) {
+    if (predicate(*it)) {
+      *accepted++ = *it;
+    } else {
+      rejected[rejectedCount++] = *it;
+    }
+  }
+  std::copy(rejected, rejected + rejectedCount, accepted);
+  return accepted;
+}
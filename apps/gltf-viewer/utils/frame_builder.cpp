@@ -0,0 +1,229 @@
+#include "frame_builder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+FrameBuilder::FrameBuilder(
+    const Scene &scene, uint8_t instancingVariant, GLuint firstRunInstance) :
+    m_scene(scene),
+    m_firstRunInstance(firstRunInstance),
+    m_batcher(instancingVariant)
+{
+}
+
+void FrameBuilder::addInstance(const Instance &instance)
+{
+  m_instances.push_back(instance);
+  m_batcher.addInstance({instance.nodeIdx, instance.meshIdx,
+      instance.primitiveIdx, instance.variant, instance.blended,
+      instance.firstGpuInstance, instance.gpuInstanceCount});
+  m_culling.push_back(DrawList::CULL_NO_FACES);
+}
+
+void FrameBuilder::build(
+    const Camera &camera, const Settings &settings, DrawList &drawList)
+{
+  drawList.arena.reset();
+  drawList.camera = camera;
+  drawList.viewMatrix = camera.getViewMatrix();
+  drawList.cullingView = CullingView{drawList.viewMatrix, settings.projMatrix,
+      settings.viewportHeight, settings.minPixelSize};
+  drawList.frustumCulling = settings.frustumCulling;
+  drawList.gpuCulling = settings.gpuCulling;
+  drawList.gpuOcclusionCulling =
+      settings.gpuCulling && settings.gpuOcclusionCulling;
+  auto &visibleInstances = drawList.visibleInstances;
+  auto &drawBatches = drawList.drawBatches;
+  auto &renderQueue = drawList.renderQueue;
+
+  cull(camera, settings, drawList);
+  updateFaceCulling(drawList);
+
+  // The instances of the multi-draw indirect path are moved after the
+  // ones drawn by batches. Its groups cull back faces or none, mirrored
+  // instances are drawn by batches.
+  const auto &indirectDraws = m_scene.indirectDraws;
+  auto indirectBegin = end(visibleInstances);
+  if (settings.multiDrawIndirect) {
+    const auto isBatched = [&](uint32_t instanceIdx) {
+      const auto group = indirectDraws.group(instanceIdx);
+      return group < 0 || m_culling[instanceIdx] !=
+                              (indirectDraws.groups()[group].doubleSided
+                                      ? DrawList::CULL_NO_FACES
+                                      : DrawList::CULL_BACK_FACES);
+    };
+    // std::stable_partition would allocate its buffer each frame
+    const auto first = visibleInstances.data();
+    indirectBegin = begin(visibleInstances) +
+                    (stablePartition(drawList.arena, first,
+                         first + visibleInstances.size(), isBatched) -
+                        first);
+  }
+  const auto batchedInstanceCount =
+      size_t(indirectBegin - begin(visibleInstances));
+
+  // Automatic instancing of the other instances, the matrices of the runs
+  // follow the GPU instances in the instance matrix buffer
+  m_batcher.build(visibleInstances.data(),
+      visibleInstances.data() + batchedInstanceCount,
+      settings.automaticInstancing, m_culling.data(), drawList.nodeMatrices,
+      m_firstRunInstance, drawBatches, drawList.runInstanceMatrices);
+
+  // Without sorting, batches are only grouped by variant
+  renderQueue.clear();
+  for (size_t i = 0; i < drawBatches.size(); ++i) {
+    renderQueue.push(settings.sortRenderQueue
+                         ? sortKey(drawList, drawBatches[i], settings.zFar)
+                         : drawBatches[i].variant,
+        uint32_t(i));
+  }
+  renderQueue.sort();
+
+  // Multi-draw indirect: one command per primitive with the draw records
+  // of its visible instances, one call per group
+  const auto &nodeMatrices = drawList.nodeMatrices;
+  indirectDraws.buildDrawCalls(indirectBegin, end(visibleInstances),
+      [&](uint32_t instanceIdx,
+          std::vector<IndirectDraws::DrawRecord> &drawRecords) {
+        const auto &instance = m_instances[instanceIdx];
+        const auto &nodeMatrix = nodeMatrices[instance.nodeIdx];
+        if (instance.gpuInstanceCount == 0) {
+          drawRecords.push_back({nodeMatrix, instance.materialIndex});
+        }
+        for (GLsizei i = 0; i < instance.gpuInstanceCount; ++i) {
+          drawRecords.push_back({nodeMatrix *
+                                     m_scene.gpuInstanceMatrices
+                                         [instance.firstGpuInstance + i],
+              instance.materialIndex});
+        }
+      },
+      drawList.indirectDrawCalls);
+}
+
+void FrameBuilder::cull(
+    const Camera &camera, const Settings &settings, DrawList &drawList)
+{
+  // Cull primitive instances against the view frustum, then draw the
+  // visible ones in scene order
+  auto &visibleInstances = drawList.visibleInstances;
+  visibleInstances.clear();
+  if (settings.gpuCulling) {
+    if (settings.frustumCulling) {
+      m_scene.cpuCullingBVH.cull(drawList.cullingView, visibleInstances);
+      for (auto &instanceIdx : visibleInstances) {
+        instanceIdx = m_scene.cpuCulledInstances[instanceIdx];
+      }
+      std::sort(begin(visibleInstances), end(visibleInstances));
+    } else {
+      visibleInstances = m_scene.cpuCulledInstances;
+    }
+  } else if (settings.frustumCulling) {
+    m_scene.sceneBVH.cull(drawList.cullingView, visibleInstances);
+    std::sort(begin(visibleInstances), end(visibleInstances));
+  } else {
+    visibleInstances.resize(m_instances.size());
+    std::iota(begin(visibleInstances), end(visibleInstances), 0);
+  }
+
+  drawList.occluderCount = 0;
+  drawList.occludedCount = 0;
+  drawList.occlusionTime = 0.;
+  if (!settings.occlusionCulling) {
+    return;
+  }
+  const auto occlusionStart = std::chrono::steady_clock::now();
+
+  // Occluders are the visible primitives with the largest projected size,
+  // until the triangle budget is spent
+  m_occluderCandidates.clear();
+  for (const auto instanceIdx : visibleInstances) {
+    const auto &instance = m_instances[instanceIdx];
+    if (!instance.occluder || instance.variant != 0 ||
+        instance.gpuInstanceCount > 0) {
+      continue; // No occluder geometry, deformed or instanced
+    }
+    const auto &bounds = m_scene.instanceBounds[instanceIdx];
+    const auto distance =
+        std::max(glm::distance(bounds.center(), camera.eye()), 1e-6f);
+    m_occluderCandidates.emplace_back(
+        glm::length(bounds.extent()) / distance, instanceIdx);
+  }
+  std::sort(begin(m_occluderCandidates), end(m_occluderCandidates),
+      [](const auto &a, const auto &b) { return a.first > b.first; });
+
+  auto &occlusionCuller = m_scene.occlusionCuller;
+  occlusionCuller.beginFrame(settings.projMatrix * drawList.viewMatrix);
+  auto remainingTriangles = settings.occluderTriangleBudget;
+  for (const auto &candidate : m_occluderCandidates) {
+    const auto &instance = m_instances[candidate.second];
+    const auto &geometry = *instance.occluder;
+    const auto triangleCount = geometry.indices.size() / 3;
+    if (triangleCount > remainingTriangles) {
+      continue;
+    }
+    remainingTriangles -= triangleCount;
+    occlusionCuller.addOccluder(drawList.nodeMatrices[instance.nodeIdx],
+        geometry.positions.data(), geometry.positions.size(),
+        geometry.indices.data(), geometry.indices.size());
+    ++drawList.occluderCount;
+  }
+  occlusionCuller.rasterize();
+
+  const auto visibleEnd = std::remove_if(begin(visibleInstances),
+      end(visibleInstances), [&](uint32_t instanceIdx) {
+        return !occlusionCuller.isVisible(
+            m_scene.instanceBounds[instanceIdx]);
+      });
+  drawList.occludedCount = size_t(end(visibleInstances) - visibleEnd);
+  visibleInstances.erase(visibleEnd, end(visibleInstances));
+
+  drawList.occlusionTime = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - occlusionStart)
+                               .count();
+}
+
+void FrameBuilder::updateFaceCulling(const DrawList &drawList)
+{
+  for (const auto instanceIdx : drawList.visibleInstances) {
+    const auto &instance = m_instances[instanceIdx];
+    auto &culling = m_culling[instanceIdx];
+    if (instance.doubleSided) {
+      culling = DrawList::CULL_NO_FACES;
+      continue;
+    }
+    // Joint matrices are not checked, skinned meshes are seldom mirrored
+    const auto nodeMirrored =
+        !instance.skinned &&
+        glm::determinant(glm::mat3(drawList.nodeMatrices[instance.nodeIdx])) <
+            0.f;
+    GLsizei mirroredCount = nodeMirrored;
+    if (instance.gpuInstanceCount > 0) {
+      mirroredCount = 0;
+      for (GLsizei i = 0; i < instance.gpuInstanceCount; ++i) {
+        const auto &instanceMatrix =
+            m_scene.gpuInstanceMatrices[instance.firstGpuInstance + i];
+        mirroredCount += nodeMirrored !=
+                         (glm::determinant(glm::mat3(instanceMatrix)) < 0.f);
+      }
+    }
+    culling = mirroredCount == 0
+                  ? DrawList::CULL_BACK_FACES
+                  : mirroredCount == std::max(instance.gpuInstanceCount, 1)
+                        ? DrawList::CULL_MIRRORED_BACK_FACES
+                        : DrawList::CULL_NO_FACES;
+  }
+}
+
+uint64_t FrameBuilder::sortKey(const DrawList &drawList,
+    const DrawBatcher::Batch &batch, float zFar) const
+{
+  const auto instanceIdx = drawList.visibleInstances[batch.begin];
+  const auto &instance = m_instances[instanceIdx];
+  const RenderQueue::RenderState state{batch.variant, instance.materialIndex,
+      batch.culling, instance.vertexArray};
+  const auto center = m_scene.instanceBounds[instanceIdx].center();
+  const auto depth = -(drawList.viewMatrix * glm::vec4(center, 1)).z;
+  return instance.blended ? RenderQueue::makeBlendedKey(state, depth, zFar)
+                          : RenderQueue::makeOpaqueKey(state, depth, zFar);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "cameras.hpp"
+#include "culling.hpp"
+#include "draw_batcher.hpp"
+#include "draw_list.hpp"
+#include "indirect_draws.hpp"
+#include "occlusion.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// CPU work of a frame: cull the primitive instances, sort their draws into
+// batches and build the multi-draw indirect commands. It makes no OpenGL
+// call, so that it runs on the worker of the frame pipeline while the GL
+// thread submits the previous frame. Its input is the scene data of the
+// caller, constant during the frame, the settings and the node matrices of
+// the draw list, its output is the rest of the draw list.
+//
+// Usage:
+//   at load, for each primitive instance, in order:
+//     builder.addInstance(instance);
+//   each frame, once the node matrices are copied to the draw list:
+//     builder.build(camera, settings, drawList);
+class FrameBuilder
+{
+public:
+  // CPU copy of the triangles of a primitive, used as occluder by software
+  // occlusion culling
+  struct OccluderGeometry
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+  };
+
+  // What the frames need of a primitive instance
+  struct Instance
+  {
+    int nodeIdx;
+    int meshIdx;
+    int primitiveIdx;
+    uint8_t variant; // Shading variant, 0 for static primitives
+    bool skinned; // The node matrix is ignored
+    uint32_t materialIndex; // In the material table
+    bool blended;
+    bool doubleSided;
+    uint32_t vertexArray; // Of the sort keys, 0 for the vertex arena
+    // nullptr if the primitive can't occlude, owned by the caller
+    const OccluderGeometry *occluder;
+    // Instances of the EXT_mesh_gpu_instancing extension of the node, in the
+    // instance matrix buffer
+    GLuint firstGpuInstance;
+    GLsizei gpuInstanceCount; // 0 if the node is not instanced
+  };
+
+  // Scene data read by the frames, owned by the caller. The bounds and the
+  // BVHs are updated by the caller between the frames.
+  struct Scene
+  {
+    const std::vector<AABB> &instanceBounds; // World space
+    const std::vector<glm::mat4> &gpuInstanceMatrices; // Local
+    const BoundingVolumeHierarchy &sceneBVH; // Of all the instances
+    // With GPU culling, the instances culled by the CPU: the BVH of their
+    // bounds and their indices
+    const BoundingVolumeHierarchy &cpuCullingBVH;
+    const std::vector<uint32_t> &cpuCulledInstances;
+    const IndirectDraws &indirectDraws;
+    OcclusionCuller &occlusionCuller;
+  };
+
+  // Settings of a frame, the GUI may change them between frames
+  struct Settings
+  {
+    glm::mat4 projMatrix;
+    float zFar; // Of projMatrix, depth range of the sort keys
+    float viewportHeight; // In pixels, for small feature culling
+    float minPixelSize; // 0 to disable small feature culling
+    bool frustumCulling;
+    bool gpuCulling; // Of the instances of the multi-draw indirect path
+    bool gpuOcclusionCulling;
+    bool occlusionCulling; // On the CPU
+    size_t occluderTriangleBudget;
+    bool multiDrawIndirect;
+    bool automaticInstancing;
+    bool sortRenderQueue;
+  };
+
+  // instancingVariant is the shading variant of the instanced draws. The
+  // matrices of the runs of automatic instancing follow the firstRunInstance
+  // GPU instances in the instance matrix buffer.
+  FrameBuilder(
+      const Scene &scene, uint8_t instancingVariant, GLuint firstRunInstance);
+
+  void addInstance(const Instance &instance);
+
+  // Build the draws of the frame seen by camera into drawList, with the
+  // node matrices it holds. Doesn't allocate once the vectors of drawList
+  // have reached their maximum size.
+  void build(
+      const Camera &camera, const Settings &settings, DrawList &drawList);
+
+private:
+  // Visible instances of the view, by frustum culling then by software
+  // occlusion culling, sorted by index
+  void cull(const Camera &camera, const Settings &settings,
+      DrawList &drawList);
+
+  // Face culling of the visible instances
+  void updateFaceCulling(const DrawList &drawList);
+
+  // Sort key of a batch of the visible instances: blended flag, then for
+  // opaque batches the render state (variant, material, face culling,
+  // vertex array) and the depth, for blended batches the reversed depth and
+  // the render state
+  uint64_t sortKey(const DrawList &drawList, const DrawBatcher::Batch &batch,
+      float zFar) const;
+
+  Scene m_scene;
+  GLuint m_firstRunInstance;
+  std::vector<Instance> m_instances;
+  DrawBatcher m_batcher;
+  std::vector<uint8_t> m_culling; // Face culling of each instance
+  // Visible instances by decreasing projected size
+  std::vector<std::pair<float, uint32_t>> m_occluderCandidates;
+};
@@ -0,0 +1,62 @@
+#include "frame_pipeline.hpp"
+
+#include <cassert>
+#include <chrono>
+
+FramePipeline::FramePipeline(Job job) :
+    m_job(std::move(job)), m_worker([this]() { workerLoop(); })
+{
+}
+
+FramePipeline::~FramePipeline()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wakeCondition.notify_one();
+  m_worker.join(); // The worker finishes its job first
+}
+
+void FramePipeline::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(!m_busy);
+    m_started = true;
+    m_busy = true;
+  }
+  m_wakeCondition.notify_one();
+}
+
+double FramePipeline::wait()
+{
+  const auto waitStart = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_doneCondition.wait(lock, [&]() { return !m_busy; });
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - waitStart)
+      .count();
+}
+
+void FramePipeline::workerLoop()
+{
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wakeCondition.wait(lock, [&]() { return m_quit || m_started; });
+      if (!m_started) {
+        return; // Quit without pending job
+      }
+      m_started = false;
+    }
+
+    m_job();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busy = false;
+    }
+    m_doneCondition.notify_all();
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs the CPU work of the next frame (scene update, culling, draw lists) on
+// a worker thread while the calling thread submits the current frame to
+// OpenGL. The queue between them holds one frame: a job can only start once
+// the previous one was waited for, so the worker is at most one frame ahead
+// and two sets of frame data are enough. The job is given once, it reads its
+// inputs from the state set before start, so that starting a frame does not
+// allocate.
+class FramePipeline
+{
+public:
+  using Job = std::function<void()>;
+
+  explicit FramePipeline(Job job);
+
+  // Wait for the pending job
+  ~FramePipeline();
+
+  FramePipeline(const FramePipeline &) = delete;
+
+  FramePipeline &operator=(const FramePipeline &) = delete;
+
+  // Run the job on the worker, after wait was called for the previous run
+  void start();
+
+  // Wait until the job started last is done, return immediately without
+  // pending job. Returns the time spent waiting, in seconds.
+  double wait();
+
+private:
+  void workerLoop();
+
+  std::mutex m_mutex;
+  std::condition_variable m_wakeCondition;
+  std::condition_variable m_doneCondition;
+  const Job m_job;
+  bool m_started = false; // From start until the worker takes the job
+  bool m_busy = false; // From start to the end of the job
+  bool m_quit = false;
+  std::thread m_worker; // Last, started once the members are initialized
+};
@@ -0,0 +1,55 @@
+#include "full_screen_pass.hpp"
+
+FullScreenPass::~FullScreenPass()
+{
+  glDeleteVertexArrays(1, &m_vertexArray); // Ignores 0
+}
+
+void FullScreenPass::load() { glGenVertexArrays(1, &m_vertexArray); }
+
+GLProgram FullScreenPass::compileProgram(
+    const fs::path &shadersPath, const fs::path &fragmentShader)
+{
+  return ::compileProgram(
+      {shadersPath / "upscale.vs.glsl", shadersPath / fragmentShader});
+}
+
+void FullScreenPass::draw(
+    const GLProgram &program, GLuint texture, bool additive) const
+{
+  GLint previousProgram, previousVertexArray, previousActiveTexture;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &previousActiveTexture);
+  glActiveTexture(GL_TEXTURE0);
+  GLint previousTexture;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  const auto depthTest = glIsEnabled(GL_DEPTH_TEST);
+  const auto blend = glIsEnabled(GL_BLEND);
+  GLint blendFunc[4]; // Source and destination RGB, then alpha
+  glGetIntegerv(GL_BLEND_SRC_RGB, &blendFunc[0]);
+  glGetIntegerv(GL_BLEND_DST_RGB, &blendFunc[1]);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendFunc[2]);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &blendFunc[3]);
+
+  glDisable(GL_DEPTH_TEST);
+  if (additive) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+  } else {
+    glDisable(GL_BLEND);
+  }
+  program.use();
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glBindVertexArray(m_vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindVertexArray(GLuint(previousVertexArray));
+  glBindTexture(GL_TEXTURE_2D, GLuint(previousTexture));
+  glActiveTexture(GLenum(previousActiveTexture));
+  glUseProgram(GLuint(previousProgram));
+  glBlendFuncSeparate(GLenum(blendFunc[0]), GLenum(blendFunc[1]),
+      GLenum(blendFunc[2]), GLenum(blendFunc[3]));
+  blend ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+  depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+// Draw of a triangle covering the viewport, generated by upscale.vs.glsl
+// without vertex buffer, with a fragment shader sampling a 2D texture on
+// unit 0. The depth test is disabled and blending is additive or disabled
+// during the draw. The state changed by the draw is restored after it, so
+// that it doesn't invalidate the state shadowed by a GLStateCache.
+class FullScreenPass
+{
+public:
+  FullScreenPass() = default;
+
+  ~FullScreenPass();
+
+  FullScreenPass(const FullScreenPass &) = delete;
+
+  FullScreenPass &operator=(const FullScreenPass &) = delete;
+
+  // Create the empty vertex array
+  void load();
+
+  // Program of the upscale.vs.glsl vertex shader and the fragment shader of
+  // shadersPath
+  static GLProgram compileProgram(
+      const fs::path &shadersPath, const fs::path &fragmentShader);
+
+  // Draw in the bound draw framebuffer and viewport. additive adds the
+  // fragments to the framebuffer with blending.
+  void draw(const GLProgram &program, GLuint texture, bool additive = false)
+      const;
+
+private:
+  GLuint m_vertexArray = 0; // Empty, the triangle is generated
+};
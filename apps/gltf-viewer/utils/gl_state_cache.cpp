@@ -0,0 +1,173 @@
+#include "gl_state_cache.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+const char *GLStateCache::callName(Call call)
+{
+  static const char *const names[CALL_COUNT] = {"glUseProgram",
+      "glBindVertexArray", "glActiveTexture", "glBindTexture", "glBindBuffer",
+      "glEnable/glDisable", "glFrontFace", "glDepthMask"};
+  return names[call];
+}
+
+GLStateCache::GLStateCache()
+{
+  invalidate();
+}
+
+void GLStateCache::beginFrame()
+{
+  invalidate();
+  for (auto &counts : m_counts) {
+    counts = {};
+  }
+}
+
+void GLStateCache::invalidate()
+{
+  m_program = UNKNOWN;
+  m_vertexArray = UNKNOWN;
+  m_activeTexture = UNKNOWN;
+  for (auto &unitTextures : m_textures) {
+    std::fill(std::begin(unitTextures), std::end(unitTextures), UNKNOWN);
+  }
+  std::fill(std::begin(m_buffers), std::end(m_buffers), UNKNOWN);
+  std::fill(std::begin(m_enabled), std::end(m_enabled), UNKNOWN);
+  m_frontFace = UNKNOWN;
+  m_depthMask = UNKNOWN;
+}
+
+int GLStateCache::textureTargetIndex(GLenum target)
+{
+  switch (target) {
+  case GL_TEXTURE_2D:
+    return TEXTURE_2D;
+  case GL_TEXTURE_2D_ARRAY:
+    return TEXTURE_2D_ARRAY;
+  case GL_TEXTURE_BUFFER:
+    return TEXTURE_BUFFER;
+  default:
+    return TEXTURE_TARGET_COUNT;
+  }
+}
+
+int GLStateCache::bufferTargetIndex(GLenum target)
+{
+  switch (target) {
+  case GL_ARRAY_BUFFER:
+    return ARRAY_BUFFER;
+  case GL_DRAW_INDIRECT_BUFFER:
+    return DRAW_INDIRECT_BUFFER;
+  case GL_PARAMETER_BUFFER_ARB:
+    return PARAMETER_BUFFER;
+  default:
+    return BUFFER_TARGET_COUNT;
+  }
+}
+
+int GLStateCache::capabilityIndex(GLenum capability)
+{
+  switch (capability) {
+  case GL_BLEND:
+    return BLEND;
+  case GL_CULL_FACE:
+    return CULL_FACE;
+  case GL_DEPTH_TEST:
+    return DEPTH_TEST;
+  default:
+    return CAPABILITY_COUNT;
+  }
+}
+
+bool GLStateCache::elide(Call call, bool unchanged)
+{
+  ++(unchanged ? m_counts[call].elided : m_counts[call].issued);
+  return unchanged;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+  if (!elide(USE_PROGRAM, program == m_program)) {
+    m_program = program;
+    glUseProgram(program);
+  }
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray)
+{
+  if (!elide(BIND_VERTEX_ARRAY, vertexArray == m_vertexArray)) {
+    m_vertexArray = vertexArray;
+    glBindVertexArray(vertexArray);
+  }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+  const auto targetIdx = textureTargetIndex(target);
+  const auto shadowed =
+      unit < TEXTURE_UNIT_COUNT && targetIdx < TEXTURE_TARGET_COUNT;
+  if (elide(BIND_TEXTURE,
+          shadowed && m_textures[unit][targetIdx] == texture)) {
+    return;
+  }
+  if (!elide(ACTIVE_TEXTURE, unit == m_activeTexture)) {
+    m_activeTexture = unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+  }
+  if (shadowed) {
+    m_textures[unit][targetIdx] = texture;
+  }
+  glBindTexture(target, texture);
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+  const auto targetIdx = bufferTargetIndex(target);
+  const auto shadowed = targetIdx < BUFFER_TARGET_COUNT;
+  if (!elide(BIND_BUFFER, shadowed && m_buffers[targetIdx] == buffer)) {
+    if (shadowed) {
+      m_buffers[targetIdx] = buffer;
+    }
+    glBindBuffer(target, buffer);
+  }
+}
+
+void GLStateCache::setEnabled(GLenum capability, bool enabled)
+{
+  const auto capabilityIdx = capabilityIndex(capability);
+  const auto shadowed = capabilityIdx < CAPABILITY_COUNT;
+  if (!elide(ENABLE,
+          shadowed && m_enabled[capabilityIdx] == GLuint(enabled))) {
+    if (shadowed) {
+      m_enabled[capabilityIdx] = enabled;
+    }
+    enabled ? glEnable(capability) : glDisable(capability);
+  }
+}
+
+void GLStateCache::frontFace(GLenum mode)
+{
+  if (!elide(FRONT_FACE, mode == m_frontFace)) {
+    m_frontFace = mode;
+    glFrontFace(mode);
+  }
+}
+
+void GLStateCache::depthMask(GLboolean flag)
+{
+  if (!elide(DEPTH_MASK, flag == m_depthMask)) {
+    m_depthMask = flag;
+    glDepthMask(flag);
+  }
+}
+
+GLStateCache::Counts GLStateCache::totalCounts() const
+{
+  Counts total = {};
+  for (const auto &counts : m_counts) {
+    total.issued += counts.issued;
+    total.elided += counts.elided;
+  }
+  return total;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Shadow of the OpenGL state changed by the draw loop: calls that would set
+// the state to its current value are elided. The shadowed state is unknown
+// after beginFrame, since other code (e.g. the GUI) changes it between
+// frames, so the first call of each kind is always issued. Issued and elided
+// calls are counted per frame. The texture units, targets and capabilities
+// used by the draws are shadowed in fixed arrays, calls with other ones are
+// always issued.
+class GLStateCache
+{
+public:
+  enum Call
+  {
+    USE_PROGRAM,
+    BIND_VERTEX_ARRAY,
+    ACTIVE_TEXTURE,
+    BIND_TEXTURE,
+    BIND_BUFFER,
+    ENABLE, // glEnable and glDisable
+    FRONT_FACE,
+    DEPTH_MASK,
+    CALL_COUNT
+  };
+
+  struct Counts
+  {
+    size_t issued;
+    size_t elided;
+  };
+
+  static const char *callName(Call call);
+
+  GLStateCache();
+
+  // Forget the shadowed context state and reset the counts
+  void beginFrame();
+
+  // Forget the shadowed context state, after code that doesn't use the
+  // cache changed it within the frame
+  void invalidate();
+
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vertexArray);
+  // Also selects the texture unit
+  void bindTexture(GLuint unit, GLenum target, GLuint texture);
+  void bindBuffer(GLenum target, GLuint buffer);
+  void setEnabled(GLenum capability, bool enabled);
+  void frontFace(GLenum mode);
+  void depthMask(GLboolean flag);
+
+  const Counts &counts(Call call) const { return m_counts[call]; }
+  Counts totalCounts() const;
+
+private:
+  enum TextureTarget
+  {
+    TEXTURE_2D,
+    TEXTURE_2D_ARRAY,
+    TEXTURE_BUFFER,
+    TEXTURE_TARGET_COUNT
+  };
+  enum BufferTarget
+  {
+    ARRAY_BUFFER,
+    DRAW_INDIRECT_BUFFER,
+    PARAMETER_BUFFER,
+    BUFFER_TARGET_COUNT
+  };
+  enum Capability
+  {
+    BLEND,
+    CULL_FACE,
+    DEPTH_TEST,
+    CAPABILITY_COUNT
+  };
+  static constexpr GLuint TEXTURE_UNIT_COUNT = 8;
+
+  // The index of target or capability, its count if it is not shadowed
+  static int textureTargetIndex(GLenum target);
+  static int bufferTargetIndex(GLenum target);
+  static int capabilityIndex(GLenum capability);
+
+  // Count the call, true if it is elided
+  bool elide(Call call, bool unchanged);
+
+  static constexpr GLuint UNKNOWN = ~GLuint(0);
+  GLuint m_program = UNKNOWN;
+  GLuint m_vertexArray = UNKNOWN;
+  GLuint m_activeTexture = UNKNOWN; // Unit index
+  GLuint m_textures[TEXTURE_UNIT_COUNT][TEXTURE_TARGET_COUNT];
+  GLuint m_buffers[BUFFER_TARGET_COUNT];
+  GLuint m_enabled[CAPABILITY_COUNT]; // 0, 1 or UNKNOWN
+  GLenum m_frontFace = UNKNOWN;
+  GLuint m_depthMask = UNKNOWN;
+  Counts m_counts[CALL_COUNT] = {};
+};
@@ -3,7 +3,71 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <numeric>
+
+namespace
+{
+// Image loader of tinygltf keeping the encoded images, listed in userData
+bool deferImageDecoding(tinygltf::Image *image, const int imageIdx,
+    std::string *, std::string *, int, int, const unsigned char *bytes,
+    int size, void *userData)
+{
+  image->image.assign(bytes, bytes + size);
+  static_cast<std::vector<int> *>(userData)->push_back(imageIdx);
+  return true;
+}
+} // namespace
+
+bool loadGltfFile(
+    const fs::path &path, tinygltf::Model &model, JobSystem *jobSystem)
+{
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  std::vector<int> encodedImages;
+  if (jobSystem) {
+    loader.SetImageLoader(deferImageDecoding, &encodedImages);
+  }
+
+  auto ret = path.extension() == ".glb"
+                 ? loader.LoadBinaryFromFile(
+                       &model, &err, &warn, path.string())
+                 : loader.LoadASCIIFromFile(
+                       &model, &err, &warn, path.string());
+
+  if (ret && !encodedImages.empty()) {
+    std::vector<std::string> imageErrors(encodedImages.size());
+    std::vector<std::string> imageWarnings(encodedImages.size());
+    jobSystem->parallelFor(
+        encodedImages.size(), 1, [&](size_t begin, size_t end) {
+          for (auto i = begin; i < end; ++i) {
+            auto &image = model.images[encodedImages[i]];
+            std::vector<unsigned char> bytes;
+            bytes.swap(image.image);
+            tinygltf::LoadImageData(&image, encodedImages[i], &imageErrors[i],
+                &imageWarnings[i], 0, 0, bytes.data(), int(bytes.size()),
+                nullptr);
+          }
+        });
+    for (size_t i = 0; i < encodedImages.size(); ++i) {
+      err += imageErrors[i];
+      warn += imageWarnings[i];
+      ret = ret && imageErrors[i].empty();
+    }
+  }
+
+  if (!err.empty())
+    std::cerr << "Err: " << err << std::endl;
+  if (!warn.empty())
+    std::cerr << "Warn: " << warn << std::endl;
+
+  if (!ret)
+    std::cerr << "Load failure for " << path << std::endl;
+
+  return ret;
+}
 
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix)
@@ -35,119 +99,468 @@ glm::mat4 getLocalToWorldMatrix(
                                                  node.scale[1], node.scale[2]));
 };
 
+void visitScene(const tinygltf::Model &model,
+    const std::function<void(int, const glm::mat4 &)> &visitNode)
+{
+  if (model.defaultScene < 0) {
+    return;
+  }
+  const std::function<void(int, const glm::mat4 &)> visit =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const glm::mat4 modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        visitNode(nodeIdx, modelMatrix);
+        for (const auto childNodeIdx : node.children) {
+          visit(childNodeIdx, modelMatrix);
+        }
+      };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visit(nodeIdx, glm::mat4(1));
+  }
+}
+
+AABB computePrimitiveBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  AABB bounds;
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return bounds;
+  }
+  const auto &positionAccessor = model.accessors[(*positionAttrIdxIt).second];
+  if (positionAccessor.minValues.size() == 3 &&
+      positionAccessor.maxValues.size() == 3) {
+    // min and max are mandatory for POSITION in glTF 2.0
+    bounds.min = glm::vec3(positionAccessor.minValues[0],
+        positionAccessor.minValues[1], positionAccessor.minValues[2]);
+    bounds.max = glm::vec3(positionAccessor.maxValues[0],
+        positionAccessor.maxValues[1], positionAccessor.maxValues[2]);
+    return bounds;
+  }
+  if (positionAccessor.type != 3 || positionAccessor.bufferView < 0) {
+    std::cerr << "Position accessor with type != VEC3, skipping" << std::endl;
+    return bounds;
+  }
+  const auto &positionBufferView =
+      model.bufferViews[positionAccessor.bufferView];
+  const auto byteOffset =
+      positionAccessor.byteOffset + positionBufferView.byteOffset;
+  const auto &positionBuffer = model.buffers[positionBufferView.buffer];
+  const auto positionByteStride = positionBufferView.byteStride
+                                      ? positionBufferView.byteStride
+                                      : 3 * sizeof(float);
+  for (size_t i = 0; i < positionAccessor.count; ++i) {
+    bounds.extend(*((const glm::vec3 *)&positionBuffer
+                        .data[byteOffset + positionByteStride * i]));
+  }
+  return bounds;
+}
+
 void computeSceneBounds(
     const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
 {
   // Compute scene bounding box
-  // todo refactor with scene drawing
-  // todo need a visitScene generic function that takes a accept() functor
   bboxMin = glm::vec3(std::numeric_limits<float>::max());
   bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
-  if (model.defaultScene >= 0) {
-    const std::function<void(int, const glm::mat4 &)> updateBounds =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const auto &node = model.nodes[nodeIdx];
-          const glm::mat4 modelMatrix =
-              getLocalToWorldMatrix(node, parentMatrix);
-          if (node.mesh >= 0) {
-            const auto &mesh = model.meshes[node.mesh];
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-              const auto &primitive = mesh.primitives[pIdx];
-              const auto positionAttrIdxIt =
-                  primitive.attributes.find("POSITION");
-              if (positionAttrIdxIt == end(primitive.attributes)) {
-                continue;
-              }
-              const auto &positionAccessor =
-                  model.accessors[(*positionAttrIdxIt).second];
-              if (positionAccessor.type != 3) {
-                std::cerr << "Position accessor with type != VEC3, skipping"
-                          << std::endl;
-                continue;
-              }
-              const auto &positionBufferView =
-                  model.bufferViews[positionAccessor.bufferView];
-              const auto byteOffset =
-                  positionAccessor.byteOffset + positionBufferView.byteOffset;
-              const auto &positionBuffer =
-                  model.buffers[positionBufferView.buffer];
-              const auto positionByteStride =
-                  positionBufferView.byteStride ? positionBufferView.byteStride
-                                                : 3 * sizeof(float);
-
-              if (primitive.indices >= 0) {
-                const auto &indexAccessor = model.accessors[primitive.indices];
-                const auto &indexBufferView =
-                    model.bufferViews[indexAccessor.bufferView];
-                const auto indexByteOffset =
-                    indexAccessor.byteOffset + indexBufferView.byteOffset;
-                const auto &indexBuffer = model.buffers[indexBufferView.buffer];
-                auto indexByteStride = indexBufferView.byteStride;
-
-                switch (indexAccessor.componentType) {
-                default:
-                  std::cerr
-                      << "Primitive index accessor with bad componentType "
-                      << indexAccessor.componentType << ", skipping it."
-                      << std::endl;
-                  continue;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint8_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint16_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint32_t);
-                  break;
-                }
-
-                for (size_t i = 0; i < indexAccessor.count; ++i) {
-                  uint32_t index = 0;
-                  switch (indexAccessor.componentType) {
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                    index = *((const uint8_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    index = *((const uint16_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    index = *((const uint32_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  }
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * index]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              } else {
-                for (size_t i = 0; i < positionAccessor.count; ++i) {
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * i]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              }
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &modelMatrix) {
+    const auto &node = model.nodes[nodeIdx];
+    // Instanced meshes are bounded by the bounds of their primitives moved by
+    // each instance, to avoid transforming every vertex of every instance
+    const auto instanceMatrices = readGpuInstanceMatrices(model, node);
+    if (!instanceMatrices.empty()) {
+      for (const auto &primitive : model.meshes[node.mesh].primitives) {
+        const auto primitiveBounds = computePrimitiveBounds(model, primitive);
+        for (const auto &instanceMatrix : instanceMatrices) {
+          const auto bounds =
+              primitiveBounds.transform(modelMatrix * instanceMatrix);
+          bboxMin = glm::min(bboxMin, bounds.min);
+          bboxMax = glm::max(bboxMax, bounds.max);
+        }
+      }
+      return;
+    }
+    if (node.mesh >= 0) {
+      const auto &mesh = model.meshes[node.mesh];
+      for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+        const auto &primitive = mesh.primitives[pIdx];
+        const auto positionAttrIdxIt =
+            primitive.attributes.find("POSITION");
+        if (positionAttrIdxIt == end(primitive.attributes)) {
+          continue;
+        }
+        const auto &positionAccessor =
+            model.accessors[(*positionAttrIdxIt).second];
+        if (positionAccessor.type != 3) {
+          std::cerr << "Position accessor with type != VEC3, skipping"
+                    << std::endl;
+          continue;
+        }
+        const auto &positionBufferView =
+            model.bufferViews[positionAccessor.bufferView];
+        const auto byteOffset =
+            positionAccessor.byteOffset + positionBufferView.byteOffset;
+        const auto &positionBuffer =
+            model.buffers[positionBufferView.buffer];
+        const auto positionByteStride =
+            positionBufferView.byteStride ? positionBufferView.byteStride
+                                          : 3 * sizeof(float);
+
+        if (primitive.indices >= 0) {
+          const auto &indexAccessor = model.accessors[primitive.indices];
+          const auto &indexBufferView =
+              model.bufferViews[indexAccessor.bufferView];
+          const auto indexByteOffset =
+              indexAccessor.byteOffset + indexBufferView.byteOffset;
+          const auto &indexBuffer = model.buffers[indexBufferView.buffer];
+          auto indexByteStride = indexBufferView.byteStride;
+
+          switch (indexAccessor.componentType) {
+          default:
+            std::cerr
+                << "Primitive index accessor with bad componentType "
+                << indexAccessor.componentType << ", skipping it."
+                << std::endl;
+            continue;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            indexByteStride =
+                indexByteStride ? indexByteStride : sizeof(uint8_t);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            indexByteStride =
+                indexByteStride ? indexByteStride : sizeof(uint16_t);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+            indexByteStride =
+                indexByteStride ? indexByteStride : sizeof(uint32_t);
+            break;
+          }
+
+          for (size_t i = 0; i < indexAccessor.count; ++i) {
+            uint32_t index = 0;
+            switch (indexAccessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+              index = *((const uint8_t *)&indexBuffer
+                            .data[indexByteOffset + indexByteStride * i]);
+              break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+              index = *((const uint16_t *)&indexBuffer
+                            .data[indexByteOffset + indexByteStride * i]);
+              break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+              index = *((const uint32_t *)&indexBuffer
+                            .data[indexByteOffset + indexByteStride * i]);
+              break;
             }
+            const auto &localPosition =
+                *((const glm::vec3 *)&positionBuffer
+                        .data[byteOffset + positionByteStride * index]);
+            const auto worldPosition =
+                glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
+            bboxMin = glm::min(bboxMin, worldPosition);
+            bboxMax = glm::max(bboxMax, worldPosition);
           }
-          for (const auto childNodeIdx : node.children) {
-            updateBounds(childNodeIdx, modelMatrix);
+        } else {
+          for (size_t i = 0; i < positionAccessor.count; ++i) {
+            const auto &localPosition =
+                *((const glm::vec3 *)&positionBuffer
+                        .data[byteOffset + positionByteStride * i]);
+            const auto worldPosition =
+                glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
+            bboxMin = glm::min(bboxMin, worldPosition);
+            bboxMax = glm::max(bboxMax, worldPosition);
           }
-        };
-    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
-      updateBounds(nodeIdx, glm::mat4(1));
+        }
+      }
+    }
+  });
+}
+
+std::vector<glm::vec3> readPrimitivePositions(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  std::vector<glm::vec3> positions;
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return positions;
+  }
+  const auto &accessor = model.accessors[(*positionAttrIdxIt).second];
+  if (accessor.type != TINYGLTF_TYPE_VEC3 ||
+      accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
+      accessor.bufferView < 0) {
+    std::cerr << "Position accessor is not a float VEC3, skipping"
+              << std::endl;
+    return positions;
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &buffer = model.buffers[bufferView.buffer];
+  const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+  const auto byteStride =
+      bufferView.byteStride ? bufferView.byteStride : sizeof(glm::vec3);
+  positions.resize(accessor.count);
+  for (size_t i = 0; i < accessor.count; ++i) {
+    std::memcpy(&positions[i], &buffer.data[byteOffset + byteStride * i],
+        sizeof(glm::vec3));
+  }
+  return positions;
+}
+
+std::vector<uint32_t> readPrimitiveTriangles(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  std::vector<uint32_t> indices;
+  if (primitive.indices >= 0) {
+    const auto &accessor = model.accessors[primitive.indices];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto &buffer = model.buffers[bufferView.buffer];
+    const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+    const auto *data = &buffer.data[byteOffset];
+    indices.resize(accessor.count);
+    for (size_t i = 0; i < accessor.count; ++i) {
+      switch (accessor.componentType) {
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        indices[i] = data[i];
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        indices[i] = ((const uint16_t *)data)[i];
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+        indices[i] = ((const uint32_t *)data)[i];
+        break;
+      default:
+        std::cerr << "Primitive index accessor with bad componentType "
+                  << accessor.componentType << ", skipping it." << std::endl;
+        return {};
+      }
+    }
+  } else {
+    const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+    if (positionAttrIdxIt == end(primitive.attributes)) {
+      return indices;
+    }
+    indices.resize(model.accessors[(*positionAttrIdxIt).second].count);
+    std::iota(begin(indices), end(indices), 0);
+  }
+
+  switch (primitive.mode) {
+  case TINYGLTF_MODE_TRIANGLES:
+    indices.resize(indices.size() - indices.size() % 3);
+    return indices;
+  case TINYGLTF_MODE_TRIANGLE_STRIP: {
+    std::vector<uint32_t> triangles;
+    for (size_t i = 2; i < indices.size(); ++i) {
+      // Keep the winding consistent on odd triangles
+      const auto odd = i % 2;
+      triangles.insert(end(triangles), {indices[i - 2 + odd],
+                                           indices[i - 1 - odd], indices[i]});
+    }
+    return triangles;
+  }
+  case TINYGLTF_MODE_TRIANGLE_FAN: {
+    std::vector<uint32_t> triangles;
+    for (size_t i = 2; i < indices.size(); ++i) {
+      triangles.insert(
+          end(triangles), {indices[0], indices[i - 1], indices[i]});
+    }
+    return triangles;
+  }
+  default:
+    return {};
+  }
+}
+
+std::vector<float> readAccessorFloats(
+    const tinygltf::Model &model, int accessorIdx)
+{
+  std::vector<float> values;
+  if (accessorIdx < 0) {
+    return values;
+  }
+  if (size_t(accessorIdx) >= model.accessors.size()) {
+    std::cerr << "Invalid accessor " << accessorIdx << ", skipping"
+              << std::endl;
+    return values;
+  }
+  const auto &accessor = model.accessors[accessorIdx];
+  const auto componentCount = tinygltf::GetNumComponentsInType(accessor.type);
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (componentCount <= 0 || componentSize <= 0 ||
+      (accessor.bufferView < 0 && !accessor.sparse.isSparse)) {
+    std::cerr << "Unsupported accessor " << accessorIdx << ", skipping"
+              << std::endl;
+    return values;
+  }
+
+  // Convert elementCount elements starting at data into output
+  const auto readElements = [&](const unsigned char *data, size_t byteStride,
+                                size_t elementCount, float *output) {
+    for (size_t i = 0; i < elementCount; ++i) {
+      const auto *element = data + byteStride * i;
+      for (int c = 0; c < componentCount; ++c) {
+        const auto *component = element + c * componentSize;
+        auto &value = output[i * componentCount + c];
+        switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+          std::memcpy(&value, component, sizeof(float));
+          break;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+          value = *(const int8_t *)component;
+          if (accessor.normalized)
+            value = std::max(value / 127.f, -1.f);
+          break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+          value = *(const uint8_t *)component;
+          if (accessor.normalized)
+            value /= 255.f;
+          break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT: {
+          int16_t v;
+          std::memcpy(&v, component, sizeof(v));
+          value = accessor.normalized ? std::max(v / 32767.f, -1.f) : v;
+          break;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+          uint16_t v;
+          std::memcpy(&v, component, sizeof(v));
+          value = accessor.normalized ? v / 65535.f : v;
+          break;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+          uint32_t v;
+          std::memcpy(&v, component, sizeof(v));
+          value = float(v);
+          break;
+        }
+        default:
+          std::cerr << "Unsupported component type " << accessor.componentType
+                    << " in accessor " << accessorIdx << ", skipping"
+                    << std::endl;
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+
+  // Without buffer view, elements are zeros replaced by the sparse values
+  values.resize(accessor.count * componentCount, 0.f);
+  if (accessor.bufferView >= 0) {
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto &buffer = model.buffers[bufferView.buffer];
+    const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+    if (!readElements(&buffer.data[byteOffset],
+            accessor.ByteStride(bufferView), accessor.count, values.data())) {
+      return {};
+    }
+  }
+
+  if (accessor.sparse.isSparse) {
+    const auto &sparse = accessor.sparse;
+    const auto &indexView = model.bufferViews[sparse.indices.bufferView];
+    const auto *indexData = &model.buffers[indexView.buffer]
+                                 .data[indexView.byteOffset +
+                                       sparse.indices.byteOffset];
+    const auto &valueView = model.bufferViews[sparse.values.bufferView];
+    const auto *valueData = &model.buffers[valueView.buffer]
+                                 .data[valueView.byteOffset +
+                                       sparse.values.byteOffset];
+    std::vector<float> sparseValues(sparse.count * componentCount);
+    if (!readElements(valueData, componentCount * componentSize,
+            sparse.count, sparseValues.data())) {
+      return {};
+    }
+    for (int i = 0; i < sparse.count; ++i) {
+      size_t elementIdx;
+      switch (sparse.indices.componentType) {
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        elementIdx = indexData[i];
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+        uint16_t v;
+        std::memcpy(&v, indexData + sizeof(v) * i, sizeof(v));
+        elementIdx = v;
+        break;
+      }
+      default: {
+        uint32_t v;
+        std::memcpy(&v, indexData + sizeof(v) * i, sizeof(v));
+        elementIdx = v;
+        break;
+      }
+      }
+      if (elementIdx < accessor.count) {
+        std::copy_n(&sparseValues[i * componentCount], componentCount,
+            &values[elementIdx * componentCount]);
+      }
+    }
+  }
+  return values;
+}
+
+std::vector<glm::mat4> readGpuInstanceMatrices(
+    const tinygltf::Model &model, const tinygltf::Node &node)
+{
+  std::vector<glm::mat4> matrices;
+  const auto extensionIt = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (node.mesh < 0 || extensionIt == end(node.extensions) ||
+      !(*extensionIt).second.IsObject()) {
+    return matrices;
+  }
+  const auto &attributes = (*extensionIt).second.Get("attributes");
+  if (!attributes.IsObject()) {
+    return matrices;
+  }
+
+  // Every attribute has one element per instance
+  size_t instanceCount = 0;
+  std::vector<float> attributeValues[3];
+  const char *attributeNames[3] = {"TRANSLATION", "ROTATION", "SCALE"};
+  const size_t componentCounts[3] = {3, 4, 3};
+  for (size_t i = 0; i < 3; ++i) {
+    const auto &attribute = attributes.Get(attributeNames[i]);
+    if (!attribute.IsNumber()) {
+      continue;
+    }
+    const auto accessorIdx = int(attribute.GetNumberAsInt());
+    if (accessorIdx < 0 || accessorIdx >= int(model.accessors.size())) {
+      std::cerr << "Invalid " << attributeNames[i]
+                << " accessor in EXT_mesh_gpu_instancing, skipping"
+                << std::endl;
+      return matrices;
+    }
+    const auto count = model.accessors[accessorIdx].count;
+    attributeValues[i] = readAccessorFloats(model, accessorIdx);
+    if (attributeValues[i].size() != componentCounts[i] * count ||
+        (instanceCount > 0 && count != instanceCount)) {
+      std::cerr << "Invalid " << attributeNames[i]
+                << " accessor in EXT_mesh_gpu_instancing, skipping"
+                << std::endl;
+      return matrices;
+    }
+    instanceCount = count;
+  }
+
+  const auto &translations = attributeValues[0];
+  const auto &rotations = attributeValues[1];
+  const auto &scales = attributeValues[2];
+  matrices.reserve(instanceCount);
+  for (size_t i = 0; i < instanceCount; ++i) {
+    auto matrix = glm::mat4(1);
+    if (!translations.empty()) {
+      matrix = glm::translate(matrix, glm::vec3(translations[3 * i],
+                                          translations[3 * i + 1],
+                                          translations[3 * i + 2]));
+    }
+    if (!rotations.empty()) {
+      matrix *= glm::mat4_cast(
+          glm::normalize(glm::quat(rotations[4 * i + 3], rotations[4 * i],
+              rotations[4 * i + 1], rotations[4 * i + 2])));
+    }
+    if (!scales.empty()) {
+      matrix = glm::scale(matrix,
+          glm::vec3(scales[3 * i], scales[3 * i + 1], scales[3 * i + 2]));
     }
+    matrices.push_back(matrix);
   }
-}
\ No newline at end of file
+  return matrices;
+}
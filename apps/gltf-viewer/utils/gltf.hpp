@@ -1,10 +1,53 @@
 #pragma once
 
+#include "culling.hpp"
+#include "filesystem.hpp"
+#include "job_system.hpp"
+
+#include <functional>
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
+// Load a .gltf or .glb file, printing errors and warnings on std::cerr. With
+// a job system, the images are decoded in parallel once the file is parsed.
+bool loadGltfFile(const fs::path &path, tinygltf::Model &model,
+    JobSystem *jobSystem = nullptr);
+
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
+// Call visitNode(nodeIdx, localToWorldMatrix) for each node of the default
+// scene, parents before their children
+void visitScene(const tinygltf::Model &model,
+    const std::function<void(int, const glm::mat4 &)> &visitNode);
+
+// Local space bounding box of a primitive, from the min/max of its POSITION
+// accessor (or from its vertices if min/max are missing). Empty if the
+// primitive has no position.
+AABB computePrimitiveBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+
 void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
+
+// Positions of a primitive (VEC3 float POSITION accessor), empty if missing
+std::vector<glm::vec3> readPrimitivePositions(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+
+// Vertex indices of the triangles of a primitive as a triangle list.
+// Strips and fans are converted, non indexed primitives get generated
+// indices. Empty for points and lines.
+std::vector<uint32_t> readPrimitiveTriangles(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+
+// Elements of an accessor as floats (count * component count values).
+// Normalized integer components are converted to [0, 1] or [-1, 1], other
+// integers are converted as is. Sparse values are applied.
+std::vector<float> readAccessorFloats(
+    const tinygltf::Model &model, int accessorIdx);
+
+// Local matrices of the instances of the mesh of a node, from the
+// TRANSLATION, ROTATION and SCALE attributes of its EXT_mesh_gpu_instancing
+// extension. Empty if the node has no instance.
+std::vector<glm::mat4> readGpuInstanceMatrices(
+    const tinygltf::Model &model, const tinygltf::Node &node);
@@ -0,0 +1,212 @@
+#include "gpu_culling.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+// Size of DrawRecord in forward.vs.glsl, with the std430 layout
+static constexpr size_t DRAW_RECORD_SIZE = 80;
+
+GpuCulling::~GpuCulling()
+{
+  const GLuint buffers[] = {m_instanceBuffer, m_initialCommandBuffer,
+      m_commandBuffer, m_drawRecordBuffer, m_commandGroupBuffer,
+      m_drawCountBuffer, m_compactedCommandBuffer};
+  glDeleteBuffers(GLsizei(std::size(buffers)), buffers); // Ignores 0
+  glDeleteBuffers(GLsizei(std::size(m_countBuffers)), m_countBuffers);
+}
+
+void GpuCulling::load(const fs::path &shadersPath,
+    const std::vector<DrawElementsIndirectCommand> &commands,
+    const std::vector<uint32_t> &groupFirstCommands, size_t recordCount)
+{
+  m_cullProgram = compileProgram({shadersPath / "cull_instances.cs.glsl"});
+  m_drawCount = GLAD_GL_ARB_indirect_parameters;
+  if (m_drawCount) {
+    m_compactProgram =
+        compileProgram({shadersPath / "compact_commands.cs.glsl"});
+  }
+  m_commandCount = commands.size();
+  m_groupFirstCommands = groupFirstCommands;
+  const auto getLocation = [&](const GLchar *name) {
+    return m_cullProgram.getUniformLocation(name);
+  };
+  m_instanceCountLocation = getLocation("uInstanceCount");
+  m_frustumCullingLocation = getLocation("uFrustumCulling");
+  m_frustumPlanesLocation = getLocation("uFrustumPlanes");
+  m_eyeLocation = getLocation("uEye");
+  m_pixelScaleLocation = getLocation("uPixelScale");
+  m_minPixelSizeLocation = getLocation("uMinPixelSize");
+  m_phaseLocation = getLocation("uPhase");
+  m_occlusionTestLocation = getLocation("uOcclusionTest");
+  m_occlusionViewProjLocation = getLocation("uOcclusionViewProj");
+  glProgramUniform1i(m_cullProgram.glId(), getLocation("uDepthPyramid"), 0);
+  glProgramUniform1ui(m_cullProgram.glId(), getLocation("uCommandCount"),
+      GLuint(m_commandCount));
+  if (m_drawCount) {
+    glProgramUniform1ui(m_compactProgram.glId(),
+        m_compactProgram.getUniformLocation("uCommandCount"),
+        GLuint(2 * m_commandCount));
+  }
+
+  const auto createBuffer = [](size_t size, const void *data) {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferStorage(
+        GL_COPY_WRITE_BUFFER, std::max(size, size_t(4)), data, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+  };
+
+  // The mirrored commands follow the commands and draw from the second half
+  // of the draw records. Instance counts are reset from these every frame.
+  auto initialCommands = commands;
+  for (auto command : commands) {
+    command.baseInstance += uint32_t(recordCount);
+    initialCommands.push_back(command);
+  }
+  for (auto &command : initialCommands) {
+    command.instanceCount = 0;
+  }
+  const auto commandsSize =
+      initialCommands.size() * sizeof(DrawElementsIndirectCommand);
+  m_initialCommandBuffer =
+      createBuffer(commandsSize, initialCommands.data());
+  m_commandBuffer = createBuffer(commandsSize, initialCommands.data());
+  m_drawRecordBuffer =
+      createBuffer(2 * recordCount * DRAW_RECORD_SIZE, nullptr);
+  glGenBuffers(1, &m_instanceBuffer);
+  const Counts noCounts = {};
+  for (auto &buffer : m_countBuffers) {
+    buffer = createBuffer(sizeof(Counts), &noCounts);
+  }
+
+  if (m_drawCount) {
+    // Group and first command of the group of each command, the mirrored
+    // groups follow the groups
+    const auto groups = uint32_t(groupCount());
+    std::vector<glm::uvec2> commandGroups(initialCommands.size());
+    for (uint32_t group = 0; group < groups; ++group) {
+      const auto first = groupFirstCommands[group];
+      for (auto c = first; c < groupFirstCommands[group + 1]; ++c) {
+        commandGroups[c] = glm::uvec2(group, first);
+        commandGroups[m_commandCount + c] = glm::uvec2(
+            groups + group, uint32_t(m_commandCount) + first);
+      }
+    }
+    m_commandGroupBuffer = createBuffer(
+        commandGroups.size() * sizeof(glm::uvec2), commandGroups.data());
+    m_drawCountBuffer = createBuffer(2 * groups * sizeof(uint32_t), nullptr);
+    m_compactedCommandBuffer = createBuffer(commandsSize, nullptr);
+  }
+
+  std::cout << "GPU culling: " << m_commandCount << " commands in "
+            << groupCount() << " groups"
+            << (m_drawCount ? ", draw counts from the GPU" : "")
+            << std::endl;
+}
+
+void GpuCulling::setInstances(const std::vector<Instance> &instances)
+{
+  m_instanceCount = instances.size();
+  glProgramUniform1ui(
+      m_cullProgram.glId(), m_instanceCountLocation, GLuint(m_instanceCount));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_instanceBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER,
+      std::max(instances.size(), size_t(1)) * sizeof(Instance),
+      instances.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuCulling::cull(const CullingView &view, bool frustumCulling,
+    OcclusionPhase phase, const DepthPyramid *depthPyramid)
+{
+  if (phase != SECOND_PHASE) {
+    // The oldest counts, reused for the frame
+    m_countIndex = (m_countIndex + 1) % std::size(m_countBuffers);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_countBuffers[m_countIndex]);
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(Counts), &m_counts);
+    glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+        GL_UNSIGNED_INT, nullptr);
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, m_initialCommandBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_commandBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+      2 * m_commandCount * sizeof(DrawElementsIndirectCommand));
+  if (m_drawCount) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_drawCountBuffer);
+    glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+        GL_UNSIGNED_INT, nullptr);
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCES_BINDING,
+      m_instanceBuffer);
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, COMMANDS_BINDING, m_commandBuffer);
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, DRAW_RECORDS_BINDING, m_drawRecordBuffer);
+  glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, m_countBuffers[m_countIndex]);
+  if (m_instanceCount > 0) {
+    m_cullProgram.use();
+    const auto occlusionTest = phase != NO_OCCLUSION && depthPyramid &&
+                               depthPyramid->isValid();
+    glUniform1ui(m_phaseLocation, phase);
+    glUniform1i(m_occlusionTestLocation, occlusionTest);
+    if (occlusionTest) {
+      glUniformMatrix4fv(m_occlusionViewProjLocation, 1, GL_FALSE,
+          glm::value_ptr(depthPyramid->viewProjMatrix()));
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, depthPyramid->texture());
+    }
+    glUniform1i(m_frustumCullingLocation, frustumCulling);
+    glUniform4fv(m_frustumPlanesLocation, 6,
+        glm::value_ptr(view.frustum.planes[0]));
+    glUniform3fv(m_eyeLocation, 1, glm::value_ptr(view.eye));
+    glUniform1f(m_pixelScaleLocation, view.pixelScale);
+    glUniform1f(m_minPixelSizeLocation, view.minPixelSize);
+    glDispatchCompute(
+        GLuint((m_instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 1, 1);
+  }
+
+  if (m_drawCount) {
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_GROUPS_BINDING,
+        m_commandGroupBuffer);
+    glBindBufferBase(
+        GL_SHADER_STORAGE_BUFFER, DRAW_COUNTS_BINDING, m_drawCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPACTED_COMMANDS_BINDING,
+        m_compactedCommandBuffer);
+    m_compactProgram.use();
+    glDispatchCompute(
+        GLuint((2 * m_commandCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 1,
+        1);
+  }
+
+  // Commands and draw counts are read by the draws, records by the shaders,
+  // counts by glGetBufferSubData
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                  GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void GpuCulling::drawGroup(size_t group, bool mirrored) const
+{
+  const auto first = m_groupFirstCommands[group];
+  const auto count = m_groupFirstCommands[group + 1] - first;
+  const auto commands = (const GLvoid *)(
+      (first + (mirrored ? m_commandCount : 0)) *
+      sizeof(DrawElementsIndirectCommand));
+  if (m_drawCount) {
+    const auto drawCount = GLintptr(
+        ((mirrored ? groupCount() : 0) + group) * sizeof(uint32_t));
+    glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT,
+        commands, drawCount, GLsizei(count), 0);
+  } else {
+    glMultiDrawElementsIndirect(
+        GL_TRIANGLES, GL_UNSIGNED_INT, commands, GLsizei(count), 0);
+  }
+}
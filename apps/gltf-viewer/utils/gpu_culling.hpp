@@ -0,0 +1,155 @@
+#pragma once
+
+#include "culling.hpp"
+#include "depth_pyramid.hpp"
+#include "filesystem.hpp"
+#include "packed_geometry.hpp"
+#include "ring_buffer.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Culling of the instances of the multi-draw indirect path by a compute
+// shader, so that the CPU cost of their visibility doesn't depend on their
+// number. Each primitive has a fixed command, followed by a twin command for
+// its mirrored instances. Every frame the commands are reset, then the
+// visible instances append their draw records to their command with an
+// atomic counter. With ARB_indirect_parameters, a second pass compacts the
+// commands with visible instances of each group, drawn with
+// glMultiDrawElementsIndirectCountARB. Otherwise all the commands of a group
+// are drawn, the empty ones draw nothing.
+//
+// Occlusion culling runs in two phases: the first one draws the instances
+// not hidden in the depth pyramid of the previous frame and flags the
+// others, then the second one draws the flagged instances not hidden in the
+// pyramid of the instances drawn by the first one.
+class GpuCulling
+{
+public:
+  enum OcclusionPhase
+  {
+    NO_OCCLUSION,
+    FIRST_PHASE,
+    SECOND_PHASE
+  };
+
+  // Instances drawn by each phase, and hidden after the second one
+  struct Counts
+  {
+    uint32_t firstPhase; // All the visible instances without occlusion
+    uint32_t secondPhase;
+    uint32_t occluded;
+  };
+
+  // Input of the culling pass, with the std430 layout of Instance in
+  // cull_instances.cs.glsl
+  struct Instance
+  {
+    glm::mat4 modelMatrix;
+    glm::vec4 boundsMin; // Local bounds of the primitive, w unused
+    glm::vec4 boundsMax;
+    uint32_t command; // Command of the primitive
+    uint32_t materialIndex;
+    uint32_t doubleSided; // Never drawn by the mirrored command
+    uint32_t occluded; // Written by the first phase of occlusion culling
+  };
+
+  GpuCulling() = default;
+
+  ~GpuCulling();
+
+  GpuCulling(const GpuCulling &) = delete;
+
+  GpuCulling &operator=(const GpuCulling &) = delete;
+
+  // Compile the compute shaders and create the buffers. Commands of a group
+  // are contiguous, groupFirstCommands has one more entry for the end. The
+  // base instances of the commands are in [0, recordCount), the mirrored
+  // commands use [recordCount, 2 * recordCount).
+  void load(const fs::path &shadersPath,
+      const std::vector<DrawElementsIndirectCommand> &commands,
+      const std::vector<uint32_t> &groupFirstCommands, size_t recordCount);
+
+  // Upload the instances, when they are created or moved
+  void setInstances(const std::vector<Instance> &instances);
+
+  // Build the commands and the draw records of the visible instances. Uses
+  // its own program and changes the buffer bindings, and the texture
+  // binding of unit 0 to sample the depth pyramid. The first phase tests
+  // occlusion only if depthPyramid is valid, then the second phase retests
+  // the instances it rejected against the rebuilt pyramid.
+  void cull(const CullingView &view, bool frustumCulling,
+      OcclusionPhase phase = NO_OCCLUSION,
+      const DepthPyramid *depthPyramid = nullptr);
+
+  // Counts of the frame FrameRingBuffer::FRAME_COUNT frames ago, read back
+  // by the first cull of each frame without waiting once the frame ring
+  // buffer waited for that frame
+  const Counts &counts() const { return m_counts; }
+
+  // Buffers read by drawGroup: the indirect buffer, the parameter buffer
+  // with ARB_indirect_parameters, and the draw records of the shaders
+  GLuint drawCommandBuffer() const
+  {
+    return m_drawCount ? m_compactedCommandBuffer : m_commandBuffer;
+  }
+  GLuint drawCountBuffer() const { return m_drawCountBuffer; }
+  GLuint drawRecordBuffer() const { return m_drawRecordBuffer; }
+
+  // Draw the (mirrored) instances of a group with the render state and the
+  // buffers of the group bound
+  void drawGroup(size_t group, bool mirrored) const;
+
+  bool usesDrawCount() const { return m_drawCount; }
+
+  size_t instanceCount() const { return m_instanceCount; }
+
+  // Commands of the primitives, excluding the mirrored ones
+  size_t commandCount() const { return m_commandCount; }
+
+  size_t groupCount() const
+  {
+    return m_groupFirstCommands.empty() ? 0 : m_groupFirstCommands.size() - 1;
+  }
+
+private:
+  // Binding points of the storage blocks of the compute shaders
+  static constexpr GLuint INSTANCES_BINDING = 2;
+  static constexpr GLuint COMMANDS_BINDING = 3;
+  static constexpr GLuint DRAW_RECORDS_BINDING = 4;
+  static constexpr GLuint COMMAND_GROUPS_BINDING = 5;
+  static constexpr GLuint DRAW_COUNTS_BINDING = 6;
+  static constexpr GLuint COMPACTED_COMMANDS_BINDING = 7;
+  static constexpr GLuint WORKGROUP_SIZE = 64;
+
+  GLProgram m_cullProgram;
+  GLProgram m_compactProgram;
+  GLint m_instanceCountLocation = -1;
+  GLint m_frustumCullingLocation = -1;
+  GLint m_frustumPlanesLocation = -1;
+  GLint m_eyeLocation = -1;
+  GLint m_pixelScaleLocation = -1;
+  GLint m_minPixelSizeLocation = -1;
+  GLint m_phaseLocation = -1;
+  GLint m_occlusionTestLocation = -1;
+  GLint m_occlusionViewProjLocation = -1;
+  bool m_drawCount = false; // ARB_indirect_parameters
+  size_t m_instanceCount = 0;
+  size_t m_commandCount = 0;
+  std::vector<uint32_t> m_groupFirstCommands;
+  GLuint m_instanceBuffer = 0;
+  GLuint m_initialCommandBuffer = 0; // Commands without instances
+  GLuint m_commandBuffer = 0;
+  GLuint m_drawRecordBuffer = 0;
+  GLuint m_commandGroupBuffer = 0;
+  GLuint m_drawCountBuffer = 0; // By group, then by mirrored group
+  GLuint m_compactedCommandBuffer = 0;
+  // Atomic counters of the last frames, written by the culling shader
+  GLuint m_countBuffers[FrameRingBuffer::FRAME_COUNT] = {};
+  size_t m_countIndex = 0; // Of the current frame
+  Counts m_counts = {};
+};
@@ -0,0 +1,69 @@
+#include "indirect_draws.hpp"
+
+#include <utility>
+
+void IndirectDraws::addInstance(uint32_t instanceIdx, int meshIdx,
+    int primitiveIdx, const PackedGeometry::PrimitiveRange &range,
+    const Group &group, uint32_t recordCount)
+{
+  if (instanceIdx >= m_instances.size()) {
+    m_instances.resize(instanceIdx + 1, {-1, -1, 0, 0, {}, 0});
+  }
+  const auto key = std::make_tuple(group.doubleSided, group.baseColorTexture,
+      group.metallicRoughnessTexture, group.emissiveTexture);
+  const auto it = m_groupIndices.find(key);
+  const auto groupIndex =
+      it != end(m_groupIndices) ? (*it).second : int(m_groups.size());
+  if (it == end(m_groupIndices)) {
+    m_groupIndices[key] = groupIndex;
+    m_groups.push_back(group);
+  }
+  m_instances[instanceIdx] = {
+      groupIndex, -1, meshIdx, primitiveIdx, range, recordCount};
+  m_drawRecordCapacity += recordCount;
+}
+
+void IndirectDraws::buildCommands(const SceneStore &sceneStore)
+{
+  m_commands.clear();
+  m_groupFirstCommands.clear();
+  m_commandBounds.clear();
+  if (m_drawRecordCapacity == 0) {
+    return;
+  }
+  // Record count and range of each primitive of each group
+  std::map<std::tuple<int, int, int>,
+      std::pair<uint32_t, PackedGeometry::PrimitiveRange>>
+      primitives;
+  for (const auto &instance : m_instances) {
+    if (instance.group >= 0) {
+      auto &primitive = primitives[std::make_tuple(
+          instance.group, instance.meshIdx, instance.primitiveIdx)];
+      primitive.first += instance.recordCount;
+      primitive.second = instance.range;
+    }
+  }
+  std::map<std::tuple<int, int, int>, int> primitiveCommands;
+  uint32_t baseInstance = 0;
+  for (const auto &entry : primitives) {
+    int group, meshIdx, primitiveIdx;
+    std::tie(group, meshIdx, primitiveIdx) = entry.first;
+    while (m_groupFirstCommands.size() <= size_t(group)) {
+      m_groupFirstCommands.push_back(uint32_t(m_commands.size()));
+    }
+    primitiveCommands[entry.first] = int(m_commands.size());
+    const auto &range = entry.second.second;
+    m_commands.push_back({range.indexCount, 0, range.firstIndex,
+        range.baseVertex, baseInstance});
+    m_commandBounds.push_back(
+        sceneStore.bounds(sceneStore.primitiveIndex(meshIdx, primitiveIdx)));
+    baseInstance += entry.second.first;
+  }
+  m_groupFirstCommands.push_back(uint32_t(m_commands.size()));
+  for (auto &instance : m_instances) {
+    if (instance.group >= 0) {
+      instance.command = primitiveCommands[std::make_tuple(
+          instance.group, instance.meshIdx, instance.primitiveIdx)];
+    }
+  }
+}
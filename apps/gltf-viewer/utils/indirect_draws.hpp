@@ -0,0 +1,164 @@
+#pragma once
+
+#include "culling.hpp"
+#include "packed_geometry.hpp"
+#include "scene_store.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+// Draws of the multi-draw indirect path: primitive instances of the vertex
+// arena, split in groups drawn by one glMultiDrawElementsIndirect call each.
+// The instances are added once at load. Each frame, the visible ones become
+// one command per primitive with one draw record per instance, read by the
+// shaders from the base instance of the command.
+class IndirectDraws
+{
+public:
+  // Primitives that can be drawn by the same call: same textures and same
+  // culling
+  struct Group
+  {
+    bool doubleSided;
+    GLuint baseColorTexture;
+    GLuint metallicRoughnessTexture;
+    GLuint emissiveTexture;
+  };
+
+  // Per instance data, with the std430 layout of DrawRecord in
+  // forward.vs.glsl
+  struct DrawRecord
+  {
+    glm::mat4 modelMatrix;
+    uint32_t materialIndex;
+    uint32_t padding[3];
+  };
+
+  // Commands of a group submitted with one call
+  struct MultiDraw
+  {
+    int group;
+    uint32_t firstCommand; // In the indirect buffer
+    uint32_t commandCount;
+  };
+
+  // Draw calls of the visible instances of a frame
+  struct DrawCalls
+  {
+    std::vector<DrawRecord> drawRecords;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<MultiDraw> multiDraws;
+  };
+
+  // Add the primitive instance instanceIdx of the caller to the path, in the
+  // group of the same textures and culling, created in the order they are
+  // first seen. recordCount is its number of GPU instances, 1 if not
+  // instanced.
+  void addInstance(uint32_t instanceIdx, int meshIdx, int primitiveIdx,
+      const PackedGeometry::PrimitiveRange &range, const Group &group,
+      uint32_t recordCount);
+
+  // Once all the instances are added, the static commands of the GPU
+  // culling: one per primitive, in group order, with room for the draw
+  // records of all its instances
+  void buildCommands(const SceneStore &sceneStore);
+
+  // -1 if the instance is not in the path
+  int group(uint32_t instanceIdx) const
+  {
+    return instanceIdx < m_instances.size() ? m_instances[instanceIdx].group
+                                            : -1;
+  }
+  // In commands(), -1 if the instance is not in the path
+  int command(uint32_t instanceIdx) const
+  {
+    return instanceIdx < m_instances.size() ? m_instances[instanceIdx].command
+                                            : -1;
+  }
+
+  const std::vector<Group> &groups() const { return m_groups; }
+  // Draw records of all the instances of the path
+  size_t drawRecordCapacity() const { return m_drawRecordCapacity; }
+
+  const std::vector<DrawElementsIndirectCommand> &commands() const
+  {
+    return m_commands;
+  }
+  // First command of each group, followed by the command count
+  const std::vector<uint32_t> &groupFirstCommands() const
+  {
+    return m_groupFirstCommands;
+  }
+  // Local bounds of the primitive of each command
+  const std::vector<AABB> &commandBounds() const { return m_commandBounds; }
+
+  // Sort the visible instances [first, last) of the path by group and
+  // primitive, and build their draw calls. addRecords(instanceIdx,
+  // drawRecords) appends the draw records of an instance. Doesn't allocate
+  // once the vectors of drawCalls have reached their maximum size.
+  template <typename Iterator, typename AddRecords>
+  void buildDrawCalls(Iterator first, Iterator last,
+      const AddRecords &addRecords, DrawCalls &drawCalls) const;
+
+private:
+  struct Instance
+  {
+    int group;
+    int command;
+    int meshIdx;
+    int primitiveIdx;
+    PackedGeometry::PrimitiveRange range;
+    uint32_t recordCount;
+  };
+
+  std::vector<Instance> m_instances; // Indexed by the caller's instances
+  std::vector<Group> m_groups;
+  std::map<std::tuple<bool, GLuint, GLuint, GLuint>, int> m_groupIndices;
+  size_t m_drawRecordCapacity = 0;
+  std::vector<DrawElementsIndirectCommand> m_commands;
+  std::vector<uint32_t> m_groupFirstCommands;
+  std::vector<AABB> m_commandBounds;
+};
+
+template <typename Iterator, typename AddRecords>
+void IndirectDraws::buildDrawCalls(Iterator first, Iterator last,
+    const AddRecords &addRecords, DrawCalls &drawCalls) const
+{
+  auto &drawRecords = drawCalls.drawRecords;
+  auto &commands = drawCalls.commands;
+  auto &multiDraws = drawCalls.multiDraws;
+  multiDraws.clear();
+  commands.clear();
+  drawRecords.clear();
+  std::sort(first, last, [&](uint32_t a, uint32_t b) {
+    const auto &instanceA = m_instances[a];
+    const auto &instanceB = m_instances[b];
+    return std::make_tuple(instanceA.group, instanceA.meshIdx,
+               instanceA.primitiveIdx, a) <
+           std::make_tuple(instanceB.group, instanceB.meshIdx,
+               instanceB.primitiveIdx, b);
+  });
+  for (auto it = first; it != last;) {
+    const auto &instance = m_instances[*it];
+    if (multiDraws.empty() || multiDraws.back().group != instance.group) {
+      multiDraws.push_back({instance.group, uint32_t(commands.size()), 0});
+    }
+    const auto baseInstance = uint32_t(drawRecords.size());
+    for (; it != last && m_instances[*it].meshIdx == instance.meshIdx &&
+           m_instances[*it].primitiveIdx == instance.primitiveIdx;
+         ++it) {
+      addRecords(*it, drawRecords);
+    }
+    const auto &range = instance.range;
+    commands.push_back({range.indexCount,
+        uint32_t(drawRecords.size()) - baseInstance, range.firstIndex,
+        range.baseVertex, baseInstance});
+    ++multiDraws.back().commandCount;
+  }
+}
@@ -0,0 +1,365 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+struct JobSystem::Job
+{
+  std::function<void()> function;
+  Affinity affinity;
+  // Dependencies not done yet, plus one until submitted
+  std::atomic<uint32_t> pendingDependencyCount{1};
+  // The handle and the scheduler, which gives it up once the job is done
+  std::atomic<uint32_t> referenceCount{2};
+  std::mutex mutex; // Protects continuations, written before done
+  std::vector<Job *> continuations;
+  std::atomic<bool> done{false};
+};
+
+namespace
+{
+// Worker of the calling thread, none for the threads that are not workers
+thread_local const JobSystem *t_jobSystem = nullptr;
+thread_local uint32_t t_workerIdx = 0;
+} // namespace
+
+// Chase-Lev deque of fixed capacity: the owner pushes and pops at the
+// bottom, the other workers steal at the top. Only the last job is
+// contended, by a compare and swap on the top.
+class JobSystem::Deque
+{
+public:
+  // Owner only, false when full
+  bool push(Job *job)
+  {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed);
+    const auto top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= CAPACITY) {
+      return false;
+    }
+    m_jobs[bottom & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Owner only, the job pushed last
+  Job *pop()
+  {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed); // Was empty
+      return nullptr;
+    }
+    auto job = m_jobs[bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // The last job, a thief may take it first
+      if (!m_top.compare_exchange_strong(top, top + 1,
+              std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        job = nullptr;
+      }
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+  }
+
+  // Any thread, the job pushed first
+  Job *steal()
+  {
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return nullptr;
+    }
+    const auto job =
+        m_jobs[top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr; // Taken by the owner or another thief
+    }
+    return job;
+  }
+
+private:
+  static const int64_t CAPACITY = 4096; // Power of 2
+
+  std::atomic<int64_t> m_top{0};
+  std::atomic<int64_t> m_bottom{0};
+  std::atomic<Job *> m_jobs[CAPACITY];
+};
+
+// Locked first in first out queue, its storage is reused once emptied
+class JobSystem::Queue
+{
+public:
+  void push(Job *job)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(job);
+  }
+
+  // nullptr if empty
+  Job *pop()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_first == m_jobs.size()) {
+      return nullptr;
+    }
+    const auto job = m_jobs[m_first++];
+    if (m_first == m_jobs.size()) {
+      m_jobs.clear();
+      m_first = 0;
+    }
+    return job;
+  }
+
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size() - m_first;
+  }
+
+private:
+  std::mutex m_mutex;
+  std::vector<Job *> m_jobs;
+  size_t m_first = 0; // The jobs before were popped
+};
+
+JobSystem::JobSystem(uint32_t threadCount) :
+    m_mainThread(std::this_thread::get_id()),
+    m_sharedJobs(new Queue()),
+    m_mainThreadJobs(new Queue())
+{
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (uint32_t workerIdx = 1; workerIdx < threadCount; ++workerIdx) {
+    m_deques.emplace_back(new Deque());
+  }
+  for (uint32_t workerIdx = 0; workerIdx + 1 < threadCount; ++workerIdx) {
+    m_workers.emplace_back([this, workerIdx]() { workerLoop(workerIdx); });
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_quit = true;
+  }
+  m_wakeCondition.notify_all();
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+  for (const auto job : m_freeJobs) {
+    delete job;
+  }
+}
+
+JobSystem::JobHandle JobSystem::create(
+    std::function<void()> function, Affinity affinity)
+{
+  Job *job = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_freeJobMutex);
+    if (!m_freeJobs.empty()) {
+      job = m_freeJobs.back();
+      m_freeJobs.pop_back();
+    }
+  }
+  if (job) {
+    job->pendingDependencyCount = 1;
+    job->referenceCount = 2;
+    job->done = false;
+  } else {
+    job = new Job();
+  }
+  job->function = std::move(function);
+  job->affinity = affinity;
+  return job;
+}
+
+void JobSystem::addDependency(JobHandle job, JobHandle dependency)
+{
+  std::lock_guard<std::mutex> lock(dependency->mutex);
+  if (!dependency->done) {
+    ++job->pendingDependencyCount;
+    dependency->continuations.push_back(job);
+  }
+}
+
+void JobSystem::submit(JobHandle job)
+{
+  if (--job->pendingDependencyCount == 0) {
+    schedule(job);
+  }
+}
+
+void JobSystem::wait(JobHandle job)
+{
+  runUntil([job]() { return job->done.load(std::memory_order_acquire); });
+  release(job);
+}
+
+void JobSystem::release(JobHandle job)
+{
+  if (--job->referenceCount == 0) {
+    job->function = nullptr; // Free its captures now
+    std::lock_guard<std::mutex> lock(m_freeJobMutex);
+    m_freeJobs.push_back(job);
+  }
+}
+
+void JobSystem::parallelForRanges(
+    size_t count, size_t grainSize, RangeFunction run, const void *function)
+{
+  if (count == 0) {
+    return;
+  }
+  if (grainSize == 0) {
+    grainSize = std::max(count / (4 * threadCount()), size_t(1));
+  }
+  const auto rangeCount = (count + grainSize - 1) / grainSize;
+  if (rangeCount == 1 || m_workers.empty()) {
+    run(function, 0, count);
+    return;
+  }
+
+  // The jobs only capture the ranges and their first index, which fits in
+  // std::function without allocation
+  struct Ranges
+  {
+    RangeFunction run;
+    const void *function;
+    size_t count;
+    size_t grainSize;
+    std::atomic<size_t> pendingRangeCount;
+  } ranges{run, function, count, grainSize, {rangeCount - 1}};
+  for (size_t rangeIdx = 1; rangeIdx < rangeCount; ++rangeIdx) {
+    const auto job = create([&ranges, begin = rangeIdx * grainSize]() {
+      ranges.run(ranges.function, begin,
+          std::min(begin + ranges.grainSize, ranges.count));
+      --ranges.pendingRangeCount;
+    });
+    submit(job);
+    release(job);
+  }
+  // The calling thread takes the first range, then helps with the others
+  run(function, 0, grainSize);
+  runUntil([&]() { return ranges.pendingRangeCount == 0; });
+}
+
+size_t JobSystem::runMainThreadJobs()
+{
+  assert(std::this_thread::get_id() == m_mainThread);
+  // Their continuations on the main thread are queued after them and wait
+  // for the next call
+  const auto jobCount = m_mainThreadJobs->size();
+  for (size_t jobIdx = 0; jobIdx < jobCount; ++jobIdx) {
+    execute(m_mainThreadJobs->pop());
+  }
+  return jobCount;
+}
+
+void JobSystem::schedule(Job *job)
+{
+  if (job->affinity == MAIN_THREAD) {
+    m_mainThreadJobs->push(job);
+    return;
+  }
+  if (t_jobSystem == this) {
+    if (!m_deques[t_workerIdx]->push(job)) {
+      execute(job); // Full, run it now
+      return;
+    }
+  } else {
+    m_sharedJobs->push(job);
+  }
+  ++m_queuedJobCount;
+  if (m_sleepingWorkerCount > 0) {
+    // Taken while the worker checks the count, so that it can't miss it
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_wakeCondition.notify_one();
+  }
+}
+
+void JobSystem::execute(Job *job)
+{
+  job->function();
+
+  std::vector<Job *> continuations;
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    continuations.swap(job->continuations);
+    job->done.store(true, std::memory_order_release);
+  }
+  for (const auto continuation : continuations) {
+    submit(continuation);
+  }
+  release(job);
+}
+
+JobSystem::Job *JobSystem::findJob()
+{
+  const auto isWorker = t_jobSystem == this;
+  Job *job = nullptr;
+  if (isWorker) {
+    job = m_deques[t_workerIdx]->pop();
+  }
+  if (!job) {
+    job = m_sharedJobs->pop();
+  }
+  // Steal from the next workers first, spreading the thieves
+  const auto dequeCount = m_deques.size();
+  const auto first = isWorker ? t_workerIdx + 1 : 0;
+  for (size_t i = 0; !job && i < dequeCount; ++i) {
+    const auto dequeIdx = (first + i) % dequeCount;
+    if (!isWorker || dequeIdx != t_workerIdx) {
+      job = m_deques[dequeIdx]->steal();
+    }
+  }
+  if (job) {
+    --m_queuedJobCount;
+  }
+  return job;
+}
+
+void JobSystem::runUntil(const std::function<bool()> &isDone)
+{
+  const auto isMainThread = std::this_thread::get_id() == m_mainThread;
+  while (!isDone()) {
+    Job *job = isMainThread ? m_mainThreadJobs->pop() : nullptr;
+    if (!job) {
+      job = findJob();
+    }
+    if (job) {
+      execute(job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::workerLoop(uint32_t workerIdx)
+{
+  t_jobSystem = this;
+  t_workerIdx = workerIdx;
+  while (true) {
+    if (const auto job = findJob()) {
+      execute(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    ++m_sleepingWorkerCount;
+    m_wakeCondition.wait(
+        lock, [&]() { return m_quit || m_queuedJobCount > 0; });
+    --m_sleepingWorkerCount;
+    if (m_quit) {
+      return;
+    }
+  }
+}
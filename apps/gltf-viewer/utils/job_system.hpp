@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler shared by the loader, the culling and the
+// animation. Each worker owns a lock-free deque: it pushes and pops its jobs
+// at the bottom, idle workers steal the oldest ones at the top. The threads
+// that are not workers (the GL thread, the frame pipeline) submit to a shared
+// queue and run jobs while they wait. Jobs created with MAIN_THREAD only run
+// on the thread that created the system, for the OpenGL work.
+//
+// Usage:
+//   const auto decode = jobs.create([&]() { ... });
+//   const auto upload = jobs.create([&]() { ... }, JobSystem::MAIN_THREAD);
+//   jobs.addDependency(upload, decode); // upload continues decode
+//   jobs.submit(upload);
+//   jobs.submit(decode);
+//   jobs.release(decode);
+//   jobs.wait(upload);
+class JobSystem
+{
+public:
+  struct Job;
+  // Valid until given back by wait or release
+  using JobHandle = Job *;
+
+  enum Affinity
+  {
+    ANY_THREAD,
+    MAIN_THREAD // Run by wait or runMainThreadJobs on the main thread
+  };
+
+  // threadCount includes the calling thread, which becomes the main thread.
+  // threadCount = 0 uses one thread per hardware thread.
+  explicit JobSystem(uint32_t threadCount = 0);
+
+  // The jobs must be done
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  uint32_t threadCount() const { return uint32_t(m_workers.size() + 1); }
+
+  // Create a job, it runs once submitted and its dependencies are done
+  JobHandle create(
+      std::function<void()> function, Affinity affinity = ANY_THREAD);
+
+  // Run job after dependency, before job is submitted
+  void addDependency(JobHandle job, JobHandle dependency);
+
+  void submit(JobHandle job);
+
+  // Run other jobs until job is done, then give up its handle
+  void wait(JobHandle job);
+
+  // Give up the handle of a job that is not waited for
+  void release(JobHandle job);
+
+  // Run function(begin, end) over the ranges of at most grainSize indices
+  // of [0, count), return when all are done. grainSize = 0 splits the
+  // indices in a few ranges per thread. function is called by reference,
+  // nothing is copied to the heap.
+  template <typename Function>
+  void parallelFor(size_t count, size_t grainSize, const Function &function)
+  {
+    parallelForRanges(count, grainSize,
+        [](const void *function, size_t begin, size_t end) {
+          (*static_cast<const Function *>(function))(begin, end);
+        },
+        &function);
+  }
+
+  // Run the main thread jobs ready so far, on the main thread. Returns
+  // their count.
+  size_t runMainThreadJobs();
+
+private:
+  class Deque;
+  class Queue;
+
+  using RangeFunction = void (*)(
+      const void *function, size_t begin, size_t end);
+
+  void parallelForRanges(size_t count, size_t grainSize, RangeFunction run,
+      const void *function);
+  void schedule(Job *job);
+  void execute(Job *job);
+  // Take a job the calling thread may run, nullptr if none
+  Job *findJob();
+  // Run jobs until isDone returns true
+  void runUntil(const std::function<bool()> &isDone);
+  void workerLoop(uint32_t workerIdx);
+
+  std::thread::id m_mainThread;
+  std::vector<std::unique_ptr<Deque>> m_deques; // One per worker
+
+  // Jobs submitted by the threads that are not workers
+  std::unique_ptr<Queue> m_sharedJobs;
+  std::unique_ptr<Queue> m_mainThreadJobs;
+
+  // Released jobs, reused by create so that the frames don't allocate them
+  std::mutex m_freeJobMutex;
+  std::vector<Job *> m_freeJobs;
+
+  // Jobs in the deques and the shared queue, the idle workers sleep while
+  // there are none
+  std::atomic<int64_t> m_queuedJobCount{0};
+  std::atomic<uint32_t> m_sleepingWorkerCount{0};
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wakeCondition;
+  bool m_quit = false;
+
+  std::vector<std::thread> m_workers; // Last, started once all is ready
+};
@@ -0,0 +1,98 @@
+#include "morphing.hpp"
+#include "gltf.hpp"
+
+#include <cmath>
+#include <iostream>
+
+void MorphTargets::load(const tinygltf::Model &model)
+{
+  m_firstPrimitives.clear();
+  m_primitives.clear();
+  m_deltaBounds.clear();
+  m_texels.clear();
+
+  for (const auto &mesh : model.meshes) {
+    m_firstPrimitives.push_back(uint32_t(m_primitives.size()));
+    for (const auto &primitive : mesh.primitives) {
+      PrimitiveTargets targets{uint32_t(m_texels.size()), 0, 0};
+      AABB deltaBounds(glm::vec3(0), glm::vec3(0));
+      const auto positionIt = primitive.attributes.find("POSITION");
+      if (!primitive.targets.empty() &&
+          positionIt != end(primitive.attributes)) {
+        targets.vertexCount =
+            uint32_t(model.accessors[(*positionIt).second].count);
+        targets.targetCount = uint32_t(primitive.targets.size());
+        m_texels.resize(m_texels.size() +
+                            2 * targets.targetCount * targets.vertexCount,
+            glm::vec4(0));
+      }
+      for (uint32_t t = 0; t < targets.targetCount; ++t) {
+        const auto &target = primitive.targets[t];
+        auto *texels =
+            &m_texels[targets.firstTexel + 2 * t * targets.vertexCount];
+        AABB targetBounds(glm::vec3(0), glm::vec3(0));
+        // Other attributes (tangents) are not used by the shaders
+        for (const auto &attribute : {"POSITION", "NORMAL"}) {
+          const auto it = target.find(attribute);
+          if (it == end(target)) {
+            continue;
+          }
+          const auto deltas = readAccessorFloats(model, (*it).second);
+          if (deltas.size() != 3 * targets.vertexCount) {
+            std::cerr << "Invalid " << attribute << " deltas in morph target "
+                      << t << ", skipping" << std::endl;
+            continue;
+          }
+          const auto isPosition = std::string(attribute) == "POSITION";
+          for (uint32_t v = 0; v < targets.vertexCount; ++v) {
+            const auto delta = glm::vec3(
+                deltas[3 * v], deltas[3 * v + 1], deltas[3 * v + 2]);
+            texels[isPosition ? v : targets.vertexCount + v] =
+                glm::vec4(delta, 0);
+            if (isPosition) {
+              targetBounds.extend(delta);
+            }
+          }
+        }
+        deltaBounds.min += targetBounds.min;
+        deltaBounds.max += targetBounds.max;
+      }
+      m_primitives.push_back(targets);
+      m_deltaBounds.push_back(deltaBounds);
+    }
+  }
+}
+
+AABB MorphTargets::morphedBounds(
+    int meshIdx, int primitiveIdx, const AABB &primitiveBounds) const
+{
+  const auto &deltaBounds =
+      m_deltaBounds[m_firstPrimitives[meshIdx] + primitiveIdx];
+  return AABB(primitiveBounds.min + deltaBounds.min,
+      primitiveBounds.max + deltaBounds.max);
+}
+
+uint32_t MorphTargets::selectActiveTargets(const float *weights,
+    uint32_t weightCount, int32_t *targets, float *activeWeights)
+{
+  // Insertion in a short list sorted by decreasing magnitude
+  uint32_t activeCount = 0;
+  for (uint32_t i = 0; i < weightCount; ++i) {
+    const auto magnitude = std::abs(weights[i]);
+    if (magnitude == 0.f ||
+        (activeCount == MAX_ACTIVE_TARGETS &&
+            magnitude <= std::abs(activeWeights[activeCount - 1]))) {
+      continue;
+    }
+    auto position = std::min(activeCount, MAX_ACTIVE_TARGETS - 1);
+    for (; position > 0 && std::abs(activeWeights[position - 1]) < magnitude;
+         --position) {
+      targets[position] = targets[position - 1];
+      activeWeights[position] = activeWeights[position - 1];
+    }
+    targets[position] = int32_t(i);
+    activeWeights[position] = weights[i];
+    activeCount = std::min(activeCount + 1, MAX_ACTIVE_TARGETS);
+  }
+  return activeCount;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "culling.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Position and normal deltas of the morph targets of all the primitives of a
+// glTF model, packed once at load for a texture buffer. Texels of target t of
+// a primitive are the position deltas of its vertices from
+// firstTexel + 2 * t * vertexCount, followed by their normal deltas.
+class MorphTargets
+{
+public:
+  // Maximum number of targets blended by a draw
+  static constexpr uint32_t MAX_ACTIVE_TARGETS = 8;
+
+  struct PrimitiveTargets
+  {
+    uint32_t firstTexel;
+    uint32_t vertexCount;
+    uint32_t targetCount; // 0 if the primitive has no target
+  };
+
+  void load(const tinygltf::Model &model);
+
+  const PrimitiveTargets &primitiveTargets(
+      int meshIdx, int primitiveIdx) const
+  {
+    return m_primitives[m_firstPrimitives[meshIdx] + primitiveIdx];
+  }
+
+  const std::vector<glm::vec4> &texels() const { return m_texels; }
+
+  // Extend the local bounds of a primitive to contain its vertices for any
+  // weights in [0, 1]
+  AABB morphedBounds(
+      int meshIdx, int primitiveIdx, const AABB &primitiveBounds) const;
+
+  // Select the non-zero weights with the largest magnitude, at most
+  // MAX_ACTIVE_TARGETS. Return the number of targets written in targets and
+  // activeWeights.
+  static uint32_t selectActiveTargets(const float *weights,
+      uint32_t weightCount, int32_t *targets, float *activeWeights);
+
+private:
+  std::vector<uint32_t> m_firstPrimitives; // In m_primitives, by mesh
+  std::vector<PrimitiveTargets> m_primitives;
+  // Sum of the negative (min) and positive (max) deltas of the targets
+  std::vector<AABB> m_deltaBounds;
+  std::vector<glm::vec4> m_texels;
+};
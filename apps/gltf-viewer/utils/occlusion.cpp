@@ -0,0 +1,428 @@
+#include "occlusion.hpp"
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Triangles with a vertex farther than this outside of the screen (in NDC)
+// are dropped: edge functions would lose too much precision
+const float GUARD_BAND = 1e4f;
+
+// Edge function of the oriented edge (p, q): e(x, y) = a * x + b * y + c is
+// positive on the left side of the edge
+struct EdgeFunction
+{
+  float a, b, c;
+
+  EdgeFunction(const glm::vec3 &p, const glm::vec3 &q) :
+      a(p.y - q.y), b(q.x - p.x), c(p.x * q.y - p.y * q.x)
+  {
+  }
+};
+
+// Edge functions and depth plane of a triangle, and the pixels of a tile
+// covered by its bounding box
+struct TriangleSetup
+{
+  EdgeFunction e0, e1, e2;
+  float zA, zB, zC; // depth(x, y) = zA * x + zB * y + zC
+  int startX, maxX; // startX is aligned on 8
+  int minY, maxY;
+};
+
+// Write the depth of the pixels inside the triangle, if nearer
+void fillTriangle(const TriangleSetup &setup, float *depth, uint32_t width)
+{
+  for (int y = setup.minY; y <= setup.maxY; ++y) {
+    const auto py = float(y) + 0.5f;
+    const auto e0Row = setup.e0.b * py + setup.e0.c;
+    const auto e1Row = setup.e1.b * py + setup.e1.c;
+    const auto e2Row = setup.e2.b * py + setup.e2.c;
+    const auto depthRow = setup.zB * py + setup.zC;
+    auto *row = depth + y * width;
+    for (int x = setup.startX; x <= setup.maxX; ++x) {
+      const auto px = float(x) + 0.5f;
+      if (setup.e0.a * px + e0Row >= 0.f && setup.e1.a * px + e1Row >= 0.f &&
+          setup.e2.a * px + e2Row >= 0.f) {
+        row[x] = std::min(row[x], setup.zA * px + depthRow);
+      }
+    }
+  }
+}
+
+GLMLV_AVX2_FUNCTION void fillTriangleAvx2(
+    const TriangleSetup &setup, float *depth, uint32_t width)
+{
+#if GLMLV_AVX2
+  const auto offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f,
+      6.5f, 7.5f);
+  const auto e0A = _mm256_set1_ps(setup.e0.a);
+  const auto e1A = _mm256_set1_ps(setup.e1.a);
+  const auto e2A = _mm256_set1_ps(setup.e2.a);
+  const auto depthA = _mm256_set1_ps(setup.zA);
+  const auto zero = _mm256_setzero_ps();
+
+  for (int y = setup.minY; y <= setup.maxY; ++y) {
+    const auto py = float(y) + 0.5f;
+    const auto e0Row = _mm256_set1_ps(setup.e0.b * py + setup.e0.c);
+    const auto e1Row = _mm256_set1_ps(setup.e1.b * py + setup.e1.c);
+    const auto e2Row = _mm256_set1_ps(setup.e2.b * py + setup.e2.c);
+    const auto depthRow = _mm256_set1_ps(setup.zB * py + setup.zC);
+    auto *row = depth + y * width;
+    for (int x = setup.startX; x <= setup.maxX; x += 8) {
+      const auto px = _mm256_add_ps(_mm256_set1_ps(float(x)), offsets);
+      const auto w0 = _mm256_fmadd_ps(e0A, px, e0Row);
+      const auto w1 = _mm256_fmadd_ps(e1A, px, e1Row);
+      const auto w2 = _mm256_fmadd_ps(e2A, px, e2Row);
+      const auto inside = _mm256_and_ps(
+          _mm256_and_ps(_mm256_cmp_ps(w0, zero, _CMP_GE_OQ),
+              _mm256_cmp_ps(w1, zero, _CMP_GE_OQ)),
+          _mm256_cmp_ps(w2, zero, _CMP_GE_OQ));
+      if (_mm256_testz_ps(inside, inside)) {
+        continue;
+      }
+      const auto pixelDepth = _mm256_fmadd_ps(depthA, px, depthRow);
+      const auto oldDepth = _mm256_loadu_ps(row + x);
+      const auto newDepth = _mm256_min_ps(oldDepth, pixelDepth);
+      _mm256_storeu_ps(row + x, _mm256_blendv_ps(oldDepth, newDepth, inside));
+    }
+  }
+#else
+  fillTriangle(setup, depth, width);
+#endif
+}
+} // namespace
+
+OcclusionCuller::OcclusionCuller(
+    JobSystem &jobSystem, uint32_t width, uint32_t height) :
+    m_jobSystem(jobSystem),
+    m_width((std::max(width, 1u) + TILE_WIDTH - 1) / TILE_WIDTH * TILE_WIDTH),
+    m_height(
+        (std::max(height, 1u) + TILE_HEIGHT - 1) / TILE_HEIGHT * TILE_HEIGHT),
+    m_tileCountX(m_width / TILE_WIDTH),
+    m_tileCountY(m_height / TILE_HEIGHT),
+    m_depth(m_width * m_height, 1.f),
+    m_blockMaxDepth((m_width / BLOCK_SIZE) * (m_height / BLOCK_SIZE), 1.f),
+    m_avx2(cpuSupportsAvx2())
+{
+  // One range of occluders per thread
+  const auto rangeCount = jobSystem.threadCount();
+  m_triangles.resize(rangeCount);
+  m_bins.resize(rangeCount);
+  for (auto &bins : m_bins) {
+    bins.resize(m_tileCountX * m_tileCountY);
+  }
+  m_clipPositions.resize(rangeCount);
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4 &viewProjMatrix)
+{
+  m_viewProjMatrix = viewProjMatrix;
+  m_occluders.clear();
+  m_occluderTriangleCount = 0;
+}
+
+void OcclusionCuller::addOccluder(const glm::mat4 &modelMatrix,
+    const glm::vec3 *positions, size_t vertexCount, const uint32_t *indices,
+    size_t indexCount)
+{
+  if (indexCount < 3) {
+    return;
+  }
+  m_occluders.push_back({m_viewProjMatrix * modelMatrix, positions,
+      vertexCount, indices, indexCount});
+  m_occluderTriangleCount += indexCount / 3;
+}
+
+void OcclusionCuller::rasterize()
+{
+  for (size_t rangeIdx = 0; rangeIdx < m_triangles.size(); ++rangeIdx) {
+    m_triangles[rangeIdx].clear();
+    for (auto &bin : m_bins[rangeIdx]) {
+      bin.clear();
+    }
+  }
+
+  // Transform, clip and bin triangles of each occluder
+  const auto rangeSize =
+      (m_occluders.size() + m_triangles.size() - 1) / m_triangles.size();
+  m_jobSystem.parallelFor(
+      m_occluders.size(), rangeSize, [&](size_t begin, size_t end) {
+        for (auto occluderIdx = begin; occluderIdx < end; ++occluderIdx) {
+          setupTriangles(m_occluders[occluderIdx], begin / rangeSize);
+        }
+      });
+
+  m_rasterizedTriangleCount = 0;
+  for (const auto &triangles : m_triangles) {
+    m_rasterizedTriangleCount += triangles.size();
+  }
+
+  // Each tile is rasterized by a single worker, so that depth writes never
+  // conflict
+  m_jobSystem.parallelFor(
+      m_tileCountX * m_tileCountY, 1, [&](size_t begin, size_t end) {
+        for (auto tileIdx = begin; tileIdx < end; ++tileIdx) {
+          rasterizeTile(uint32_t(tileIdx));
+        }
+      });
+}
+
+bool OcclusionCuller::isVisible(const AABB &worldBox) const
+{
+  if (worldBox.isEmpty()) {
+    return false;
+  }
+
+  // Screen space bounds of the 8 corners
+  auto screenMin = glm::vec3(std::numeric_limits<float>::max());
+  auto screenMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (uint32_t i = 0; i < 8; ++i) {
+    const auto corner = glm::vec3(i & 1 ? worldBox.max.x : worldBox.min.x,
+        i & 2 ? worldBox.max.y : worldBox.min.y,
+        i & 4 ? worldBox.max.z : worldBox.min.z);
+    const auto clip = m_viewProjMatrix * glm::vec4(corner, 1);
+    if (clip.w <= 0.f || clip.z < -clip.w) {
+      return true; // Crossing the near plane
+    }
+    const auto ndc = glm::vec3(clip) / clip.w;
+    const auto screen =
+        glm::vec3((0.5f * ndc.x + 0.5f) * m_width,
+            (0.5f * ndc.y + 0.5f) * m_height, 0.5f * ndc.z + 0.5f);
+    screenMin = glm::min(screenMin, screen);
+    screenMax = glm::max(screenMax, screen);
+  }
+
+  if (screenMax.x < 0.f || screenMax.y < 0.f || screenMin.x > m_width ||
+      screenMin.y > m_height) {
+    return false; // Outside of the screen
+  }
+
+  // All pixels touched by the box, plus a one pixel border since occluders
+  // only cover the pixels whose center they contain
+  const auto minX = std::max(int(std::floor(screenMin.x)) - 1, 0);
+  const auto minY = std::max(int(std::floor(screenMin.y)) - 1, 0);
+  const auto maxX =
+      std::min(int(std::floor(screenMax.x)) + 1, int(m_width) - 1);
+  const auto maxY =
+      std::min(int(std::floor(screenMax.y)) + 1, int(m_height) - 1);
+
+  // The box is hidden if the depth buffer is closer than its nearest point
+  // everywhere it covers
+  const auto boxDepth = screenMin.z;
+  const auto blockCountX = m_width / BLOCK_SIZE;
+  for (int blockY = minY / BLOCK_SIZE; blockY <= maxY / int(BLOCK_SIZE);
+       ++blockY) {
+    for (int blockX = minX / BLOCK_SIZE; blockX <= maxX / int(BLOCK_SIZE);
+         ++blockX) {
+      if (m_blockMaxDepth[blockY * blockCountX + blockX] < boxDepth) {
+        continue;
+      }
+      const auto x0 = std::max(minX, blockX * int(BLOCK_SIZE));
+      const auto x1 = std::min(maxX, (blockX + 1) * int(BLOCK_SIZE) - 1);
+      const auto y0 = std::max(minY, blockY * int(BLOCK_SIZE));
+      const auto y1 = std::min(maxY, (blockY + 1) * int(BLOCK_SIZE) - 1);
+      for (int y = y0; y <= y1; ++y) {
+        const auto *row = m_depth.data() + y * m_width;
+        for (int x = x0; x <= x1; ++x) {
+          if (row[x] >= boxDepth) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void OcclusionCuller::setupTriangles(const Occluder &occluder, size_t rangeIdx)
+{
+  auto &clipPositions = m_clipPositions[rangeIdx];
+  clipPositions.resize(occluder.vertexCount);
+  for (size_t i = 0; i < occluder.vertexCount; ++i) {
+    clipPositions[i] =
+        occluder.modelViewProjMatrix * glm::vec4(occluder.positions[i], 1);
+  }
+
+  auto &triangles = m_triangles[rangeIdx];
+  auto &bins = m_bins[rangeIdx];
+
+  const auto emitTriangle = [&](const glm::vec4 &a, const glm::vec4 &b,
+                                const glm::vec4 &c) {
+    ScreenTriangle triangle;
+    const glm::vec4 *clip[3] = {&a, &b, &c};
+    auto screenMin = glm::vec2(std::numeric_limits<float>::max());
+    auto screenMax = glm::vec2(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < 3; ++i) {
+      const auto ndc = glm::vec3(*clip[i]) / clip[i]->w;
+      if (std::abs(ndc.x) > GUARD_BAND || std::abs(ndc.y) > GUARD_BAND) {
+        return;
+      }
+      triangle.v[i] = glm::vec3((0.5f * ndc.x + 0.5f) * m_width,
+          (0.5f * ndc.y + 0.5f) * m_height, 0.5f * ndc.z + 0.5f);
+      screenMin = glm::min(screenMin, glm::vec2(triangle.v[i]));
+      screenMax = glm::max(screenMax, glm::vec2(triangle.v[i]));
+    }
+
+    // Range of covered pixel centers
+    const auto minX = std::max(int(std::ceil(screenMin.x - 0.5f)), 0);
+    const auto minY = std::max(int(std::ceil(screenMin.y - 0.5f)), 0);
+    const auto maxX =
+        std::min(int(std::floor(screenMax.x - 0.5f)), int(m_width) - 1);
+    const auto maxY =
+        std::min(int(std::floor(screenMax.y - 0.5f)), int(m_height) - 1);
+    if (minX > maxX || minY > maxY) {
+      return;
+    }
+
+    const auto e = triangle.v[1] - triangle.v[0];
+    const auto f = triangle.v[2] - triangle.v[0];
+    if (e.x * f.y - e.y * f.x == 0.f) {
+      return; // Degenerate
+    }
+
+    const auto triangleIdx = uint32_t(triangles.size());
+    triangles.push_back(triangle);
+    for (auto tileY = minY / TILE_HEIGHT; tileY <= maxY / TILE_HEIGHT;
+         ++tileY) {
+      for (auto tileX = minX / TILE_WIDTH; tileX <= maxX / TILE_WIDTH;
+           ++tileX) {
+        bins[tileY * m_tileCountX + tileX].push_back(triangleIdx);
+      }
+    }
+  };
+
+  for (size_t i = 0; i + 2 < occluder.indexCount; i += 3) {
+    const auto i0 = occluder.indices[i];
+    const auto i1 = occluder.indices[i + 1];
+    const auto i2 = occluder.indices[i + 2];
+    if (i0 >= occluder.vertexCount || i1 >= occluder.vertexCount ||
+        i2 >= occluder.vertexCount) {
+      continue;
+    }
+    const glm::vec4 v[3] = {
+        clipPositions[i0], clipPositions[i1], clipPositions[i2]};
+
+    // Distance to the near plane z = -w, positive in front
+    const float d[3] = {v[0].z + v[0].w, v[1].z + v[1].w, v[2].z + v[2].w};
+    if (d[0] >= 0.f && d[1] >= 0.f && d[2] >= 0.f) {
+      emitTriangle(v[0], v[1], v[2]);
+      continue;
+    }
+
+    // Clip against the near plane, giving 0 to 2 triangles
+    glm::vec4 polygon[4];
+    uint32_t polygonSize = 0;
+    for (uint32_t j = 0; j < 3; ++j) {
+      const auto k = (j + 1) % 3;
+      if (d[j] >= 0.f) {
+        polygon[polygonSize++] = v[j];
+      }
+      if ((d[j] >= 0.f) != (d[k] >= 0.f)) {
+        polygon[polygonSize++] = glm::mix(v[j], v[k], d[j] / (d[j] - d[k]));
+      }
+    }
+    if (polygonSize >= 3) {
+      emitTriangle(polygon[0], polygon[1], polygon[2]);
+    }
+    if (polygonSize == 4) {
+      emitTriangle(polygon[0], polygon[2], polygon[3]);
+    }
+  }
+}
+
+void OcclusionCuller::rasterizeTile(uint32_t tileIdx)
+{
+  const auto tileX = tileIdx % m_tileCountX;
+  const auto tileY = tileIdx / m_tileCountX;
+  const auto tileRect = glm::ivec4(tileX * TILE_WIDTH, tileY * TILE_HEIGHT,
+      (tileX + 1) * TILE_WIDTH, (tileY + 1) * TILE_HEIGHT);
+
+  for (uint32_t y = tileRect.y; y < uint32_t(tileRect.w); ++y) {
+    std::fill_n(m_depth.data() + y * m_width + tileRect.x, TILE_WIDTH, 1.f);
+  }
+
+  for (size_t rangeIdx = 0; rangeIdx < m_bins.size(); ++rangeIdx) {
+    const auto &triangles = m_triangles[rangeIdx];
+    for (const auto triangleIdx : m_bins[rangeIdx][tileIdx]) {
+      rasterizeTriangle(triangles[triangleIdx], tileRect);
+    }
+  }
+
+  // Update the max depth of the blocks of the tile
+  const auto blockCountX = m_width / BLOCK_SIZE;
+  for (auto blockY = uint32_t(tileRect.y) / BLOCK_SIZE;
+       blockY < uint32_t(tileRect.w) / BLOCK_SIZE; ++blockY) {
+    for (auto blockX = uint32_t(tileRect.x) / BLOCK_SIZE;
+         blockX < uint32_t(tileRect.z) / BLOCK_SIZE; ++blockX) {
+      auto maxDepth = 0.f;
+      for (uint32_t y = 0; y < BLOCK_SIZE; ++y) {
+        const auto *row = m_depth.data() + (blockY * BLOCK_SIZE + y) * m_width +
+                          blockX * BLOCK_SIZE;
+        for (uint32_t x = 0; x < BLOCK_SIZE; ++x) {
+          maxDepth = std::max(maxDepth, row[x]);
+        }
+      }
+      m_blockMaxDepth[blockY * blockCountX + blockX] = maxDepth;
+    }
+  }
+}
+
+void OcclusionCuller::rasterizeTriangle(
+    const ScreenTriangle &triangle, const glm::ivec4 &tileRect)
+{
+  const auto &v0 = triangle.v[0];
+  const auto &v1 = triangle.v[1];
+  const auto &v2 = triangle.v[2];
+
+  // Pixel centers covered by the bounding box, clamped to the tile
+  const auto minX = std::max(
+      int(std::ceil(std::min({v0.x, v1.x, v2.x}) - 0.5f)), tileRect.x);
+  const auto minY = std::max(
+      int(std::ceil(std::min({v0.y, v1.y, v2.y}) - 0.5f)), tileRect.y);
+  const auto maxX = std::min(
+      int(std::floor(std::max({v0.x, v1.x, v2.x}) - 0.5f)), tileRect.z - 1);
+  const auto maxY = std::min(
+      int(std::floor(std::max({v0.y, v1.y, v2.y}) - 0.5f)), tileRect.w - 1);
+  if (minX > maxX || minY > maxY) {
+    return;
+  }
+
+  // Both windings are rasterized: flip the edges of clockwise triangles so
+  // that the inside is always positive. e0 is the barycentric weight of v0,
+  // etc.
+  auto e0 = EdgeFunction(v1, v2);
+  auto e1 = EdgeFunction(v2, v0);
+  auto e2 = EdgeFunction(v0, v1);
+  auto area = e0.a * v0.x + e0.b * v0.y + e0.c;
+  if (area < 0.f) {
+    for (auto *e : {&e0, &e1, &e2}) {
+      e->a = -e->a;
+      e->b = -e->b;
+      e->c = -e->c;
+    }
+    area = -area;
+  }
+
+  // Depth is an affine function of screen position. The farthest depth over
+  // the pixel is written instead of the depth at its center, to stay
+  // conservative.
+  const auto invArea = 1.f / area;
+  const auto zA = (e0.a * v0.z + e1.a * v1.z + e2.a * v2.z) * invArea;
+  const auto zB = (e0.b * v0.z + e1.b * v1.z + e2.b * v2.z) * invArea;
+  const auto zC = (e0.c * v0.z + e1.c * v1.z + e2.c * v2.z) * invArea +
+                  0.5f * (std::abs(zA) + std::abs(zB));
+
+  // Rows are processed by 8 pixels aligned on 8, this never goes out of the
+  // tile since tiles are aligned on 8
+  const TriangleSetup setup{
+      e0, e1, e2, zA, zB, zC, minX & ~7, maxX, minY, maxY};
+  if (m_avx2) {
+    fillTriangleAvx2(setup, m_depth.data(), m_width);
+  } else {
+    fillTriangle(setup, m_depth.data(), m_width);
+  }
+}
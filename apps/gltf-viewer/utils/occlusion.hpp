@@ -0,0 +1,110 @@
+#pragma once
+
+#include "culling.hpp"
+#include "job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Software occlusion culling: occluder triangles are rasterized on the CPU in
+// a coarse depth buffer, then bounding boxes are tested against it.
+// The depth buffer is split in tiles rasterized in parallel by the job system,
+// and an 8x8 max depth hierarchy allows to reject most box tests early.
+// Nothing here depends on OpenGL.
+//
+// Usage, each frame:
+//   culler.beginFrame(viewProjMatrix);
+//   culler.addOccluder(modelMatrix, positions, vertexCount, indices, count);
+//   ...
+//   culler.rasterize();
+//   if (culler.isVisible(worldBox)) { ... }
+class OcclusionCuller
+{
+public:
+  static const uint32_t TILE_WIDTH = 64;
+  static const uint32_t TILE_HEIGHT = 16;
+  static const uint32_t BLOCK_SIZE = 8;
+
+  // Size of the depth buffer is rounded up to a multiple of the tile size
+  OcclusionCuller(
+      JobSystem &jobSystem, uint32_t width = 256, uint32_t height = 128);
+
+  OcclusionCuller(const OcclusionCuller &) = delete;
+  OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+  void beginFrame(const glm::mat4 &viewProjMatrix);
+
+  // Queue a triangle list for rasterization. The geometry is not copied and
+  // must stay alive until rasterize() returns.
+  void addOccluder(const glm::mat4 &modelMatrix, const glm::vec3 *positions,
+      size_t vertexCount, const uint32_t *indices, size_t indexCount);
+
+  // Rasterize all occluders queued since beginFrame()
+  void rasterize();
+
+  // Return false if the box is entirely hidden by the occluders. Boxes
+  // crossing the near plane are always visible.
+  bool isVisible(const AABB &worldBox) const;
+
+  uint32_t width() const { return m_width; }
+
+  uint32_t height() const { return m_height; }
+
+  uint32_t threadCount() const { return m_jobSystem.threadCount(); }
+
+  // Depth in [0, 1] per pixel, row major with y up, cleared to 1
+  const std::vector<float> &depthBuffer() const { return m_depth; }
+
+  // Triangles submitted with addOccluder()
+  size_t occluderTriangleCount() const { return m_occluderTriangleCount; }
+
+  // Triangles remaining after clipping, binned in the tiles
+  size_t rasterizedTriangleCount() const { return m_rasterizedTriangleCount; }
+
+private:
+  struct Occluder
+  {
+    glm::mat4 modelViewProjMatrix;
+    const glm::vec3 *positions;
+    size_t vertexCount;
+    const uint32_t *indices;
+    size_t indexCount;
+  };
+
+  // Triangle in depth buffer space: x, y in pixels and z in [0, 1]
+  struct ScreenTriangle
+  {
+    glm::vec3 v[3];
+  };
+
+  void setupTriangles(const Occluder &occluder, size_t rangeIdx);
+  void rasterizeTile(uint32_t tileIdx);
+  void rasterizeTriangle(
+      const ScreenTriangle &triangle, const glm::ivec4 &tileRect);
+
+  JobSystem &m_jobSystem;
+  uint32_t m_width;
+  uint32_t m_height;
+  uint32_t m_tileCountX;
+  uint32_t m_tileCountY;
+  glm::mat4 m_viewProjMatrix = glm::mat4(1);
+
+  std::vector<float> m_depth;
+  std::vector<float> m_blockMaxDepth; // Max depth of each 8x8 block
+  bool m_avx2; // Rasterize 8 pixels at a time
+
+  std::vector<Occluder> m_occluders;
+  size_t m_occluderTriangleCount = 0;
+  size_t m_rasterizedTriangleCount = 0;
+
+  // Per range of occluders, each range is set up by a single job without
+  // synchronization:
+  // m_triangles[rangeIdx] = triangles of the occluders of the range
+  // m_bins[rangeIdx][tileIdx] = indices in m_triangles[rangeIdx] of the
+  // triangles overlapping the tile
+  std::vector<std::vector<ScreenTriangle>> m_triangles;
+  std::vector<std::vector<std::vector<uint32_t>>> m_bins;
+  std::vector<std::vector<glm::vec4>> m_clipPositions;
+};
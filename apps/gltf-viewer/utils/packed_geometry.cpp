@@ -0,0 +1,85 @@
+#include "packed_geometry.hpp"
+#include "gltf.hpp"
+
+#include <iostream>
+
+void PackedGeometry::load(const tinygltf::Model &model)
+{
+  m_firstPrimitives.clear();
+  m_ranges.clear();
+  m_positions.clear();
+  m_normals.clear();
+  m_texCoords.clear();
+  m_joints.clear();
+  m_weights.clear();
+  m_indices.clear();
+
+  // Skin attributes are stored only if a primitive uses them
+  bool hasSkinAttributes = false;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      hasSkinAttributes = hasSkinAttributes ||
+                          (primitive.attributes.count("JOINTS_0") &&
+                              primitive.attributes.count("WEIGHTS_0"));
+    }
+  }
+
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &mesh = model.meshes[meshIdx];
+    m_firstPrimitives.push_back(uint32_t(m_ranges.size()));
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &primitive = mesh.primitives[pIdx];
+      m_ranges.push_back({false, 0, 0, 0});
+
+      const auto positionIt = primitive.attributes.find("POSITION");
+      if (positionIt == end(primitive.attributes)) {
+        continue;
+      }
+      const auto vertexCount = model.accessors[(*positionIt).second].count;
+      const auto positions = readAccessorFloats(model, (*positionIt).second);
+      const auto indices = readPrimitiveTriangles(model, primitive);
+      if (positions.size() != 3 * vertexCount || indices.empty()) {
+        continue; // Points, lines or unsupported positions
+      }
+
+      // Missing or invalid attributes are left to zero
+      const auto readAttribute = [&](const char *name, size_t size) {
+        const auto it = primitive.attributes.find(name);
+        auto values = it != end(primitive.attributes)
+                          ? readAccessorFloats(model, (*it).second)
+                          : std::vector<float>();
+        if (values.size() != size * vertexCount) {
+          values.assign(size * vertexCount, 0.f);
+        }
+        return values;
+      };
+      const auto normals = readAttribute("NORMAL", 3);
+      const auto texCoords = readAttribute("TEXCOORD_0", 2);
+      std::vector<float> joints, weights;
+      if (hasSkinAttributes) {
+        joints = readAttribute("JOINTS_0", 4);
+        weights = readAttribute("WEIGHTS_0", 4);
+      }
+
+      m_ranges.back() = {true, uint32_t(m_indices.size()),
+          uint32_t(indices.size()), int32_t(m_positions.size())};
+      for (size_t v = 0; v < vertexCount; ++v) {
+        m_positions.emplace_back(
+            positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+        m_normals.emplace_back(
+            normals[3 * v], normals[3 * v + 1], normals[3 * v + 2]);
+        m_texCoords.emplace_back(texCoords[2 * v], texCoords[2 * v + 1]);
+        if (hasSkinAttributes) {
+          m_joints.emplace_back(joints[4 * v], joints[4 * v + 1],
+              joints[4 * v + 2], joints[4 * v + 3]);
+          m_weights.emplace_back(weights[4 * v], weights[4 * v + 1],
+              weights[4 * v + 2], weights[4 * v + 3]);
+        }
+      }
+      m_indices.insert(end(m_indices), begin(indices), end(indices));
+    }
+  }
+
+  std::cout << "Vertex arena: " << m_positions.size() << " vertices, "
+            << m_indices.size() << " indices" << std::endl;
+}
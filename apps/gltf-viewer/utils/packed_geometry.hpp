@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Command of glMultiDrawElementsIndirect, as read from the indirect buffer
+struct DrawElementsIndirectCommand
+{
+  uint32_t count;
+  uint32_t instanceCount;
+  uint32_t firstIndex;
+  int32_t baseVertex;
+  uint32_t baseInstance;
+};
+
+// Vertices and triangles of the primitives of a glTF model packed in a
+// vertex arena: shared arrays of every attribute and of the indices, so that
+// all the primitives are drawn from one vertex array with a base vertex and
+// a first index, including by glMultiDrawElementsIndirect. Attributes are
+// converted to floats, joints to 16 bits integers and indices to 32 bits
+// triangle lists. Missing attributes are zero, like disabled attribute
+// arrays.
+class PackedGeometry
+{
+public:
+  // Indices of a primitive in the arena
+  struct PrimitiveRange
+  {
+    bool packed; // False for points, lines and unsupported positions
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t baseVertex;
+  };
+
+  void load(const tinygltf::Model &model);
+
+  const PrimitiveRange &primitiveRange(int meshIdx, int primitiveIdx) const
+  {
+    return m_ranges[m_firstPrimitives[meshIdx] + primitiveIdx];
+  }
+
+  const std::vector<glm::vec3> &positions() const { return m_positions; }
+  const std::vector<glm::vec3> &normals() const { return m_normals; }
+  const std::vector<glm::vec2> &texCoords() const { return m_texCoords; }
+  // Empty if no primitive has JOINTS_0 and WEIGHTS_0
+  const std::vector<glm::u16vec4> &joints() const { return m_joints; }
+  const std::vector<glm::vec4> &weights() const { return m_weights; }
+  const std::vector<uint32_t> &indices() const { return m_indices; }
+
+private:
+  std::vector<uint32_t> m_firstPrimitives; // In m_ranges, by mesh
+  std::vector<PrimitiveRange> m_ranges;
+  std::vector<glm::vec3> m_positions;
+  std::vector<glm::vec3> m_normals;
+  std::vector<glm::vec2> m_texCoords;
+  std::vector<glm::u16vec4> m_joints;
+  std::vector<glm::vec4> m_weights;
+  std::vector<uint32_t> m_indices;
+};
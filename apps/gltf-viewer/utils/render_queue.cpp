@@ -0,0 +1,87 @@
+#include "render_queue.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+void RenderQueue::sort()
+{
+  // 8 passes of 8 bits, the histograms of all passes are computed at once
+  const size_t DIGIT_COUNT = 8;
+  const size_t BUCKET_COUNT = 256;
+  uint32_t histograms[DIGIT_COUNT][BUCKET_COUNT] = {};
+  for (const auto &item : m_items) {
+    for (size_t d = 0; d < DIGIT_COUNT; ++d) {
+      ++histograms[d][(item.key >> (8 * d)) & 0xFF];
+    }
+  }
+
+  m_sortedItems.resize(m_items.size());
+  for (size_t d = 0; d < DIGIT_COUNT; ++d) {
+    auto &histogram = histograms[d];
+    // Skip digits shared by all keys, frequent in the high bits
+    if (m_items.empty() ||
+        histogram[(m_items.front().key >> (8 * d)) & 0xFF] == m_items.size()) {
+      continue;
+    }
+    uint32_t offset = 0;
+    for (auto &count : histogram) {
+      const auto bucketCount = count;
+      count = offset; // Becomes the next position in the bucket
+      offset += bucketCount;
+    }
+    for (const auto &item : m_items) {
+      m_sortedItems[histogram[(item.key >> (8 * d)) & 0xFF]++] = item;
+    }
+    std::swap(m_items, m_sortedItems);
+  }
+}
+
+uint64_t RenderQueue::quantizeDepth(
+    float depth, float maxDepth, uint32_t bitCount)
+{
+  const auto maxValue = (uint64_t(1) << bitCount) - 1;
+  if (!(depth > 0.f) || maxDepth <= 0.f) {
+    return 0; // Also for NaN
+  }
+  if (depth >= maxDepth) {
+    return maxValue;
+  }
+  return std::min(maxValue, uint64_t(double(depth) / maxDepth * maxValue));
+}
+
+uint64_t RenderQueue::makeOpaqueKey(
+    const RenderState &state, float depth, float maxDepth)
+{
+  static_assert(1 + STATE_BITS + DEPTH_BITS <= 64, "Keys are 64 bits");
+  return (packState(state) << DEPTH_BITS) |
+         quantizeDepth(depth, maxDepth, DEPTH_BITS);
+}
+
+uint64_t RenderQueue::makeBlendedKey(
+    const RenderState &state, float depth, float maxDepth)
+{
+  const auto maxValue = (uint64_t(1) << DEPTH_BITS) - 1;
+  return (uint64_t(1) << 63) |
+         ((maxValue - quantizeDepth(depth, maxDepth, DEPTH_BITS))
+             << STATE_BITS) |
+         packState(state);
+}
+
+uint64_t RenderQueue::packState(const RenderState &state)
+{
+  // Larger values are truncated, they would share keys with others and break
+  // the batching of their state
+  assert(state.variant < (1u << VARIANT_BITS));
+  assert(state.material < (1u << MATERIAL_BITS));
+  assert(state.culling < (1u << CULLING_BITS));
+  assert(state.vertexArray < (1u << VERTEX_ARRAY_BITS));
+  const auto field = [](uint32_t value, uint32_t bitCount) {
+    return uint64_t(value & ((1u << bitCount) - 1));
+  };
+  auto key = field(state.variant, VARIANT_BITS);
+  key = (key << MATERIAL_BITS) | field(state.material, MATERIAL_BITS);
+  key = (key << CULLING_BITS) | field(state.culling, CULLING_BITS);
+  key = (key << VERTEX_ARRAY_BITS) |
+        field(state.vertexArray, VERTEX_ARRAY_BITS);
+  return key;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Draw items sorted each frame by 64 bits keys, packing the render state
+// and the depth of the items, with a least significant digit radix sort:
+// linear in the number of items, stable, and without allocation once the
+// queue has reached its maximum size
+class RenderQueue
+{
+public:
+  struct Item
+  {
+    uint64_t key;
+    uint32_t index; // Of the draw in the caller's arrays
+  };
+
+  void clear() { m_items.clear(); }
+
+  void push(uint64_t key, uint32_t index) { m_items.push_back({key, index}); }
+
+  // Sort the items by increasing key, items with equal keys keep their order
+  void sort();
+
+  const std::vector<Item> &items() const { return m_items; }
+
+  // Render state of an item, packed in its key from variant down to
+  // vertexArray, in fields of the given number of bits
+  struct RenderState
+  {
+    uint32_t variant; // Shading variant flags
+    uint32_t material;
+    uint32_t culling;
+    uint32_t vertexArray;
+  };
+  static const uint32_t VARIANT_BITS = 4;
+  static const uint32_t MATERIAL_BITS = 16;
+  static const uint32_t CULLING_BITS = 2;
+  static const uint32_t VERTEX_ARRAY_BITS = 17;
+  static const uint32_t STATE_BITS =
+      VARIANT_BITS + MATERIAL_BITS + CULLING_BITS + VERTEX_ARRAY_BITS;
+  static const uint32_t DEPTH_BITS = 24;
+
+  // Key of an opaque item, sorted by render state then front to back. depth
+  // is the view space distance in [0, maxDepth].
+  static uint64_t makeOpaqueKey(
+      const RenderState &state, float depth, float maxDepth);
+
+  // Key of a blended item, sorted after the opaque ones and back to front
+  static uint64_t makeBlendedKey(
+      const RenderState &state, float depth, float maxDepth);
+
+  // Quantize a depth in [0, maxDepth] (clamped) to an integer of bitCount
+  // bits, preserving the order
+  static uint64_t quantizeDepth(float depth, float maxDepth, uint32_t bitCount);
+
+private:
+  static uint64_t packState(const RenderState &state);
+
+  std::vector<Item> m_items;
+  std::vector<Item> m_sortedItems; // Destination of the sort passes
+};
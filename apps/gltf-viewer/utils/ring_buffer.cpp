@@ -0,0 +1,91 @@
+#include "ring_buffer.hpp"
+
+#include <cassert>
+#include <iostream>
+
+FrameRingBuffer::FrameRingBuffer(size_t frameCapacity) :
+    m_frameCapacity(frameCapacity)
+{
+  const auto flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  const auto size = GLsizeiptr(FRAME_COUNT * m_frameCapacity);
+  glGenBuffers(1, &m_GLId);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_GLId);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+  m_data = static_cast<uint8_t *>(
+      glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if (!m_data) {
+    std::cerr << "Unable to map the frame ring buffer" << std::endl;
+  }
+}
+
+FrameRingBuffer::~FrameRingBuffer()
+{
+  for (auto &fence : m_fences) {
+    glDeleteSync(fence); // Ignores 0
+  }
+  if (m_data) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_GLId);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  glDeleteBuffers(1, &m_GLId);
+}
+
+void FrameRingBuffer::beginFrame()
+{
+  auto &fence = m_fences[m_frameIndex];
+  if (fence) {
+    // Flush on the first wait, the fence may not have been submitted yet
+    GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fence, waitFlags, 1000000) ==
+           GL_TIMEOUT_EXPIRED) {
+      waitFlags = 0;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+  }
+  m_frameBegin = m_frameIndex * m_frameCapacity;
+  m_offset = m_frameBegin;
+}
+
+void FrameRingBuffer::endFrame()
+{
+  m_fences[m_frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_frameIndex = (m_frameIndex + 1) % FRAME_COUNT;
+}
+
+FrameRingBuffer::Allocation FrameRingBuffer::allocate(
+    size_t size, size_t alignment)
+{
+  const auto offset = (m_offset + alignment - 1) & ~(alignment - 1);
+  // The frame capacity must fit the allocations of a frame, callers skip
+  // what uses an allocation that failed
+  assert(!m_data || offset + size <= m_frameBegin + m_frameCapacity);
+  if (!m_data || offset + size > m_frameBegin + m_frameCapacity) {
+    return {nullptr, 0, 0};
+  }
+  m_offset = offset + size;
+  return {m_data + offset, GLintptr(offset), GLsizeiptr(size)};
+}
+
+size_t FrameRingBuffer::uniformBufferAlignment()
+{
+  static const auto alignment = []() {
+    GLint value = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+    return size_t(std::max(value, 1));
+  }();
+  return alignment;
+}
+
+size_t FrameRingBuffer::storageBufferAlignment()
+{
+  static const auto alignment = []() {
+    GLint value = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &value);
+    return size_t(std::max(value, 1));
+  }();
+  return alignment;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Buffer object persistently mapped for the dynamic data of the frames:
+// split in FRAME_COUNT regions so the CPU writes a frame while the GPU reads
+// the previous ones, each region guarded by a fence. Data is bump allocated
+// at aligned offsets and bound with glBindBufferRange, or read from the
+// buffer bound to another target (e.g. indirect commands).
+class FrameRingBuffer
+{
+public:
+  static constexpr size_t FRAME_COUNT = 3;
+
+  struct Allocation
+  {
+    void *data; // Write only, nullptr if the region is full or unmapped
+    GLintptr offset; // In the buffer
+    GLsizeiptr size;
+  };
+
+  // frameCapacity is the size of a region, allocations of a frame must fit
+  explicit FrameRingBuffer(size_t frameCapacity);
+
+  ~FrameRingBuffer();
+
+  FrameRingBuffer(const FrameRingBuffer &) = delete;
+
+  FrameRingBuffer &operator=(const FrameRingBuffer &) = delete;
+
+  GLuint glId() const { return m_GLId; }
+
+  // Wait until the GPU has read the region of the frame, then reset it
+  void beginFrame();
+
+  // Fence the commands reading the region of the frame
+  void endFrame();
+
+  // Allocate size bytes at an offset multiple of alignment (a power of 2)
+  Allocation allocate(size_t size, size_t alignment);
+
+  template <typename T>
+  Allocation allocate(const T *values, size_t count, size_t alignment);
+
+  // Bind an allocation to an indexed target (uniform or storage buffer)
+  void bindRange(GLenum target, GLuint index, const Allocation &allocation)
+  {
+    glBindBufferRange(
+        target, index, m_GLId, allocation.offset, allocation.size);
+  }
+
+  // Offset alignments required by glBindBufferRange
+  static size_t uniformBufferAlignment();
+  static size_t storageBufferAlignment();
+
+  size_t frameCapacity() const { return m_frameCapacity; }
+
+  // Bytes allocated in the current frame, or the last one after endFrame
+  size_t frameSize() const { return m_offset - m_frameBegin; }
+
+private:
+  GLuint m_GLId = 0;
+  uint8_t *m_data = nullptr; // Mapping of the whole buffer
+  size_t m_frameCapacity;
+  size_t m_frameIndex = 0; // Of the current region
+  size_t m_frameBegin = 0;
+  size_t m_offset = 0; // Next allocation, in the current region
+  GLsync m_fences[FRAME_COUNT] = {};
+};
+
+template <typename T>
+FrameRingBuffer::Allocation FrameRingBuffer::allocate(
+    const T *values, size_t count, size_t alignment)
+{
+  const auto allocation = allocate(count * sizeof(T), alignment);
+  if (allocation.data) {
+    std::copy(values, values + count, static_cast<T *>(allocation.data));
+  }
+  return allocation;
+}
@@ -0,0 +1,647 @@
+#include "scene_query.hpp"
+#include "gltf.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+const uint32_t BIN_COUNT = 16;
+const uint32_t MAX_LEAF_SIZE = 16; // Larger leaves are always split
+const float TRAVERSAL_COST = 1.f; // Relative to an item intersection
+
+float surfaceArea(const AABB &box)
+{
+  if (box.isEmpty()) {
+    return 0.f;
+  }
+  const auto d = box.max - box.min;
+  return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Möller-Trumbore, t in [0, tMax)
+bool intersectTriangle(const Ray &ray, const glm::vec3 &a, const glm::vec3 &b,
+    const glm::vec3 &c, float tMax, float &t)
+{
+  const auto e1 = b - a;
+  const auto e2 = c - a;
+  const auto p = glm::cross(ray.direction, e2);
+  const auto det = glm::dot(e1, p);
+  if (det == 0.f) {
+    return false;
+  }
+  const auto invDet = 1.f / det;
+  const auto s = ray.origin - a;
+  const auto u = glm::dot(s, p) * invDet;
+  if (u < 0.f || u > 1.f) {
+    return false;
+  }
+  const auto q = glm::cross(s, e1);
+  const auto v = glm::dot(ray.direction, q) * invDet;
+  if (v < 0.f || u + v > 1.f) {
+    return false;
+  }
+  t = glm::dot(e2, q) * invDet;
+  return t >= 0.f && t < tMax;
+}
+
+// Separating axis test (Akenine-Möller)
+bool triangleIntersectsBox(const glm::vec3 &a, const glm::vec3 &b,
+    const glm::vec3 &c, const AABB &box)
+{
+  const auto center = box.center();
+  const auto halfSize = box.extent();
+  const glm::vec3 v[3] = {a - center, b - center, c - center};
+  const glm::vec3 edges[3] = {v[1] - v[0], v[2] - v[1], v[0] - v[2]};
+
+  glm::vec3 axes[13] = {glm::vec3(1, 0, 0), glm::vec3(0, 1, 0),
+      glm::vec3(0, 0, 1), glm::cross(edges[0], edges[1])};
+  for (uint32_t i = 0; i < 3; ++i) {
+    for (uint32_t j = 0; j < 3; ++j) {
+      axes[4 + 3 * i + j] = glm::cross(axes[i], edges[j]);
+    }
+  }
+  for (const auto &axis : axes) {
+    const auto p0 = glm::dot(v[0], axis);
+    const auto p1 = glm::dot(v[1], axis);
+    const auto p2 = glm::dot(v[2], axis);
+    const auto r = glm::dot(halfSize, glm::abs(axis));
+    if (std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// From Real-Time Collision Detection (Ericson), 5.1.5
+glm::vec3 closestPointOnTriangle(const glm::vec3 &p, const glm::vec3 &a,
+    const glm::vec3 &b, const glm::vec3 &c)
+{
+  const auto ab = b - a;
+  const auto ac = c - a;
+  const auto ap = p - a;
+  const auto d1 = glm::dot(ab, ap);
+  const auto d2 = glm::dot(ac, ap);
+  if (d1 <= 0.f && d2 <= 0.f) {
+    return a;
+  }
+  const auto bp = p - b;
+  const auto d3 = glm::dot(ab, bp);
+  const auto d4 = glm::dot(ac, bp);
+  if (d3 >= 0.f && d4 <= d3) {
+    return b;
+  }
+  const auto vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+    return a + ab * (d1 / (d1 - d3));
+  }
+  const auto cp = p - c;
+  const auto d5 = glm::dot(ab, cp);
+  const auto d6 = glm::dot(ac, cp);
+  if (d6 >= 0.f && d5 <= d6) {
+    return c;
+  }
+  const auto vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+    return a + ac * (d2 / (d2 - d6));
+  }
+  const auto va = d3 * d6 - d5 * d4;
+  if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) {
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  const auto denom = 1.f / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Lower bound of the scale applied by the inverse of worldToLocal. The
+// smallest singular value of a matrix is 1 / the spectral norm of its inverse,
+// which is at most sqrt(1-norm * infinity-norm)
+float computeMinScale(const glm::mat4 &worldToLocal)
+{
+  const auto inverseLinear = glm::mat3(worldToLocal);
+  auto maxColumnSum = 0.f, maxRowSum = 0.f;
+  for (int i = 0; i < 3; ++i) {
+    maxColumnSum = std::max(maxColumnSum, glm::abs(inverseLinear[i]).x +
+                                              glm::abs(inverseLinear[i]).y +
+                                              glm::abs(inverseLinear[i]).z);
+    maxRowSum = std::max(maxRowSum, std::abs(inverseLinear[0][i]) +
+                                        std::abs(inverseLinear[1][i]) +
+                                        std::abs(inverseLinear[2][i]));
+  }
+  return 1.f / std::sqrt(maxColumnSum * maxRowSum);
+}
+
+// FNV-1a, identifies the geometry of a primitive in the BVH cache
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash)
+{
+  const auto *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// BVH cache file: header, then for each primitive its geometry hash,
+// triangle count, node count, nodes and items
+const char CACHE_MAGIC[8] = {'G', 'L', 'M', 'L', 'V', 'B', 'V', 'H'};
+const uint32_t CACHE_VERSION = 1;
+
+struct CacheEntry
+{
+  std::vector<BinaryBVH::Node> nodes;
+  std::vector<uint32_t> items;
+};
+
+std::unordered_map<uint64_t, CacheEntry> readCache(const fs::path &path)
+{
+  std::unordered_map<uint64_t, CacheEntry> entries;
+  std::ifstream in(path.string(), std::ios::binary);
+  if (!in) {
+    return entries;
+  }
+  char magic[8];
+  uint32_t version = 0, entryCount = 0;
+  in.read(magic, sizeof(magic));
+  in.read((char *)&version, sizeof(version));
+  in.read((char *)&entryCount, sizeof(entryCount));
+  if (!in || !std::equal(magic, magic + 8, CACHE_MAGIC) ||
+      version != CACHE_VERSION) {
+    std::cerr << "Ignoring invalid BVH cache " << path << std::endl;
+    return entries;
+  }
+  for (uint32_t i = 0; i < entryCount; ++i) {
+    uint64_t hash = 0, itemCount = 0, nodeCount = 0;
+    in.read((char *)&hash, sizeof(hash));
+    in.read((char *)&itemCount, sizeof(itemCount));
+    in.read((char *)&nodeCount, sizeof(nodeCount));
+    if (!in) {
+      break;
+    }
+    CacheEntry entry;
+    entry.nodes.resize(nodeCount);
+    entry.items.resize(itemCount);
+    in.read((char *)entry.nodes.data(), nodeCount * sizeof(BinaryBVH::Node));
+    in.read((char *)entry.items.data(), itemCount * sizeof(uint32_t));
+    if (!in) {
+      std::cerr << "Truncated BVH cache " << path << std::endl;
+      break;
+    }
+    // Children are always stored after their parent
+    auto isValid = std::all_of(begin(entry.items), end(entry.items),
+        [&](uint32_t item) { return item < itemCount; });
+    for (size_t nodeIdx = 0; nodeIdx < nodeCount && isValid; ++nodeIdx) {
+      const auto &node = entry.nodes[nodeIdx];
+      isValid = node.count > 0
+                    ? uint64_t(node.first) + node.count <= itemCount
+                    : node.first > nodeIdx && node.first + 1 < nodeCount;
+    }
+    if (!isValid) {
+      std::cerr << "Ignoring invalid BVH cache " << path << std::endl;
+      return {};
+    }
+    entries[hash] = std::move(entry);
+  }
+  return entries;
+}
+
+void writeCache(const fs::path &path, const std::vector<uint64_t> &hashes,
+    const std::vector<const BinaryBVH *> &bvhs)
+{
+  std::ofstream out(path.string(), std::ios::binary);
+  if (!out) {
+    std::cerr << "Unable to write BVH cache " << path << std::endl;
+    return;
+  }
+  const auto entryCount = uint32_t(bvhs.size());
+  out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  out.write((const char *)&CACHE_VERSION, sizeof(CACHE_VERSION));
+  out.write((const char *)&entryCount, sizeof(entryCount));
+  for (size_t i = 0; i < bvhs.size(); ++i) {
+    const auto &nodes = bvhs[i]->nodes();
+    const auto &items = bvhs[i]->items();
+    const uint64_t itemCount = items.size(), nodeCount = nodes.size();
+    out.write((const char *)&hashes[i], sizeof(hashes[i]));
+    out.write((const char *)&itemCount, sizeof(itemCount));
+    out.write((const char *)&nodeCount, sizeof(nodeCount));
+    out.write(
+        (const char *)nodes.data(), nodeCount * sizeof(BinaryBVH::Node));
+    out.write((const char *)items.data(), itemCount * sizeof(uint32_t));
+  }
+}
+} // namespace
+
+struct BinaryBVH::BuildContext
+{
+  const std::vector<AABB> &itemBounds;
+  std::vector<glm::vec3> centroids;
+  std::vector<uint32_t> &items;
+  JobSystem *jobSystem;
+  size_t parallelThreshold;
+};
+
+void BinaryBVH::build(const std::vector<AABB> &itemBounds,
+    JobSystem *jobSystem, size_t parallelThreshold)
+{
+  m_nodes.clear();
+  m_items.resize(itemBounds.size());
+  std::iota(begin(m_items), end(m_items), 0);
+  if (itemBounds.empty()) {
+    return;
+  }
+
+  BuildContext context{itemBounds, {}, m_items, jobSystem, parallelThreshold};
+  context.centroids.reserve(itemBounds.size());
+  for (const auto &box : itemBounds) {
+    context.centroids.push_back(box.center());
+  }
+
+  m_nodes.reserve(2 * itemBounds.size() / 4 + 1);
+  m_nodes.resize(1);
+  buildNode(context, 0, 0, uint32_t(itemBounds.size()), 0, m_nodes);
+}
+
+void BinaryBVH::assign(std::vector<Node> nodes, std::vector<uint32_t> items)
+{
+  m_nodes = std::move(nodes);
+  m_items = std::move(items);
+}
+
+void BinaryBVH::buildNode(const BuildContext &context, uint32_t nodeIdx,
+    uint32_t begin, uint32_t end, uint32_t depth, std::vector<Node> &nodes)
+{
+  AABB bounds, centroidBounds;
+  for (auto i = begin; i < end; ++i) {
+    bounds.extend(context.itemBounds[context.items[i]]);
+    centroidBounds.extend(context.centroids[context.items[i]]);
+  }
+
+  const auto count = end - begin;
+  const auto makeLeaf = [&]() {
+    nodes[nodeIdx] = {bounds.min, begin, bounds.max, count};
+  };
+  if (count == 1 || depth + 1 >= MAX_DEPTH) {
+    makeLeaf();
+    return;
+  }
+
+  // Find the best split among the bin boundaries of the 3 axes
+  struct Bin
+  {
+    AABB bounds;
+    uint32_t count = 0;
+  };
+  const auto centroidExtent = centroidBounds.max - centroidBounds.min;
+  auto bestCost = std::numeric_limits<float>::max();
+  auto bestAxis = -1;
+  auto bestSplit = 0u;
+  for (auto axis = 0; axis < 3; ++axis) {
+    if (centroidExtent[axis] <= 0.f) {
+      continue;
+    }
+    const auto scale = BIN_COUNT / centroidExtent[axis];
+    Bin bins[BIN_COUNT];
+    for (auto i = begin; i < end; ++i) {
+      const auto item = context.items[i];
+      const auto binIdx = std::min(BIN_COUNT - 1,
+          uint32_t((context.centroids[item][axis] -
+                       centroidBounds.min[axis]) *
+                   scale));
+      bins[binIdx].bounds.extend(context.itemBounds[item]);
+      ++bins[binIdx].count;
+    }
+    // Cost of splitting after bin i = area of each side * item count
+    float rightCosts[BIN_COUNT];
+    AABB rightBounds;
+    auto rightCount = 0u;
+    for (auto i = BIN_COUNT - 1; i > 0; --i) {
+      rightBounds.extend(bins[i].bounds);
+      rightCount += bins[i].count;
+      rightCosts[i] = surfaceArea(rightBounds) * rightCount;
+    }
+    AABB leftBounds;
+    auto leftCount = 0u;
+    for (auto i = 0u; i + 1 < BIN_COUNT; ++i) {
+      leftBounds.extend(bins[i].bounds);
+      leftCount += bins[i].count;
+      const auto cost = surfaceArea(leftBounds) * leftCount + rightCosts[i + 1];
+      if (leftCount > 0 && leftCount < count && cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i + 1;
+      }
+    }
+  }
+
+  auto middle = begin;
+  if (bestAxis >= 0) {
+    const auto area = surfaceArea(bounds);
+    const auto splitCost =
+        TRAVERSAL_COST + (area > 0.f ? bestCost / area : float(count));
+    if (count <= MAX_LEAF_SIZE && splitCost >= float(count)) {
+      makeLeaf();
+      return;
+    }
+    const auto scale = BIN_COUNT / centroidExtent[bestAxis];
+    middle = uint32_t(std::partition(context.items.begin() + begin,
+                          context.items.begin() + end,
+                          [&](uint32_t item) {
+                            const auto binIdx = std::min(BIN_COUNT - 1,
+                                uint32_t((context.centroids[item][bestAxis] -
+                                             centroidBounds.min[bestAxis]) *
+                                         scale));
+                            return binIdx < bestSplit;
+                          }) -
+                      context.items.begin());
+  } else if (count <= MAX_LEAF_SIZE) {
+    makeLeaf(); // All centroids at the same place
+    return;
+  }
+  if (middle == begin || middle == end) {
+    middle = begin + count / 2;
+  }
+
+  const auto leftIdx = uint32_t(nodes.size());
+  nodes.resize(nodes.size() + 2);
+  nodes[nodeIdx] = {bounds.min, leftIdx, bounds.max, 0};
+
+  if (!context.jobSystem || count <= context.parallelThreshold) {
+    buildNode(context, leftIdx, begin, middle, depth + 1, nodes);
+    buildNode(context, leftIdx + 1, middle, end, depth + 1, nodes);
+    return;
+  }
+
+  // Build the right subtree by a job in its own array, then move it after
+  // the left subtree
+  std::vector<Node> rightNodes(1);
+  const auto rightBuild = context.jobSystem->create([&]() {
+    buildNode(context, 0, middle, end, depth + 1, rightNodes);
+  });
+  context.jobSystem->submit(rightBuild);
+  buildNode(context, leftIdx, begin, middle, depth + 1, nodes);
+  context.jobSystem->wait(rightBuild);
+
+  // Index k > 0 in rightNodes becomes offset + k in nodes
+  const auto offset = uint32_t(nodes.size()) - 1;
+  const auto relocate = [&](Node node) {
+    if (node.count == 0) {
+      node.first += offset;
+    }
+    return node;
+  };
+  nodes[leftIdx + 1] = relocate(rightNodes[0]);
+  for (size_t k = 1; k < rightNodes.size(); ++k) {
+    nodes.push_back(relocate(rightNodes[k]));
+  }
+}
+
+void SceneQuery::build(const tinygltf::Model &model,
+    const fs::path &cachePath, JobSystem *jobSystem)
+{
+  m_geometries.clear();
+  m_instances.clear();
+  m_triangleCount = 0;
+  m_cachedPrimitiveCount = 0;
+
+  // Geometry of each primitive, m_geometries[firstGeometry[meshIdx] + pIdx]
+  std::vector<uint32_t> firstGeometry;
+  std::vector<uint64_t> hashes;
+  for (const auto &mesh : model.meshes) {
+    firstGeometry.push_back(uint32_t(m_geometries.size()));
+    for (const auto &primitive : mesh.primitives) {
+      m_geometries.emplace_back();
+      auto &geometry = m_geometries.back();
+      geometry.positions = readPrimitivePositions(model, primitive);
+      const auto indices = readPrimitiveTriangles(model, primitive);
+      for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const auto triangle =
+            glm::uvec3(indices[i], indices[i + 1], indices[i + 2]);
+        if (glm::all(glm::lessThan(
+                triangle, glm::uvec3(geometry.positions.size())))) {
+          geometry.triangles.push_back(triangle);
+        }
+      }
+      auto hash = hashBytes(geometry.positions.data(),
+          geometry.positions.size() * sizeof(glm::vec3),
+          14695981039346656037ull);
+      hash = hashBytes(geometry.triangles.data(),
+          geometry.triangles.size() * sizeof(glm::uvec3), hash);
+      hashes.push_back(hash);
+    }
+  }
+
+  const auto cache = cachePath.empty()
+                   ? std::unordered_map<uint64_t, CacheEntry>{}
+                   : readCache(cachePath);
+
+  // Build (or read) the BVH of each primitive, primitives are distributed on
+  // the jobs
+  std::atomic<size_t> cachedCount{0};
+  const auto buildGeometries = [&](size_t first, size_t last) {
+    for (auto geometryIdx = first; geometryIdx < last; ++geometryIdx) {
+      auto &geometry = m_geometries[geometryIdx];
+      for (const auto &position : geometry.positions) {
+        geometry.bounds.extend(position);
+      }
+      const auto triangleCount = geometry.triangles.size();
+      const auto cacheIt = cache.find(hashes[geometryIdx]);
+      if (cacheIt != end(cache) &&
+          cacheIt->second.items.size() == triangleCount &&
+          !cacheIt->second.nodes.empty()) {
+        // Copied since identical primitives share the entry
+        geometry.bvh.assign(cacheIt->second.nodes, cacheIt->second.items);
+        ++cachedCount;
+      } else {
+        std::vector<AABB> triangleBounds(triangleCount);
+        for (size_t i = 0; i < triangleCount; ++i) {
+          for (uint32_t k = 0; k < 3; ++k) {
+            triangleBounds[i].extend(
+                geometry.positions[geometry.triangles[i][k]]);
+          }
+        }
+        geometry.bvh.build(triangleBounds, jobSystem);
+      }
+      // Store triangles in leaf order
+      std::vector<glm::uvec3> triangles(triangleCount);
+      for (size_t i = 0; i < triangleCount; ++i) {
+        triangles[i] = geometry.triangles[geometry.bvh.items()[i]];
+      }
+      geometry.triangles = std::move(triangles);
+    }
+  };
+  if (jobSystem) {
+    jobSystem->parallelFor(m_geometries.size(), 1, buildGeometries);
+  } else {
+    buildGeometries(0, m_geometries.size());
+  }
+  m_cachedPrimitiveCount = cachedCount;
+
+  if (!cachePath.empty() && m_cachedPrimitiveCount < m_geometries.size()) {
+    std::vector<const BinaryBVH *> bvhs;
+    for (const auto &geometry : m_geometries) {
+      bvhs.push_back(&geometry.bvh);
+    }
+    writeCache(cachePath, hashes, bvhs);
+  }
+
+  // Instances of the primitives in the scene and their top level BVH
+  std::vector<AABB> instanceBounds;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &modelMatrix) {
+    const auto meshIdx = model.nodes[nodeIdx].mesh;
+    if (meshIdx < 0) {
+      return;
+    }
+    const auto worldToLocal = glm::inverse(modelMatrix);
+    const auto minScale = computeMinScale(worldToLocal);
+    for (size_t pIdx = 0; pIdx < model.meshes[meshIdx].primitives.size();
+         ++pIdx) {
+      const auto geometryIdx = firstGeometry[meshIdx] + uint32_t(pIdx);
+      const auto &geometry = m_geometries[geometryIdx];
+      if (geometry.triangles.empty()) {
+        continue;
+      }
+      m_instances.push_back({nodeIdx, meshIdx, int(pIdx), geometryIdx,
+          modelMatrix, worldToLocal, minScale});
+      instanceBounds.push_back(geometry.bounds.transform(modelMatrix));
+      m_triangleCount += geometry.triangles.size();
+    }
+  });
+  m_instanceBVH.build(instanceBounds, jobSystem);
+}
+
+void SceneQuery::updateTransforms(const std::vector<glm::mat4> &nodeMatrices)
+{
+  std::vector<AABB> instanceBounds;
+  instanceBounds.reserve(m_instances.size());
+  for (auto &instance : m_instances) {
+    instance.localToWorld = nodeMatrices[instance.nodeIdx];
+    instance.worldToLocal = glm::inverse(instance.localToWorld);
+    instance.minScale = computeMinScale(instance.worldToLocal);
+    instanceBounds.push_back(
+        m_geometries[instance.geometryIdx].bounds.transform(
+            instance.localToWorld));
+  }
+  // Only the top level BVH depends on the transforms
+  m_instanceBVH.build(instanceBounds);
+}
+
+bool SceneQuery::intersect(
+    const Ray &ray, SceneQueryHit &hit, float maxDistance) const
+{
+  const auto worldRay = Ray{ray.origin, glm::normalize(ray.direction)};
+  // The local ray direction is not normalized so that t is the same in
+  // world and local space
+  auto tMax = maxDistance;
+  bool found = false;
+  m_instanceBVH.traverseRay(worldRay, tMax, [&](uint32_t begin, uint32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      const auto &instance = m_instances[m_instanceBVH.items()[i]];
+      const auto &geometry = m_geometries[instance.geometryIdx];
+      const auto localRay =
+          Ray{glm::vec3(instance.worldToLocal * glm::vec4(worldRay.origin, 1)),
+              glm::vec3(
+                  instance.worldToLocal * glm::vec4(worldRay.direction, 0))};
+      geometry.bvh.traverseRay(
+          localRay, tMax, [&](uint32_t first, uint32_t last) {
+            for (auto t = first; t < last; ++t) {
+              const auto &triangle = geometry.triangles[t];
+              float tHit;
+              if (intersectTriangle(localRay, geometry.positions[triangle[0]],
+                      geometry.positions[triangle[1]],
+                      geometry.positions[triangle[2]], tMax, tHit)) {
+                tMax = tHit;
+                found = true;
+                hit.nodeIdx = instance.nodeIdx;
+                hit.meshIdx = instance.meshIdx;
+                hit.primitiveIdx = instance.primitiveIdx;
+                hit.triangleIdx = geometry.bvh.items()[t];
+              }
+            }
+          });
+    }
+  });
+  if (found) {
+    hit.distance = tMax;
+    hit.position = worldRay.origin + tMax * worldRay.direction;
+  }
+  return found;
+}
+
+void SceneQuery::queryBox(
+    const AABB &box, std::vector<SceneQueryHit> &hits) const
+{
+  m_instanceBVH.traverseBox(box, [&](uint32_t begin, uint32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      const auto &instance = m_instances[m_instanceBVH.items()[i]];
+      const auto &geometry = m_geometries[instance.geometryIdx];
+      const auto localBox = box.transform(instance.worldToLocal);
+      geometry.bvh.traverseBox(localBox, [&](uint32_t first, uint32_t last) {
+        for (auto t = first; t < last; ++t) {
+          const auto &triangle = geometry.triangles[t];
+          glm::vec3 v[3];
+          for (uint32_t k = 0; k < 3; ++k) {
+            v[k] = glm::vec3(instance.localToWorld *
+                             glm::vec4(geometry.positions[triangle[k]], 1));
+          }
+          if (triangleIntersectsBox(v[0], v[1], v[2], box)) {
+            hits.push_back({instance.nodeIdx, instance.meshIdx,
+                instance.primitiveIdx, geometry.bvh.items()[t],
+                (v[0] + v[1] + v[2]) / 3.f, 0.f});
+          }
+        }
+      });
+    }
+  });
+}
+
+bool SceneQuery::nearestPoint(
+    const glm::vec3 &point, SceneQueryHit &hit, float maxDistance) const
+{
+  const auto maxFloat = std::numeric_limits<float>::max();
+  auto maxDistanceSq = maxDistance < std::sqrt(maxFloat)
+                           ? maxDistance * maxDistance
+                           : maxFloat;
+  bool found = false;
+  m_instanceBVH.traverseNearest(
+      point, 1.f, maxDistanceSq, [&](uint32_t begin, uint32_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const auto &instance = m_instances[m_instanceBVH.items()[i]];
+          const auto &geometry = m_geometries[instance.geometryIdx];
+          const auto localPoint =
+              glm::vec3(instance.worldToLocal * glm::vec4(point, 1));
+          // Local distances are scaled to never overestimate world distances
+          geometry.bvh.traverseNearest(localPoint,
+              instance.minScale * instance.minScale, maxDistanceSq,
+              [&](uint32_t first, uint32_t last) {
+                for (auto t = first; t < last; ++t) {
+                  const auto &triangle = geometry.triangles[t];
+                  glm::vec3 v[3];
+                  for (uint32_t k = 0; k < 3; ++k) {
+                    v[k] = glm::vec3(
+                        instance.localToWorld *
+                        glm::vec4(geometry.positions[triangle[k]], 1));
+                  }
+                  const auto closest =
+                      closestPointOnTriangle(point, v[0], v[1], v[2]);
+                  const auto distanceSq =
+                      glm::dot(closest - point, closest - point);
+                  if (distanceSq < maxDistanceSq) {
+                    maxDistanceSq = distanceSq;
+                    found = true;
+                    hit.nodeIdx = instance.nodeIdx;
+                    hit.meshIdx = instance.meshIdx;
+                    hit.primitiveIdx = instance.primitiveIdx;
+                    hit.triangleIdx = geometry.bvh.items()[t];
+                    hit.position = closest;
+                  }
+                }
+              });
+        }
+      });
+  if (found) {
+    hit.distance = std::sqrt(maxDistanceSq);
+  }
+  return found;
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include "culling.hpp"
+#include "filesystem.hpp"
+#include "job_system.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct Ray
+{
+  glm::vec3 origin = glm::vec3(0);
+  glm::vec3 direction = glm::vec3(0, 0, -1);
+};
+
+// Binary bounding volume hierarchy built with the binned surface area
+// heuristic. Unlike BoundingVolumeHierarchy (culling.hpp), it is meant for
+// ray and proximity queries over many items: the triangles of a primitive or
+// the primitive instances of a scene.
+class BinaryBVH
+{
+public:
+  static const uint32_t MAX_DEPTH = 64;
+
+  struct Node
+  {
+    glm::vec3 min;
+    uint32_t first; // Leaf: first item, inner node: left child (right child
+                    // is first + 1)
+    glm::vec3 max;
+    uint32_t count; // Number of items, 0 for inner nodes
+  };
+
+  // With a job system, subtrees with more than parallelThreshold items are
+  // built by jobs
+  void build(const std::vector<AABB> &itemBounds,
+      JobSystem *jobSystem = nullptr, size_t parallelThreshold = 1 << 16);
+
+  // Replace the hierarchy, e.g. by one loaded from a cache
+  void assign(std::vector<Node> nodes, std::vector<uint32_t> items);
+
+  const std::vector<Node> &nodes() const { return m_nodes; }
+
+  // Item indices in leaf order: a leaf contains items()[first, first + count)
+  const std::vector<uint32_t> &items() const { return m_items; }
+
+  // Call leafFn(begin, end) for the leaves hit by the ray between 0 and
+  // tMax, closest first. leafFn can reduce tMax to prune the traversal.
+  template <typename LeafFn>
+  void traverseRay(const Ray &ray, const float &tMax, LeafFn &&leafFn) const;
+
+  // Call leafFn(begin, end) for the leaves overlapping the box
+  template <typename LeafFn>
+  void traverseBox(const AABB &box, LeafFn &&leafFn) const;
+
+  // Call leafFn(begin, end) for the leaves whose squared distance to point,
+  // multiplied by distanceScaleSq, is less than maxDistanceSq, closest first.
+  // leafFn can reduce maxDistanceSq to prune the traversal.
+  template <typename LeafFn>
+  void traverseNearest(const glm::vec3 &point, float distanceScaleSq,
+      const float &maxDistanceSq, LeafFn &&leafFn) const;
+
+private:
+  struct BuildContext;
+
+  void buildNode(const BuildContext &context, uint32_t nodeIdx, uint32_t begin,
+      uint32_t end, uint32_t depth, std::vector<Node> &nodes);
+
+  std::vector<Node> m_nodes; // m_nodes[0] is the root
+  std::vector<uint32_t> m_items;
+};
+
+// Result of a scene query
+struct SceneQueryHit
+{
+  int nodeIdx = -1;
+  int meshIdx = -1;
+  int primitiveIdx = -1;
+  uint32_t triangleIdx = 0; // In the triangle list of the primitive
+  glm::vec3 position = glm::vec3(0); // World space
+  float distance = 0.f; // From the ray origin or query point
+};
+
+// Spatial queries on the triangles of the default scene of a glTF model, on
+// the CPU. Each primitive has its own triangle BVH, shared by all the nodes
+// instancing its mesh, and a top level BVH is built over the instances.
+class SceneQuery
+{
+public:
+  // If cachePath is not empty, primitive BVHs are read from this file when
+  // their geometry has not changed, and the file is updated after building
+  // the others. With a job system, the primitive BVHs are built in parallel.
+  void build(const tinygltf::Model &model, const fs::path &cachePath = {},
+      JobSystem *jobSystem = nullptr);
+
+  // Move the instances to new local to world matrices, indexed by node (e.g.
+  // after animating the nodes). Primitive BVHs are kept.
+  void updateTransforms(const std::vector<glm::mat4> &nodeMatrices);
+
+  // Closest triangle hit by the ray, at most maxDistance away
+  bool intersect(const Ray &ray, SceneQueryHit &hit,
+      float maxDistance = std::numeric_limits<float>::max()) const;
+
+  // Append to hits the triangles intersecting the box (position is the
+  // triangle center)
+  void queryBox(const AABB &box, std::vector<SceneQueryHit> &hits) const;
+
+  // Closest point on the triangles, at most maxDistance away
+  bool nearestPoint(const glm::vec3 &point, SceneQueryHit &hit,
+      float maxDistance = std::numeric_limits<float>::max()) const;
+
+  size_t instanceCount() const { return m_instances.size(); }
+
+  // Triangles in the scene, counting each instance
+  size_t triangleCount() const { return m_triangleCount; }
+
+  // Number of primitive BVHs read from the cache during the last build()
+  size_t cachedPrimitiveCount() const { return m_cachedPrimitiveCount; }
+
+private:
+  struct PrimitiveGeometry
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::uvec3> triangles; // In BVH leaf order
+    BinaryBVH bvh; // bvh.items()[i] is the glTF index of triangles[i]
+    AABB bounds;
+  };
+
+  struct Instance
+  {
+    int nodeIdx;
+    int meshIdx;
+    int primitiveIdx;
+    uint32_t geometryIdx;
+    glm::mat4 localToWorld;
+    glm::mat4 worldToLocal;
+    // Lower bound of the scale applied by localToWorld, to compare local
+    // and world distances
+    float minScale;
+  };
+
+  std::vector<PrimitiveGeometry> m_geometries;
+  std::vector<Instance> m_instances;
+  BinaryBVH m_instanceBVH;
+  size_t m_triangleCount = 0;
+  size_t m_cachedPrimitiveCount = 0;
+};
+
+template <typename LeafFn>
+void BinaryBVH::traverseRay(
+    const Ray &ray, const float &tMax, LeafFn &&leafFn) const
+{
+  if (m_nodes.empty()) {
+    return;
+  }
+  const auto invDirection = 1.f / ray.direction;
+  // Distance to the entry point in the box, or infinity if missed
+  const auto intersectNode = [&](const Node &node) {
+    const auto t0 = (node.min - ray.origin) * invDirection;
+    const auto t1 = (node.max - ray.origin) * invDirection;
+    const auto tNear = glm::min(t0, t1);
+    const auto tFar = glm::max(t0, t1);
+    const auto tEnter = std::max(std::max(tNear.x, tNear.y), tNear.z);
+    const auto tExit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+    return tEnter <= tExit && tExit >= 0.f && tEnter <= tMax
+               ? std::max(tEnter, 0.f)
+               : std::numeric_limits<float>::infinity();
+  };
+
+  struct Entry
+  {
+    uint32_t nodeIdx;
+    float t;
+  } stack[MAX_DEPTH];
+  uint32_t stackSize = 0;
+  if (intersectNode(m_nodes[0]) > tMax) {
+    return;
+  }
+  auto nodeIdx = 0u;
+  while (true) {
+    const auto &node = m_nodes[nodeIdx];
+    if (node.count > 0) {
+      leafFn(node.first, node.first + node.count);
+    } else {
+      auto tLeft = intersectNode(m_nodes[node.first]);
+      auto tRight = intersectNode(m_nodes[node.first + 1]);
+      if (tLeft <= tMax || tRight <= tMax) {
+        auto nearIdx = node.first;
+        auto farIdx = node.first + 1;
+        if (tRight < tLeft) {
+          std::swap(nearIdx, farIdx);
+          std::swap(tLeft, tRight);
+        }
+        if (tRight <= tMax) {
+          stack[stackSize++] = {farIdx, tRight};
+        }
+        nodeIdx = nearIdx;
+        continue;
+      }
+    }
+    // Pop the next node still in range
+    do {
+      if (stackSize == 0) {
+        return;
+      }
+      --stackSize;
+    } while (stack[stackSize].t > tMax);
+    nodeIdx = stack[stackSize].nodeIdx;
+  }
+}
+
+template <typename LeafFn>
+void BinaryBVH::traverseBox(const AABB &box, LeafFn &&leafFn) const
+{
+  if (m_nodes.empty()) {
+    return;
+  }
+  uint32_t stack[MAX_DEPTH];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0) {
+    const auto &node = m_nodes[stack[--stackSize]];
+    if (glm::any(glm::lessThan(node.max, box.min)) ||
+        glm::any(glm::greaterThan(node.min, box.max))) {
+      continue;
+    }
+    if (node.count > 0) {
+      leafFn(node.first, node.first + node.count);
+    } else {
+      stack[stackSize++] = node.first + 1;
+      stack[stackSize++] = node.first;
+    }
+  }
+}
+
+template <typename LeafFn>
+void BinaryBVH::traverseNearest(const glm::vec3 &point, float distanceScaleSq,
+    const float &maxDistanceSq, LeafFn &&leafFn) const
+{
+  if (m_nodes.empty()) {
+    return;
+  }
+  const auto nodeDistanceSq = [&](const Node &node) {
+    const auto d = glm::max(glm::max(node.min - point, point - node.max), 0.f);
+    return distanceScaleSq * glm::dot(d, d);
+  };
+
+  struct Entry
+  {
+    uint32_t nodeIdx;
+    float distanceSq;
+  } stack[MAX_DEPTH];
+  uint32_t stackSize = 0;
+  if (nodeDistanceSq(m_nodes[0]) >= maxDistanceSq) {
+    return;
+  }
+  auto nodeIdx = 0u;
+  while (true) {
+    const auto &node = m_nodes[nodeIdx];
+    if (node.count > 0) {
+      leafFn(node.first, node.first + node.count);
+    } else {
+      auto dLeft = nodeDistanceSq(m_nodes[node.first]);
+      auto dRight = nodeDistanceSq(m_nodes[node.first + 1]);
+      if (dLeft < maxDistanceSq || dRight < maxDistanceSq) {
+        auto nearIdx = node.first;
+        auto farIdx = node.first + 1;
+        if (dRight < dLeft) {
+          std::swap(nearIdx, farIdx);
+          std::swap(dLeft, dRight);
+        }
+        if (dRight < maxDistanceSq) {
+          stack[stackSize++] = {farIdx, dRight};
+        }
+        nodeIdx = nearIdx;
+        continue;
+      }
+    }
+    do {
+      if (stackSize == 0) {
+        return;
+      }
+      --stackSize;
+    } while (stack[stackSize].distanceSq >= maxDistanceSq);
+    nodeIdx = stack[stackSize].nodeIdx;
+  }
+}
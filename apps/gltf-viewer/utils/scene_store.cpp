@@ -0,0 +1,40 @@
+#include "scene_store.hpp"
+
+#include "gltf.hpp"
+
+void SceneStore::load(
+    const tinygltf::Model &model, const std::vector<GLuint> &vertexArrays)
+{
+  *this = SceneStore();
+  for (const auto &mesh : model.meshes) {
+    m_firstPrimitives.push_back(uint32_t(m_modes.size()));
+    m_meshNames.push_back(mesh.name);
+    for (const auto &primitive : mesh.primitives) {
+      m_modes.push_back(GLenum(primitive.mode));
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        m_counts.push_back(GLsizei(accessor.count));
+        m_indexTypes.push_back(GLenum(accessor.componentType));
+        m_indexOffsets.push_back(accessor.byteOffset + bufferView.byteOffset);
+      } else {
+        // Take first accessor to get the count
+        const auto accessorIdx = (*begin(primitive.attributes)).second;
+        m_counts.push_back(GLsizei(model.accessors[accessorIdx].count));
+        m_indexTypes.push_back(0);
+        m_indexOffsets.push_back(0);
+      }
+      m_vertexArrays.push_back(vertexArrays[m_vertexArrays.size()]);
+      m_materialIndices.push_back(uint32_t(primitive.material >= 0
+                                               ? size_t(primitive.material)
+                                               : model.materials.size()));
+      m_bounds.push_back(computePrimitiveBounds(model, primitive));
+    }
+  }
+  for (const auto &material : model.materials) {
+    m_materialNames.push_back(material.name);
+  }
+  for (const auto &node : model.nodes) {
+    m_nodeNames.push_back(node.name);
+  }
+}
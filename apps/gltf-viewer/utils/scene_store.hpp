@@ -0,0 +1,78 @@
+#pragma once
+
+#include "culling.hpp"
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the frames read from a glTF model, copied once after load so that the
+// draw loop and the GUI don't go through the JSON model (attribute maps,
+// accessor and buffer view chains). The primitives of all the meshes are
+// stored as arrays of each field, indexed by primitiveIndex.
+class SceneStore
+{
+public:
+  // vertexArrays holds the vertex array of each primitive, mesh by mesh
+  void load(
+      const tinygltf::Model &model, const std::vector<GLuint> &vertexArrays);
+
+  size_t primitiveIndex(int meshIdx, int primitiveIdx) const
+  {
+    return m_firstPrimitives[meshIdx] + primitiveIdx;
+  }
+
+  size_t primitiveCount() const { return m_modes.size(); }
+
+  // Parameters of glDrawElements, or of glDrawArrays if indexType is 0
+  GLenum mode(size_t primitive) const { return m_modes[primitive]; }
+  // Indices, or vertices if not indexed
+  GLsizei count(size_t primitive) const { return m_counts[primitive]; }
+  GLenum indexType(size_t primitive) const { return m_indexTypes[primitive]; }
+  // In the element array buffer of the vertex array
+  size_t indexOffset(size_t primitive) const
+  {
+    return m_indexOffsets[primitive];
+  }
+  GLuint vertexArray(size_t primitive) const
+  {
+    return m_vertexArrays[primitive];
+  }
+  // materialCount() for the default material
+  uint32_t materialIndex(size_t primitive) const
+  {
+    return m_materialIndices[primitive];
+  }
+  // Local space bounding box
+  const AABB &bounds(size_t primitive) const { return m_bounds[primitive]; }
+
+  size_t materialCount() const { return m_materialNames.size(); }
+  const std::string &materialName(size_t materialIdx) const
+  {
+    return m_materialNames[materialIdx];
+  }
+  const std::string &nodeName(int nodeIdx) const
+  {
+    return m_nodeNames[nodeIdx];
+  }
+  const std::string &meshName(int meshIdx) const
+  {
+    return m_meshNames[meshIdx];
+  }
+
+private:
+  std::vector<uint32_t> m_firstPrimitives; // By mesh
+  std::vector<GLenum> m_modes;
+  std::vector<GLsizei> m_counts;
+  std::vector<GLenum> m_indexTypes;
+  std::vector<size_t> m_indexOffsets;
+  std::vector<GLuint> m_vertexArrays;
+  std::vector<uint32_t> m_materialIndices;
+  std::vector<AABB> m_bounds;
+  std::vector<std::string> m_materialNames;
+  std::vector<std::string> m_nodeNames;
+  std::vector<std::string> m_meshNames;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "filesystem.hpp"
+#include <algorithm>
 #include <fstream>
 #include <glad/glad.h>
 #include <iostream>
@@ -9,6 +10,7 @@
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class GLShader
@@ -98,7 +100,10 @@ GLShader compileShader(GLenum type, StringType &&src)
 // *.fs.glsl -> fragment shader
 // *.gs.glsl -> geometry shader
 // *.cs.glsl -> compute shader
-inline GLShader loadShader(const fs::path &shaderPath)
+// defines are inserted after the #version directive, to compile variants of a
+// shader with #ifdef
+inline GLShader loadShader(
+    const fs::path &shaderPath, const std::vector<std::string> &defines = {})
 {
   static auto extToShaderType =
       std::unordered_map<std::string, std::pair<GLenum, std::string>>(
@@ -117,8 +122,21 @@ inline GLShader loadShader(const fs::path &shaderPath)
   std::clog << "Compiling " << (*it).second.second << " shader " << shaderPath
             << "\n";
 
+  auto source = loadShaderSource(shaderPath);
+  if (!defines.empty()) {
+    std::string defineLines;
+    for (const auto &define : defines) {
+      defineLines += "#define " + define + "\n";
+    }
+    const auto versionPos = source.find("#version");
+    const auto insertPos = versionPos == std::string::npos
+                               ? 0
+                               : source.find('\n', versionPos) + 1;
+    source.insert(std::min(insertPos, source.size()), defineLines);
+  }
+
   GLShader shader{(*it).second.first};
-  shader.setSource(loadShaderSource(shaderPath));
+  shader.setSource(source);
   shader.compile();
   if (!shader.getCompileStatus()) {
     std::cerr << "Shader compilation error:" << shader.getInfoLog()
@@ -244,11 +262,12 @@ template <typename CSrc> GLProgram buildComputeProgram(CSrc &&src)
   ;
 }
 
-inline GLProgram compileProgram(std::vector<fs::path> shaderPaths)
+inline GLProgram compileProgram(std::vector<fs::path> shaderPaths,
+    const std::vector<std::string> &defines = {})
 {
   GLProgram program;
   for (const auto &path : shaderPaths) {
-    auto shader = loadShader(path);
+    auto shader = loadShader(path, defines);
     program.attachShader(shader);
   }
   program.link();
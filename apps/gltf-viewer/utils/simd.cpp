@@ -0,0 +1,14 @@
+#include "simd.hpp"
+
+bool cpuSupportsAvx2()
+{
+#if defined(__AVX2__)
+  return true;
+#elif GLMLV_AVX2
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+#else
+  return false;
+#endif
+}
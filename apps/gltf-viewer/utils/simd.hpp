@@ -0,0 +1,26 @@
+#pragma once
+
+// AVX2 code paths chosen at runtime. With GCC and Clang on x86, functions
+// marked GLMLV_AVX2_FUNCTION are compiled for AVX2 and FMA whatever the flags
+// of the build, and must only be called if cpuSupportsAvx2(). Other compilers
+// only have them when the whole build targets AVX2 (GLMLV_USE_AVX2 in
+// CMakeLists.txt). Lambdas don't inherit the target of their function, the
+// intrinsics can't be used in them.
+#if defined(__AVX2__)
+#define GLMLV_AVX2 1
+#define GLMLV_AVX2_FUNCTION
+#elif (defined(__GNUC__) || defined(__clang__)) &&                             \
+    (defined(__x86_64__) || defined(__i386__))
+#define GLMLV_AVX2 1
+#define GLMLV_AVX2_FUNCTION __attribute__((target("avx2,fma")))
+#else
+#define GLMLV_AVX2 0
+#define GLMLV_AVX2_FUNCTION
+#endif
+
+#if GLMLV_AVX2
+#include <immintrin.h>
+#endif
+
+// True if the CPU runs the AVX2 and FMA code paths, checked once
+bool cpuSupportsAvx2();
@@ -0,0 +1,53 @@
+#include "skinning.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <iostream>
+
+void SkinPalette::load(const tinygltf::Model &model)
+{
+  m_skinOffsets.assign(1, 0);
+  m_jointNodes.clear();
+  m_inverseBindMatrices.clear();
+
+  for (size_t skinIdx = 0; skinIdx < model.skins.size(); ++skinIdx) {
+    const auto &skin = model.skins[skinIdx];
+    const auto inverseBindMatrices =
+        readAccessorFloats(model, skin.inverseBindMatrices);
+    const auto hasInverseBindMatrices =
+        inverseBindMatrices.size() == 16 * skin.joints.size();
+    if (skin.inverseBindMatrices >= 0 && !hasInverseBindMatrices) {
+      std::cerr << "Invalid inverse bind matrices in skin " << skinIdx
+                << ", using identity" << std::endl;
+    }
+    for (size_t jointIdx = 0; jointIdx < skin.joints.size(); ++jointIdx) {
+      m_jointNodes.push_back(skin.joints[jointIdx]);
+      m_inverseBindMatrices.push_back(
+          hasInverseBindMatrices
+              ? glm::make_mat4(&inverseBindMatrices[16 * jointIdx])
+              : glm::mat4(1));
+    }
+    m_skinOffsets.push_back(uint32_t(m_jointNodes.size()));
+  }
+  m_jointMatrices.assign(m_jointNodes.size(), glm::mat4(1));
+}
+
+void SkinPalette::update(const std::vector<glm::mat4> &nodeMatrices)
+{
+  for (size_t i = 0; i < m_jointNodes.size(); ++i) {
+    m_jointMatrices[i] =
+        nodeMatrices[m_jointNodes[i]] * m_inverseBindMatrices[i];
+  }
+}
+
+AABB SkinPalette::skinnedBounds(int skinIdx, const AABB &bindPoseBounds) const
+{
+  // Each vertex is a convex combination of its position moved by the joints
+  // of the skin, so it lies in the union of the bounds moved by each joint
+  AABB bounds;
+  for (auto i = m_skinOffsets[skinIdx]; i < m_skinOffsets[skinIdx + 1]; ++i) {
+    bounds.extend(bindPoseBounds.transform(m_jointMatrices[i]));
+  }
+  return bounds;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "culling.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Joint matrices of the skins of a glTF model, for GPU skinning. The joints
+// of all skins are stored contiguously, so the palette of the whole scene is
+// computed in one pass and uploaded in one call.
+class SkinPalette
+{
+public:
+  void load(const tinygltf::Model &model);
+
+  size_t skinCount() const { return m_skinOffsets.size() - 1; }
+
+  // Index of the first joint of the skin in jointMatrices()
+  uint32_t jointOffset(int skinIdx) const { return m_skinOffsets[skinIdx]; }
+
+  size_t jointCount() const { return m_jointNodes.size(); }
+
+  // Compute the joint matrices from the local to world matrices of the nodes
+  void update(const std::vector<glm::mat4> &nodeMatrices);
+
+  // World space joint matrices (joint world matrix * inverse bind matrix)
+  const std::vector<glm::mat4> &jointMatrices() const
+  {
+    return m_jointMatrices;
+  }
+
+  // World space bounds of a skinned primitive from its bind pose bounds:
+  // conservative as long as the weights of each vertex sum to 1
+  AABB skinnedBounds(int skinIdx, const AABB &bindPoseBounds) const;
+
+private:
+  std::vector<uint32_t> m_skinOffsets{0}; // Joints of skin i in [i, i + 1)
+  std::vector<int> m_jointNodes;
+  std::vector<glm::mat4> m_inverseBindMatrices;
+  std::vector<glm::mat4> m_jointMatrices;
+};
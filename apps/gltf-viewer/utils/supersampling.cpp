@@ -0,0 +1,125 @@
+#include "supersampling.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+// Radical inverse of index in base, in [0, 1)
+float halton(uint32_t index, uint32_t base)
+{
+  auto result = 0.f;
+  auto fraction = 1.f;
+  for (; index > 0; index /= base) {
+    fraction /= float(base);
+    result += fraction * float(index % base);
+  }
+  return result;
+}
+} // namespace
+
+ProgressiveSupersampling::~ProgressiveSupersampling()
+{
+  const GLuint framebuffers[] = {
+      m_sampleFramebuffer, m_accumulationFramebuffer};
+  glDeleteFramebuffers(2, framebuffers); // Ignores 0
+  const GLuint textures[] = {m_sampleTexture, m_accumulationTexture};
+  glDeleteTextures(2, textures);
+  glDeleteRenderbuffers(1, &m_depthRenderbuffer);
+}
+
+void ProgressiveSupersampling::load(
+    const fs::path &shadersPath, GLsizei width, GLsizei height)
+{
+  m_accumulateProgram =
+      FullScreenPass::compileProgram(shadersPath, "accumulate.fs.glsl");
+  m_resolveProgram =
+      FullScreenPass::compileProgram(shadersPath, "resolve_samples.fs.glsl");
+  glProgramUniform1i(m_accumulateProgram.glId(),
+      m_accumulateProgram.getUniformLocation("uSample"), 0);
+  glProgramUniform1i(m_resolveProgram.glId(),
+      m_resolveProgram.getUniformLocation("uAccumulation"), 0);
+  m_sampleCountLocation =
+      m_resolveProgram.getUniformLocation("uSampleCount");
+  m_pass.load();
+  m_width = width;
+  m_height = height;
+
+  const auto createTexture = [&](GLenum format) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+  };
+  const auto createFramebuffer = [&](GLuint texture, GLuint depth) {
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+    if (depth) {
+      glFramebufferRenderbuffer(
+          GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "Supersampling: incomplete framebuffer" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return framebuffer;
+  };
+  // Samples are clamped when accumulated, like in a fixed point framebuffer
+  m_sampleTexture = createTexture(GL_RGBA16F);
+  glGenRenderbuffers(1, &m_depthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  m_sampleFramebuffer = createFramebuffer(m_sampleTexture, m_depthRenderbuffer);
+  m_accumulationTexture = createTexture(GL_RGBA32F);
+  m_accumulationFramebuffer = createFramebuffer(m_accumulationTexture, 0);
+}
+
+void ProgressiveSupersampling::setTargetSampleCount(uint32_t sampleCount)
+{
+  m_targetSampleCount = std::max(sampleCount, 1u);
+}
+
+glm::vec2 ProgressiveSupersampling::jitter() const
+{
+  if (m_sampleCount == 0) {
+    return glm::vec2(0);
+  }
+  return glm::vec2(halton(m_sampleCount, 2), halton(m_sampleCount, 3)) -
+         0.5f;
+}
+
+void ProgressiveSupersampling::beginSample()
+{
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_targetFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_sampleFramebuffer);
+}
+
+void ProgressiveSupersampling::endSample()
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_accumulationFramebuffer);
+  glViewport(0, 0, m_width, m_height);
+  if (m_sampleCount == 0) {
+    const GLfloat zero[] = {0, 0, 0, 0};
+    glClearBufferfv(GL_COLOR, 0, zero);
+  }
+  m_pass.draw(m_accumulateProgram, m_sampleTexture, true);
+  ++m_sampleCount;
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_targetFramebuffer);
+  resolve();
+}
+
+void ProgressiveSupersampling::resolve()
+{
+  glViewport(0, 0, m_width, m_height);
+  glProgramUniform1f(m_resolveProgram.glId(), m_sampleCountLocation,
+      GLfloat(std::max(m_sampleCount, 1u)));
+  m_pass.draw(m_resolveProgram, m_accumulationTexture);
+}
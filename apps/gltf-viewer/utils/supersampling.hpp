@@ -0,0 +1,75 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "full_screen_pass.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// Progressive supersampling: while the view doesn't change, frames rendered
+// with sub-pixel offsets of the projection are summed into a float buffer,
+// and their average is drawn in the target framebuffer. It replaces
+// multisampling: frames drawn while the view changes are not antialiased,
+// still views converge to sampleCount samples per pixel.
+class ProgressiveSupersampling
+{
+public:
+  ProgressiveSupersampling() = default;
+
+  ~ProgressiveSupersampling();
+
+  ProgressiveSupersampling(const ProgressiveSupersampling &) = delete;
+
+  ProgressiveSupersampling &operator=(
+      const ProgressiveSupersampling &) = delete;
+
+  // Compile the programs and create the buffers for frames of width x height
+  void load(const fs::path &shadersPath, GLsizei width, GLsizei height);
+
+  // Samples of a converged view
+  uint32_t targetSampleCount() const { return m_targetSampleCount; }
+  void setTargetSampleCount(uint32_t sampleCount);
+
+  // Samples accumulated since the last reset
+  uint32_t sampleCount() const { return m_sampleCount; }
+
+  bool isConverged() const { return m_sampleCount >= m_targetSampleCount; }
+
+  // Forget the samples, after the view changed
+  void reset() { m_sampleCount = 0; }
+
+  // Offset of the next sample, in pixels: 0 for the first one, then points
+  // of the Halton (2, 3) sequence in the pixel
+  glm::vec2 jitter() const;
+
+  // Bind the framebuffer of the sample, instead of the bound draw
+  // framebuffer
+  void beginSample();
+
+  // Add the sample and draw the average in the framebuffer bound before
+  // beginSample
+  void endSample();
+
+  // Draw the average of the samples in the bound draw framebuffer, e.g. to
+  // redraw a converged view
+  void resolve();
+
+private:
+  FullScreenPass m_pass;
+  GLProgram m_accumulateProgram;
+  GLProgram m_resolveProgram;
+  GLint m_sampleCountLocation = -1;
+  GLuint m_sampleFramebuffer = 0;
+  GLuint m_sampleTexture = 0;
+  GLuint m_depthRenderbuffer = 0;
+  GLuint m_accumulationFramebuffer = 0;
+  GLuint m_accumulationTexture = 0;
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  GLint m_targetFramebuffer = 0; // Bound before beginSample
+  uint32_t m_targetSampleCount = 16;
+  uint32_t m_sampleCount = 0;
+};
@@ -0,0 +1,109 @@
+#include "texture_arrays.hpp"
+
+#include <iostream>
+#include <map>
+#include <tuple>
+
+TextureArrays::~TextureArrays()
+{
+  glDeleteTextures(GLsizei(m_arrays.size()), m_arrays.data());
+}
+
+void TextureArrays::load(const tinygltf::Model &model)
+{
+  glDeleteTextures(GLsizei(m_arrays.size()), m_arrays.data());
+  m_arrays.clear();
+  m_layers.assign(model.textures.size(), {0, -1});
+
+  GLint maxLayerCount = 0;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayerCount);
+
+  // Same sampling parameters as the texture objects of the viewer
+  struct Array
+  {
+    const tinygltf::Image *image; // Gives the size and pixel type
+    GLint minFilter, magFilter, wrapS, wrapT;
+    std::vector<int> sources; // Images of the layers
+  };
+  std::vector<Array> arrays;
+  using ArrayKey = std::tuple<int, int, int, GLint, GLint, GLint, GLint>;
+  std::map<ArrayKey, size_t> openArrays; // Arrays with free layers
+  std::map<std::pair<size_t, int>, int32_t> imageLayers; // By array, source
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    const auto &texture = model.textures[i];
+    if (texture.source < 0) {
+      continue;
+    }
+    const auto &image = model.images[texture.source];
+    if (image.width <= 0 || image.height <= 0 || image.image.empty()) {
+      continue;
+    }
+    tinygltf::Sampler sampler;
+    if (texture.sampler >= 0) {
+      sampler = model.samplers[texture.sampler];
+    }
+    const auto minFilter =
+        sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR;
+    const auto magFilter =
+        sampler.magFilter != -1 ? sampler.magFilter : GL_LINEAR;
+    const ArrayKey key{image.width, image.height, image.pixel_type,
+        minFilter, magFilter, sampler.wrapS, sampler.wrapT};
+    auto it = openArrays.find(key);
+    if (it == end(openArrays)) {
+      it = openArrays.emplace(key, arrays.size()).first;
+      arrays.push_back(
+          {&image, minFilter, magFilter, sampler.wrapS, sampler.wrapT, {}});
+    }
+    auto &array = arrays[(*it).second];
+    // Textures sharing an image and a sampler share a layer
+    const auto layerIt =
+        imageLayers.find(std::make_pair((*it).second, texture.source));
+    if (layerIt != end(imageLayers)) {
+      m_layers[i] = {GLuint((*it).second), (*layerIt).second};
+      continue;
+    }
+    const auto layer = int32_t(array.sources.size());
+    imageLayers[std::make_pair((*it).second, texture.source)] = layer;
+    m_layers[i] = {GLuint((*it).second), layer};
+    array.sources.push_back(texture.source);
+    if (array.sources.size() == size_t(maxLayerCount)) {
+      openArrays.erase(it);
+    }
+  }
+
+  m_arrays.resize(arrays.size());
+  glGenTextures(GLsizei(m_arrays.size()), m_arrays.data());
+  for (size_t a = 0; a < arrays.size(); ++a) {
+    const auto &array = arrays[a];
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_arrays[a]);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, array.image->width,
+        array.image->height, GLsizei(array.sources.size()), 0, GL_RGBA,
+        array.image->pixel_type, nullptr);
+    for (size_t layer = 0; layer < array.sources.size(); ++layer) {
+      const auto &image = model.images[array.sources[layer]];
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, GLint(layer), image.width,
+          image.height, 1, GL_RGBA, image.pixel_type, image.image.data());
+    }
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.minFilter);
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, array.magFilter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, array.wrapS);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, array.wrapT);
+    if (array.minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+        array.minFilter == GL_NEAREST_MIPMAP_LINEAR ||
+        array.minFilter == GL_LINEAR_MIPMAP_NEAREST ||
+        array.minFilter == GL_LINEAR_MIPMAP_LINEAR) {
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  for (auto &layer : m_layers) {
+    if (layer.layer >= 0) {
+      layer.texture = m_arrays[layer.texture]; // Array index to object
+    }
+  }
+
+  std::cout << "Texture arrays: " << m_arrays.size() << " arrays for "
+            << imageLayers.size() << " images" << std::endl;
+}
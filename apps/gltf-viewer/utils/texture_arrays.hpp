@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Textures of a glTF model packed in GL_TEXTURE_2D_ARRAY objects: images of
+// the same size and pixel type sampled with the same sampler share an array,
+// one layer per image, so that materials are switched by layer index instead
+// of texture binds.
+class TextureArrays
+{
+public:
+  // Array and layer of a texture, layer -1 for a missing texture or image
+  struct Layer
+  {
+    GLuint texture;
+    int32_t layer;
+  };
+
+  TextureArrays() = default;
+
+  ~TextureArrays();
+
+  TextureArrays(const TextureArrays &) = delete;
+
+  TextureArrays &operator=(const TextureArrays &) = delete;
+
+  void load(const tinygltf::Model &model);
+
+  // Layer of a glTF texture, textureIdx may be -1
+  Layer layer(int textureIdx) const
+  {
+    return textureIdx >= 0 ? m_layers[textureIdx] : Layer{0, -1};
+  }
+
+  size_t arrayCount() const { return m_arrays.size(); }
+
+private:
+  std::vector<GLuint> m_arrays;
+  std::vector<Layer> m_layers; // By glTF texture
+};
@@ -0,0 +1,113 @@
+#include "window_events.hpp"
+
+WindowEvents::WindowEvents(GLFWwindow *window) :
+    m_window(window),
+    m_previousUserPointer(glfwGetWindowUserPointer(window))
+{
+  glfwSetWindowUserPointer(window, this);
+  m_previousCursorPos = glfwSetCursorPosCallback(window, cursorPosCallback);
+  m_previousMouseButton =
+      glfwSetMouseButtonCallback(window, mouseButtonCallback);
+  m_previousScroll = glfwSetScrollCallback(window, scrollCallback);
+  m_previousKey = glfwSetKeyCallback(window, keyCallback);
+  m_previousChar = glfwSetCharCallback(window, charCallback);
+  m_previousFocus = glfwSetWindowFocusCallback(window, focusCallback);
+  m_previousRefresh = glfwSetWindowRefreshCallback(window, refreshCallback);
+  m_previousFramebufferSize =
+      glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+}
+
+WindowEvents::~WindowEvents()
+{
+  glfwSetCursorPosCallback(m_window, m_previousCursorPos);
+  glfwSetMouseButtonCallback(m_window, m_previousMouseButton);
+  glfwSetScrollCallback(m_window, m_previousScroll);
+  glfwSetKeyCallback(m_window, m_previousKey);
+  glfwSetCharCallback(m_window, m_previousChar);
+  glfwSetWindowFocusCallback(m_window, m_previousFocus);
+  glfwSetWindowRefreshCallback(m_window, m_previousRefresh);
+  glfwSetFramebufferSizeCallback(m_window, m_previousFramebufferSize);
+  glfwSetWindowUserPointer(m_window, m_previousUserPointer);
+}
+
+bool WindowEvents::consume()
+{
+  const auto hasEvents = m_hasEvents;
+  m_hasEvents = false;
+  return hasEvents;
+}
+
+bool WindowEvents::consumeInput()
+{
+  const auto hasInput = m_hasInput;
+  m_hasInput = false;
+  return hasInput;
+}
+
+WindowEvents *WindowEvents::get(GLFWwindow *window, bool isInput)
+{
+  const auto events =
+      static_cast<WindowEvents *>(glfwGetWindowUserPointer(window));
+  events->m_hasEvents = true;
+  events->m_hasInput = events->m_hasInput || isInput;
+  return events;
+}
+
+void WindowEvents::cursorPosCallback(GLFWwindow *window, double x, double y)
+{
+  if (const auto previous = get(window)->m_previousCursorPos) {
+    previous(window, x, y);
+  }
+}
+
+void WindowEvents::mouseButtonCallback(
+    GLFWwindow *window, int button, int action, int mods)
+{
+  if (const auto previous = get(window, true)->m_previousMouseButton) {
+    previous(window, button, action, mods);
+  }
+}
+
+void WindowEvents::scrollCallback(GLFWwindow *window, double x, double y)
+{
+  if (const auto previous = get(window, true)->m_previousScroll) {
+    previous(window, x, y);
+  }
+}
+
+void WindowEvents::keyCallback(
+    GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+  if (const auto previous = get(window, true)->m_previousKey) {
+    previous(window, key, scancode, action, mods);
+  }
+}
+
+void WindowEvents::charCallback(GLFWwindow *window, unsigned int codepoint)
+{
+  if (const auto previous = get(window, true)->m_previousChar) {
+    previous(window, codepoint);
+  }
+}
+
+void WindowEvents::focusCallback(GLFWwindow *window, int focused)
+{
+  if (const auto previous = get(window)->m_previousFocus) {
+    previous(window, focused);
+  }
+}
+
+void WindowEvents::refreshCallback(GLFWwindow *window)
+{
+  if (const auto previous = get(window)->m_previousRefresh) {
+    previous(window);
+  }
+}
+
+void WindowEvents::framebufferSizeCallback(
+    GLFWwindow *window, int width, int height)
+{
+  if (const auto previous = get(window, true)->m_previousFramebufferSize) {
+    previous(window, width, height);
+  }
+}
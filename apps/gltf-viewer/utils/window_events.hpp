@@ -0,0 +1,57 @@
+#pragma once
+
+#include "glfw.hpp"
+
+// Records whether GLFW delivered input or window events, so that the viewer
+// only redraws when something may have changed. The callbacks are installed
+// on top of the ones already set (ImGui, the key callback of the viewer) and
+// forward the events to them.
+class WindowEvents
+{
+public:
+  explicit WindowEvents(GLFWwindow *window);
+
+  // Restore the previous callbacks
+  ~WindowEvents();
+
+  WindowEvents(const WindowEvents &) = delete;
+
+  WindowEvents &operator=(const WindowEvents &) = delete;
+
+  // True if events arrived since the last call
+  bool consume();
+
+  // True if keys, mouse buttons, scrolling or resizing may have changed the
+  // view since the last call. Moving the cursor, focusing or exposing the
+  // window only need a redraw.
+  bool consumeInput();
+
+private:
+  // The events of the window, marked as arrived
+  static WindowEvents *get(GLFWwindow *window, bool isInput = false);
+
+  static void cursorPosCallback(GLFWwindow *window, double x, double y);
+  static void mouseButtonCallback(
+      GLFWwindow *window, int button, int action, int mods);
+  static void scrollCallback(GLFWwindow *window, double x, double y);
+  static void keyCallback(
+      GLFWwindow *window, int key, int scancode, int action, int mods);
+  static void charCallback(GLFWwindow *window, unsigned int codepoint);
+  static void focusCallback(GLFWwindow *window, int focused);
+  static void refreshCallback(GLFWwindow *window);
+  static void framebufferSizeCallback(
+      GLFWwindow *window, int width, int height);
+
+  GLFWwindow *m_window;
+  void *m_previousUserPointer;
+  GLFWcursorposfun m_previousCursorPos;
+  GLFWmousebuttonfun m_previousMouseButton;
+  GLFWscrollfun m_previousScroll;
+  GLFWkeyfun m_previousKey;
+  GLFWcharfun m_previousChar;
+  GLFWwindowfocusfun m_previousFocus;
+  GLFWwindowrefreshfun m_previousRefresh;
+  GLFWframebuffersizefun m_previousFramebufferSize;
+  bool m_hasEvents = true; // The first frame is always drawn
+  bool m_hasInput = true;
+};